@@ -0,0 +1,526 @@
+/*
+ * bench_utflite.c - Microbenchmarks for utflite hot paths
+ *
+ * Builds a large buffer for each sample script, then times how long the
+ * library takes to walk it. Results are reported in MB/s so runs on
+ * different inputs can be compared directly.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef UTFLITE_SINGLE_HEADER
+#define UTFLITE_IMPLEMENTATION
+#include "utflite.h"
+#else
+#include <utflite/utflite.h>
+#endif
+
+/* Size of the generated input buffer for each benchmark (bytes). */
+#define BENCH_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* Number of timed passes over the buffer; the fastest one is reported so
+ * scheduler noise does not hide small differences. */
+#define BENCH_ITERATIONS 8
+
+/* Nanoseconds in one second, for converting timespec values. */
+#define NANOSECONDS_PER_SECOND 1000000000.0
+
+/* Bytes in one megabyte, for throughput reporting. */
+#define BYTES_PER_MEGABYTE (1024.0 * 1024.0)
+
+/* Table benchmarks cut the buffer into cells of about this many bytes,
+ * laid out this many to a row. */
+#define BENCH_CELL_BYTES 12
+#define BENCH_TABLE_COLUMNS 8
+
+/* Cell grid benchmarks draw the buffer as lines of about this many bytes
+ * into a viewport this many columns wide. */
+#define BENCH_LINE_BYTES 200
+#define BENCH_VIEWPORT_COLUMNS 80
+
+/* Horizontal scrolling benchmarks show this many columns of each line,
+ * starting at BENCH_SCROLL_COLUMN. */
+#define BENCH_SCROLL_COLUMN 40
+
+/* Offset conversion benchmarks place a highlight span boundary every this
+ * many bytes of a line. */
+#define BENCH_SPAN_BYTES 10
+
+/* Boundary test benchmarks probe a splice point every this many bytes; the
+ * odd stride also lands inside multibyte sequences. */
+#define BENCH_SPLICE_BYTES 7
+
+/* Terminal print benchmarks feed the buffer in reads of this many bytes,
+ * the usual size of a PTY read. */
+#define BENCH_READ_BYTES 4096
+
+/* Input buffer shared by all benchmarks, refilled per sample. */
+static char bench_buffer[BENCH_BUFFER_SIZE];
+
+/* Cells of the line being drawn in the cell grid benchmarks. */
+static struct utflite_cell bench_line_cells[BENCH_VIEWPORT_COLUMNS];
+
+/* Span boundaries of one line and their conversions. */
+static int bench_span_offsets[BENCH_LINE_BYTES / BENCH_SPAN_BYTES + 1];
+static int bench_span_codepoints[BENCH_LINE_BYTES / BENCH_SPAN_BYTES + 1];
+static int bench_span_utf16[BENCH_LINE_BYTES / BENCH_SPAN_BYTES + 1];
+static int bench_span_columns[BENCH_LINE_BYTES / BENCH_SPAN_BYTES + 1];
+
+/* Cells of one read in the terminal print benchmarks. */
+static struct utflite_print_cell bench_print_cells[BENCH_READ_BYTES];
+
+/* Cells over bench_buffer for the table benchmarks, rebuilt per run. */
+static struct utflite_span bench_cells[BENCH_BUFFER_SIZE / BENCH_CELL_BYTES + 1];
+static int bench_cell_widths[BENCH_BUFFER_SIZE / BENCH_CELL_BYTES + 1];
+
+/* A named sample whose text is repeated to fill the benchmark buffer. */
+struct bench_sample {
+    const char *name;
+    const char *text;
+};
+
+/* Representative inputs: plain Latin, Hangul syllables, and emoji sequences
+ * (ZWJ family, skin tone modifier, flag pair, VS16 heart). */
+static const struct bench_sample bench_samples[] = {
+    { "latin",  "The quick brown fox jumps over the lazy dog. caf\xC3\xA9 na\xC3\xAFve " },
+    { "hangul", "\xED\x95\x9C\xEA\xB5\xAD\xEC\x96\xB4 \xED\x85\x8C\xEC\x8A\xA4\xED\x8A\xB8 "
+                "\xE1\x84\x92\xE1\x85\xA1\xE1\x86\xAB " },
+    { "emoji",  "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9\xE2\x80\x8D\xF0\x9F\x91\xA7"
+                "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6"
+                "\xE2\x9D\xA4\xEF\xB8\x8F " },
+};
+
+/* Returns the current time in seconds from a monotonic-enough C17 clock. */
+static double bench_get_seconds(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec / NANOSECONDS_PER_SECOND;
+}
+
+/* Fills the benchmark buffer with repeated copies of the sample text, never
+ * cutting a copy in half. Returns the number of bytes used. */
+static int bench_fill_buffer(const char *text) {
+    int text_length = (int)strlen(text);
+    int used = 0;
+    while (used + text_length <= BENCH_BUFFER_SIZE) {
+        memcpy(bench_buffer + used, text, (size_t)text_length);
+        used += text_length;
+    }
+    return used;
+}
+
+/* Walks the buffer one grapheme cluster at a time and returns the count, so
+ * the compiler cannot discard the loop. */
+static long bench_walk_graphemes(int length) {
+    long clusters = 0;
+    int offset = 0;
+    while (offset < length) {
+        offset = utflite_next_grapheme(bench_buffer, length, offset);
+        clusters++;
+    }
+    return clusters;
+}
+
+/* Counts clusters with the dedicated counting API. */
+static long bench_count_graphemes(int length) {
+    return utflite_grapheme_count(bench_buffer, length);
+}
+
+/* Measures grapheme-aware width the two-pass way: segment with
+ * utflite_next_grapheme(), then look up the widths inside each cluster. */
+static long bench_width_two_pass(int length) {
+    long columns = 0;
+    int offset = 0;
+    while (offset < length) {
+        int next = utflite_next_grapheme(bench_buffer, length, offset);
+        int cluster_width = 0;
+        for (int at = offset; at < next; at = utflite_next_char(bench_buffer, length, at)) {
+            int char_width = utflite_char_width(bench_buffer, length, at);
+            if (char_width > cluster_width) {
+                cluster_width = char_width;
+            }
+        }
+        columns += cluster_width;
+        offset = next;
+    }
+    return columns;
+}
+
+/* Measures grapheme-aware width in one pass. */
+static long bench_width_one_pass(int length) {
+    return utflite_string_width_mode(bench_buffer, length, UTFLITE_WIDTH_GRAPHEMES);
+}
+
+/* Cuts at half the byte length in columns the old way: codepoint
+ * truncation, a back-off to the cluster start, and a second measurement. */
+static long bench_truncate_back_off(int length) {
+    int cut = utflite_truncate(bench_buffer, length, length / 2);
+    int start = utflite_prev_grapheme(bench_buffer, cut);
+    if (utflite_next_grapheme(bench_buffer, length, start) != cut) {
+        cut = start;
+    }
+    return utflite_string_width_mode(bench_buffer, cut, UTFLITE_WIDTH_GRAPHEMES);
+}
+
+static long bench_truncate_one_pass(int length) {
+    int width;
+    utflite_truncate_graphemes(bench_buffer, length, length / 2, &width);
+    return width;
+}
+
+/* Cuts the buffer into cells that start on lead bytes and returns the
+ * number of whole rows. */
+static int bench_fill_cells(int length) {
+    int count = 0;
+    int start = 0;
+    while (start < length) {
+        int end = start + BENCH_CELL_BYTES < length ? start + BENCH_CELL_BYTES : length;
+        while (end < length && ((unsigned char)bench_buffer[end] & 0xC0) == 0x80) {
+            end++;
+        }
+        bench_cells[count].text = bench_buffer + start;
+        bench_cells[count].length = end - start;
+        count++;
+        start = end;
+    }
+    return count / BENCH_TABLE_COLUMNS;
+}
+
+/* Sizes table columns the per-cell way: utflite_string_width() on every
+ * cell, then a running maximum. */
+static long bench_table_per_cell(int length) {
+    int rows = bench_fill_cells(length);
+    int column_widths[BENCH_TABLE_COLUMNS] = {0};
+    long total = 0;
+    for (int i = 0; i < rows * BENCH_TABLE_COLUMNS; i++) {
+        int width = utflite_string_width(bench_cells[i].text, bench_cells[i].length);
+        bench_cell_widths[i] = width;
+        if (width > column_widths[i % BENCH_TABLE_COLUMNS]) {
+            column_widths[i % BENCH_TABLE_COLUMNS] = width;
+        }
+    }
+    for (int column = 0; column < BENCH_TABLE_COLUMNS; column++) {
+        total += column_widths[column];
+    }
+    return total;
+}
+
+static long bench_table_batch(int length) {
+    int rows = bench_fill_cells(length);
+    int column_widths[BENCH_TABLE_COLUMNS];
+    return utflite_column_widths(bench_cells, rows, BENCH_TABLE_COLUMNS, UTFLITE_WIDTH_CODEPOINTS,
+                                 bench_cell_widths, column_widths);
+}
+
+/* Measures width skipping escape sequences; the samples have none, so
+ * this shows what the ESC scan costs on plain text. */
+static long bench_width_ansi(int length) {
+    return utflite_string_width_ansi(bench_buffer, length);
+}
+
+/* Returns the end of the line starting at 'start': about BENCH_LINE_BYTES
+ * later, moved forward to a lead byte. */
+static int bench_line_end(int start, int length) {
+    int end = start + BENCH_LINE_BYTES < length ? start + BENCH_LINE_BYTES : length;
+    while (end < length && ((unsigned char)bench_buffer[end] & 0xC0) == 0x80) {
+        end++;
+    }
+    return end;
+}
+
+/* Builds each line's cells the manual way: utflite_next_grapheme() for the
+ * clusters and utflite_string_width() for their widths. */
+static long bench_cells_manual(int length) {
+    struct utflite_cell *cells = bench_line_cells;
+    long filled = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        int end = bench_line_end(start, length);
+        int column = 0;
+        int offset = start;
+        while (offset < end && column < BENCH_VIEWPORT_COLUMNS) {
+            int next = utflite_next_grapheme(bench_buffer, end, offset);
+            int width = utflite_string_width(bench_buffer + offset, next - offset);
+            if (width > 0 && column + width <= BENCH_VIEWPORT_COLUMNS) {
+                cells[column].offset = offset - start;
+                cells[column].length = next - offset;
+                cells[column].width = width;
+                for (int spacer = 1; spacer < width; spacer++) {
+                    cells[column + spacer].offset = offset - start;
+                    cells[column + spacer].length = 0;
+                    cells[column + spacer].width = 0;
+                }
+            }
+            column += width > 0 ? width : 0;
+            offset = next;
+        }
+        filled += column < BENCH_VIEWPORT_COLUMNS ? column : BENCH_VIEWPORT_COLUMNS;
+    }
+    return filled;
+}
+
+static long bench_cells_one_pass(int length) {
+    long filled = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        filled += utflite_fill_cells(bench_buffer + start, bench_line_end(start, length) - start,
+                                     0, BENCH_VIEWPORT_COLUMNS, 0, bench_line_cells);
+    }
+    return filled;
+}
+
+/* Tests each splice point by backing up to the previous cluster start and
+ * walking forward to see whether a cluster starts at the point. Points
+ * inside a multibyte sequence are rejected first. */
+static long bench_splice_rescan(int length) {
+    long boundaries = 0;
+    for (int offset = 0; offset < length; offset += BENCH_SPLICE_BYTES) {
+        if (utflite_prev_char(bench_buffer, utflite_next_char(bench_buffer, length, offset)) !=
+            offset) {
+            continue;
+        }
+        int cluster = utflite_prev_grapheme(bench_buffer, offset);
+        while (cluster < offset) {
+            cluster = utflite_next_grapheme(bench_buffer, length, cluster);
+        }
+        boundaries += cluster == offset;
+    }
+    return boundaries;
+}
+
+static long bench_splice_boundary(int length) {
+    long boundaries = 0;
+    for (int offset = 0; offset < length; offset += BENCH_SPLICE_BYTES) {
+        boundaries += utflite_is_grapheme_boundary(bench_buffer, length, offset);
+    }
+    return boundaries;
+}
+
+/* Converts each span boundary on its own, rescanning the line from its
+ * start for every unit. */
+static long bench_spans_each(int length) {
+    long total = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        const char *line = bench_buffer + start;
+        int line_length = bench_line_end(start, length) - start;
+        for (int offset = 0; offset < line_length; offset += BENCH_SPAN_BYTES) {
+            int codepoints = utflite_codepoint_count(line, offset);
+            int utf16 = 0;
+            for (int at = 0; at < offset; at = utflite_next_char(line, offset, at)) {
+                uint32_t codepoint;
+                utflite_decode(line + at, offset - at, &codepoint);
+                utf16 += codepoint >= 0x10000 ? 2 : 1;
+            }
+            total += codepoints + utf16 + utflite_string_width(line, offset);
+        }
+    }
+    return total;
+}
+
+static long bench_spans_batch(int length) {
+    long total = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        int line_length = bench_line_end(start, length) - start;
+        int count = 0;
+        for (int offset = 0; offset < line_length; offset += BENCH_SPAN_BYTES) {
+            bench_span_offsets[count++] = offset;
+        }
+        utflite_convert_offsets(bench_buffer + start, line_length, bench_span_offsets, count,
+                                bench_span_codepoints, bench_span_utf16, bench_span_columns);
+        for (int i = 0; i < count; i++) {
+            total += bench_span_codepoints[i] + bench_span_utf16[i] + bench_span_columns[i];
+        }
+    }
+    return total;
+}
+
+/* Finds the byte at BENCH_SCROLL_COLUMN of each line with utflite_truncate(). */
+static long bench_seek_truncate(int length) {
+    long offsets = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        offsets += utflite_truncate(bench_buffer + start, bench_line_end(start, length) - start,
+                                    BENCH_SCROLL_COLUMN);
+    }
+    return offsets;
+}
+
+static long bench_seek(int length) {
+    long offsets = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        offsets += utflite_column_seek(bench_buffer + start, bench_line_end(start, length) - start,
+                                       BENCH_SCROLL_COLUMN, NULL, NULL);
+    }
+    return offsets;
+}
+
+/* Steps a caret through each line, measuring its column from the start of
+ * the line after every step. */
+static long bench_caret_rescan(int length) {
+    long columns = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        int line_length = bench_line_end(start, length) - start;
+        int offset = 0;
+        while (offset < line_length) {
+            offset = utflite_next_grapheme(bench_buffer + start, line_length, offset);
+            columns += utflite_string_width_mode(bench_buffer + start, offset,
+                                                 UTFLITE_WIDTH_GRAPHEMES);
+        }
+    }
+    return columns;
+}
+
+static long bench_caret_cursor(int length) {
+    long columns = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        int line_length = bench_line_end(start, length) - start;
+        struct utflite_cursor cursor = {0};
+        while (utflite_cursor_next(&cursor, bench_buffer + start, line_length)) {
+            columns += cursor.column;
+        }
+    }
+    return columns;
+}
+
+/* Finds each line's window with two truncations, then fixes up a wide
+ * character that straddles the left edge. */
+static long bench_slice_truncate(int length) {
+    long shown = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        const char *line = bench_buffer + start;
+        int line_length = bench_line_end(start, length) - start;
+        int before;
+        int first = utflite_truncate_graphemes(line, line_length, BENCH_SCROLL_COLUMN, &before);
+        if (before < BENCH_SCROLL_COLUMN && first < line_length) {
+            first = utflite_next_grapheme(line, line_length, first);
+        }
+        int end = utflite_truncate(line, line_length, BENCH_SCROLL_COLUMN + BENCH_VIEWPORT_COLUMNS);
+        shown += end > first ? end - first : 0;
+    }
+    return shown;
+}
+
+static long bench_slice_one_pass(int length) {
+    long shown = 0;
+    for (int start = 0; start < length; start = bench_line_end(start, length)) {
+        struct utflite_column_slice slice;
+        utflite_slice_columns(bench_buffer + start, bench_line_end(start, length) - start,
+                              BENCH_SCROLL_COLUMN, BENCH_SCROLL_COLUMN + BENCH_VIEWPORT_COLUMNS,
+                              &slice);
+        shown += slice.end - slice.start;
+    }
+    return shown;
+}
+
+/* Prints each read the way a terminal does without a bulk call: clusters
+ * come from utflite_next_grapheme(), and every codepoint in them is
+ * decoded and measured on its own. */
+static long bench_print_per_codepoint(int length) {
+    long columns = 0;
+    for (int start = 0; start < length; start += BENCH_READ_BYTES) {
+        int end = start + BENCH_READ_BYTES < length ? start + BENCH_READ_BYTES : length;
+        int offset = start;
+        while (offset < end) {
+            int next = utflite_next_grapheme(bench_buffer, end, offset);
+            int cluster = 0;
+            while (offset < next) {
+                uint32_t codepoint;
+                offset += utflite_decode(bench_buffer + offset, next - offset, &codepoint);
+                int width = utflite_codepoint_width(codepoint);
+                cluster = width > cluster ? width : cluster;
+            }
+            columns += cluster;
+        }
+    }
+    return columns;
+}
+
+static long bench_print_run(int length) {
+    struct utflite_print_state state = {0};
+    long columns = 0;
+    for (int start = 0; start < length; start += BENCH_READ_BYTES) {
+        int end = start + BENCH_READ_BYTES < length ? start + BENCH_READ_BYTES : length;
+        int offset = start;
+        while (offset < end) {
+            int count;
+            offset += utflite_print_run(&state, bench_buffer + offset, end - offset,
+                                        bench_print_cells, BENCH_READ_BYTES, &count);
+            for (int i = 0; i < count; i++) {
+                columns += bench_print_cells[i].joins_previous ? 0 : bench_print_cells[i].width;
+            }
+        }
+    }
+    return columns;
+}
+
+/* Times 'walk' over every sample and prints throughput under 'title'. The
+ * walker receives the filled length and returns a count, reported in 'unit'. */
+static void bench_run(const char *title, const char *unit, long (*walk)(int length)) {
+    printf("%s:\n", title);
+    for (size_t i = 0; i < sizeof(bench_samples) / sizeof(bench_samples[0]); i++) {
+        int length = bench_fill_buffer(bench_samples[i].text);
+        long result = 0;
+        double fastest = 0.0;
+        for (int pass = 0; pass < BENCH_ITERATIONS; pass++) {
+            double start = bench_get_seconds();
+            result = walk(length);
+            double elapsed = bench_get_seconds() - start;
+            if (pass == 0 || elapsed < fastest) {
+                fastest = elapsed;
+            }
+        }
+        double megabytes = (double)length / BYTES_PER_MEGABYTE;
+        printf("  %-8s %8.1f MB/s  (%ld %s)\n",
+               bench_samples[i].name, megabytes / fastest, result, unit);
+    }
+}
+
+int main(void) {
+    printf("utflite benchmarks\n");
+    printf("==================\n\n");
+    bench_run("utflite_next_grapheme", "clusters", bench_walk_graphemes);
+    printf("\n");
+    bench_run("utflite_grapheme_count", "clusters", bench_count_graphemes);
+    printf("\n");
+    bench_run("cluster widths, next_grapheme + char_width", "columns", bench_width_two_pass);
+    printf("\n");
+    bench_run("utflite_string_width_mode (graphemes)", "columns", bench_width_one_pass);
+    printf("\n");
+    bench_run("utflite_string_width_ansi", "columns", bench_width_ansi);
+    printf("\n");
+    bench_run("truncate + prev_grapheme + width", "columns", bench_truncate_back_off);
+    printf("\n");
+    bench_run("utflite_truncate_graphemes", "columns", bench_truncate_one_pass);
+    printf("\n");
+    bench_run("table, utflite_string_width per cell", "columns", bench_table_per_cell);
+    printf("\n");
+    bench_run("utflite_column_widths", "columns", bench_table_batch);
+    printf("\n");
+    bench_run("cells, next_grapheme + string_width", "cells", bench_cells_manual);
+    printf("\n");
+    bench_run("utflite_fill_cells", "cells", bench_cells_one_pass);
+    printf("\n");
+    bench_run("splice, prev_grapheme + next_grapheme", "boundaries", bench_splice_rescan);
+    printf("\n");
+    bench_run("utflite_is_grapheme_boundary", "boundaries", bench_splice_boundary);
+    printf("\n");
+    bench_run("spans, rescan per offset", "units", bench_spans_each);
+    printf("\n");
+    bench_run("utflite_convert_offsets", "units", bench_spans_batch);
+    printf("\n");
+    bench_run("seek, utflite_truncate", "bytes", bench_seek_truncate);
+    printf("\n");
+    bench_run("utflite_column_seek", "bytes", bench_seek);
+    printf("\n");
+    bench_run("caret, next_grapheme + width from line start", "columns", bench_caret_rescan);
+    printf("\n");
+    bench_run("utflite_cursor_next", "columns", bench_caret_cursor);
+    printf("\n");
+    bench_run("slice, two truncations", "bytes", bench_slice_truncate);
+    printf("\n");
+    bench_run("utflite_slice_columns", "bytes", bench_slice_one_pass);
+    printf("\n");
+    bench_run("print, next_grapheme + codepoint_width", "columns", bench_print_per_codepoint);
+    printf("\n");
+    bench_run("utflite_print_run", "columns", bench_print_run);
+    return 0;
+}
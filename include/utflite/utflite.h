@@ -91,6 +91,34 @@ int utflite_codepoint_width(uint32_t codepoint);
  */
 int utflite_char_width(const char *text, int length, int offset);
 
+/* How string widths treat grapheme clusters. */
+enum utflite_width_mode {
+    /* Sum of codepoint widths, as utflite_string_width(). */
+    UTFLITE_WIDTH_CODEPOINTS,
+
+    /* One width per cluster, as utflite_grapheme_width(). */
+    UTFLITE_WIDTH_GRAPHEMES
+};
+
+/*
+ * Returns the display width of the grapheme cluster starting at 'offset',
+ * segmenting and measuring it in one pass. A cluster is as wide as its
+ * widest codepoint, so an emoji ZWJ sequence or a flag is 2 columns. An
+ * emoji presentation selector (U+FE0F) makes a cluster 2 wide and a text
+ * presentation selector (U+FE0E) makes it 1.
+ *
+ * Parameters:
+ *   text        - UTF-8 string
+ *   length      - Total bytes in string
+ *   offset      - Start of the cluster
+ *   next_offset - Optional: set to where the cluster ends
+ *
+ * Returns:
+ *   The cluster's width, -1 for control characters (including CRLF), or 0
+ *   at the end of the string.
+ */
+int utflite_grapheme_width(const char *text, int length, int offset, int *next_offset);
+
 /* ============================================================================
  * String Navigation
  * ============================================================================ */
@@ -137,6 +165,802 @@ int utflite_next_grapheme(const char *text, int length, int offset);
  */
 int utflite_prev_grapheme(const char *text, int offset);
 
+/*
+ * Tests whether a byte offset is a grapheme cluster boundary, as a scan
+ * from the start of the text would find, without scanning from there.
+ * Most pairs are decided by the codepoints on either side of the offset;
+ * only regional indicator runs (GB12/GB13), emoji ZWJ sequences (GB11)
+ * and Indic conjuncts (GB9c) look further back, at most as far as
+ * utflite_prev_grapheme() does. Use it before splicing text at an offset.
+ *
+ * Returns:
+ *   1 at a boundary (including either end of the text), 0 otherwise,
+ *   also for an offset inside a multibyte sequence
+ */
+int utflite_is_grapheme_boundary(const char *text, int length, int offset);
+
+/*
+ * Counts the grapheme clusters (user-perceived characters) in a string.
+ * Equivalent to walking it with utflite_next_grapheme(), but carries the
+ * segmentation state across clusters and skips property lookups for runs
+ * of printable ASCII.
+ *
+ * Returns:
+ *   Number of grapheme clusters (not bytes, not codepoints).
+ */
+int utflite_grapheme_count(const char *text, int length);
+
+/*
+ * Counts grapheme clusters, giving up as soon as the count exceeds a limit.
+ * Use it to enforce "at most N characters" without scanning the whole input.
+ *
+ * Parameters:
+ *   text          - UTF-8 string
+ *   length        - Number of bytes in string
+ *   max_graphemes - Largest count the caller accepts (negative acts as 0)
+ *
+ * Returns:
+ *   The number of grapheme clusters if it is at most max_graphemes,
+ *   otherwise max_graphemes + 1.
+ */
+int utflite_grapheme_count_bounded(const char *text, int length, int max_graphemes);
+
+/* ============================================================================
+ * Grapheme Index
+ * ============================================================================ */
+
+/* Suggested number of clusters between grapheme index checkpoints. */
+#define UTFLITE_GRAPHEME_INDEX_INTERVAL 64
+
+/* A grapheme cluster boundary: cluster number grapheme_index starts at byte_offset. */
+struct utflite_grapheme_checkpoint {
+    int byte_offset;
+    int grapheme_index;
+};
+
+/*
+ * Sampled index of grapheme cluster boundaries for random access into a
+ * large string. Checkpoints live in caller-provided storage, are sorted by
+ * offset, start with {0, 0}, and are at most 'interval' clusters apart.
+ * Treat the fields as read-only; use the functions below to change them.
+ */
+struct utflite_grapheme_index {
+    /* Caller-provided checkpoint storage. */
+    struct utflite_grapheme_checkpoint *checkpoints;
+
+    /* Entries available in checkpoints. */
+    int capacity;
+
+    /* Entries in use. */
+    int count;
+
+    /* Maximum clusters between checkpoints. */
+    int interval;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Total clusters in the indexed text. */
+    int grapheme_count;
+};
+
+/*
+ * Returns the number of checkpoints that always suffices for a string of
+ * 'length' bytes indexed every 'interval' clusters.
+ */
+int utflite_grapheme_index_capacity(int length, int interval);
+
+/*
+ * Builds a grapheme index over a string.
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned checkpoint array; must outlive the index
+ *   capacity - Number of entries in storage
+ *   interval - Clusters between checkpoints (UTFLITE_GRAPHEME_INDEX_INTERVAL)
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid or storage is too small.
+ */
+int utflite_grapheme_index_build(struct utflite_grapheme_index *index, struct utflite_grapheme_checkpoint *storage, int capacity, int interval, const char *text, int length);
+
+/*
+ * Updates an index after bytes [edit_start, old_end) of the indexed text
+ * were replaced by bytes [edit_start, new_end) of 'text'. Only the edited
+ * region is rescanned, plus at most 'interval' clusters after it until the
+ * boundaries line up with the old ones again.
+ *
+ * Parameters:
+ *   index      - Index built over the text before the edit
+ *   text       - UTF-8 string after the edit
+ *   length     - Number of bytes in text after the edit
+ *   edit_start - First byte that changed
+ *   old_end    - End of the replaced range, in the old text
+ *   new_end    - End of the replacement, in the new text
+ *
+ * Returns:
+ *   1 on success. 0 if the arguments do not describe an edit of the indexed
+ *   text or storage ran out; the index must then be rebuilt.
+ */
+int utflite_grapheme_index_update(struct utflite_grapheme_index *index, const char *text, int length, int edit_start, int old_end, int new_end);
+
+/*
+ * Finds where a grapheme cluster starts, in O(log n + interval).
+ *
+ * Returns:
+ *   Byte offset of cluster number grapheme_index (0-based), or the text
+ *   length if grapheme_index is past the last cluster.
+ */
+int utflite_grapheme_index_offset(const struct utflite_grapheme_index *index, const char *text, int grapheme_index);
+
+/*
+ * Finds which grapheme cluster contains a byte, in O(log n + interval).
+ *
+ * Returns:
+ *   0-based index of the cluster containing byte_offset, or the total
+ *   cluster count if byte_offset is at or past the end of the text.
+ */
+int utflite_grapheme_index_lookup(const struct utflite_grapheme_index *index, const char *text, int byte_offset);
+
+/* ============================================================================
+ * Codepoint Index
+ * ============================================================================ */
+
+/* Bytes covered by each rank entry of a codepoint index. */
+#define UTFLITE_CODEPOINT_INDEX_BLOCK 256
+
+/* Codepoints between select samples of a codepoint index. */
+#define UTFLITE_CODEPOINT_INDEX_SAMPLE 256
+
+/*
+ * Rank/select index over the lead bytes of a UTF-8 string, mapping between
+ * codepoint indices and byte offsets in near-constant time. It stores one
+ * int per UTFLITE_CODEPOINT_INDEX_BLOCK bytes and one per
+ * UTFLITE_CODEPOINT_INDEX_SAMPLE codepoints (about 3% of the text size) in
+ * caller-provided storage.
+ *
+ * Codepoints are counted by lead bytes (any byte other than 10xxxxxx). For
+ * valid UTF-8 this matches utflite_codepoint_count(); stray continuation
+ * bytes in invalid input belong to the codepoint before them.
+ */
+struct utflite_codepoint_index {
+    /* Codepoints starting before each block. */
+    int *block_ranks;
+
+    /* Block holding every SAMPLE-th codepoint. */
+    int *select_blocks;
+
+    /* Entries in block_ranks and select_blocks. */
+    int block_count;
+    int sample_count;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Total codepoints in the indexed text. */
+    int codepoint_count;
+};
+
+/*
+ * Returns the number of ints of storage a codepoint index needs for a
+ * string of 'length' bytes.
+ */
+int utflite_codepoint_index_capacity(int length);
+
+/*
+ * Builds a codepoint index in one pass over the string.
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned array; must outlive the index
+ *   capacity - Number of ints in storage (utflite_codepoint_index_capacity)
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid or storage is too small.
+ */
+int utflite_codepoint_index_build(struct utflite_codepoint_index *index, int *storage, int capacity, const char *text, int length);
+
+/*
+ * Finds where a codepoint starts.
+ *
+ * Returns:
+ *   Byte offset of codepoint number codepoint_index (0-based), or the text
+ *   length if codepoint_index is past the last codepoint.
+ */
+int utflite_codepoint_index_offset(const struct utflite_codepoint_index *index, const char *text, int codepoint_index);
+
+/*
+ * Finds which codepoint contains a byte.
+ *
+ * Returns:
+ *   0-based index of the codepoint containing byte_offset, or the total
+ *   codepoint count if byte_offset is at or past the end of the text.
+ */
+int utflite_codepoint_index_lookup(const struct utflite_codepoint_index *index, const char *text, int byte_offset);
+
+/* ============================================================================
+ * UTF-16 Offset Index
+ * ============================================================================ */
+
+/* Bytes between breadcrumbs of a UTF-16 offset index. */
+#define UTFLITE_UTF16_INDEX_BLOCK 256
+
+/*
+ * Breadcrumbs for converting between UTF-8 byte offsets and UTF-16 code
+ * unit offsets (as used by LSP and JavaScript), recording the UTF-16 offset
+ * every UTFLITE_UTF16_INDEX_BLOCK bytes. Conversions start from the nearest
+ * breadcrumb instead of the start of the text.
+ *
+ * Code units are counted from lead bytes: one per codepoint, plus one for
+ * each four-byte sequence (a surrogate pair). Exact for valid UTF-8.
+ */
+struct utflite_utf16_index {
+    /* UTF-16 code units before each block. */
+    int *block_units;
+
+    /* Entries in block_units. */
+    int block_count;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Total UTF-16 code units in the indexed text. */
+    int utf16_length;
+};
+
+/*
+ * Returns the number of ints of storage a UTF-16 offset index needs for a
+ * string of 'length' bytes.
+ */
+int utflite_utf16_index_capacity(int length);
+
+/*
+ * Builds a UTF-16 offset index in one pass over the string.
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned array; must outlive the index
+ *   capacity - Number of ints in storage (utflite_utf16_index_capacity)
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid or storage is too small.
+ */
+int utflite_utf16_index_build(struct utflite_utf16_index *index, int *storage, int capacity, const char *text, int length);
+
+/*
+ * Converts a UTF-8 byte offset to a UTF-16 code unit offset. An offset
+ * inside a multibyte sequence is rounded down to the start of it.
+ *
+ * Returns:
+ *   UTF-16 code units before byte_offset, clamped to the text.
+ */
+int utflite_utf16_index_to_utf16(const struct utflite_utf16_index *index, const char *text, int byte_offset);
+
+/*
+ * Converts a UTF-16 code unit offset to a UTF-8 byte offset. An offset
+ * between the two halves of a surrogate pair is rounded down to the start
+ * of the codepoint.
+ *
+ * Returns:
+ *   Byte offset of the codepoint at utf16_offset, or the text length if
+ *   utf16_offset is at or past the end.
+ */
+int utflite_utf16_index_to_utf8(const struct utflite_utf16_index *index, const char *text, int utf16_offset);
+
+/* ============================================================================
+ * Column Index
+ * ============================================================================ */
+
+/* Suggested bytes between column index samples. */
+#define UTFLITE_COLUMN_INDEX_INTERVAL 256
+
+/* One segment of a column index: the bytes and display columns it covers. */
+struct utflite_column_segment {
+    int bytes;
+    int columns;
+};
+
+/*
+ * Display-column index for long lines. The text is cut into segments of
+ * about 'interval' bytes at grapheme cluster boundaries, and the segment
+ * sizes are kept in a Fenwick tree in caller-provided storage. Lookups and
+ * edits touch O(log n) tree nodes plus the segments near the position.
+ * Columns are measured as utflite_string_width() does.
+ * Treat the fields as read-only; use the functions below to change them.
+ */
+struct utflite_column_index {
+    /* Fenwick tree of segment sizes, in caller-provided storage. */
+    struct utflite_column_segment *tree;
+
+    /* Entries available in tree. */
+    int capacity;
+
+    /* Entries in use. */
+    int segment_count;
+
+    /* Target bytes per segment. */
+    int interval;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Display width of the indexed text. */
+    int width;
+};
+
+/*
+ * Returns the number of segments that always suffices for a string of
+ * 'length' bytes sampled every 'interval' bytes.
+ */
+int utflite_column_index_capacity(int length, int interval);
+
+/*
+ * Builds a column index over a string (typically one line).
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned segment array; must outlive the index
+ *   capacity - Number of entries in storage
+ *   interval - Bytes between samples (UTFLITE_COLUMN_INDEX_INTERVAL)
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid or storage is too small.
+ */
+int utflite_column_index_build(struct utflite_column_index *index, struct utflite_column_segment *storage, int capacity, int interval, const char *text, int length);
+
+/*
+ * Updates an index after bytes [edit_start, old_end) of the indexed text
+ * were replaced by bytes [edit_start, new_end) of 'text'. Only the segments
+ * around the edit are rescanned; later ones keep their sizes. When an edit
+ * leaves one segment much longer than 'interval', the index is rebuilt.
+ *
+ * Returns:
+ *   1 on success. 0 if the arguments do not describe an edit of the indexed
+ *   text or a needed rebuild ran out of storage.
+ */
+int utflite_column_index_update(struct utflite_column_index *index, const char *text, int length, int edit_start, int old_end, int new_end);
+
+/*
+ * Returns the display width of text[0, byte_offset), with byte_offset
+ * rounded down to the start of its codepoint and clamped to the text.
+ */
+int utflite_column_index_to_column(const struct utflite_column_index *index, const char *text, int byte_offset);
+
+/*
+ * Finds the last grapheme cluster boundary whose preceding text fits in
+ * 'column' display columns. Use it to find where to start drawing when
+ * scrolled horizontally, or where to cut a line.
+ *
+ * Returns:
+ *   Byte offset of that boundary, or the text length if everything fits.
+ */
+int utflite_column_index_to_offset(const struct utflite_column_index *index, const char *text, int column);
+
+/* ============================================================================
+ * Line Index
+ * ============================================================================ */
+
+/*
+ * Counts lines, ending each at LF, CR or CRLF. Text that ends with a line
+ * break has an empty last line after it, so "a\n" has 2 lines and "" has 1.
+ */
+int utflite_line_count(const char *text, int length);
+
+/*
+ * Byte offsets where each line starts, kept in caller-provided storage.
+ * The array has a gap at the last edit, and the offsets after the gap are
+ * stored relative to a shared delta, so an edit only touches the entries
+ * between it and the previous edit. Treat the fields as read-only; use the
+ * functions below to read and change them.
+ */
+struct utflite_line_index {
+    /* Line start offsets, in caller-provided storage. */
+    int *starts;
+
+    /* Entries available in starts. */
+    int capacity;
+
+    /* Lines in the indexed text (at least 1). */
+    int line_count;
+
+    /* Entries [gap_start, gap_end) of starts are unused. */
+    int gap_start;
+    int gap_end;
+
+    /* Added to the offsets stored after the gap. */
+    int delta;
+
+    /* Byte length of the indexed text. */
+    int length;
+};
+
+/*
+ * Builds a line index over a string.
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned array; must outlive the index. Leave room
+ *              beyond utflite_line_count() for lines added by edits.
+ *   capacity - Number of ints in storage
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid or storage is too small.
+ */
+int utflite_line_index_build(struct utflite_line_index *index, int *storage, int capacity, const char *text, int length);
+
+/*
+ * Updates an index after bytes [edit_start, old_end) of the indexed text
+ * were replaced by bytes [edit_start, new_end) of 'text'. Only the new
+ * bytes (and one on each side, for CRLF pairs) are scanned.
+ *
+ * Returns:
+ *   1 on success. 0 if the arguments do not describe an edit of the indexed
+ *   text or storage ran out; the index must then be rebuilt.
+ */
+int utflite_line_index_update(struct utflite_line_index *index, const char *text, int length, int edit_start, int old_end, int new_end);
+
+/*
+ * Returns the byte offset where a line (0-based) starts, or the text
+ * length if line is past the last line.
+ */
+int utflite_line_index_start(const struct utflite_line_index *index, int line);
+
+/*
+ * Returns the 0-based line containing byte_offset, in O(log n). Offsets
+ * past the end belong to the last line.
+ */
+int utflite_line_index_find(const struct utflite_line_index *index, int byte_offset);
+
+/* ============================================================================
+ * Rope
+ * ============================================================================ */
+
+/*
+ * A text buffer for large documents, stored as a balanced tree of chunks
+ * of about a kilobyte. Every node caches the byte, codepoint, grapheme
+ * cluster, column and line break totals of its subtree, so edits and
+ * conversions between these units take O(log n) time however big the
+ * text gets. Chunks never split a codepoint. Unlike the rest of the
+ * library, a rope allocates its own memory with malloc().
+ */
+struct utflite_rope;
+
+/* Totals for the whole text held by a rope. */
+struct utflite_rope_metrics {
+    /* Length of the text in bytes. */
+    int bytes;
+
+    /* Lead bytes, as counted by utflite_codepoint_index. */
+    int codepoints;
+
+    /* Grapheme clusters. */
+    int graphemes;
+
+    /* Display width, as utflite_string_width(). */
+    int columns;
+
+    /* Lines, as utflite_line_count() counts them. */
+    int lines;
+};
+
+/* Units that rope offsets can be converted to and from. */
+enum utflite_rope_metric {
+    UTFLITE_ROPE_CODEPOINTS,
+    UTFLITE_ROPE_GRAPHEMES,
+    UTFLITE_ROPE_COLUMNS,
+    UTFLITE_ROPE_LINES
+};
+
+/*
+ * Creates a rope holding a copy of a string.
+ *
+ * Returns:
+ *   The new rope, or NULL if an argument is invalid or memory ran out.
+ *   Free it with utflite_rope_destroy().
+ */
+struct utflite_rope *utflite_rope_create(const char *text, int length);
+
+/* Frees a rope and all of its chunks. Accepts NULL. */
+void utflite_rope_destroy(struct utflite_rope *rope);
+
+/*
+ * Replaces bytes [start, end) of a rope with a copy of 'text'. Only the
+ * chunks around the edit are rebuilt; the rest of the tree is shared.
+ *
+ * Parameters:
+ *   rope   - Rope to edit
+ *   start  - First byte to replace
+ *   end    - End of the replaced range (start == end inserts)
+ *   text   - Replacement bytes (may be NULL when length is 0)
+ *   length - Number of replacement bytes (0 deletes)
+ *
+ * Returns:
+ *   1 on success. 0 if an argument is invalid or memory ran out, in which
+ *   case the rope is unchanged.
+ */
+int utflite_rope_replace(struct utflite_rope *rope, int start, int end, const char *text, int length);
+
+/* Returns the number of bytes in a rope. */
+int utflite_rope_length(const struct utflite_rope *rope);
+
+/* Reads the totals for the whole rope in O(1). */
+void utflite_rope_get_metrics(const struct utflite_rope *rope, struct utflite_rope_metrics *metrics);
+
+/*
+ * Converts a position in some unit to a byte offset, in O(log n).
+ *
+ * Returns:
+ *   For codepoints and graphemes, where unit number 'value' (0-based)
+ *   starts. For lines, where line 'value' starts. For columns, the last
+ *   grapheme cluster boundary whose preceding text fits in 'value'
+ *   columns, like utflite_column_index_to_offset(). The rope length if
+ *   'value' is past the end.
+ */
+int utflite_rope_to_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int value);
+
+/*
+ * Converts a byte offset to a position in some unit, in O(log n).
+ *
+ * Returns:
+ *   For codepoints, graphemes and lines, the 0-based unit containing
+ *   byte_offset, or the unit count (last line) at or past the end. For
+ *   columns, the display width of the text before byte_offset, rounded
+ *   down to the start of its codepoint.
+ */
+int utflite_rope_from_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int byte_offset);
+
+/*
+ * Copies bytes [start, end) of a rope into 'buffer', which must have room
+ * for end - start bytes. The range is clamped to the rope.
+ *
+ * Returns:
+ *   Number of bytes copied.
+ */
+int utflite_rope_copy(const struct utflite_rope *rope, int start, int end, char *buffer);
+
+/*
+ * Gives direct access to the chunk holding byte 'offset', for iterating
+ * over the text without copying. The pointer is valid until the next edit.
+ *
+ * Returns:
+ *   Pointer to byte 'offset', with the bytes left in its chunk stored in
+ *   *chunk_length. NULL (and 0) if offset is outside the rope.
+ */
+const char *utflite_rope_chunk(const struct utflite_rope *rope, int offset, int *chunk_length);
+
+/* ============================================================================
+ * Gap Buffer
+ * ============================================================================ */
+
+/*
+ * Per-line cache entry of a gap buffer. The caller provides an array of
+ * these; read lines through utflite_gap_buffer_line().
+ */
+struct utflite_gap_line {
+    /* Start of the line: absolute before the gap, distance from the end
+     * after it. */
+    int start;
+
+    /* Codepoints in the line; -1 until measured. */
+    int codepoints;
+
+    /* Display width of the line, once codepoints is measured. */
+    int columns;
+};
+
+/*
+ * An editable text buffer in caller-provided storage, for small or
+ * embedded editors. The free space (the gap) sits at the last edit, so
+ * typing only touches the bytes and line entries around the cursor. The
+ * line table has a matching gap, and lines after it are stored relative
+ * to the end of the text, so no entry needs adjusting when text before it
+ * grows. Line widths and codepoint counts are measured when first asked
+ * for after an edit. The gap never splits a codepoint, and the grapheme
+ * segmentation state at the gap is kept for cluster-wise cursor movement.
+ * Treat the fields as read-only.
+ */
+struct utflite_gap_buffer {
+    /* Text before the gap, the gap, then the rest of the text. */
+    char *text;
+
+    /* Bytes available in text. */
+    int capacity;
+
+    /* Bytes [gap_start, gap_end) of text are the gap. */
+    int gap_start;
+    int gap_end;
+
+    /* Caller-provided line entries and how many there are. */
+    struct utflite_gap_line *lines;
+    int line_capacity;
+
+    /* Entries [0, line_gap_start) hold the lines starting at or before
+     * gap_start. */
+    int line_gap_start;
+
+    /* Entries [line_gap_end, line_capacity) hold the later lines. */
+    int line_gap_end;
+
+    /* Grapheme segmentation state at gap_start. */
+    uint8_t grapheme_state;
+
+    /* Start of the cluster before the gap; -1 if stale. */
+    int grapheme_start;
+};
+
+/* What utflite_gap_buffer_line() reports about a line. */
+struct utflite_gap_line_metrics {
+    /* Byte offset of the line. */
+    int start;
+
+    /* Length including the line break. */
+    int bytes;
+
+    /* Codepoints, not counting the line break. */
+    int codepoints;
+
+    /* Display width, as utflite_string_width(). */
+    int columns;
+};
+
+/*
+ * Initializes an empty gap buffer. Load the initial text with
+ * utflite_gap_buffer_replace(buffer, 0, 0, text, length).
+ *
+ * Parameters:
+ *   buffer        - Buffer to initialize
+ *   storage       - Caller-owned bytes; capacity bounds the text length
+ *   capacity      - Number of bytes in storage
+ *   lines         - Caller-owned line entries; line_capacity bounds the
+ *                   number of lines
+ *   line_capacity - Number of entries in lines
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid.
+ */
+int utflite_gap_buffer_init(struct utflite_gap_buffer *buffer, char *storage, int capacity, struct utflite_gap_line *lines, int line_capacity);
+
+/* Returns the number of bytes of text in a gap buffer. */
+int utflite_gap_buffer_length(const struct utflite_gap_buffer *buffer);
+
+/* Returns the number of lines, as utflite_line_count() would count them. */
+int utflite_gap_buffer_line_count(const struct utflite_gap_buffer *buffer);
+
+/*
+ * Replaces bytes [start, end) with 'text' and leaves the gap after the
+ * new text. Offsets inside a codepoint are moved back to its start. Only
+ * the lines around the edit are rescanned, so the cost depends on the
+ * edit and the lines it touches, not on the size of the buffer.
+ *
+ * Returns:
+ *   1 on success. 0 if an argument is invalid or the text or line storage
+ *   is full, in which case the text is unchanged.
+ */
+int utflite_gap_buffer_replace(struct utflite_gap_buffer *buffer, int start, int end, const char *text, int length);
+
+/*
+ * Moves the gap (the cursor) to 'offset', moved back to the start of its
+ * codepoint. Costs time proportional to the distance moved.
+ *
+ * Returns:
+ *   The new gap position.
+ */
+int utflite_gap_buffer_move_gap(struct utflite_gap_buffer *buffer, int offset);
+
+/*
+ * Returns where the grapheme cluster before the gap starts (the target of
+ * a backspace), or 0 at the start of the text. Uses the state kept at the
+ * gap; after a backward move it is rebuilt from the start of the line.
+ */
+int utflite_gap_buffer_prev_grapheme(struct utflite_gap_buffer *buffer);
+
+/*
+ * Returns where the grapheme cluster after the gap ends, or the text
+ * length at the end of the text.
+ */
+int utflite_gap_buffer_next_grapheme(struct utflite_gap_buffer *buffer);
+
+/* Returns the 0-based line containing byte_offset, in O(log n). */
+int utflite_gap_buffer_find_line(const struct utflite_gap_buffer *buffer, int byte_offset);
+
+/*
+ * Reports where a line is and how wide it is, measuring it first if it
+ * changed since it was last measured.
+ *
+ * Returns:
+ *   1 on success, 0 if the line does not exist.
+ */
+int utflite_gap_buffer_line(struct utflite_gap_buffer *buffer, int line, struct utflite_gap_line_metrics *metrics);
+
+/*
+ * Copies bytes [start, end) of the text into 'out', joining the pieces on
+ * either side of the gap. The range is clamped to the text.
+ *
+ * Returns:
+ *   Number of bytes copied.
+ */
+int utflite_gap_buffer_copy(const struct utflite_gap_buffer *buffer, int start, int end, char *out);
+
+/* ============================================================================
+ * Cursor
+ * ============================================================================ */
+
+/*
+ * A caret in a line editor, kept on a grapheme cluster boundary with its
+ * position in every unit an editor needs. Moves and edits near the cursor
+ * only measure the clusters they touch, so their cost does not depend on
+ * how far along the line the cursor is. Columns are counted per cluster,
+ * as utflite_string_width_mode() does with UTFLITE_WIDTH_GRAPHEMES. Zero
+ * it to start at the beginning of the text.
+ */
+struct utflite_cursor {
+    /* Byte offset. */
+    int offset;
+
+    /* Codepoints before offset. */
+    int codepoint;
+
+    /* Grapheme clusters before offset. */
+    int grapheme;
+
+    /* Display columns before offset. */
+    int column;
+};
+
+/*
+ * Moves a cursor past the next grapheme cluster.
+ *
+ * Returns:
+ *   1 if it moved, 0 at the end of the text.
+ */
+int utflite_cursor_next(struct utflite_cursor *cursor, const char *text, int length);
+
+/*
+ * Moves a cursor back to the start of the previous grapheme cluster.
+ *
+ * Returns:
+ *   1 if it moved, 0 at the start of the text.
+ */
+int utflite_cursor_prev(struct utflite_cursor *cursor, const char *text);
+
+/*
+ * Updates a cursor after bytes [edit_start, old_end) of the text were
+ * replaced by bytes [edit_start, new_end) of 'text'. A cursor before the
+ * edit stays put, one after it moves with the text that follows (so text
+ * inserted at the cursor ends up before it), and one inside a replaced
+ * range moves to the end of the replacement. It is then moved forward to
+ * a cluster boundary, in case the edit joined text to the cluster before
+ * it.
+ *
+ * Only the clusters around the edit are measured, as long as the edit
+ * starts at or after the cursor. For an edit that starts before it, the
+ * text from the start is measured again; to delete the cluster before the
+ * cursor, move it back with utflite_cursor_prev() first.
+ *
+ * Parameters:
+ *   cursor     - Cursor into the text before the edit
+ *   text       - UTF-8 string after the edit
+ *   length     - Number of bytes in text after the edit
+ *   edit_start - First byte that changed
+ *   old_end    - End of the replaced range, in the old text
+ *   new_end    - End of the replacement, in the new text
+ *
+ * Returns:
+ *   1 on success, 0 if the arguments do not describe an edit or the
+ *   cursor would move past the end of the text (it is left unchanged).
+ */
+int utflite_cursor_update(struct utflite_cursor *cursor, const char *text, int length, int edit_start, int old_end, int new_end);
+
 /* ============================================================================
  * Utility Functions
  * ============================================================================ */
@@ -170,6 +994,16 @@ int utflite_codepoint_count(const char *text, int length);
  */
 int utflite_string_width(const char *text, int length);
 
+/*
+ * Calculates display width of a UTF-8 string, choosing whether widths are
+ * taken per codepoint or per grapheme cluster. In grapheme mode each
+ * codepoint is decoded and looked up once, for both segmentation and width.
+ *
+ * Returns:
+ *   Total display columns needed. Control characters count as 0.
+ */
+int utflite_string_width_mode(const char *text, int length, enum utflite_width_mode mode);
+
 /*
  * Checks if a codepoint is zero-width (combining marks, format chars, ZWJ, etc).
  *
@@ -200,6 +1034,429 @@ int utflite_is_wide(uint32_t codepoint);
  */
 int utflite_truncate(const char *text, int length, int max_cols);
 
+/*
+ * Finds the byte offset to truncate a string at a maximum display width
+ * without splitting a grapheme cluster. Clusters are segmented and measured
+ * in the same pass, each as wide as utflite_grapheme_width() reports, so a
+ * combining mark stays with its base and a flag or ZWJ sequence is kept or
+ * dropped whole.
+ *
+ * Parameters:
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *   max_cols - Maximum display columns
+ *   width    - Receives the display width of text before the returned
+ *              offset (may be NULL)
+ *
+ * Returns:
+ *   Byte offset of the last cluster boundary that fits within max_cols.
+ *   Returns length if string already fits.
+ */
+int utflite_truncate_graphemes(const char *text, int length, int max_cols, int *width);
+
+/* Where utflite_truncate_ellipsis() drops text and writes the ellipsis. */
+enum utflite_ellipsis_mode {
+    /* Keep the start: "prefix..." */
+    UTFLITE_ELLIPSIS_END,
+
+    /* Keep the end: "...suffix" */
+    UTFLITE_ELLIPSIS_START,
+
+    /* Keep both ends: "pre...fix" */
+    UTFLITE_ELLIPSIS_MIDDLE
+};
+
+/*
+ * Truncates a string to a maximum display width, marking the dropped text
+ * with an ellipsis (U+2026, one column), and writes the result into
+ * 'buffer'. Text that already fits is copied unchanged. The kept start is
+ * found with a forward scan and the kept end with a backward scan, both
+ * bounded by max_cols, so a long string is never measured in full. Cuts
+ * fall on grapheme cluster boundaries.
+ *
+ * Parameters:
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *   max_cols - Maximum display columns, ellipsis included
+ *   mode     - Which part of the text to drop
+ *   buffer   - Receives the result; needs room for length + 3 bytes. It is
+ *              not NUL-terminated.
+ *   width    - Receives the display width of the result (may be NULL)
+ *
+ * Returns:
+ *   Number of bytes written. Nothing is written when the text does not fit
+ *   and max_cols has no room for the ellipsis.
+ */
+int utflite_truncate_ellipsis(const char *text, int length, int max_cols, enum utflite_ellipsis_mode mode, char *buffer, int *width);
+
+/* How utflite_pad() places text within its cell. */
+enum utflite_align {
+    /* Padding after the text. */
+    UTFLITE_ALIGN_LEFT,
+
+    /* Padding before the text. */
+    UTFLITE_ALIGN_RIGHT,
+
+    /* Padding split, the odd column after. */
+    UTFLITE_ALIGN_CENTER
+};
+
+/* A piece of UTF-8 text that need not be NUL-terminated. */
+struct utflite_span {
+    const char *text;
+    int length;
+};
+
+/*
+ * Writes text into 'buffer' as a cell exactly 'cols' columns wide: text
+ * that is too wide is cut at a grapheme cluster boundary, and the rest of
+ * the cell is filled with spaces. The text is measured and cut in a
+ * single pass.
+ *
+ * Parameters:
+ *   text   - UTF-8 string
+ *   length - Number of bytes in string
+ *   cols   - Cell width in display columns
+ *   align  - Where the padding goes
+ *   buffer - Receives the cell; needs room for length + cols bytes. It is
+ *            not NUL-terminated.
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_pad(const char *text, int length, int cols, enum utflite_align align, char *buffer);
+
+/*
+ * Lays out a table row: each cell is padded as utflite_pad() does, and
+ * cells are joined with 'separator'.
+ *
+ * Parameters:
+ *   cells     - Text of each cell
+ *   cols      - Width of each cell in display columns
+ *   aligns    - Alignment of each cell, or NULL to align all left
+ *   count     - Number of cells
+ *   separator - NUL-terminated text written between cells (may be NULL)
+ *   buffer    - Receives the row; needs room for each cell's length plus
+ *               its width, and count - 1 separators. It is not
+ *               NUL-terminated.
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_pad_row(const struct utflite_span *cells, const int *cols, const enum utflite_align *aligns, int count, const char *separator, char *buffer);
+
+/*
+ * Measures a table of cells given in row-major order, reporting each cell's
+ * width and the widest cell of each column. Runs of printable ASCII are
+ * counted a 64-bit word at a time; the rest of a cell is measured as
+ * utflite_string_width_mode() does.
+ *
+ * Parameters:
+ *   cells         - rows * columns cells, row by row
+ *   rows          - Number of rows
+ *   columns       - Number of cells per row
+ *   mode          - Per-codepoint or per-cluster widths
+ *   cell_widths   - Receives rows * columns widths (may be NULL)
+ *   column_widths - Receives 'columns' maxima
+ *
+ * Returns:
+ *   Sum of the column maxima.
+ */
+int utflite_column_widths(const struct utflite_span *cells, int rows, int columns, enum utflite_width_mode mode, int *cell_widths, int *column_widths);
+
+/*
+ * Calculates the display width of a line that starts at column 'start_col',
+ * expanding each TAB to the next multiple of 'tab_size' columns. Widths are
+ * taken per grapheme cluster, as utflite_grapheme_width() reports.
+ *
+ * Parameters:
+ *   text      - UTF-8 string
+ *   length    - Number of bytes in string
+ *   tab_size  - Columns between tab stops; below 1, TAB counts as 0
+ *   start_col - Column of the first byte (0 or more)
+ *
+ * Returns:
+ *   Columns the text advances past start_col.
+ */
+int utflite_string_width_tabs(const char *text, int length, int tab_size, int start_col);
+
+/*
+ * Finds the last grapheme cluster boundary whose preceding text fits in
+ * max_cols columns, with tabs expanded as utflite_string_width_tabs()
+ * does. To find the offset at an absolute column, pass
+ * max_cols = column - start_col.
+ *
+ * Parameters:
+ *   text      - UTF-8 string
+ *   length    - Number of bytes in string
+ *   max_cols  - Maximum display columns after start_col
+ *   tab_size  - Columns between tab stops; below 1, TAB counts as 0
+ *   start_col - Column of the first byte (0 or more)
+ *   width     - Receives the width of text before the returned offset
+ *               (may be NULL)
+ *
+ * Returns:
+ *   Byte offset of that boundary, or length if the text fits.
+ */
+int utflite_truncate_tabs(const char *text, int length, int max_cols, int tab_size, int start_col, int *width);
+
+/*
+ * Returns the display column of byte_offset, with tabs expanded as
+ * utflite_string_width_tabs() does. byte_offset is clamped to the text and
+ * rounded down to the start of its grapheme cluster.
+ */
+int utflite_offset_to_column_tabs(const char *text, int length, int byte_offset, int tab_size, int start_col);
+
+/*
+ * One terminal cell filled by utflite_fill_cells(). The cell holding a
+ * cluster points at its bytes in the line, and a wide cluster is followed
+ * by a spacer. Blank cells stand for columns of a tab, or of a wide
+ * cluster cut by the viewport edge.
+ */
+struct utflite_cell {
+    /* Byte offset of the cluster the cell belongs to. */
+    int offset;
+
+    /* Bytes of the cluster to draw; 0 for spacers and blanks. */
+    int length;
+
+    /* Columns drawn: 1 or 2; 0 for the spacer after a wide cell. */
+    int width;
+};
+
+/*
+ * Lays out the visible part of a line as terminal cells in one pass:
+ * grapheme clusters are segmented, measured and placed together, and the
+ * walk stops at the right edge of the viewport. Zero-width clusters and
+ * controls take no cell.
+ *
+ * Parameters:
+ *   text      - UTF-8 line
+ *   length    - Number of bytes in line
+ *   first_col - First column of the viewport (0 or more)
+ *   col_count - Number of columns in the viewport
+ *   tab_size  - Columns between tab stops; below 1, TAB takes no cell
+ *   cells     - Receives one entry per column; needs col_count entries
+ *
+ * Returns:
+ *   Number of cells filled: col_count, or fewer if the line ends first.
+ */
+int utflite_fill_cells(const char *text, int length, int first_col, int col_count, int tab_size, struct utflite_cell *cells);
+
+/*
+ * Compares two versions of a line and finds the display columns a terminal
+ * must redraw. The common prefix and suffix are skipped a word at a time
+ * before any decoding; then only the clusters in between are segmented
+ * and measured. The range starts and ends on grapheme cluster boundaries
+ * of both lines, so a wide character is never split. When the change
+ * shifts the common suffix, the range runs to the end of the longer line.
+ *
+ * Parameters:
+ *   old_text   - Previous line
+ *   old_length - Number of bytes in old_text
+ *   new_text   - Next line
+ *   new_length - Number of bytes in new_text
+ *   first_col  - Receives the first column that differs
+ *   end_col    - Receives the column after the last one that differs
+ *
+ * Returns:
+ *   1 if the lines differ, 0 if they are identical (both columns are 0).
+ */
+int utflite_line_damage(const char *old_text, int old_length, const char *new_text, int new_length, int *first_col, int *end_col);
+
+/* Where a window of columns falls in a line; see utflite_slice_columns(). */
+struct utflite_column_slice {
+    /* First byte to draw. */
+    int start;
+
+    /* Byte after the last one to draw. */
+    int end;
+
+    /* Blank columns for a wide cluster cut by the left edge, or 0. */
+    int left_padding;
+
+    /* Blank columns for a wide cluster cut by the right edge, or 0. */
+    int right_padding;
+};
+
+/*
+ * Finds the bytes of a line that show in columns [first_col, end_col), for
+ * horizontal scrolling, in one walk over the clusters before end_col.
+ * Clusters are measured as utflite_grapheme_width() does, and the range
+ * holds only clusters that fit the window entirely. A wide cluster cut by
+ * either edge is left out, and the columns of it that fall inside the
+ * window are reported as padding.
+ *
+ * Parameters:
+ *   text      - UTF-8 line
+ *   length    - Number of bytes in line
+ *   first_col - First column of the window (0 or more)
+ *   end_col   - Column after the window
+ *   slice     - Receives the byte range and padding
+ *
+ * Returns:
+ *   Display width of text[start, end). With the padding it fills the
+ *   window, unless the line ends inside it.
+ */
+int utflite_slice_columns(const char *text, int length, int first_col, int end_col, struct utflite_column_slice *slice);
+
+/*
+ * Finds the grapheme cluster that covers a display column, for moving a
+ * cursor up or down to a sticky column. Clusters are measured as
+ * utflite_grapheme_width() does. Lines that start with printable ASCII are
+ * answered from the bytes alone, a word at a time.
+ *
+ * Parameters:
+ *   text           - UTF-8 line
+ *   length         - Number of bytes in line
+ *   column         - Target display column (0 or more)
+ *   cluster_column - Receives the column where the returned cluster starts
+ *                    (may be NULL)
+ *   inside         - Receives 1 if 'column' falls inside a wide cluster
+ *                    that starts before it, else 0 (may be NULL)
+ *
+ * Returns:
+ *   Byte offset of the cluster covering 'column', or the length of the
+ *   line if it is narrower than that (*cluster_column is then its width).
+ */
+int utflite_column_seek(const char *text, int length, int column, int *cluster_column, int *inside);
+
+/*
+ * Converts many byte offsets into one line at once, in a single forward
+ * pass, for syntax highlighting spans and diagnostics. Each offset gets
+ * its codepoint index, UTF-16 code unit offset and display column (as
+ * utflite_string_width() counts it). An offset inside a multibyte
+ * sequence is rounded down to the start of it, and offsets past the end
+ * are clamped. Runs of printable ASCII are skipped a word at a time.
+ *
+ * Parameters:
+ *   text         - UTF-8 line
+ *   length       - Number of bytes in line
+ *   byte_offsets - Offsets to convert, in nondecreasing order
+ *   count        - Number of offsets
+ *   codepoints   - Receives each offset's codepoint index (may be NULL)
+ *   utf16        - Receives each offset's UTF-16 offset (may be NULL)
+ *   columns      - Receives each offset's display column (may be NULL)
+ *
+ * Returns:
+ *   Number of offsets converted: count, or the index of the first offset
+ *   that is smaller than the one before it.
+ */
+int utflite_convert_offsets(const char *text, int length, const int *byte_offsets, int count, int *codepoints, int *utf16, int *columns);
+
+/* ============================================================================
+ * ANSI Escape Sequences
+ * ============================================================================ */
+
+/*
+ * Returns the byte length of the escape sequence starting at 'offset', or 0
+ * if text[offset] is not ESC. CSI sequences (colors, cursor movement), OSC
+ * strings (titles, OSC 8 hyperlinks) ended by BEL or ST, DCS/SOS/PM/APC
+ * strings and two- or three-byte escapes are recognized. A sequence cut
+ * off by the end of the text runs to the end.
+ */
+int utflite_ansi_sequence_length(const char *text, int length, int offset);
+
+/*
+ * Calculates display width of a UTF-8 string, skipping escape sequences.
+ * Widths are taken per grapheme cluster, as utflite_grapheme_width()
+ * reports.
+ *
+ * Returns:
+ *   Total display columns needed. Control characters count as 0.
+ */
+int utflite_string_width_ansi(const char *text, int length);
+
+/*
+ * Truncates a string to a maximum display width, skipping escape sequences
+ * while measuring, and writes the result into 'buffer'. Visible text is cut
+ * at a grapheme cluster boundary, but escape sequences after the cut are
+ * still copied, so color resets and hyperlink ends are not lost.
+ *
+ * Parameters:
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *   max_cols - Maximum display columns
+ *   buffer   - Receives the result; needs room for length bytes. It is not
+ *              NUL-terminated.
+ *   width    - Receives the display width of the result (may be NULL)
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_truncate_ansi(const char *text, int length, int max_cols, char *buffer, int *width);
+
+/*
+ * Copies a string into 'buffer' without its escape sequences. 'buffer'
+ * needs room for length bytes and may be 'text' itself.
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_strip_ansi(const char *text, int length, char *buffer);
+
+/* ============================================================================
+ * Terminal Output
+ * ============================================================================ */
+
+/*
+ * What utflite_print_run() carries from one read to the next: the grapheme
+ * segmentation state after the last codepoint, the width of the cluster it
+ * belongs to, and the bytes of a UTF-8 sequence the read cut off. Zero it
+ * before the first call.
+ */
+struct utflite_print_state {
+    uint8_t grapheme_state;
+    int cluster_width;
+    int pending_length;
+    char pending[UTFLITE_MAX_BYTES];
+};
+
+/*
+ * One grapheme cluster printed by utflite_print_run(). Its first codepoint
+ * is decoded; the rest (combining marks, emoji joined by ZWJ, ...) are left
+ * as UTF-8 in the input.
+ */
+struct utflite_print_cell {
+    /* First codepoint; U+FFFD for malformed bytes. */
+    uint32_t codepoint;
+
+    /* Where the other codepoints start in the input. */
+    int extra_offset;
+
+    /* Their length in bytes; 0 for a lone codepoint. */
+    int extra_length;
+
+    /* Columns of the whole cluster so far: 0, 1 or 2. */
+    int width;
+
+    /* Set when the cell extends the last cluster of the previous call. */
+    int joins_previous;
+};
+
+/*
+ * Decodes, segments and measures a run of printable terminal output in one
+ * pass, for the print path of a terminal emulator. The run ends before the
+ * first C0 control byte or DEL (including ESC), which the caller handles.
+ * Data may be split anywhere across calls: a UTF-8 sequence cut off at the
+ * end of 'data' is held in 'state', and a cluster left open may be extended
+ * by the next call (its first cell then has joins_previous set). C1
+ * controls, which take two bytes in UTF-8, are returned as cells of width 0.
+ *
+ * Parameters:
+ *   state         - Carry-over state; zeroed before the first call
+ *   data          - Bytes read from the terminal's input
+ *   length        - Number of bytes in data
+ *   cells         - Receives one entry per cluster
+ *   cell_capacity - Number of entries in cells (1 or more)
+ *   cell_count    - Receives the number of entries filled (required)
+ *
+ * Returns:
+ *   Number of bytes consumed: up to the first control byte, or where cells
+ *   ran out, or all of data. Bytes held in 'state' count as consumed.
+ */
+int utflite_print_run(struct utflite_print_state *state, const char *data, int length, struct utflite_print_cell *cells, int cell_capacity, int *cell_count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -113,6 +113,34 @@ int utflite_codepoint_width(uint32_t codepoint);
  */
 int utflite_char_width(const char *text, int length, int offset);
 
+/* How string widths treat grapheme clusters. */
+enum utflite_width_mode {
+    /* Sum of codepoint widths, as utflite_string_width(). */
+    UTFLITE_WIDTH_CODEPOINTS,
+
+    /* One width per cluster, as utflite_grapheme_width(). */
+    UTFLITE_WIDTH_GRAPHEMES
+};
+
+/*
+ * Returns the display width of the grapheme cluster starting at 'offset',
+ * segmenting and measuring it in one pass. A cluster is as wide as its
+ * widest codepoint, so an emoji ZWJ sequence or a flag is 2 columns. An
+ * emoji presentation selector (U+FE0F) makes a cluster 2 wide and a text
+ * presentation selector (U+FE0E) makes it 1.
+ *
+ * Parameters:
+ *   text        - UTF-8 string
+ *   length      - Total bytes in string
+ *   offset      - Start of the cluster
+ *   next_offset - Optional: set to where the cluster ends
+ *
+ * Returns:
+ *   The cluster's width, -1 for control characters (including CRLF), or 0
+ *   at the end of the string.
+ */
+int utflite_grapheme_width(const char *text, int length, int offset, int *next_offset);
+
 /* ============================================================================
  * String Navigation
  * ============================================================================ */
@@ -159,211 +187,1443 @@ int utflite_next_grapheme(const char *text, int length, int offset);
  */
 int utflite_prev_grapheme(const char *text, int offset);
 
+/*
+ * Tests whether a byte offset is a grapheme cluster boundary, as a scan
+ * from the start of the text would find, without scanning from there.
+ * Most pairs are decided by the codepoints on either side of the offset;
+ * only regional indicator runs (GB12/GB13), emoji ZWJ sequences (GB11)
+ * and Indic conjuncts (GB9c) look further back, at most as far as
+ * utflite_prev_grapheme() does. Use it before splicing text at an offset.
+ *
+ * Returns:
+ *   1 at a boundary (including either end of the text), 0 otherwise,
+ *   also for an offset inside a multibyte sequence
+ */
+int utflite_is_grapheme_boundary(const char *text, int length, int offset);
+
+/*
+ * Counts the grapheme clusters (user-perceived characters) in a string.
+ * Equivalent to walking it with utflite_next_grapheme(), but carries the
+ * segmentation state across clusters and skips property lookups for runs
+ * of printable ASCII.
+ *
+ * Returns:
+ *   Number of grapheme clusters (not bytes, not codepoints).
+ */
+int utflite_grapheme_count(const char *text, int length);
+
+/*
+ * Counts grapheme clusters, giving up as soon as the count exceeds a limit.
+ * Use it to enforce "at most N characters" without scanning the whole input.
+ *
+ * Parameters:
+ *   text          - UTF-8 string
+ *   length        - Number of bytes in string
+ *   max_graphemes - Largest count the caller accepts (negative acts as 0)
+ *
+ * Returns:
+ *   The number of grapheme clusters if it is at most max_graphemes,
+ *   otherwise max_graphemes + 1.
+ */
+int utflite_grapheme_count_bounded(const char *text, int length, int max_graphemes);
+
 /* ============================================================================
- * Utility Functions
+ * Grapheme Index
  * ============================================================================ */
 
+/* Suggested number of clusters between grapheme index checkpoints. */
+#define UTFLITE_GRAPHEME_INDEX_INTERVAL 64
+
+/* A grapheme cluster boundary: cluster number grapheme_index starts at byte_offset. */
+struct utflite_grapheme_checkpoint {
+    int byte_offset;
+    int grapheme_index;
+};
+
 /*
- * Validates a UTF-8 string.
+ * Sampled index of grapheme cluster boundaries for random access into a
+ * large string. Checkpoints live in caller-provided storage, are sorted by
+ * offset, start with {0, 0}, and are at most 'interval' clusters apart.
+ * Treat the fields as read-only; use the functions below to change them.
+ */
+struct utflite_grapheme_index {
+    /* Caller-provided checkpoint storage. */
+    struct utflite_grapheme_checkpoint *checkpoints;
+
+    /* Entries available in checkpoints. */
+    int capacity;
+
+    /* Entries in use. */
+    int count;
+
+    /* Maximum clusters between checkpoints. */
+    int interval;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Total clusters in the indexed text. */
+    int grapheme_count;
+};
+
+/*
+ * Returns the number of checkpoints that always suffices for a string of
+ * 'length' bytes indexed every 'interval' clusters.
+ */
+int utflite_grapheme_index_capacity(int length, int interval);
+
+/*
+ * Builds a grapheme index over a string.
  *
  * Parameters:
- *   text         - UTF-8 string to validate
- *   length       - Number of bytes in string
- *   error_offset - Optional: set to byte offset of first invalid sequence
+ *   index    - Index to initialize
+ *   storage  - Caller-owned checkpoint array; must outlive the index
+ *   capacity - Number of entries in storage
+ *   interval - Clusters between checkpoints (UTFLITE_GRAPHEME_INDEX_INTERVAL)
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
  *
  * Returns:
- *   1 if valid UTF-8, 0 if invalid.
+ *   1 on success, 0 if an argument is invalid or storage is too small.
  */
-int utflite_validate(const char *text, int length, int *error_offset);
+int utflite_grapheme_index_build(struct utflite_grapheme_index *index, struct utflite_grapheme_checkpoint *storage, int capacity, int interval, const char *text, int length);
 
 /*
- * Counts the number of Unicode codepoints in a UTF-8 string.
+ * Updates an index after bytes [edit_start, old_end) of the indexed text
+ * were replaced by bytes [edit_start, new_end) of 'text'. Only the edited
+ * region is rescanned, plus at most 'interval' clusters after it until the
+ * boundaries line up with the old ones again.
+ *
+ * Parameters:
+ *   index      - Index built over the text before the edit
+ *   text       - UTF-8 string after the edit
+ *   length     - Number of bytes in text after the edit
+ *   edit_start - First byte that changed
+ *   old_end    - End of the replaced range, in the old text
+ *   new_end    - End of the replacement, in the new text
  *
  * Returns:
- *   Number of codepoints (not bytes, not graphemes).
+ *   1 on success. 0 if the arguments do not describe an edit of the indexed
+ *   text or storage ran out; the index must then be rebuilt.
  */
-int utflite_codepoint_count(const char *text, int length);
+int utflite_grapheme_index_update(struct utflite_grapheme_index *index, const char *text, int length, int edit_start, int old_end, int new_end);
 
 /*
- * Calculates display width of a UTF-8 string.
+ * Finds where a grapheme cluster starts, in O(log n + interval).
  *
  * Returns:
- *   Total display columns needed. Control characters count as 0.
+ *   Byte offset of cluster number grapheme_index (0-based), or the text
+ *   length if grapheme_index is past the last cluster.
  */
-int utflite_string_width(const char *text, int length);
+int utflite_grapheme_index_offset(const struct utflite_grapheme_index *index, const char *text, int grapheme_index);
 
 /*
- * Checks if a codepoint is zero-width (combining marks, format chars, ZWJ, etc).
+ * Finds which grapheme cluster contains a byte, in O(log n + interval).
  *
  * Returns:
- *   1 if codepoint is zero-width, 0 otherwise.
+ *   0-based index of the cluster containing byte_offset, or the total
+ *   cluster count if byte_offset is at or past the end of the text.
  */
-int utflite_is_zero_width(uint32_t codepoint);
+int utflite_grapheme_index_lookup(const struct utflite_grapheme_index *index, const char *text, int byte_offset);
+
+/* ============================================================================
+ * Codepoint Index
+ * ============================================================================ */
+
+/* Bytes covered by each rank entry of a codepoint index. */
+#define UTFLITE_CODEPOINT_INDEX_BLOCK 256
+
+/* Codepoints between select samples of a codepoint index. */
+#define UTFLITE_CODEPOINT_INDEX_SAMPLE 256
 
 /*
- * Checks if a codepoint is double-width (CJK, emoji, etc).
+ * Rank/select index over the lead bytes of a UTF-8 string, mapping between
+ * codepoint indices and byte offsets in near-constant time. It stores one
+ * int per UTFLITE_CODEPOINT_INDEX_BLOCK bytes and one per
+ * UTFLITE_CODEPOINT_INDEX_SAMPLE codepoints (about 3% of the text size) in
+ * caller-provided storage.
+ *
+ * Codepoints are counted by lead bytes (any byte other than 10xxxxxx). For
+ * valid UTF-8 this matches utflite_codepoint_count(); stray continuation
+ * bytes in invalid input belong to the codepoint before them.
+ */
+struct utflite_codepoint_index {
+    /* Codepoints starting before each block. */
+    int *block_ranks;
+
+    /* Block holding every SAMPLE-th codepoint. */
+    int *select_blocks;
+
+    /* Entries in block_ranks and select_blocks. */
+    int block_count;
+    int sample_count;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Total codepoints in the indexed text. */
+    int codepoint_count;
+};
+
+/*
+ * Returns the number of ints of storage a codepoint index needs for a
+ * string of 'length' bytes.
+ */
+int utflite_codepoint_index_capacity(int length);
+
+/*
+ * Builds a codepoint index in one pass over the string.
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned array; must outlive the index
+ *   capacity - Number of ints in storage (utflite_codepoint_index_capacity)
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
  *
  * Returns:
- *   1 if codepoint is double-width, 0 otherwise.
+ *   1 on success, 0 if an argument is invalid or storage is too small.
  */
-int utflite_is_wide(uint32_t codepoint);
+int utflite_codepoint_index_build(struct utflite_codepoint_index *index, int *storage, int capacity, const char *text, int length);
 
 /*
- * Finds byte offset to truncate string at a maximum display width.
+ * Finds where a codepoint starts.
+ *
+ * Returns:
+ *   Byte offset of codepoint number codepoint_index (0-based), or the text
+ *   length if codepoint_index is past the last codepoint.
+ */
+int utflite_codepoint_index_offset(const struct utflite_codepoint_index *index, const char *text, int codepoint_index);
+
+/*
+ * Finds which codepoint contains a byte.
+ *
+ * Returns:
+ *   0-based index of the codepoint containing byte_offset, or the total
+ *   codepoint count if byte_offset is at or past the end of the text.
+ */
+int utflite_codepoint_index_lookup(const struct utflite_codepoint_index *index, const char *text, int byte_offset);
+
+/* ============================================================================
+ * UTF-16 Offset Index
+ * ============================================================================ */
+
+/* Bytes between breadcrumbs of a UTF-16 offset index. */
+#define UTFLITE_UTF16_INDEX_BLOCK 256
+
+/*
+ * Breadcrumbs for converting between UTF-8 byte offsets and UTF-16 code
+ * unit offsets (as used by LSP and JavaScript), recording the UTF-16 offset
+ * every UTFLITE_UTF16_INDEX_BLOCK bytes. Conversions start from the nearest
+ * breadcrumb instead of the start of the text.
+ *
+ * Code units are counted from lead bytes: one per codepoint, plus one for
+ * each four-byte sequence (a surrogate pair). Exact for valid UTF-8.
+ */
+struct utflite_utf16_index {
+    /* UTF-16 code units before each block. */
+    int *block_units;
+
+    /* Entries in block_units. */
+    int block_count;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Total UTF-16 code units in the indexed text. */
+    int utf16_length;
+};
+
+/*
+ * Returns the number of ints of storage a UTF-16 offset index needs for a
+ * string of 'length' bytes.
+ */
+int utflite_utf16_index_capacity(int length);
+
+/*
+ * Builds a UTF-16 offset index in one pass over the string.
  *
  * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned array; must outlive the index
+ *   capacity - Number of ints in storage (utflite_utf16_index_capacity)
  *   text     - UTF-8 string
  *   length   - Number of bytes in string
- *   max_cols - Maximum display columns
  *
  * Returns:
- *   Byte offset where string should be truncated to fit within max_cols.
- *   Returns length if string already fits.
+ *   1 on success, 0 if an argument is invalid or storage is too small.
  */
-int utflite_truncate(const char *text, int length, int max_cols);
+int utflite_utf16_index_build(struct utflite_utf16_index *index, int *storage, int capacity, const char *text, int length);
 
-#ifdef __cplusplus
-}
-#endif
+/*
+ * Converts a UTF-8 byte offset to a UTF-16 code unit offset. An offset
+ * inside a multibyte sequence is rounded down to the start of it.
+ *
+ * Returns:
+ *   UTF-16 code units before byte_offset, clamped to the text.
+ */
+int utflite_utf16_index_to_utf16(const struct utflite_utf16_index *index, const char *text, int byte_offset);
 
-#endif /* UTFLITE_H */
+/*
+ * Converts a UTF-16 code unit offset to a UTF-8 byte offset. An offset
+ * between the two halves of a surrogate pair is rounded down to the start
+ * of the codepoint.
+ *
+ * Returns:
+ *   Byte offset of the codepoint at utf16_offset, or the text length if
+ *   utf16_offset is at or past the end.
+ */
+int utflite_utf16_index_to_utf8(const struct utflite_utf16_index *index, const char *text, int utf16_offset);
 
 /* ============================================================================
- * IMPLEMENTATION
+ * Column Index
  * ============================================================================ */
 
-#ifdef UTFLITE_IMPLEMENTATION
+/* Suggested bytes between column index samples. */
+#define UTFLITE_COLUMN_INDEX_INTERVAL 256
 
-/* Range of Unicode codepoints, used for binary search in property tables. */
-struct utflite__unicode_range {
-    uint32_t start;
-    uint32_t end;
+/* One segment of a column index: the bytes and display columns it covers. */
+struct utflite_column_segment {
+    int bytes;
+    int columns;
 };
 
 /*
- * Zero-width character ranges (Unicode 17.0).
- * Mn (Nonspacing Mark), Me (Enclosing Mark), Cf (Format).
- * Sorted by start codepoint for binary search.
+ * Display-column index for long lines. The text is cut into segments of
+ * about 'interval' bytes at grapheme cluster boundaries, and the segment
+ * sizes are kept in a Fenwick tree in caller-provided storage. Lookups and
+ * edits touch O(log n) tree nodes plus the segments near the position.
+ * Columns are measured as utflite_string_width() does.
+ * Treat the fields as read-only; use the functions below to change them.
  */
-static const struct utflite__unicode_range UTFLITE__ZERO_WIDTH_RANGES[] = {
-    {0x0300, 0x036F},
-    {0x0483, 0x0489},
-    {0x0591, 0x05BD},
-    {0x05BF, 0x05BF},
-    {0x05C1, 0x05C2},
-    {0x05C4, 0x05C5},
-    {0x05C7, 0x05C7},
-    {0x0600, 0x0605},
-    {0x0610, 0x061A},
-    {0x061C, 0x061C},
-    {0x064B, 0x065F},
-    {0x0670, 0x0670},
-    {0x06D6, 0x06DD},
-    {0x06DF, 0x06E4},
-    {0x06E7, 0x06E8},
-    {0x06EA, 0x06ED},
-    {0x070F, 0x070F},
-    {0x0711, 0x0711},
-    {0x0730, 0x074A},
-    {0x07A6, 0x07B0},
-    {0x07EB, 0x07F3},
-    {0x07FD, 0x07FD},
-    {0x0816, 0x0819},
-    {0x081B, 0x0823},
-    {0x0825, 0x0827},
-    {0x0829, 0x082D},
-    {0x0859, 0x085B},
-    {0x0890, 0x0891},
-    {0x0897, 0x089F},
-    {0x08CA, 0x0902},
-    {0x093A, 0x093A},
-    {0x093C, 0x093C},
-    {0x0941, 0x0948},
-    {0x094D, 0x094D},
-    {0x0951, 0x0957},
-    {0x0962, 0x0963},
-    {0x0981, 0x0981},
-    {0x09BC, 0x09BC},
-    {0x09C1, 0x09C4},
-    {0x09CD, 0x09CD},
-    {0x09E2, 0x09E3},
-    {0x09FE, 0x09FE},
-    {0x0A01, 0x0A02},
-    {0x0A3C, 0x0A3C},
-    {0x0A41, 0x0A42},
-    {0x0A47, 0x0A48},
-    {0x0A4B, 0x0A4D},
-    {0x0A51, 0x0A51},
-    {0x0A70, 0x0A71},
-    {0x0A75, 0x0A75},
-    {0x0A81, 0x0A82},
-    {0x0ABC, 0x0ABC},
-    {0x0AC1, 0x0AC5},
-    {0x0AC7, 0x0AC8},
-    {0x0ACD, 0x0ACD},
-    {0x0AE2, 0x0AE3},
-    {0x0AFA, 0x0AFF},
-    {0x0B01, 0x0B01},
-    {0x0B3C, 0x0B3C},
-    {0x0B3F, 0x0B3F},
-    {0x0B41, 0x0B44},
-    {0x0B4D, 0x0B4D},
-    {0x0B55, 0x0B56},
-    {0x0B62, 0x0B63},
-    {0x0B82, 0x0B82},
-    {0x0BC0, 0x0BC0},
-    {0x0BCD, 0x0BCD},
-    {0x0C00, 0x0C00},
-    {0x0C04, 0x0C04},
-    {0x0C3C, 0x0C3C},
-    {0x0C3E, 0x0C40},
-    {0x0C46, 0x0C48},
-    {0x0C4A, 0x0C4D},
-    {0x0C55, 0x0C56},
-    {0x0C62, 0x0C63},
-    {0x0C81, 0x0C81},
-    {0x0CBC, 0x0CBC},
-    {0x0CBF, 0x0CBF},
-    {0x0CC6, 0x0CC6},
-    {0x0CCC, 0x0CCD},
-    {0x0CE2, 0x0CE3},
-    {0x0D00, 0x0D01},
-    {0x0D3B, 0x0D3C},
-    {0x0D41, 0x0D44},
-    {0x0D4D, 0x0D4D},
-    {0x0D62, 0x0D63},
-    {0x0D81, 0x0D81},
-    {0x0DCA, 0x0DCA},
-    {0x0DD2, 0x0DD4},
-    {0x0DD6, 0x0DD6},
-    {0x0E31, 0x0E31},
-    {0x0E34, 0x0E3A},
-    {0x0E47, 0x0E4E},
-    {0x0EB1, 0x0EB1},
-    {0x0EB4, 0x0EBC},
-    {0x0EC8, 0x0ECE},
-    {0x0F18, 0x0F19},
-    {0x0F35, 0x0F35},
-    {0x0F37, 0x0F37},
-    {0x0F39, 0x0F39},
-    {0x0F71, 0x0F7E},
-    {0x0F80, 0x0F84},
-    {0x0F86, 0x0F87},
-    {0x0F8D, 0x0F97},
-    {0x0F99, 0x0FBC},
-    {0x0FC6, 0x0FC6},
-    {0x102D, 0x1030},
-    {0x1032, 0x1037},
-    {0x1039, 0x103A},
-    {0x103D, 0x103E},
-    {0x1058, 0x1059},
-    {0x105E, 0x1060},
-    {0x1071, 0x1074},
-    {0x1082, 0x1082},
-    {0x1085, 0x1086},
-    {0x108D, 0x108D},
-    {0x109D, 0x109D},
-    {0x135D, 0x135F},
+struct utflite_column_index {
+    /* Fenwick tree of segment sizes, in caller-provided storage. */
+    struct utflite_column_segment *tree;
+
+    /* Entries available in tree. */
+    int capacity;
+
+    /* Entries in use. */
+    int segment_count;
+
+    /* Target bytes per segment. */
+    int interval;
+
+    /* Byte length of the indexed text. */
+    int length;
+
+    /* Display width of the indexed text. */
+    int width;
+};
+
+/*
+ * Returns the number of segments that always suffices for a string of
+ * 'length' bytes sampled every 'interval' bytes.
+ */
+int utflite_column_index_capacity(int length, int interval);
+
+/*
+ * Builds a column index over a string (typically one line).
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned segment array; must outlive the index
+ *   capacity - Number of entries in storage
+ *   interval - Bytes between samples (UTFLITE_COLUMN_INDEX_INTERVAL)
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid or storage is too small.
+ */
+int utflite_column_index_build(struct utflite_column_index *index, struct utflite_column_segment *storage, int capacity, int interval, const char *text, int length);
+
+/*
+ * Updates an index after bytes [edit_start, old_end) of the indexed text
+ * were replaced by bytes [edit_start, new_end) of 'text'. Only the segments
+ * around the edit are rescanned; later ones keep their sizes. When an edit
+ * leaves one segment much longer than 'interval', the index is rebuilt.
+ *
+ * Returns:
+ *   1 on success. 0 if the arguments do not describe an edit of the indexed
+ *   text or a needed rebuild ran out of storage.
+ */
+int utflite_column_index_update(struct utflite_column_index *index, const char *text, int length, int edit_start, int old_end, int new_end);
+
+/*
+ * Returns the display width of text[0, byte_offset), with byte_offset
+ * rounded down to the start of its codepoint and clamped to the text.
+ */
+int utflite_column_index_to_column(const struct utflite_column_index *index, const char *text, int byte_offset);
+
+/*
+ * Finds the last grapheme cluster boundary whose preceding text fits in
+ * 'column' display columns. Use it to find where to start drawing when
+ * scrolled horizontally, or where to cut a line.
+ *
+ * Returns:
+ *   Byte offset of that boundary, or the text length if everything fits.
+ */
+int utflite_column_index_to_offset(const struct utflite_column_index *index, const char *text, int column);
+
+/* ============================================================================
+ * Line Index
+ * ============================================================================ */
+
+/*
+ * Counts lines, ending each at LF, CR or CRLF. Text that ends with a line
+ * break has an empty last line after it, so "a\n" has 2 lines and "" has 1.
+ */
+int utflite_line_count(const char *text, int length);
+
+/*
+ * Byte offsets where each line starts, kept in caller-provided storage.
+ * The array has a gap at the last edit, and the offsets after the gap are
+ * stored relative to a shared delta, so an edit only touches the entries
+ * between it and the previous edit. Treat the fields as read-only; use the
+ * functions below to read and change them.
+ */
+struct utflite_line_index {
+    /* Line start offsets, in caller-provided storage. */
+    int *starts;
+
+    /* Entries available in starts. */
+    int capacity;
+
+    /* Lines in the indexed text (at least 1). */
+    int line_count;
+
+    /* Entries [gap_start, gap_end) of starts are unused. */
+    int gap_start;
+    int gap_end;
+
+    /* Added to the offsets stored after the gap. */
+    int delta;
+
+    /* Byte length of the indexed text. */
+    int length;
+};
+
+/*
+ * Builds a line index over a string.
+ *
+ * Parameters:
+ *   index    - Index to initialize
+ *   storage  - Caller-owned array; must outlive the index. Leave room
+ *              beyond utflite_line_count() for lines added by edits.
+ *   capacity - Number of ints in storage
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid or storage is too small.
+ */
+int utflite_line_index_build(struct utflite_line_index *index, int *storage, int capacity, const char *text, int length);
+
+/*
+ * Updates an index after bytes [edit_start, old_end) of the indexed text
+ * were replaced by bytes [edit_start, new_end) of 'text'. Only the new
+ * bytes (and one on each side, for CRLF pairs) are scanned.
+ *
+ * Returns:
+ *   1 on success. 0 if the arguments do not describe an edit of the indexed
+ *   text or storage ran out; the index must then be rebuilt.
+ */
+int utflite_line_index_update(struct utflite_line_index *index, const char *text, int length, int edit_start, int old_end, int new_end);
+
+/*
+ * Returns the byte offset where a line (0-based) starts, or the text
+ * length if line is past the last line.
+ */
+int utflite_line_index_start(const struct utflite_line_index *index, int line);
+
+/*
+ * Returns the 0-based line containing byte_offset, in O(log n). Offsets
+ * past the end belong to the last line.
+ */
+int utflite_line_index_find(const struct utflite_line_index *index, int byte_offset);
+
+/* ============================================================================
+ * Rope
+ * ============================================================================ */
+
+/*
+ * A text buffer for large documents, stored as a balanced tree of chunks
+ * of about a kilobyte. Every node caches the byte, codepoint, grapheme
+ * cluster, column and line break totals of its subtree, so edits and
+ * conversions between these units take O(log n) time however big the
+ * text gets. Chunks never split a codepoint. Unlike the rest of the
+ * library, a rope allocates its own memory with malloc().
+ */
+struct utflite_rope;
+
+/* Totals for the whole text held by a rope. */
+struct utflite_rope_metrics {
+    /* Length of the text in bytes. */
+    int bytes;
+
+    /* Lead bytes, as counted by utflite_codepoint_index. */
+    int codepoints;
+
+    /* Grapheme clusters. */
+    int graphemes;
+
+    /* Display width, as utflite_string_width(). */
+    int columns;
+
+    /* Lines, as utflite_line_count() counts them. */
+    int lines;
+};
+
+/* Units that rope offsets can be converted to and from. */
+enum utflite_rope_metric {
+    UTFLITE_ROPE_CODEPOINTS,
+    UTFLITE_ROPE_GRAPHEMES,
+    UTFLITE_ROPE_COLUMNS,
+    UTFLITE_ROPE_LINES
+};
+
+/*
+ * Creates a rope holding a copy of a string.
+ *
+ * Returns:
+ *   The new rope, or NULL if an argument is invalid or memory ran out.
+ *   Free it with utflite_rope_destroy().
+ */
+struct utflite_rope *utflite_rope_create(const char *text, int length);
+
+/* Frees a rope and all of its chunks. Accepts NULL. */
+void utflite_rope_destroy(struct utflite_rope *rope);
+
+/*
+ * Replaces bytes [start, end) of a rope with a copy of 'text'. Only the
+ * chunks around the edit are rebuilt; the rest of the tree is shared.
+ *
+ * Parameters:
+ *   rope   - Rope to edit
+ *   start  - First byte to replace
+ *   end    - End of the replaced range (start == end inserts)
+ *   text   - Replacement bytes (may be NULL when length is 0)
+ *   length - Number of replacement bytes (0 deletes)
+ *
+ * Returns:
+ *   1 on success. 0 if an argument is invalid or memory ran out, in which
+ *   case the rope is unchanged.
+ */
+int utflite_rope_replace(struct utflite_rope *rope, int start, int end, const char *text, int length);
+
+/* Returns the number of bytes in a rope. */
+int utflite_rope_length(const struct utflite_rope *rope);
+
+/* Reads the totals for the whole rope in O(1). */
+void utflite_rope_get_metrics(const struct utflite_rope *rope, struct utflite_rope_metrics *metrics);
+
+/*
+ * Converts a position in some unit to a byte offset, in O(log n).
+ *
+ * Returns:
+ *   For codepoints and graphemes, where unit number 'value' (0-based)
+ *   starts. For lines, where line 'value' starts. For columns, the last
+ *   grapheme cluster boundary whose preceding text fits in 'value'
+ *   columns, like utflite_column_index_to_offset(). The rope length if
+ *   'value' is past the end.
+ */
+int utflite_rope_to_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int value);
+
+/*
+ * Converts a byte offset to a position in some unit, in O(log n).
+ *
+ * Returns:
+ *   For codepoints, graphemes and lines, the 0-based unit containing
+ *   byte_offset, or the unit count (last line) at or past the end. For
+ *   columns, the display width of the text before byte_offset, rounded
+ *   down to the start of its codepoint.
+ */
+int utflite_rope_from_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int byte_offset);
+
+/*
+ * Copies bytes [start, end) of a rope into 'buffer', which must have room
+ * for end - start bytes. The range is clamped to the rope.
+ *
+ * Returns:
+ *   Number of bytes copied.
+ */
+int utflite_rope_copy(const struct utflite_rope *rope, int start, int end, char *buffer);
+
+/*
+ * Gives direct access to the chunk holding byte 'offset', for iterating
+ * over the text without copying. The pointer is valid until the next edit.
+ *
+ * Returns:
+ *   Pointer to byte 'offset', with the bytes left in its chunk stored in
+ *   *chunk_length. NULL (and 0) if offset is outside the rope.
+ */
+const char *utflite_rope_chunk(const struct utflite_rope *rope, int offset, int *chunk_length);
+
+/* ============================================================================
+ * Gap Buffer
+ * ============================================================================ */
+
+/*
+ * Per-line cache entry of a gap buffer. The caller provides an array of
+ * these; read lines through utflite_gap_buffer_line().
+ */
+struct utflite_gap_line {
+    /* Start of the line: absolute before the gap, distance from the end
+     * after it. */
+    int start;
+
+    /* Codepoints in the line; -1 until measured. */
+    int codepoints;
+
+    /* Display width of the line, once codepoints is measured. */
+    int columns;
+};
+
+/*
+ * An editable text buffer in caller-provided storage, for small or
+ * embedded editors. The free space (the gap) sits at the last edit, so
+ * typing only touches the bytes and line entries around the cursor. The
+ * line table has a matching gap, and lines after it are stored relative
+ * to the end of the text, so no entry needs adjusting when text before it
+ * grows. Line widths and codepoint counts are measured when first asked
+ * for after an edit. The gap never splits a codepoint, and the grapheme
+ * segmentation state at the gap is kept for cluster-wise cursor movement.
+ * Treat the fields as read-only.
+ */
+struct utflite_gap_buffer {
+    /* Text before the gap, the gap, then the rest of the text. */
+    char *text;
+
+    /* Bytes available in text. */
+    int capacity;
+
+    /* Bytes [gap_start, gap_end) of text are the gap. */
+    int gap_start;
+    int gap_end;
+
+    /* Caller-provided line entries and how many there are. */
+    struct utflite_gap_line *lines;
+    int line_capacity;
+
+    /* Entries [0, line_gap_start) hold the lines starting at or before
+     * gap_start. */
+    int line_gap_start;
+
+    /* Entries [line_gap_end, line_capacity) hold the later lines. */
+    int line_gap_end;
+
+    /* Grapheme segmentation state at gap_start. */
+    uint8_t grapheme_state;
+
+    /* Start of the cluster before the gap; -1 if stale. */
+    int grapheme_start;
+};
+
+/* What utflite_gap_buffer_line() reports about a line. */
+struct utflite_gap_line_metrics {
+    /* Byte offset of the line. */
+    int start;
+
+    /* Length including the line break. */
+    int bytes;
+
+    /* Codepoints, not counting the line break. */
+    int codepoints;
+
+    /* Display width, as utflite_string_width(). */
+    int columns;
+};
+
+/*
+ * Initializes an empty gap buffer. Load the initial text with
+ * utflite_gap_buffer_replace(buffer, 0, 0, text, length).
+ *
+ * Parameters:
+ *   buffer        - Buffer to initialize
+ *   storage       - Caller-owned bytes; capacity bounds the text length
+ *   capacity      - Number of bytes in storage
+ *   lines         - Caller-owned line entries; line_capacity bounds the
+ *                   number of lines
+ *   line_capacity - Number of entries in lines
+ *
+ * Returns:
+ *   1 on success, 0 if an argument is invalid.
+ */
+int utflite_gap_buffer_init(struct utflite_gap_buffer *buffer, char *storage, int capacity, struct utflite_gap_line *lines, int line_capacity);
+
+/* Returns the number of bytes of text in a gap buffer. */
+int utflite_gap_buffer_length(const struct utflite_gap_buffer *buffer);
+
+/* Returns the number of lines, as utflite_line_count() would count them. */
+int utflite_gap_buffer_line_count(const struct utflite_gap_buffer *buffer);
+
+/*
+ * Replaces bytes [start, end) with 'text' and leaves the gap after the
+ * new text. Offsets inside a codepoint are moved back to its start. Only
+ * the lines around the edit are rescanned, so the cost depends on the
+ * edit and the lines it touches, not on the size of the buffer.
+ *
+ * Returns:
+ *   1 on success. 0 if an argument is invalid or the text or line storage
+ *   is full, in which case the text is unchanged.
+ */
+int utflite_gap_buffer_replace(struct utflite_gap_buffer *buffer, int start, int end, const char *text, int length);
+
+/*
+ * Moves the gap (the cursor) to 'offset', moved back to the start of its
+ * codepoint. Costs time proportional to the distance moved.
+ *
+ * Returns:
+ *   The new gap position.
+ */
+int utflite_gap_buffer_move_gap(struct utflite_gap_buffer *buffer, int offset);
+
+/*
+ * Returns where the grapheme cluster before the gap starts (the target of
+ * a backspace), or 0 at the start of the text. Uses the state kept at the
+ * gap; after a backward move it is rebuilt from the start of the line.
+ */
+int utflite_gap_buffer_prev_grapheme(struct utflite_gap_buffer *buffer);
+
+/*
+ * Returns where the grapheme cluster after the gap ends, or the text
+ * length at the end of the text.
+ */
+int utflite_gap_buffer_next_grapheme(struct utflite_gap_buffer *buffer);
+
+/* Returns the 0-based line containing byte_offset, in O(log n). */
+int utflite_gap_buffer_find_line(const struct utflite_gap_buffer *buffer, int byte_offset);
+
+/*
+ * Reports where a line is and how wide it is, measuring it first if it
+ * changed since it was last measured.
+ *
+ * Returns:
+ *   1 on success, 0 if the line does not exist.
+ */
+int utflite_gap_buffer_line(struct utflite_gap_buffer *buffer, int line, struct utflite_gap_line_metrics *metrics);
+
+/*
+ * Copies bytes [start, end) of the text into 'out', joining the pieces on
+ * either side of the gap. The range is clamped to the text.
+ *
+ * Returns:
+ *   Number of bytes copied.
+ */
+int utflite_gap_buffer_copy(const struct utflite_gap_buffer *buffer, int start, int end, char *out);
+
+/* ============================================================================
+ * Cursor
+ * ============================================================================ */
+
+/*
+ * A caret in a line editor, kept on a grapheme cluster boundary with its
+ * position in every unit an editor needs. Moves and edits near the cursor
+ * only measure the clusters they touch, so their cost does not depend on
+ * how far along the line the cursor is. Columns are counted per cluster,
+ * as utflite_string_width_mode() does with UTFLITE_WIDTH_GRAPHEMES. Zero
+ * it to start at the beginning of the text.
+ */
+struct utflite_cursor {
+    /* Byte offset. */
+    int offset;
+
+    /* Codepoints before offset. */
+    int codepoint;
+
+    /* Grapheme clusters before offset. */
+    int grapheme;
+
+    /* Display columns before offset. */
+    int column;
+};
+
+/*
+ * Moves a cursor past the next grapheme cluster.
+ *
+ * Returns:
+ *   1 if it moved, 0 at the end of the text.
+ */
+int utflite_cursor_next(struct utflite_cursor *cursor, const char *text, int length);
+
+/*
+ * Moves a cursor back to the start of the previous grapheme cluster.
+ *
+ * Returns:
+ *   1 if it moved, 0 at the start of the text.
+ */
+int utflite_cursor_prev(struct utflite_cursor *cursor, const char *text);
+
+/*
+ * Updates a cursor after bytes [edit_start, old_end) of the text were
+ * replaced by bytes [edit_start, new_end) of 'text'. A cursor before the
+ * edit stays put, one after it moves with the text that follows (so text
+ * inserted at the cursor ends up before it), and one inside a replaced
+ * range moves to the end of the replacement. It is then moved forward to
+ * a cluster boundary, in case the edit joined text to the cluster before
+ * it.
+ *
+ * Only the clusters around the edit are measured, as long as the edit
+ * starts at or after the cursor. For an edit that starts before it, the
+ * text from the start is measured again; to delete the cluster before the
+ * cursor, move it back with utflite_cursor_prev() first.
+ *
+ * Parameters:
+ *   cursor     - Cursor into the text before the edit
+ *   text       - UTF-8 string after the edit
+ *   length     - Number of bytes in text after the edit
+ *   edit_start - First byte that changed
+ *   old_end    - End of the replaced range, in the old text
+ *   new_end    - End of the replacement, in the new text
+ *
+ * Returns:
+ *   1 on success, 0 if the arguments do not describe an edit or the
+ *   cursor would move past the end of the text (it is left unchanged).
+ */
+int utflite_cursor_update(struct utflite_cursor *cursor, const char *text, int length, int edit_start, int old_end, int new_end);
+
+/* ============================================================================
+ * Utility Functions
+ * ============================================================================ */
+
+/*
+ * Validates a UTF-8 string.
+ *
+ * Parameters:
+ *   text         - UTF-8 string to validate
+ *   length       - Number of bytes in string
+ *   error_offset - Optional: set to byte offset of first invalid sequence
+ *
+ * Returns:
+ *   1 if valid UTF-8, 0 if invalid.
+ */
+int utflite_validate(const char *text, int length, int *error_offset);
+
+/*
+ * Counts the number of Unicode codepoints in a UTF-8 string.
+ *
+ * Returns:
+ *   Number of codepoints (not bytes, not graphemes).
+ */
+int utflite_codepoint_count(const char *text, int length);
+
+/*
+ * Calculates display width of a UTF-8 string.
+ *
+ * Returns:
+ *   Total display columns needed. Control characters count as 0.
+ */
+int utflite_string_width(const char *text, int length);
+
+/*
+ * Calculates display width of a UTF-8 string, choosing whether widths are
+ * taken per codepoint or per grapheme cluster. In grapheme mode each
+ * codepoint is decoded and looked up once, for both segmentation and width.
+ *
+ * Returns:
+ *   Total display columns needed. Control characters count as 0.
+ */
+int utflite_string_width_mode(const char *text, int length, enum utflite_width_mode mode);
+
+/*
+ * Checks if a codepoint is zero-width (combining marks, format chars, ZWJ, etc).
+ *
+ * Returns:
+ *   1 if codepoint is zero-width, 0 otherwise.
+ */
+int utflite_is_zero_width(uint32_t codepoint);
+
+/*
+ * Checks if a codepoint is double-width (CJK, emoji, etc).
+ *
+ * Returns:
+ *   1 if codepoint is double-width, 0 otherwise.
+ */
+int utflite_is_wide(uint32_t codepoint);
+
+/*
+ * Finds byte offset to truncate string at a maximum display width.
+ *
+ * Parameters:
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *   max_cols - Maximum display columns
+ *
+ * Returns:
+ *   Byte offset where string should be truncated to fit within max_cols.
+ *   Returns length if string already fits.
+ */
+int utflite_truncate(const char *text, int length, int max_cols);
+
+/*
+ * Finds the byte offset to truncate a string at a maximum display width
+ * without splitting a grapheme cluster. Clusters are segmented and measured
+ * in the same pass, each as wide as utflite_grapheme_width() reports, so a
+ * combining mark stays with its base and a flag or ZWJ sequence is kept or
+ * dropped whole.
+ *
+ * Parameters:
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *   max_cols - Maximum display columns
+ *   width    - Receives the display width of text before the returned
+ *              offset (may be NULL)
+ *
+ * Returns:
+ *   Byte offset of the last cluster boundary that fits within max_cols.
+ *   Returns length if string already fits.
+ */
+int utflite_truncate_graphemes(const char *text, int length, int max_cols, int *width);
+
+/* Where utflite_truncate_ellipsis() drops text and writes the ellipsis. */
+enum utflite_ellipsis_mode {
+    /* Keep the start: "prefix..." */
+    UTFLITE_ELLIPSIS_END,
+
+    /* Keep the end: "...suffix" */
+    UTFLITE_ELLIPSIS_START,
+
+    /* Keep both ends: "pre...fix" */
+    UTFLITE_ELLIPSIS_MIDDLE
+};
+
+/*
+ * Truncates a string to a maximum display width, marking the dropped text
+ * with an ellipsis (U+2026, one column), and writes the result into
+ * 'buffer'. Text that already fits is copied unchanged. The kept start is
+ * found with a forward scan and the kept end with a backward scan, both
+ * bounded by max_cols, so a long string is never measured in full. Cuts
+ * fall on grapheme cluster boundaries.
+ *
+ * Parameters:
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *   max_cols - Maximum display columns, ellipsis included
+ *   mode     - Which part of the text to drop
+ *   buffer   - Receives the result; needs room for length + 3 bytes. It is
+ *              not NUL-terminated.
+ *   width    - Receives the display width of the result (may be NULL)
+ *
+ * Returns:
+ *   Number of bytes written. Nothing is written when the text does not fit
+ *   and max_cols has no room for the ellipsis.
+ */
+int utflite_truncate_ellipsis(const char *text, int length, int max_cols, enum utflite_ellipsis_mode mode, char *buffer, int *width);
+
+/* How utflite_pad() places text within its cell. */
+enum utflite_align {
+    /* Padding after the text. */
+    UTFLITE_ALIGN_LEFT,
+
+    /* Padding before the text. */
+    UTFLITE_ALIGN_RIGHT,
+
+    /* Padding split, the odd column after. */
+    UTFLITE_ALIGN_CENTER
+};
+
+/* A piece of UTF-8 text that need not be NUL-terminated. */
+struct utflite_span {
+    const char *text;
+    int length;
+};
+
+/*
+ * Writes text into 'buffer' as a cell exactly 'cols' columns wide: text
+ * that is too wide is cut at a grapheme cluster boundary, and the rest of
+ * the cell is filled with spaces. The text is measured and cut in a
+ * single pass.
+ *
+ * Parameters:
+ *   text   - UTF-8 string
+ *   length - Number of bytes in string
+ *   cols   - Cell width in display columns
+ *   align  - Where the padding goes
+ *   buffer - Receives the cell; needs room for length + cols bytes. It is
+ *            not NUL-terminated.
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_pad(const char *text, int length, int cols, enum utflite_align align, char *buffer);
+
+/*
+ * Lays out a table row: each cell is padded as utflite_pad() does, and
+ * cells are joined with 'separator'.
+ *
+ * Parameters:
+ *   cells     - Text of each cell
+ *   cols      - Width of each cell in display columns
+ *   aligns    - Alignment of each cell, or NULL to align all left
+ *   count     - Number of cells
+ *   separator - NUL-terminated text written between cells (may be NULL)
+ *   buffer    - Receives the row; needs room for each cell's length plus
+ *               its width, and count - 1 separators. It is not
+ *               NUL-terminated.
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_pad_row(const struct utflite_span *cells, const int *cols, const enum utflite_align *aligns, int count, const char *separator, char *buffer);
+
+/*
+ * Measures a table of cells given in row-major order, reporting each cell's
+ * width and the widest cell of each column. Runs of printable ASCII are
+ * counted a 64-bit word at a time; the rest of a cell is measured as
+ * utflite_string_width_mode() does.
+ *
+ * Parameters:
+ *   cells         - rows * columns cells, row by row
+ *   rows          - Number of rows
+ *   columns       - Number of cells per row
+ *   mode          - Per-codepoint or per-cluster widths
+ *   cell_widths   - Receives rows * columns widths (may be NULL)
+ *   column_widths - Receives 'columns' maxima
+ *
+ * Returns:
+ *   Sum of the column maxima.
+ */
+int utflite_column_widths(const struct utflite_span *cells, int rows, int columns, enum utflite_width_mode mode, int *cell_widths, int *column_widths);
+
+/*
+ * Calculates the display width of a line that starts at column 'start_col',
+ * expanding each TAB to the next multiple of 'tab_size' columns. Widths are
+ * taken per grapheme cluster, as utflite_grapheme_width() reports.
+ *
+ * Parameters:
+ *   text      - UTF-8 string
+ *   length    - Number of bytes in string
+ *   tab_size  - Columns between tab stops; below 1, TAB counts as 0
+ *   start_col - Column of the first byte (0 or more)
+ *
+ * Returns:
+ *   Columns the text advances past start_col.
+ */
+int utflite_string_width_tabs(const char *text, int length, int tab_size, int start_col);
+
+/*
+ * Finds the last grapheme cluster boundary whose preceding text fits in
+ * max_cols columns, with tabs expanded as utflite_string_width_tabs()
+ * does. To find the offset at an absolute column, pass
+ * max_cols = column - start_col.
+ *
+ * Parameters:
+ *   text      - UTF-8 string
+ *   length    - Number of bytes in string
+ *   max_cols  - Maximum display columns after start_col
+ *   tab_size  - Columns between tab stops; below 1, TAB counts as 0
+ *   start_col - Column of the first byte (0 or more)
+ *   width     - Receives the width of text before the returned offset
+ *               (may be NULL)
+ *
+ * Returns:
+ *   Byte offset of that boundary, or length if the text fits.
+ */
+int utflite_truncate_tabs(const char *text, int length, int max_cols, int tab_size, int start_col, int *width);
+
+/*
+ * Returns the display column of byte_offset, with tabs expanded as
+ * utflite_string_width_tabs() does. byte_offset is clamped to the text and
+ * rounded down to the start of its grapheme cluster.
+ */
+int utflite_offset_to_column_tabs(const char *text, int length, int byte_offset, int tab_size, int start_col);
+
+/*
+ * One terminal cell filled by utflite_fill_cells(). The cell holding a
+ * cluster points at its bytes in the line, and a wide cluster is followed
+ * by a spacer. Blank cells stand for columns of a tab, or of a wide
+ * cluster cut by the viewport edge.
+ */
+struct utflite_cell {
+    /* Byte offset of the cluster the cell belongs to. */
+    int offset;
+
+    /* Bytes of the cluster to draw; 0 for spacers and blanks. */
+    int length;
+
+    /* Columns drawn: 1 or 2; 0 for the spacer after a wide cell. */
+    int width;
+};
+
+/*
+ * Lays out the visible part of a line as terminal cells in one pass:
+ * grapheme clusters are segmented, measured and placed together, and the
+ * walk stops at the right edge of the viewport. Zero-width clusters and
+ * controls take no cell.
+ *
+ * Parameters:
+ *   text      - UTF-8 line
+ *   length    - Number of bytes in line
+ *   first_col - First column of the viewport (0 or more)
+ *   col_count - Number of columns in the viewport
+ *   tab_size  - Columns between tab stops; below 1, TAB takes no cell
+ *   cells     - Receives one entry per column; needs col_count entries
+ *
+ * Returns:
+ *   Number of cells filled: col_count, or fewer if the line ends first.
+ */
+int utflite_fill_cells(const char *text, int length, int first_col, int col_count, int tab_size, struct utflite_cell *cells);
+
+/*
+ * Compares two versions of a line and finds the display columns a terminal
+ * must redraw. The common prefix and suffix are skipped a word at a time
+ * before any decoding; then only the clusters in between are segmented
+ * and measured. The range starts and ends on grapheme cluster boundaries
+ * of both lines, so a wide character is never split. When the change
+ * shifts the common suffix, the range runs to the end of the longer line.
+ *
+ * Parameters:
+ *   old_text   - Previous line
+ *   old_length - Number of bytes in old_text
+ *   new_text   - Next line
+ *   new_length - Number of bytes in new_text
+ *   first_col  - Receives the first column that differs
+ *   end_col    - Receives the column after the last one that differs
+ *
+ * Returns:
+ *   1 if the lines differ, 0 if they are identical (both columns are 0).
+ */
+int utflite_line_damage(const char *old_text, int old_length, const char *new_text, int new_length, int *first_col, int *end_col);
+
+/* Where a window of columns falls in a line; see utflite_slice_columns(). */
+struct utflite_column_slice {
+    /* First byte to draw. */
+    int start;
+
+    /* Byte after the last one to draw. */
+    int end;
+
+    /* Blank columns for a wide cluster cut by the left edge, or 0. */
+    int left_padding;
+
+    /* Blank columns for a wide cluster cut by the right edge, or 0. */
+    int right_padding;
+};
+
+/*
+ * Finds the bytes of a line that show in columns [first_col, end_col), for
+ * horizontal scrolling, in one walk over the clusters before end_col.
+ * Clusters are measured as utflite_grapheme_width() does, and the range
+ * holds only clusters that fit the window entirely. A wide cluster cut by
+ * either edge is left out, and the columns of it that fall inside the
+ * window are reported as padding.
+ *
+ * Parameters:
+ *   text      - UTF-8 line
+ *   length    - Number of bytes in line
+ *   first_col - First column of the window (0 or more)
+ *   end_col   - Column after the window
+ *   slice     - Receives the byte range and padding
+ *
+ * Returns:
+ *   Display width of text[start, end). With the padding it fills the
+ *   window, unless the line ends inside it.
+ */
+int utflite_slice_columns(const char *text, int length, int first_col, int end_col, struct utflite_column_slice *slice);
+
+/*
+ * Finds the grapheme cluster that covers a display column, for moving a
+ * cursor up or down to a sticky column. Clusters are measured as
+ * utflite_grapheme_width() does. Lines that start with printable ASCII are
+ * answered from the bytes alone, a word at a time.
+ *
+ * Parameters:
+ *   text           - UTF-8 line
+ *   length         - Number of bytes in line
+ *   column         - Target display column (0 or more)
+ *   cluster_column - Receives the column where the returned cluster starts
+ *                    (may be NULL)
+ *   inside         - Receives 1 if 'column' falls inside a wide cluster
+ *                    that starts before it, else 0 (may be NULL)
+ *
+ * Returns:
+ *   Byte offset of the cluster covering 'column', or the length of the
+ *   line if it is narrower than that (*cluster_column is then its width).
+ */
+int utflite_column_seek(const char *text, int length, int column, int *cluster_column, int *inside);
+
+/*
+ * Converts many byte offsets into one line at once, in a single forward
+ * pass, for syntax highlighting spans and diagnostics. Each offset gets
+ * its codepoint index, UTF-16 code unit offset and display column (as
+ * utflite_string_width() counts it). An offset inside a multibyte
+ * sequence is rounded down to the start of it, and offsets past the end
+ * are clamped. Runs of printable ASCII are skipped a word at a time.
+ *
+ * Parameters:
+ *   text         - UTF-8 line
+ *   length       - Number of bytes in line
+ *   byte_offsets - Offsets to convert, in nondecreasing order
+ *   count        - Number of offsets
+ *   codepoints   - Receives each offset's codepoint index (may be NULL)
+ *   utf16        - Receives each offset's UTF-16 offset (may be NULL)
+ *   columns      - Receives each offset's display column (may be NULL)
+ *
+ * Returns:
+ *   Number of offsets converted: count, or the index of the first offset
+ *   that is smaller than the one before it.
+ */
+int utflite_convert_offsets(const char *text, int length, const int *byte_offsets, int count, int *codepoints, int *utf16, int *columns);
+
+/* ============================================================================
+ * ANSI Escape Sequences
+ * ============================================================================ */
+
+/*
+ * Returns the byte length of the escape sequence starting at 'offset', or 0
+ * if text[offset] is not ESC. CSI sequences (colors, cursor movement), OSC
+ * strings (titles, OSC 8 hyperlinks) ended by BEL or ST, DCS/SOS/PM/APC
+ * strings and two- or three-byte escapes are recognized. A sequence cut
+ * off by the end of the text runs to the end.
+ */
+int utflite_ansi_sequence_length(const char *text, int length, int offset);
+
+/*
+ * Calculates display width of a UTF-8 string, skipping escape sequences.
+ * Widths are taken per grapheme cluster, as utflite_grapheme_width()
+ * reports.
+ *
+ * Returns:
+ *   Total display columns needed. Control characters count as 0.
+ */
+int utflite_string_width_ansi(const char *text, int length);
+
+/*
+ * Truncates a string to a maximum display width, skipping escape sequences
+ * while measuring, and writes the result into 'buffer'. Visible text is cut
+ * at a grapheme cluster boundary, but escape sequences after the cut are
+ * still copied, so color resets and hyperlink ends are not lost.
+ *
+ * Parameters:
+ *   text     - UTF-8 string
+ *   length   - Number of bytes in string
+ *   max_cols - Maximum display columns
+ *   buffer   - Receives the result; needs room for length bytes. It is not
+ *              NUL-terminated.
+ *   width    - Receives the display width of the result (may be NULL)
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_truncate_ansi(const char *text, int length, int max_cols, char *buffer, int *width);
+
+/*
+ * Copies a string into 'buffer' without its escape sequences. 'buffer'
+ * needs room for length bytes and may be 'text' itself.
+ *
+ * Returns:
+ *   Number of bytes written.
+ */
+int utflite_strip_ansi(const char *text, int length, char *buffer);
+
+/* ============================================================================
+ * Terminal Output
+ * ============================================================================ */
+
+/*
+ * What utflite_print_run() carries from one read to the next: the grapheme
+ * segmentation state after the last codepoint, the width of the cluster it
+ * belongs to, and the bytes of a UTF-8 sequence the read cut off. Zero it
+ * before the first call.
+ */
+struct utflite_print_state {
+    uint8_t grapheme_state;
+    int cluster_width;
+    int pending_length;
+    char pending[UTFLITE_MAX_BYTES];
+};
+
+/*
+ * One grapheme cluster printed by utflite_print_run(). Its first codepoint
+ * is decoded; the rest (combining marks, emoji joined by ZWJ, ...) are left
+ * as UTF-8 in the input.
+ */
+struct utflite_print_cell {
+    /* First codepoint; U+FFFD for malformed bytes. */
+    uint32_t codepoint;
+
+    /* Where the other codepoints start in the input. */
+    int extra_offset;
+
+    /* Their length in bytes; 0 for a lone codepoint. */
+    int extra_length;
+
+    /* Columns of the whole cluster so far: 0, 1 or 2. */
+    int width;
+
+    /* Set when the cell extends the last cluster of the previous call. */
+    int joins_previous;
+};
+
+/*
+ * Decodes, segments and measures a run of printable terminal output in one
+ * pass, for the print path of a terminal emulator. The run ends before the
+ * first C0 control byte or DEL (including ESC), which the caller handles.
+ * Data may be split anywhere across calls: a UTF-8 sequence cut off at the
+ * end of 'data' is held in 'state', and a cluster left open may be extended
+ * by the next call (its first cell then has joins_previous set). C1
+ * controls, which take two bytes in UTF-8, are returned as cells of width 0.
+ *
+ * Parameters:
+ *   state         - Carry-over state; zeroed before the first call
+ *   data          - Bytes read from the terminal's input
+ *   length        - Number of bytes in data
+ *   cells         - Receives one entry per cluster
+ *   cell_capacity - Number of entries in cells (1 or more)
+ *   cell_count    - Receives the number of entries filled (required)
+ *
+ * Returns:
+ *   Number of bytes consumed: up to the first control byte, or where cells
+ *   ran out, or all of data. Bytes held in 'state' count as consumed.
+ */
+int utflite_print_run(struct utflite_print_state *state, const char *data, int length, struct utflite_print_cell *cells, int cell_capacity, int *cell_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTFLITE_H */
+
+/* ============================================================================
+ * IMPLEMENTATION
+ * ============================================================================ */
+
+#ifdef UTFLITE_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Range of Unicode codepoints, used for binary search in property tables. */
+struct utflite__unicode_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+/*
+ * Zero-width character ranges (Unicode 17.0).
+ * Mn (Nonspacing Mark), Me (Enclosing Mark), Cf (Format).
+ * Sorted by start codepoint for binary search.
+ */
+static const struct utflite__unicode_range UTFLITE__ZERO_WIDTH_RANGES[] = {
+    {0x0300, 0x036F},
+    {0x0483, 0x0489},
+    {0x0591, 0x05BD},
+    {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2},
+    {0x05C4, 0x05C5},
+    {0x05C7, 0x05C7},
+    {0x0600, 0x0605},
+    {0x0610, 0x061A},
+    {0x061C, 0x061C},
+    {0x064B, 0x065F},
+    {0x0670, 0x0670},
+    {0x06D6, 0x06DD},
+    {0x06DF, 0x06E4},
+    {0x06E7, 0x06E8},
+    {0x06EA, 0x06ED},
+    {0x070F, 0x070F},
+    {0x0711, 0x0711},
+    {0x0730, 0x074A},
+    {0x07A6, 0x07B0},
+    {0x07EB, 0x07F3},
+    {0x07FD, 0x07FD},
+    {0x0816, 0x0819},
+    {0x081B, 0x0823},
+    {0x0825, 0x0827},
+    {0x0829, 0x082D},
+    {0x0859, 0x085B},
+    {0x0890, 0x0891},
+    {0x0897, 0x089F},
+    {0x08CA, 0x0902},
+    {0x093A, 0x093A},
+    {0x093C, 0x093C},
+    {0x0941, 0x0948},
+    {0x094D, 0x094D},
+    {0x0951, 0x0957},
+    {0x0962, 0x0963},
+    {0x0981, 0x0981},
+    {0x09BC, 0x09BC},
+    {0x09C1, 0x09C4},
+    {0x09CD, 0x09CD},
+    {0x09E2, 0x09E3},
+    {0x09FE, 0x09FE},
+    {0x0A01, 0x0A02},
+    {0x0A3C, 0x0A3C},
+    {0x0A41, 0x0A42},
+    {0x0A47, 0x0A48},
+    {0x0A4B, 0x0A4D},
+    {0x0A51, 0x0A51},
+    {0x0A70, 0x0A71},
+    {0x0A75, 0x0A75},
+    {0x0A81, 0x0A82},
+    {0x0ABC, 0x0ABC},
+    {0x0AC1, 0x0AC5},
+    {0x0AC7, 0x0AC8},
+    {0x0ACD, 0x0ACD},
+    {0x0AE2, 0x0AE3},
+    {0x0AFA, 0x0AFF},
+    {0x0B01, 0x0B01},
+    {0x0B3C, 0x0B3C},
+    {0x0B3F, 0x0B3F},
+    {0x0B41, 0x0B44},
+    {0x0B4D, 0x0B4D},
+    {0x0B55, 0x0B56},
+    {0x0B62, 0x0B63},
+    {0x0B82, 0x0B82},
+    {0x0BC0, 0x0BC0},
+    {0x0BCD, 0x0BCD},
+    {0x0C00, 0x0C00},
+    {0x0C04, 0x0C04},
+    {0x0C3C, 0x0C3C},
+    {0x0C3E, 0x0C40},
+    {0x0C46, 0x0C48},
+    {0x0C4A, 0x0C4D},
+    {0x0C55, 0x0C56},
+    {0x0C62, 0x0C63},
+    {0x0C81, 0x0C81},
+    {0x0CBC, 0x0CBC},
+    {0x0CBF, 0x0CBF},
+    {0x0CC6, 0x0CC6},
+    {0x0CCC, 0x0CCD},
+    {0x0CE2, 0x0CE3},
+    {0x0D00, 0x0D01},
+    {0x0D3B, 0x0D3C},
+    {0x0D41, 0x0D44},
+    {0x0D4D, 0x0D4D},
+    {0x0D62, 0x0D63},
+    {0x0D81, 0x0D81},
+    {0x0DCA, 0x0DCA},
+    {0x0DD2, 0x0DD4},
+    {0x0DD6, 0x0DD6},
+    {0x0E31, 0x0E31},
+    {0x0E34, 0x0E3A},
+    {0x0E47, 0x0E4E},
+    {0x0EB1, 0x0EB1},
+    {0x0EB4, 0x0EBC},
+    {0x0EC8, 0x0ECE},
+    {0x0F18, 0x0F19},
+    {0x0F35, 0x0F35},
+    {0x0F37, 0x0F37},
+    {0x0F39, 0x0F39},
+    {0x0F71, 0x0F7E},
+    {0x0F80, 0x0F84},
+    {0x0F86, 0x0F87},
+    {0x0F8D, 0x0F97},
+    {0x0F99, 0x0FBC},
+    {0x0FC6, 0x0FC6},
+    {0x102D, 0x1030},
+    {0x1032, 0x1037},
+    {0x1039, 0x103A},
+    {0x103D, 0x103E},
+    {0x1058, 0x1059},
+    {0x105E, 0x1060},
+    {0x1071, 0x1074},
+    {0x1082, 0x1082},
+    {0x1085, 0x1086},
+    {0x108D, 0x108D},
+    {0x109D, 0x109D},
+    {0x135D, 0x135F},
     {0x1712, 0x1714},
     {0x1732, 0x1733},
     {0x1752, 0x1753},
@@ -842,11 +2102,121 @@ enum utflite__gcb_property {
 	UTFLITE__GCB_LVT
 };
 
+/* Number of Grapheme Cluster Break property values (rows/columns of the pair table). */
+#define UTFLITE__GCB_PROPERTY_COUNT 14
+
+/*
+ * Feature index layout for the grapheme automaton: the GCB property plus the
+ * extra bits GB11 (Extended_Pictographic) and GB9c (InCB) need, combined as
+ * gcb + GCB_PROPERTY_COUNT * (extpict + 2 * incb). The generated tables map
+ * each feature to the class (column) it uses in the automaton.
+ */
+#define UTFLITE__GRAPHEME_FEATURE_EXTENDED_PICTOGRAPHIC UTFLITE__GCB_PROPERTY_COUNT
+#define UTFLITE__GRAPHEME_FEATURE_INCB_CONSONANT (2 * UTFLITE__GCB_PROPERTY_COUNT)
+#define UTFLITE__GRAPHEME_FEATURE_INCB_LINKER (4 * UTFLITE__GCB_PROPERTY_COUNT)
+#define UTFLITE__GRAPHEME_FEATURE_COUNT (6 * UTFLITE__GCB_PROPERTY_COUNT)
+
+/* Codepoints below this are ASCII and have a precomputed grapheme class. */
+#define UTFLITE__ASCII_LIMIT 0x80
+
+/* Printable ASCII (space through tilde): always GCB Other, never ExtPict. */
+#define UTFLITE__ASCII_PRINTABLE_FIRST 0x20
+#define UTFLITE__ASCII_PRINTABLE_LAST 0x7E
+
+/* DEL, the one control byte above the printable ASCII range. */
+#define UTFLITE__ASCII_DEL 0x7F
+
+/* Line break bytes. */
+#define UTFLITE__ASCII_LF 0x0A
+#define UTFLITE__ASCII_CR 0x0D
+
+/* Horizontal tab, which the *_tabs functions expand to the next tab stop. */
+#define UTFLITE__ASCII_TAB 0x09
+
+/* Escape sequences (ECMA-48): ESC starts one, BEL or ESC '\' ends strings. */
+#define UTFLITE__ASCII_ESC 0x1B
+#define UTFLITE__ASCII_BEL 0x07
+#define UTFLITE__ANSI_CSI '['
+#define UTFLITE__ANSI_OSC ']'
+#define UTFLITE__ANSI_DCS 'P'
+#define UTFLITE__ANSI_SOS 'X'
+#define UTFLITE__ANSI_PM '^'
+#define UTFLITE__ANSI_APC '_'
+#define UTFLITE__ANSI_STRING_TERMINATOR '\\'
+
+/* CSI parameter and intermediate bytes, then the byte that ends it. */
+#define UTFLITE__ANSI_CSI_BODY_FIRST 0x20
+#define UTFLITE__ANSI_CSI_BODY_LAST 0x3F
+#define UTFLITE__ANSI_CSI_FINAL_FIRST 0x40
+#define UTFLITE__ANSI_CSI_FINAL_LAST 0x7E
+
+/* Other escapes: intermediate bytes, then the byte that ends it. */
+#define UTFLITE__ANSI_INTERMEDIATE_FIRST 0x20
+#define UTFLITE__ANSI_INTERMEDIATE_LAST 0x2F
+#define UTFLITE__ANSI_FINAL_FIRST 0x30
+#define UTFLITE__ANSI_FINAL_LAST 0x7E
+
+/* Automaton state at the start of text (before any codepoint). */
+#define UTFLITE__GRAPHEME_STATE_START 0
+
+/* Transition byte layout: next state in the low bits, boundary flag on top. */
+#define UTFLITE__GRAPHEME_DFA_BREAK 0x80
+#define UTFLITE__GRAPHEME_DFA_STATE_MASK 0x7F
+
 /* Hangul syllable constants for LV/LVT computation (Unicode 3.0) */
 #define UTFLITE__HANGUL_SBASE  0xAC00  /* First Hangul syllable */
 #define UTFLITE__HANGUL_SEND   0xD7A3  /* Last Hangul syllable */
 #define UTFLITE__HANGUL_TCOUNT 28      /* Number of trailing jamo per syllable */
 
+/* Word-at-a-time (SWAR) byte scanning: eight bytes per 64-bit word. */
+#define UTFLITE__SWAR_WORD_BYTES 8
+#define UTFLITE__SWAR_LOW_BITS 0x0101010101010101ULL
+#define UTFLITE__SWAR_HIGH_BITS 0x8080808080808080ULL
+#define UTFLITE__SWAR_TOP_BYTE_SHIFT 56
+
+/* A UTF-8 continuation byte is 10xxxxxx; every other byte starts a codepoint. */
+#define UTFLITE__UTF8_CONTINUATION_MASK 0xC0
+#define UTFLITE__UTF8_CONTINUATION_BITS 0x80
+
+/* Lead bytes 11110xxx start four-byte sequences, which need a surrogate pair. */
+#define UTFLITE__UTF8_FOUR_BYTE_LEAD 0xF0
+
+/* Codepoints from here on take a surrogate pair in UTF-16. */
+#define UTFLITE__UTF16_PAIR_FIRST 0x10000
+
+/* An edit may grow a column index segment to this many intervals before
+ * the index is rebuilt to split it again. */
+#define UTFLITE__COLUMN_INDEX_MAX_SEGMENT_INTERVALS 4
+
+/* Variation selectors that request text or emoji presentation, and the
+ * cluster widths they imply. */
+#define UTFLITE__VARIATION_SELECTOR_TEXT 0xFE0E
+#define UTFLITE__VARIATION_SELECTOR_EMOJI 0xFE0F
+#define UTFLITE__TEXT_PRESENTATION_WIDTH 1
+#define UTFLITE__EMOJI_PRESENTATION_WIDTH 2
+
+/* Tells utflite__codepoint_width() to search the double-width table itself. */
+#define UTFLITE__WIDTH_NOT_LOOKED_UP -1
+
+/* A column budget no real text reaches, for walks that must not stop early. */
+#define UTFLITE__UNLIMITED_COLUMNS 0x7FFFFFFF
+
+/* U+2026 HORIZONTAL ELLIPSIS, written where truncation dropped text. */
+#define UTFLITE__ELLIPSIS_UTF8 "\xE2\x80\xA6"
+#define UTFLITE__ELLIPSIS_BYTES 3
+#define UTFLITE__ELLIPSIS_WIDTH 1
+
+/* Byte written by utflite_pad() to fill a cell. */
+#define UTFLITE__PADDING_BYTE ' '
+
+/* Rope chunks are cut to about this many bytes, and an edit that would
+ * leave a chunk shorter than the minimum merges it with a neighbour. */
+#define UTFLITE__ROPE_LEAF_TARGET 1024
+#define UTFLITE__ROPE_LEAF_MINIMUM 256
+
+/* Spare internal rope nodes kept between edits. */
+#define UTFLITE__ROPE_SPARE_NODES 64
+
 /* Maximum codepoints to scan backward for grapheme boundary */
 #define UTFLITE__GRAPHEME_MAX_BACKTRACK 128
 
@@ -1417,550 +2787,4009 @@ static const struct utflite__gcb_range UTFLITE__GCB_RANGES[] = {
     {0xE0100, 0xE01EF, UTFLITE__GCB_EXTEND},
     {0xE01F0, 0xE0FFF, UTFLITE__GCB_CONTROL},
 };
-#define UTFLITE__GCB_RANGE_COUNT (sizeof(UTFLITE__GCB_RANGES) / sizeof(UTFLITE__GCB_RANGES[0]))
+#define UTFLITE__GCB_RANGE_COUNT (sizeof(UTFLITE__GCB_RANGES) / sizeof(UTFLITE__GCB_RANGES[0]))
+
+/*
+ * InCB (Indic_Conjunct_Break) property tables for GB9c rule.
+ * Linkers are virama characters that join consonants in Indic scripts.
+ */
+static const uint32_t UTFLITE__INCB_LINKERS[] = {
+    0x094D, 0x09CD, 0x0ACD, 0x0B4D, 0x0C4D, 0x0D4D, 0x1039, 0x103A,
+    0x1714, 0x1715, 0x17D2, 0x1A60, 0x1B44, 0x1BAA, 0x1BAB, 0xA806,
+    0xA8C4, 0xA9C0, 0xAAF6, 0x10A3F, 0x11046, 0x110B9, 0x11133, 0x11134,
+    0x111C0, 0x11235, 0x1134D, 0x11442, 0x114C2, 0x115BF, 0x1163F, 0x116B6,
+    0x1172B, 0x11839, 0x119E0, 0x11A34, 0x11A47, 0x11A99, 0x11C3F, 0x11D45,
+    0x11D97, 0x11F41, 0x11F42,
+};
+#define UTFLITE__INCB_LINKER_COUNT (sizeof(UTFLITE__INCB_LINKERS) / sizeof(UTFLITE__INCB_LINKERS[0]))
+
+/* InCB Consonant ranges */
+static const struct utflite__unicode_range UTFLITE__INCB_CONSONANTS[] = {
+    {0x0915, 0x0939}, {0x0958, 0x095F}, {0x0978, 0x097F}, {0x0995, 0x09A8},
+    {0x09AA, 0x09B0}, {0x09B2, 0x09B2}, {0x09B6, 0x09B9}, {0x09DC, 0x09DD},
+    {0x09DF, 0x09E1}, {0x09F0, 0x09F1}, {0x0A15, 0x0A28}, {0x0A2A, 0x0A30},
+    {0x0A32, 0x0A33}, {0x0A35, 0x0A36}, {0x0A38, 0x0A39}, {0x0A59, 0x0A5C},
+    {0x0A5E, 0x0A5E}, {0x0A72, 0x0A74}, {0x0A95, 0x0AA8}, {0x0AAA, 0x0AB0},
+    {0x0AB2, 0x0AB3}, {0x0AB5, 0x0AB9}, {0x0AE0, 0x0AE1}, {0x0B15, 0x0B28},
+    {0x0B2A, 0x0B30}, {0x0B32, 0x0B33}, {0x0B35, 0x0B39}, {0x0B5C, 0x0B5D},
+    {0x0B5F, 0x0B61}, {0x0B71, 0x0B71}, {0x0B95, 0x0B95}, {0x0B99, 0x0B9A},
+    {0x0B9C, 0x0B9C}, {0x0B9E, 0x0B9F}, {0x0BA3, 0x0BA4}, {0x0BA8, 0x0BAA},
+    {0x0BAE, 0x0BB9}, {0x0C15, 0x0C28}, {0x0C2A, 0x0C39}, {0x0C58, 0x0C5A},
+    {0x0C5D, 0x0C5D}, {0x0C60, 0x0C61}, {0x0C95, 0x0CA8}, {0x0CAA, 0x0CB3},
+    {0x0CB5, 0x0CB9}, {0x0CDD, 0x0CDE}, {0x0CE0, 0x0CE1}, {0x0D15, 0x0D3A},
+    {0x0D54, 0x0D56}, {0x0D5F, 0x0D61}, {0x0D7A, 0x0D7F}, {0x1000, 0x1025},
+    {0x1027, 0x1027}, {0x1029, 0x102A}, {0x1050, 0x1055}, {0x105A, 0x105D},
+    {0x1061, 0x1061}, {0x1065, 0x1066}, {0x106E, 0x1070}, {0x1075, 0x1081},
+    {0x108E, 0x108E}, {0x1703, 0x170C}, {0x170E, 0x1711}, {0x1780, 0x17A2},
+    {0x17A5, 0x17A7}, {0x17A9, 0x17B3}, {0x1901, 0x1922}, {0x1930, 0x1931},
+    {0x1950, 0x196D}, {0x1980, 0x19A9}, {0x19C1, 0x19C7}, {0x1A00, 0x1A16},
+    {0x1A20, 0x1A4C}, {0x1B05, 0x1B33}, {0x1B83, 0x1BA0}, {0xA807, 0xA80A},
+    {0xA80C, 0xA822}, {0xA882, 0xA8B3}, {0xA90A, 0xA925}, {0xA930, 0xA946},
+    {0xA989, 0xA98B}, {0xA98D, 0xA9B2}, {0xAA00, 0xAA28}, {0xAA60, 0xAA6F},
+    {0xAA71, 0xAA76}, {0xAAE0, 0xAAEA}, {0x10A00, 0x10A00}, {0x10A10, 0x10A13},
+    {0x10A15, 0x10A17}, {0x10A19, 0x10A35}, {0x11005, 0x11037}, {0x11071, 0x11072},
+    {0x11075, 0x11075}, {0x11083, 0x110AF}, {0x11107, 0x1112B}, {0x11150, 0x11172},
+    {0x11183, 0x111B2}, {0x111C1, 0x111C4}, {0x11200, 0x11211}, {0x11213, 0x1122B},
+    {0x1123F, 0x11240}, {0x11284, 0x11286}, {0x11288, 0x11288}, {0x1128A, 0x1128D},
+    {0x1128F, 0x1129D}, {0x1129F, 0x112A8}, {0x11305, 0x1130C}, {0x1130F, 0x11310},
+    {0x11313, 0x11328}, {0x1132A, 0x11330}, {0x11332, 0x11333}, {0x11335, 0x11339},
+    {0x1135D, 0x11361}, {0x11400, 0x11434}, {0x11447, 0x1144A}, {0x11481, 0x114AF},
+    {0x114C4, 0x114C5}, {0x114C7, 0x114C7}, {0x11580, 0x115AE}, {0x115D8, 0x115DB},
+    {0x11600, 0x1162F}, {0x11644, 0x11644}, {0x11680, 0x116AA}, {0x116B8, 0x116B8},
+    {0x11700, 0x1171A}, {0x11800, 0x1182B}, {0x11912, 0x11935}, {0x11937, 0x11938},
+    {0x119A0, 0x119A7}, {0x119AA, 0x119D0}, {0x11A0B, 0x11A32}, {0x11A5C, 0x11A89},
+    {0x11C00, 0x11C08}, {0x11C0A, 0x11C2E}, {0x11C72, 0x11C8F}, {0x11D00, 0x11D06},
+    {0x11D08, 0x11D09}, {0x11D0B, 0x11D30}, {0x11D60, 0x11D65}, {0x11D67, 0x11D68},
+    {0x11D6A, 0x11D89}, {0x11EE0, 0x11EF2}, {0x11F02, 0x11F02}, {0x11F04, 0x11F10},
+    {0x11F12, 0x11F33},
+};
+#define UTFLITE__INCB_CONSONANT_COUNT (sizeof(UTFLITE__INCB_CONSONANTS) / sizeof(UTFLITE__INCB_CONSONANTS[0]))
+
+/* BEGIN GENERATED: tools/gen_grapheme_tables.py */
+/* Span covered by the InCB tables; codepoints outside it skip both searches. */
+#define UTFLITE__GRAPHEME_INCB_FIRST 0x0915
+#define UTFLITE__GRAPHEME_INCB_LAST 0x11F42
+
+/* Bit per GCB property that any InCB Consonant or Linker carries. */
+#define UTFLITE__GRAPHEME_INCB_PROPERTY_MASK 0x0191
+
+/* Number of distinct grapheme classes (columns of the automaton). */
+#define UTFLITE__GRAPHEME_CLASS_COUNT 23
+
+/* Number of automaton states (rows of the automaton). */
+#define UTFLITE__GRAPHEME_STATE_COUNT 20
+
+/*
+ * Grapheme class for every feature index. Classes:
+ *    0  OTHER
+ *    1  CR
+ *    2  LF
+ *    3  CONTROL
+ *    4  EXTEND
+ *    5  ZWJ
+ *    6  REGIONAL_INDICATOR
+ *    7  PREPEND
+ *    8  SPACING_MARK
+ *    9  V
+ *   10  T
+ *   11  OTHER ExtPict
+ *   12  EXTEND ExtPict
+ *   13  SPACING_MARK ExtPict
+ *   14  L ExtPict
+ *   15  LV ExtPict
+ *   16  LVT ExtPict
+ *   17  OTHER InCB=Consonant
+ *   18  EXTEND InCB=Consonant
+ *   19  PREPEND InCB=Consonant
+ *   20  SPACING_MARK InCB=Consonant
+ *   21  EXTEND InCB=Linker
+ *   22  SPACING_MARK InCB=Linker
+ */
+static const uint8_t UTFLITE__GRAPHEME_FEATURE_CLASSES[UTFLITE__GRAPHEME_FEATURE_COUNT] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 9, 10, 0, 0,
+    11, 0, 0, 0, 12, 0, 0, 0, 13, 14, 0, 0, 15, 16,
+    17, 0, 0, 0, 18, 0, 0, 19, 20, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 21, 0, 0, 0, 22, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* Grapheme class of each ASCII codepoint, so ASCII skips every lookup. */
+static const uint8_t UTFLITE__GRAPHEME_ASCII_CLASSES[UTFLITE__ASCII_LIMIT] = {
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2, 3, 3, 1, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3,
+};
+
+/* Bit per class after which the automaton reaches the same state whatever
+ * came before, so segmentation may restart at such a codepoint. */
+#define UTFLITE__GRAPHEME_RESTART_CLASSES 0x1BEF8F
+
+/* Per class of a codepoint: bit per class of the next codepoint whose
+ * boundary the pair alone decides, whatever preceded the pair. */
+static const uint32_t UTFLITE__GRAPHEME_PAIR_DECIDED[UTFLITE__GRAPHEME_CLASS_COUNT] = {
+    0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x75FFFF, 0x7437FF,
+    0x7FFFBF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF,
+    0x75FFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x7FFFFF,
+    0x7FFFFF, 0x7FFFFF, 0x7FFFFF, 0x75FFFF, 0x75FFFF,
+};
+
+/*
+ * Transition table: GRAPHEME_DFA[state][class] holds the next state in the
+ * low bits and GRAPHEME_DFA_BREAK when a cluster boundary precedes the
+ * codepoint. Each row notes one rule state that the row stands for.
+ */
+static const uint8_t UTFLITE__GRAPHEME_DFA[UTFLITE__GRAPHEME_STATE_COUNT][UTFLITE__GRAPHEME_CLASS_COUNT] = {
+    /*  0: start of text */
+    {0x81, 0x82, 0x83, 0x83, 0x81, 0x81, 0x84, 0x85, 0x81, 0x86, 0x87, 0x88, 0x88, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8C, 0x8D, 0x8C, 0x81, 0x81},
+    /*  1: after OTHER */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x08, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x01, 0x01},
+    /*  2: after CR */
+    {0x81, 0x82, 0x03, 0x83, 0x81, 0x81, 0x84, 0x85, 0x81, 0x86, 0x87, 0x88, 0x88, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8C, 0x8D, 0x8C, 0x81, 0x81},
+    /*  3: after LF */
+    {0x81, 0x82, 0x83, 0x83, 0x81, 0x81, 0x84, 0x85, 0x81, 0x86, 0x87, 0x88, 0x88, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8C, 0x8D, 0x8C, 0x81, 0x81},
+    /*  4: after REGIONAL_INDICATOR, odd RI run */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x01, 0x85, 0x01, 0x86, 0x87, 0x88, 0x08, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x01, 0x01},
+    /*  5: after PREPEND */
+    {0x01, 0x82, 0x83, 0x83, 0x01, 0x01, 0x04, 0x05, 0x01, 0x06, 0x07, 0x08, 0x08, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0C, 0x0D, 0x0C, 0x01, 0x01},
+    /*  6: after V */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x84, 0x85, 0x01, 0x06, 0x07, 0x88, 0x08, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x01, 0x01},
+    /*  7: after T */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x84, 0x85, 0x01, 0x86, 0x07, 0x88, 0x08, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x01, 0x01},
+    /*  8: after OTHER, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x08, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x08, 0x01},
+    /*  9: after L, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x06, 0x87, 0x88, 0x08, 0x08, 0x09, 0x0A, 0x0B, 0x8C, 0x0F, 0x8D, 0x0C, 0x08, 0x01},
+    /* 10: after LV, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x06, 0x07, 0x88, 0x08, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x08, 0x01},
+    /* 11: after LVT, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x86, 0x07, 0x88, 0x08, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x08, 0x01},
+    /* 12: after OTHER, InCB consonant */
+    {0x81, 0x82, 0x83, 0x83, 0x0C, 0x0C, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x0F, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x10, 0x10},
+    /* 13: after PREPEND, InCB consonant */
+    {0x01, 0x82, 0x83, 0x83, 0x0C, 0x0C, 0x04, 0x05, 0x01, 0x06, 0x07, 0x08, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0C, 0x0D, 0x0C, 0x10, 0x10},
+    /* 14: after ZWJ, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x86, 0x87, 0x08, 0x08, 0x08, 0x09, 0x0A, 0x0B, 0x8C, 0x0F, 0x8D, 0x0C, 0x08, 0x01},
+    /* 15: after EXTEND, in ExtPict Extend*, InCB consonant */
+    {0x81, 0x82, 0x83, 0x83, 0x0F, 0x11, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x0F, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x12, 0x10},
+    /* 16: after EXTEND, InCB consonant+linker */
+    {0x81, 0x82, 0x83, 0x83, 0x10, 0x10, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x12, 0x08, 0x89, 0x8A, 0x8B, 0x0C, 0x0C, 0x0D, 0x0C, 0x10, 0x10},
+    /* 17: after ZWJ, in ExtPict Extend*, InCB consonant */
+    {0x81, 0x82, 0x83, 0x83, 0x0F, 0x11, 0x84, 0x85, 0x01, 0x86, 0x87, 0x08, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x8C, 0x0F, 0x8D, 0x0C, 0x12, 0x10},
+    /* 18: after EXTEND, in ExtPict Extend*, InCB consonant+linker */
+    {0x81, 0x82, 0x83, 0x83, 0x12, 0x13, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x12, 0x08, 0x89, 0x8A, 0x8B, 0x0C, 0x0F, 0x0D, 0x0C, 0x12, 0x10},
+    /* 19: after ZWJ, in ExtPict Extend*, InCB consonant+linker */
+    {0x81, 0x82, 0x83, 0x83, 0x12, 0x13, 0x84, 0x85, 0x01, 0x86, 0x87, 0x08, 0x12, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0F, 0x0D, 0x0C, 0x12, 0x10},
+};
+/* END GENERATED: tools/gen_grapheme_tables.py */
+
+static inline int utflite__unicode_range_contains(uint32_t codepoint, const struct utflite__unicode_range *ranges, int count) {
+    int low = 0;
+    int high = count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (codepoint < ranges[mid].start) {
+            high = mid - 1;
+        } else if (codepoint > ranges[mid].end) {
+            low = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Get grapheme cluster break property for a codepoint */
+static enum utflite__gcb_property utflite__get_gcb(uint32_t cp) {
+	/* Hangul syllables: LV and LVT are computed algorithmically */
+	if (cp >= UTFLITE__HANGUL_SBASE && cp <= UTFLITE__HANGUL_SEND) {
+		return ((cp - UTFLITE__HANGUL_SBASE) % UTFLITE__HANGUL_TCOUNT == 0)
+		       ? UTFLITE__GCB_LV : UTFLITE__GCB_LVT;
+	}
+
+    /* Binary search in property table */
+    int low = 0;
+    int high = UTFLITE__GCB_RANGE_COUNT - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (cp < UTFLITE__GCB_RANGES[mid].start) {
+            high = mid - 1;
+        } else if (cp > UTFLITE__GCB_RANGES[mid].end) {
+            low = mid + 1;
+        } else {
+            return (enum utflite__gcb_property)UTFLITE__GCB_RANGES[mid].property;
+        }
+    }
+    return UTFLITE__GCB_OTHER;
+}
+
+/* Extended_Pictographic check for GB11 (emoji ZWJ sequences) */
+static int utflite__is_extended_pictographic(uint32_t cp) {
+	/* Use double-width ranges which include Extended_Pictographic */
+	return utflite__unicode_range_contains(cp, UTFLITE__DOUBLE_WIDTH_RANGES,
+	                                       UTFLITE__DOUBLE_WIDTH_COUNT);
+}
+
+/* InCB Linker check for GB9c (binary search in sorted array) */
+static int utflite__is_incb_linker(uint32_t cp) {
+    int low = 0;
+    int high = UTFLITE__INCB_LINKER_COUNT - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (cp < UTFLITE__INCB_LINKERS[mid]) {
+            high = mid - 1;
+        } else if (cp > UTFLITE__INCB_LINKERS[mid]) {
+            low = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* InCB Consonant check for GB9c */
+static int utflite__is_incb_consonant(uint32_t cp) {
+    return utflite__unicode_range_contains(cp, UTFLITE__INCB_CONSONANTS,
+                                           UTFLITE__INCB_CONSONANT_COUNT);
+}
+
+/*
+ * Maps a non-ASCII codepoint to its column in the grapheme automaton,
+ * combining its GCB property with the Extended_Pictographic and InCB bits
+ * that GB11 and GB9c look at. The caller passes Extended_Pictographic in,
+ * as it may already have searched the double-width table for the width.
+ * The InCB searches only run for properties and codepoints their tables
+ * can cover.
+ */
+static uint8_t utflite__grapheme_class_lookup(uint32_t cp, int extended_pictographic) {
+    enum utflite__gcb_property property = utflite__get_gcb(cp);
+    int feature = (int)property;
+    if (extended_pictographic) {
+        feature += UTFLITE__GRAPHEME_FEATURE_EXTENDED_PICTOGRAPHIC;
+    }
+    if (cp >= UTFLITE__GRAPHEME_INCB_FIRST && cp <= UTFLITE__GRAPHEME_INCB_LAST &&
+        (UTFLITE__GRAPHEME_INCB_PROPERTY_MASK & (1u << property))) {
+        if (utflite__is_incb_consonant(cp)) {
+            feature += UTFLITE__GRAPHEME_FEATURE_INCB_CONSONANT;
+        } else if (utflite__is_incb_linker(cp)) {
+            feature += UTFLITE__GRAPHEME_FEATURE_INCB_LINKER;
+        }
+    }
+    return UTFLITE__GRAPHEME_FEATURE_CLASSES[feature];
+}
+
+/* Maps a codepoint to its column in the grapheme automaton; ASCII comes
+ * straight from a table. */
+static uint8_t utflite__grapheme_class(uint32_t cp) {
+    if (cp < UTFLITE__ASCII_LIMIT) {
+        return UTFLITE__GRAPHEME_ASCII_CLASSES[cp];
+    }
+    return utflite__grapheme_class_lookup(cp, utflite__is_extended_pictographic(cp));
+}
+
+/*
+ * Feeds one codepoint, given as its grapheme_class() column, to the grapheme
+ * automaton (UAX #29, GB3-GB13, GB999).
+ * The state byte replaces the separate RI count, ExtPict and InCB trackers:
+ * a single table load yields both the next state and the break decision.
+ *
+ * Returns nonzero when a cluster boundary falls before this codepoint. The
+ * first codepoint after GRAPHEME_STATE_START always reports a boundary (GB1).
+ */
+static int utflite__grapheme_step_class(uint8_t *state, uint8_t class) {
+    uint8_t transition = UTFLITE__GRAPHEME_DFA[*state][class];
+    *state = transition & UTFLITE__GRAPHEME_DFA_STATE_MASK;
+    return transition & UTFLITE__GRAPHEME_DFA_BREAK;
+}
+
+/* Feeds one codepoint to the grapheme automaton; see utflite__grapheme_step_class(). */
+static int utflite__grapheme_step(uint8_t *state, uint32_t cp) {
+    return utflite__grapheme_step_class(state, utflite__grapheme_class(cp));
+}
+
+/*
+ * Error handling strategy: consume minimal bytes for structural errors,
+ * consume full sequence for semantic errors.
+ */
+int utflite_decode(const char *bytes, int length, uint32_t *codepoint) {
+    if (length <= 0 || !bytes) {
+        *codepoint = UTFLITE_REPLACEMENT_CHAR;
+        return 1;
+    }
+    unsigned char first = (unsigned char)bytes[0];
+    if (first < 0x80) {
+        *codepoint = first;
+        return 1;
+    }
+    int sequence_length;
+    uint32_t cp;
+    if ((first & 0xE0) == 0xC0) {
+        sequence_length = 2;
+        cp = first & 0x1F;
+    } else if ((first & 0xF0) == 0xE0) {
+        sequence_length = 3;
+        cp = first & 0x0F;
+    } else if ((first & 0xF8) == 0xF0) {
+        sequence_length = 4;
+        cp = first & 0x07;
+    } else {
+        *codepoint = UTFLITE_REPLACEMENT_CHAR;
+        return 1;
+    }
+    if (length < sequence_length) {
+        *codepoint = UTFLITE_REPLACEMENT_CHAR;
+        return 1;
+    }
+    for (int i = 1; i < sequence_length; i++) {
+        unsigned char byte = (unsigned char)bytes[i];
+        if ((byte & 0xC0) != 0x80) {
+            *codepoint = UTFLITE_REPLACEMENT_CHAR;
+            return 1;
+        }
+        cp = (cp << 6) | (byte & 0x3F);
+    }
+    if ((sequence_length == 2 && cp < 0x80) ||
+        (sequence_length == 3 && cp < 0x800) ||
+        (sequence_length == 4 && cp < 0x10000)) {
+        *codepoint = UTFLITE_REPLACEMENT_CHAR;
+        return sequence_length;
+    }
+    if (cp >= 0xD800 && cp <= 0xDFFF) {
+        *codepoint = UTFLITE_REPLACEMENT_CHAR;
+        return sequence_length;
+    }
+    if (cp > 0x10FFFF) {
+        *codepoint = UTFLITE_REPLACEMENT_CHAR;
+        return sequence_length;
+    }
+    *codepoint = cp;
+    return sequence_length;
+}
+
+int utflite_encode(uint32_t codepoint, char *buffer) {
+    if (codepoint < 0x80) {
+        buffer[0] = (char)codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        buffer[0] = (char)(0xC0 | (codepoint >> 6));
+        buffer[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    } else if (codepoint < 0x10000) {
+        if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
+            return 0;
+        }
+        buffer[0] = (char)(0xE0 | (codepoint >> 12));
+        buffer[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        buffer[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    } else if (codepoint <= 0x10FFFF) {
+        buffer[0] = (char)(0xF0 | (codepoint >> 18));
+        buffer[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+        buffer[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        buffer[3] = (char)(0x80 | (codepoint & 0x3F));
+        return 4;
+    }
+    return 0;
+}
+
+/*
+ * Display width of a codepoint. 'wide' is the double-width table result
+ * when the caller already has it, or UTFLITE__WIDTH_NOT_LOOKED_UP to search here.
+ */
+static int utflite__codepoint_width(uint32_t codepoint, int wide) {
+    if (codepoint < 0x20) {
+        if (codepoint == 0x00) return 0;
+        return -1;
+    }
+    if (codepoint < 0x7F) {
+        return 1;
+    }
+    if (codepoint == 0x7F) {
+        return -1;
+    }
+    if (codepoint < 0xA0) {
+        return -1;
+    }
+    if (codepoint == 0x00AD) {
+        return 1;
+    }
+    if (utflite__unicode_range_contains(codepoint, UTFLITE__ZERO_WIDTH_RANGES, UTFLITE__ZERO_WIDTH_COUNT)) {
+        return 0;
+    }
+    if (wide == UTFLITE__WIDTH_NOT_LOOKED_UP) {
+        wide = utflite__unicode_range_contains(codepoint, UTFLITE__DOUBLE_WIDTH_RANGES, UTFLITE__DOUBLE_WIDTH_COUNT);
+    }
+    if (wide) {
+        return 2;
+    }
+    return 1;
+}
+
+int utflite_codepoint_width(uint32_t codepoint) {
+    return utflite__codepoint_width(codepoint, UTFLITE__WIDTH_NOT_LOOKED_UP);
+}
+
+int utflite_char_width(const char *text, int length, int offset) {
+    if (offset >= length) {
+        return 0;
+    }
+    uint32_t codepoint;
+    utflite_decode(text + offset, length - offset, &codepoint);
+    return utflite_codepoint_width(codepoint);
+}
+
+/*
+ * Looks up a codepoint's grapheme automaton column and display width
+ * together. The double-width table doubles as the Extended_Pictographic
+ * test, so one search serves both.
+ */
+static uint8_t utflite__grapheme_class_width(uint32_t cp, int *width) {
+    if (cp < UTFLITE__ASCII_LIMIT) {
+        *width = utflite__codepoint_width(cp, 0);
+        return UTFLITE__GRAPHEME_ASCII_CLASSES[cp];
+    }
+    int wide = utflite__unicode_range_contains(cp, UTFLITE__DOUBLE_WIDTH_RANGES, UTFLITE__DOUBLE_WIDTH_COUNT);
+    *width = utflite__codepoint_width(cp, wide);
+    return utflite__grapheme_class_lookup(cp, wide);
+}
+
+/* Folds a codepoint that continues a cluster into the cluster's width:
+ * the widest codepoint wins, and variation selectors pick a presentation. */
+static int utflite__grapheme_width_extend(int width, uint32_t cp, int cp_width) {
+    if (width > 0 && cp == UTFLITE__VARIATION_SELECTOR_EMOJI) {
+        return UTFLITE__EMOJI_PRESENTATION_WIDTH;
+    }
+    if (width > 0 && cp == UTFLITE__VARIATION_SELECTOR_TEXT) {
+        return UTFLITE__TEXT_PRESENTATION_WIDTH;
+    }
+    return cp_width > width ? cp_width : width;
+}
+
+int utflite_grapheme_width(const char *text, int length, int offset, int *next_offset) {
+    if (!text || offset < 0 || offset >= length) {
+        if (next_offset) {
+            *next_offset = length > 0 ? length : 0;
+        }
+        return 0;
+    }
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    uint32_t codepoint;
+    int width;
+    offset += utflite_decode(text + offset, length - offset, &codepoint);
+    utflite__grapheme_step_class(&state, utflite__grapheme_class_width(codepoint, &width));
+    while (offset < length) {
+        int cp_width;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (utflite__grapheme_step_class(&state, utflite__grapheme_class_width(codepoint, &cp_width))) {
+            break;
+        }
+        width = utflite__grapheme_width_extend(width, codepoint, cp_width);
+        offset += bytes;
+    }
+    if (next_offset) {
+        *next_offset = offset;
+    }
+    return width;
+}
+
+int utflite_next_char(const char *text, int length, int offset) {
+    if (offset >= length) {
+        return length;
+    }
+    uint32_t codepoint;
+    int char_bytes = utflite_decode(text + offset, length - offset, &codepoint);
+    int next_offset = offset + char_bytes;
+    return (next_offset > length) ? length : next_offset;
+}
+
+int utflite_prev_char(const char *text, int offset) {
+    if (offset <= 0) {
+        return 0;
+    }
+    int pos = offset - 1;
+    int limit = (offset > 4) ? offset - 4 : 0;
+    while (pos > limit && ((unsigned char)text[pos] & 0xC0) == 0x80) {
+        pos--;
+    }
+    return pos;
+}
+
+/*
+ * Returns byte offset of next grapheme cluster boundary.
+ * Implements UAX #29 extended grapheme cluster segmentation.
+ */
+int utflite_next_grapheme(const char *text, int length, int offset) {
+    if (!text || offset >= length || offset < 0) {
+        return length;
+    }
+
+    /* The first codepoint always starts the cluster */
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    uint32_t codepoint;
+    int next_offset = offset + utflite_decode(text + offset, length - offset, &codepoint);
+    utflite__grapheme_step(&state, codepoint);
+
+    /* Consume codepoints until the automaton reports a boundary */
+    while (next_offset < length) {
+        int bytes = utflite_decode(text + next_offset, length - next_offset, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint)) {
+            return next_offset;
+        }
+        next_offset += bytes;
+    }
+
+    return length;
+}
+
+/*
+ * Returns byte offset of previous grapheme cluster boundary.
+ * Scans backward and applies UAX #29 rules.
+ */
+/*
+ * Finds the codepoint that forward decoding ends exactly at 'offset',
+ * storing it in *codepoint. Returns its start, or -1 when 'offset' falls
+ * inside a multibyte sequence. Stray continuation bytes decode alone.
+ */
+static int utflite__codepoint_before(const char *text, int length, int offset, uint32_t *codepoint) {
+    int start = utflite_prev_char(text, offset);
+    int end = start + utflite_decode(text + start, length - start, codepoint);
+    if (end > offset) {
+        return -1;
+    }
+    if (end < offset) {
+        start = offset - 1;
+        utflite_decode(text + start, length - start, codepoint);
+    }
+    return start;
+}
+
+int utflite_prev_grapheme(const char *text, int offset) {
+    if (!text || offset <= 0) {
+        return 0;
+    }
+
+    /* Find the start of the previous codepoint */
+    int prev_start = utflite_prev_char(text, offset);
+    if (prev_start == 0 && offset > 0) {
+        /* We're at the start after moving back one char */
+        return 0;
+    }
+
+	/*
+	 * Strategy: scan forward from a safe point to find grapheme boundaries,
+	 * then return the last one before 'offset'.
+	 */
+	int scan_start = prev_start;
+	int remaining = UTFLITE__GRAPHEME_MAX_BACKTRACK;
+	while (remaining > 0 && scan_start > 0) {
+		int prev = utflite_prev_char(text, scan_start);
+		if (prev == scan_start) break;
+		scan_start = prev;
+		remaining--;
+	}
+
+    /* Run the automaton forward once, remembering the last boundary before
+     * 'offset'. Restarting at each boundary would give the same answer,
+     * since the state after a break depends only on the new codepoint. */
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int grapheme_start = scan_start;
+    int curr = scan_start;
+
+    while (curr < offset) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + curr, offset - curr, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint)) {
+            grapheme_start = curr;
+        }
+        curr += bytes;
+    }
+
+    return grapheme_start;
+}
+
+int utflite_is_grapheme_boundary(const char *text, int length, int offset) {
+    if (!text || offset <= 0 || offset >= length) {
+        return 1;
+    }
+    uint32_t codepoint;
+    int start = utflite__codepoint_before(text, length, offset, &codepoint);
+    if (start < 0) {
+        return 0;
+    }
+    uint8_t before = utflite__grapheme_class(codepoint);
+    utflite_decode(text + offset, length - offset, &codepoint);
+    uint8_t after = utflite__grapheme_class(codepoint);
+
+    /* Common case: the pair decides the boundary whatever came before it */
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    if (UTFLITE__GRAPHEME_PAIR_DECIDED[before] & (1u << after)) {
+        utflite__grapheme_step_class(&state, before);
+        return utflite__grapheme_step_class(&state, after) != 0;
+    }
+
+    /* RI parity, ExtPict Extend* ZWJ or a conjunct in progress: back up to a
+     * codepoint the automaton restarts at and run forward from there */
+    uint8_t class = before;
+    int remaining = UTFLITE__GRAPHEME_MAX_BACKTRACK;
+    while (!(UTFLITE__GRAPHEME_RESTART_CLASSES & (1u << class)) && start > 0 && remaining > 0) {
+        start = utflite__codepoint_before(text, length, start, &codepoint);
+        class = utflite__grapheme_class(codepoint);
+        remaining--;
+    }
+    while (start < offset) {
+        start += utflite_decode(text + start, length - start, &codepoint);
+        utflite__grapheme_step(&state, codepoint);
+    }
+    return utflite__grapheme_step_class(&state, after) != 0;
+}
+
+/*
+ * Counts grapheme clusters in text, returning early once the count passes
+ * 'limit'. A run of printable ASCII only needs the automaton for its first
+ * byte, which may still attach to a preceding Prepend (GB9b). Every later
+ * byte in the run is Other after Other, which always breaks (GB999) and
+ * leaves the state unchanged, so the rest of the run is counted directly.
+ */
+static int utflite__grapheme_count_limited(const char *text, int length, int limit) {
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int count = 0;
+    int offset = 0;
+
+    while (offset < length) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte >= UTFLITE__ASCII_PRINTABLE_FIRST && byte <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            if (utflite__grapheme_step(&state, byte)) {
+                count++;
+            }
+            /* Scan no further than the byte that takes the count past the limit */
+            int run_end = offset + 1;
+            int run_limit = length;
+            if (limit - count < length - run_end) {
+                run_limit = run_end + (limit - count) + 1;
+            }
+            while (run_end < run_limit &&
+                   (unsigned char)text[run_end] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            count += run_end - offset - 1;
+            offset = run_end;
+        } else {
+            uint32_t codepoint;
+            offset += utflite_decode(text + offset, length - offset, &codepoint);
+            if (utflite__grapheme_step(&state, codepoint)) {
+                count++;
+            }
+        }
+        if (count > limit) {
+            return limit + 1;
+        }
+    }
+
+    return count;
+}
+
+int utflite_grapheme_count(const char *text, int length) {
+    if (!text || length <= 0) {
+        return 0;
+    }
+    /* The count can never exceed the byte length */
+    return utflite__grapheme_count_limited(text, length, length);
+}
+
+int utflite_grapheme_count_bounded(const char *text, int length, int max_graphemes) {
+    if (!text || length <= 0) {
+        return 0;
+    }
+    if (max_graphemes < 0) {
+        max_graphemes = 0;
+    }
+    return utflite__grapheme_count_limited(text, length, max_graphemes);
+}
+
+/* ============================================================================
+ * Grapheme Index
+ * ============================================================================ */
+
+/*
+ * Scans forward from the last checkpoint of 'index', appending a checkpoint
+ * every index->interval clusters. 'tail' holds the old checkpoints after an
+ * edit, still in old-text coordinates; 'delta' converts them to new ones.
+ * A boundary that lands on a shifted old checkpoint ends the scan early:
+ * the automaton state after a boundary depends only on the text from there
+ * on, so every later boundary matches the old ones too.
+ *
+ * Returns 1 on success, 0 when the checkpoint storage is full.
+ */
+static int utflite__grapheme_index_rescan(struct utflite_grapheme_index *index, const char *text, int length, int tail_start, int tail_count, int delta) {
+    struct utflite_grapheme_checkpoint *checkpoints = index->checkpoints;
+    struct utflite_grapheme_checkpoint last = checkpoints[index->count - 1];
+    int old_grapheme_count = index->grapheme_count;
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int graphemes = last.grapheme_index;
+    int since_checkpoint = 0;
+    int tail_next = 0;
+    int offset = last.byte_offset;
+
+    index->length = length;
+    if (offset < length) {
+        /* The checkpoint itself starts a cluster */
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        utflite__grapheme_step(&state, codepoint);
+        graphemes++;
+    }
+    while (offset < length) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint)) {
+            /* Cluster number 'graphemes' starts here */
+            while (tail_next < tail_count &&
+                   checkpoints[tail_start + tail_next].byte_offset + delta < offset) {
+                tail_next++;
+            }
+            if (tail_next < tail_count &&
+                checkpoints[tail_start + tail_next].byte_offset + delta == offset) {
+                int shift = graphemes - checkpoints[tail_start + tail_next].grapheme_index;
+                for (int i = tail_next; i < tail_count; i++) {
+                    struct utflite_grapheme_checkpoint moved = checkpoints[tail_start + i];
+                    moved.byte_offset += delta;
+                    moved.grapheme_index += shift;
+                    checkpoints[index->count++] = moved;
+                }
+                index->grapheme_count = old_grapheme_count + shift;
+                return 1;
+            }
+            if (++since_checkpoint == index->interval) {
+                if (index->count == tail_start + tail_next) {
+                    /* Out of free slots: park the unread tail at the end */
+                    int remaining = tail_count - tail_next;
+                    int new_start = index->capacity - remaining;
+                    if (new_start <= index->count) {
+                        return 0;
+                    }
+                    for (int i = remaining - 1; i >= 0; i--) {
+                        checkpoints[new_start + i] = checkpoints[tail_start + tail_next + i];
+                    }
+                    tail_start = new_start;
+                    tail_count = remaining;
+                    tail_next = 0;
+                }
+                checkpoints[index->count].byte_offset = offset;
+                checkpoints[index->count].grapheme_index = graphemes;
+                index->count++;
+                since_checkpoint = 0;
+            }
+            graphemes++;
+        }
+        offset += bytes;
+    }
+
+    index->grapheme_count = graphemes;
+    return 1;
+}
+
+/*
+ * Returns the position of the last checkpoint whose byte offset (or
+ * grapheme index, if by_grapheme is set) is at most 'key'.
+ */
+static int utflite__grapheme_index_find(const struct utflite_grapheme_index *index, int key, int by_grapheme) {
+    int low = 0;
+    int high = index->count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        const struct utflite_grapheme_checkpoint *checkpoint = &index->checkpoints[mid];
+        int value = by_grapheme ? checkpoint->grapheme_index : checkpoint->byte_offset;
+        if (value <= key) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+int utflite_grapheme_index_capacity(int length, int interval) {
+    if (length < 0 || interval < 1) {
+        return 1;
+    }
+    /* Every cluster takes at least one byte */
+    return length / interval + 1;
+}
+
+int utflite_grapheme_index_build(struct utflite_grapheme_index *index, struct utflite_grapheme_checkpoint *storage, int capacity, int interval, const char *text, int length) {
+    if (!index || !storage || capacity < 1 || interval < 1 || length < 0 ||
+        (!text && length > 0)) {
+        return 0;
+    }
+    index->checkpoints = storage;
+    index->capacity = capacity;
+    index->interval = interval;
+    index->count = 1;
+    index->length = 0;
+    index->grapheme_count = 0;
+    storage[0].byte_offset = 0;
+    storage[0].grapheme_index = 0;
+    return utflite__grapheme_index_rescan(index, text, length, capacity, 0, 0);
+}
+
+int utflite_grapheme_index_update(struct utflite_grapheme_index *index, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!index || (!text && length > 0) || edit_start < 0 ||
+        old_end < edit_start || old_end > index->length || new_end < edit_start ||
+        length != index->length + (new_end - old_end)) {
+        return 0;
+    }
+
+    /* Keep checkpoints whose first codepoint ends before the edit; the
+     * boundary there depends only on text before it. Offset 0 always stays. */
+    int keep = utflite__grapheme_index_find(index, edit_start - UTFLITE_MAX_BYTES, 0) + 1;
+
+    /* Old checkpoints past the edit are candidates for resynchronizing */
+    int tail_start = utflite__grapheme_index_find(index, old_end - 1, 0) + 1;
+    if (tail_start < keep) {
+        tail_start = keep;
+    }
+
+    int tail_count = index->count - tail_start;
+    index->count = keep;
+    return utflite__grapheme_index_rescan(index, text, length, tail_start, tail_count,
+                                 new_end - old_end);
+}
+
+int utflite_grapheme_index_offset(const struct utflite_grapheme_index *index, const char *text, int grapheme_index) {
+    if (grapheme_index <= 0) {
+        return 0;
+    }
+    if (grapheme_index >= index->grapheme_count) {
+        return index->length;
+    }
+    const struct utflite_grapheme_checkpoint *checkpoint =
+        &index->checkpoints[utflite__grapheme_index_find(index, grapheme_index, 1)];
+    int offset = checkpoint->byte_offset;
+    for (int i = checkpoint->grapheme_index; i < grapheme_index; i++) {
+        offset = utflite_next_grapheme(text, index->length, offset);
+    }
+    return offset;
+}
+
+int utflite_grapheme_index_lookup(const struct utflite_grapheme_index *index, const char *text, int byte_offset) {
+    if (byte_offset <= 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->grapheme_count;
+    }
+    const struct utflite_grapheme_checkpoint *checkpoint =
+        &index->checkpoints[utflite__grapheme_index_find(index, byte_offset, 0)];
+    int grapheme_index = checkpoint->grapheme_index;
+    int offset = checkpoint->byte_offset;
+    for (;;) {
+        offset = utflite_next_grapheme(text, index->length, offset);
+        if (offset > byte_offset) {
+            return grapheme_index;
+        }
+        grapheme_index++;
+    }
+}
+
+/* ============================================================================
+ * Codepoint Index
+ * ============================================================================ */
+
+/*
+ * Counts the lead bytes in one 8-byte word. A continuation byte has bit 7
+ * set and bit 6 clear; shifting left by one lines each bit 6 up under its
+ * bit 7, and the multiply sums the per-byte flags into the top byte.
+ */
+static int utflite__utf8_lead_bytes_in_word(uint64_t word) {
+    uint64_t continuation = word & ~(word << 1) & UTFLITE__SWAR_HIGH_BITS;
+    int continuation_count = (int)(((continuation >> 7) * UTFLITE__SWAR_LOW_BITS) >> UTFLITE__SWAR_TOP_BYTE_SHIFT);
+    return UTFLITE__SWAR_WORD_BYTES - continuation_count;
+}
+
+/* Counts the bytes in text[0, count) that start a codepoint. */
+static int utflite__utf8_lead_byte_count(const char *text, int count) {
+    int leads = 0;
+    int i = 0;
+    for (; i + UTFLITE__SWAR_WORD_BYTES <= count; i += UTFLITE__SWAR_WORD_BYTES) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        leads += utflite__utf8_lead_bytes_in_word(word);
+    }
+    for (; i < count; i++) {
+        if (((unsigned char)text[i] & UTFLITE__UTF8_CONTINUATION_MASK) != UTFLITE__UTF8_CONTINUATION_BITS) {
+            leads++;
+        }
+    }
+    return leads;
+}
+
+/* Returns the last block in [low, high] whose rank is at most 'rank'. */
+static int utflite__codepoint_index_block_at(const struct utflite_codepoint_index *index, int low, int high, int rank) {
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (index->block_ranks[mid] <= rank) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+int utflite_codepoint_index_capacity(int length) {
+    if (length < 0) {
+        length = 0;
+    }
+    /* One rank per block plus at most one select sample per block */
+    return 2 * (length / UTFLITE_CODEPOINT_INDEX_BLOCK + 1);
+}
+
+int utflite_codepoint_index_build(struct utflite_codepoint_index *index, int *storage, int capacity, const char *text, int length) {
+    if (!index || !storage || length < 0 || (!text && length > 0) ||
+        capacity < utflite_codepoint_index_capacity(length)) {
+        return 0;
+    }
+    index->block_count = length / UTFLITE_CODEPOINT_INDEX_BLOCK + 1;
+    index->block_ranks = storage;
+    index->select_blocks = storage + index->block_count;
+    index->sample_count = 0;
+    index->length = length;
+
+    int rank = 0;
+    for (int block = 0; block < index->block_count; block++) {
+        int start = block * UTFLITE_CODEPOINT_INDEX_BLOCK;
+        int end = start + UTFLITE_CODEPOINT_INDEX_BLOCK;
+        if (end > length) {
+            end = length;
+        }
+        index->block_ranks[block] = rank;
+        rank += utflite__utf8_lead_byte_count(text + start, end - start);
+        /* Record this block for every sampled codepoint that starts in it */
+        while (index->sample_count * UTFLITE_CODEPOINT_INDEX_SAMPLE < rank) {
+            index->select_blocks[index->sample_count++] = block;
+        }
+    }
+    index->codepoint_count = rank;
+    return 1;
+}
+
+int utflite_codepoint_index_offset(const struct utflite_codepoint_index *index, const char *text, int codepoint_index) {
+    if (codepoint_index < 0) {
+        codepoint_index = 0;
+    }
+    if (codepoint_index >= index->codepoint_count) {
+        return index->length;
+    }
+
+    /* Select: the samples around the target bound the blocks to search */
+    int sample = codepoint_index / UTFLITE_CODEPOINT_INDEX_SAMPLE;
+    int low = index->select_blocks[sample];
+    int high = (sample + 1 < index->sample_count) ? index->select_blocks[sample + 1]
+                                                  : index->block_count - 1;
+    int block = utflite__codepoint_index_block_at(index, low, high, codepoint_index);
+
+    /* Skip whole words, then find the lead byte within the last one */
+    int rank = index->block_ranks[block];
+    int offset = block * UTFLITE_CODEPOINT_INDEX_BLOCK;
+    while (offset + UTFLITE__SWAR_WORD_BYTES <= index->length) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        int leads = utflite__utf8_lead_bytes_in_word(word);
+        if (rank + leads > codepoint_index) {
+            break;
+        }
+        rank += leads;
+        offset += UTFLITE__SWAR_WORD_BYTES;
+    }
+    for (;; offset++) {
+        if (((unsigned char)text[offset] & UTFLITE__UTF8_CONTINUATION_MASK) != UTFLITE__UTF8_CONTINUATION_BITS) {
+            if (rank == codepoint_index) {
+                return offset;
+            }
+            rank++;
+        }
+    }
+}
+
+int utflite_codepoint_index_lookup(const struct utflite_codepoint_index *index, const char *text, int byte_offset) {
+    if (byte_offset < 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->codepoint_count;
+    }
+    /* Rank: codepoints starting in [0, byte_offset], minus one */
+    int block = byte_offset / UTFLITE_CODEPOINT_INDEX_BLOCK;
+    int start = block * UTFLITE_CODEPOINT_INDEX_BLOCK;
+    int rank = index->block_ranks[block] +
+               utflite__utf8_lead_byte_count(text + start, byte_offset + 1 - start);
+    return rank > 0 ? rank - 1 : 0;
+}
+
+/* ============================================================================
+ * UTF-16 Offset Index
+ * ============================================================================ */
+
+/*
+ * Counts the UTF-16 code units that the codepoints starting in one 8-byte
+ * word need: one per lead byte plus one per byte whose top four bits are
+ * set (a four-byte lead).
+ */
+static int utflite__utf8_utf16_units_in_word(uint64_t word) {
+    uint64_t four_byte = word & (word << 1) & (word << 2) & (word << 3) & UTFLITE__SWAR_HIGH_BITS;
+    int four_byte_count = (int)(((four_byte >> 7) * UTFLITE__SWAR_LOW_BITS) >> UTFLITE__SWAR_TOP_BYTE_SHIFT);
+    return utflite__utf8_lead_bytes_in_word(word) + four_byte_count;
+}
+
+/* Returns the UTF-16 code units needed by a codepoint starting with 'byte'. */
+static int utflite__utf8_byte_utf16_units(unsigned char byte) {
+    if ((byte & UTFLITE__UTF8_CONTINUATION_MASK) == UTFLITE__UTF8_CONTINUATION_BITS) {
+        return 0;
+    }
+    return byte >= UTFLITE__UTF8_FOUR_BYTE_LEAD ? 2 : 1;
+}
+
+/* Counts the UTF-16 code units for the codepoints starting in text[0, count). */
+static int utflite__utf8_utf16_unit_count(const char *text, int count) {
+    int units = 0;
+    int i = 0;
+    for (; i + UTFLITE__SWAR_WORD_BYTES <= count; i += UTFLITE__SWAR_WORD_BYTES) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        units += utflite__utf8_utf16_units_in_word(word);
+    }
+    for (; i < count; i++) {
+        units += utflite__utf8_byte_utf16_units((unsigned char)text[i]);
+    }
+    return units;
+}
+
+int utflite_utf16_index_capacity(int length) {
+    if (length < 0) {
+        length = 0;
+    }
+    return length / UTFLITE_UTF16_INDEX_BLOCK + 1;
+}
+
+int utflite_utf16_index_build(struct utflite_utf16_index *index, int *storage, int capacity, const char *text, int length) {
+    if (!index || !storage || length < 0 || (!text && length > 0) ||
+        capacity < utflite_utf16_index_capacity(length)) {
+        return 0;
+    }
+    index->block_units = storage;
+    index->block_count = length / UTFLITE_UTF16_INDEX_BLOCK + 1;
+    index->length = length;
+
+    int units = 0;
+    for (int block = 0; block < index->block_count; block++) {
+        int start = block * UTFLITE_UTF16_INDEX_BLOCK;
+        int end = start + UTFLITE_UTF16_INDEX_BLOCK;
+        if (end > length) {
+            end = length;
+        }
+        index->block_units[block] = units;
+        units += utflite__utf8_utf16_unit_count(text + start, end - start);
+    }
+    index->utf16_length = units;
+    return 1;
+}
+
+int utflite_utf16_index_to_utf16(const struct utflite_utf16_index *index, const char *text, int byte_offset) {
+    if (byte_offset <= 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->utf16_length;
+    }
+    /* Round down to the start of the codepoint containing byte_offset */
+    byte_offset = utflite_prev_char(text, byte_offset + 1);
+    int block = byte_offset / UTFLITE_UTF16_INDEX_BLOCK;
+    int start = block * UTFLITE_UTF16_INDEX_BLOCK;
+    return index->block_units[block] + utflite__utf8_utf16_unit_count(text + start, byte_offset - start);
+}
+
+int utflite_utf16_index_to_utf8(const struct utflite_utf16_index *index, const char *text, int utf16_offset) {
+    if (utf16_offset <= 0) {
+        return 0;
+    }
+    if (utf16_offset >= index->utf16_length) {
+        return index->length;
+    }
+
+    /* Last breadcrumb at or before the target */
+    int low = 0;
+    int high = index->block_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (index->block_units[mid] <= utf16_offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    /* Skip whole words, then walk the lead bytes of the last one */
+    int units = index->block_units[low];
+    int offset = low * UTFLITE_UTF16_INDEX_BLOCK;
+    while (offset + UTFLITE__SWAR_WORD_BYTES <= index->length) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        int word_units = utflite__utf8_utf16_units_in_word(word);
+        if (units + word_units > utf16_offset) {
+            break;
+        }
+        units += word_units;
+        offset += UTFLITE__SWAR_WORD_BYTES;
+    }
+    for (; offset < index->length; offset++) {
+        units += utflite__utf8_byte_utf16_units((unsigned char)text[offset]);
+        if (units > utf16_offset) {
+            return offset;
+        }
+    }
+    return index->length;
+}
+
+/* ============================================================================
+ * Column Index
+ * ============================================================================ */
+
+/* A segment found by utflite__column_index_find() and where it starts. */
+struct utflite__column_index_hit {
+    /* Index of the segment. */
+    int segment;
+
+    /* Bytes and columns before the segment. */
+    struct utflite_column_segment start;
+};
+
+/*
+ * Adds 'delta' to the size of one segment. The tree is a Fenwick tree:
+ * node i (1-based, stored at tree[i - 1]) holds the sum of the i & -i
+ * segments ending at segment i - 1.
+ */
+static void utflite__column_index_add(struct utflite_column_index *index, int segment, struct utflite_column_segment delta) {
+    for (int node = segment + 1; node <= index->segment_count; node += node & -node) {
+        index->tree[node - 1].bytes += delta.bytes;
+        index->tree[node - 1].columns += delta.columns;
+    }
+}
+
+/* Returns the total size of segments [0, segment). */
+static struct utflite_column_segment utflite__column_index_prefix(const struct utflite_column_index *index, int segment) {
+    struct utflite_column_segment sum = { 0, 0 };
+    for (int node = segment; node > 0; node -= node & -node) {
+        sum.bytes += index->tree[node - 1].bytes;
+        sum.columns += index->tree[node - 1].columns;
+    }
+    return sum;
+}
+
+/*
+ * Returns the last segment whose start (in bytes, or in columns when
+ * by_columns is set) is at most 'key', with where it starts. Descends the
+ * tree from its highest power of two.
+ */
+static struct utflite__column_index_hit utflite__column_index_find(const struct utflite_column_index *index, int key, int by_columns) {
+    int step = 1;
+    while (step * 2 <= index->segment_count) {
+        step *= 2;
+    }
+    struct utflite__column_index_hit hit = { 0, { 0, 0 } };
+    for (; step > 0; step /= 2) {
+        int node = hit.segment + step;
+        if (node >= index->segment_count) {
+            continue;
+        }
+        const struct utflite_column_segment *sum = &index->tree[node - 1];
+        int value = by_columns ? hit.start.columns + sum->columns : hit.start.bytes + sum->bytes;
+        if (value <= key) {
+            hit.segment = node;
+            hit.start.bytes += sum->bytes;
+            hit.start.columns += sum->columns;
+        }
+    }
+    return hit;
+}
+
+int utflite_column_index_capacity(int length, int interval) {
+    if (length < 0 || interval < 1) {
+        return 1;
+    }
+    /* Every segment but the last holds at least 'interval' bytes */
+    return length / interval + 1;
+}
+
+int utflite_column_index_build(struct utflite_column_index *index, struct utflite_column_segment *storage, int capacity, int interval, const char *text, int length) {
+    if (!index || !storage || capacity < 1 || interval < 1 || length < 0 ||
+        (!text && length > 0)) {
+        return 0;
+    }
+    index->tree = storage;
+    index->capacity = capacity;
+    index->interval = interval;
+    index->length = length;
+    index->width = 0;
+
+    /* Cut a segment at the first cluster boundary 'interval' bytes in */
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int count = 0;
+    int segment_start = 0;
+    int segment_columns = 0;
+    int offset = 0;
+    while (offset < length) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint) && offset - segment_start >= interval) {
+            if (count + 1 >= capacity) {
+                return 0;
+            }
+            storage[count].bytes = offset - segment_start;
+            storage[count].columns = segment_columns;
+            count++;
+            segment_start = offset;
+            segment_columns = 0;
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            segment_columns += char_width;
+            index->width += char_width;
+        }
+        offset += bytes;
+    }
+    storage[count].bytes = length - segment_start;
+    storage[count].columns = segment_columns;
+    count++;
+
+    /* Turn the plain sizes into a Fenwick tree in place */
+    index->segment_count = count;
+    for (int node = 1; node <= count; node++) {
+        int parent = node + (node & -node);
+        if (parent <= count) {
+            storage[parent - 1].bytes += storage[node - 1].bytes;
+            storage[parent - 1].columns += storage[node - 1].columns;
+        }
+    }
+    return 1;
+}
+
+int utflite_column_index_update(struct utflite_column_index *index, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!index || (!text && length > 0) || edit_start < 0 ||
+        old_end < edit_start || old_end > index->length || new_end < edit_start ||
+        length != index->length + (new_end - old_end)) {
+        return 0;
+    }
+    int delta = new_end - old_end;
+    int max_segment = index->interval * UTFLITE__COLUMN_INDEX_MAX_SEGMENT_INTERVALS;
+
+    /* Restart at a segment whose first codepoint ends before the edit; the
+     * cluster boundary there does not depend on anything after it. */
+    struct utflite__column_index_hit hit = utflite__column_index_find(index, edit_start - UTFLITE_MAX_BYTES, 0);
+    int first = hit.segment;
+    struct utflite_column_segment start = hit.start;
+    struct utflite_column_segment old_first = utflite__column_index_prefix(index, first + 1);
+    old_first.bytes -= start.bytes;
+    old_first.columns -= start.columns;
+
+    /* Old starts of the following segments, in old-text coordinates */
+    int next = first + 1;
+    int next_start = start.bytes + old_first.bytes;
+
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int columns = 0;
+    int offset = start.bytes;
+    while (offset < length) {
+        /* Samples inside the edit, or no longer on a boundary, are dropped */
+        while (next < index->segment_count &&
+               (next_start < old_end || next_start + delta < offset)) {
+            next_start += utflite__column_index_prefix(index, next + 1).bytes -
+                          utflite__column_index_prefix(index, next).bytes;
+            next++;
+        }
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint) && next < index->segment_count &&
+            offset == next_start + delta) {
+            /* Boundaries from here on match the old text */
+            break;
+        }
+        if (offset - start.bytes > max_segment) {
+            return utflite_column_index_build(index, index->tree, index->capacity,
+                                              index->interval, text, length);
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            columns += char_width;
+        }
+        offset += bytes;
+    }
+    if (offset >= length) {
+        next = index->segment_count;
+    }
+
+    /* The first segment absorbs everything up to the resync point; the
+     * segments it swallowed become empty. */
+    int old_bytes = old_first.bytes;
+    int old_columns = old_first.columns;
+    for (int segment = first + 1; segment < next; segment++) {
+        struct utflite_column_segment size = utflite__column_index_prefix(index, segment + 1);
+        struct utflite_column_segment before = utflite__column_index_prefix(index, segment);
+        size.bytes -= before.bytes;
+        size.columns -= before.columns;
+        if (size.bytes != 0 || size.columns != 0) {
+            struct utflite_column_segment empty = { -size.bytes, -size.columns };
+            utflite__column_index_add(index, segment, empty);
+            old_bytes += size.bytes;
+            old_columns += size.columns;
+        }
+    }
+    struct utflite_column_segment grown = { (offset - start.bytes) - old_first.bytes, columns - old_first.columns };
+    utflite__column_index_add(index, first, grown);
+    index->width += columns - old_columns;
+    index->length = length;
+    return 1;
+}
+
+int utflite_column_index_to_column(const struct utflite_column_index *index, const char *text, int byte_offset) {
+    if (byte_offset <= 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->width;
+    }
+    struct utflite_column_segment start = utflite__column_index_find(index, byte_offset, 0).start;
+    int width = start.columns;
+    for (int offset = start.bytes; offset < byte_offset; ) {
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, index->length - offset, &codepoint);
+        if (offset > byte_offset) {
+            /* byte_offset is inside this codepoint */
+            break;
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            width += char_width;
+        }
+    }
+    return width;
+}
+
+int utflite_column_index_to_offset(const struct utflite_column_index *index, const char *text, int column) {
+    if (column < 0) {
+        return 0;
+    }
+    if (column >= index->width) {
+        return index->length;
+    }
+    struct utflite_column_segment start = utflite__column_index_find(index, column, 1).start;
+
+    /* Segments start on cluster boundaries, so the automaton can start fresh */
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int width = start.columns;
+    int best = start.bytes;
+    int offset = start.bytes;
+    while (offset < index->length) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, index->length - offset, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint)) {
+            if (width > column) {
+                break;
+            }
+            best = offset;
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            width += char_width;
+        }
+        offset += bytes;
+    }
+    return best;
+}
+
+/* ============================================================================
+ * Line Index
+ * ============================================================================ */
+
+/*
+ * Nonzero when any byte of 'word' equals 'byte'. Standard SWAR zero-byte
+ * test on word ^ (byte repeated): only a zero byte borrows into its top bit.
+ */
+static int utflite__swar_has_byte(uint64_t word, unsigned char byte) {
+    uint64_t x = word ^ (UTFLITE__SWAR_LOW_BITS * byte);
+    return ((x - UTFLITE__SWAR_LOW_BITS) & ~x & UTFLITE__SWAR_HIGH_BITS) != 0;
+}
+
+/* Returns the offset of the first CR or LF in text[from, to), or 'to'. */
+static int utflite__line_break_find(const char *text, int from, int to) {
+    int offset = from;
+    while (offset + UTFLITE__SWAR_WORD_BYTES <= to) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        if (utflite__swar_has_byte(word, UTFLITE__ASCII_LF) || utflite__swar_has_byte(word, UTFLITE__ASCII_CR)) {
+            break;
+        }
+        offset += UTFLITE__SWAR_WORD_BYTES;
+    }
+    for (; offset < to; offset++) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte == UTFLITE__ASCII_LF || byte == UTFLITE__ASCII_CR) {
+            return offset;
+        }
+    }
+    return to;
+}
+
+/* Nonzero when a line starts right after the break byte at text[offset];
+ * a CR directly followed by LF leaves that to the LF. */
+static int utflite__line_start_after(const char *text, int length, int offset) {
+    return text[offset] == UTFLITE__ASCII_LF || offset + 1 >= length || text[offset + 1] != UTFLITE__ASCII_LF;
+}
+
+/* Returns where line 'line' starts; the line must exist. */
+static int utflite__line_index_get(const struct utflite_line_index *index, int line) {
+    if (line < index->gap_start) {
+        return index->starts[line];
+    }
+    return index->starts[line + index->gap_end - index->gap_start] + index->delta;
+}
+
+/* Moves the gap so it starts before line 'line', converting the entries it
+ * passes between absolute and delta-relative offsets. */
+static void utflite__line_index_move_gap(struct utflite_line_index *index, int line) {
+    int gap = index->gap_end - index->gap_start;
+    while (index->gap_start > line) {
+        index->gap_start--;
+        index->gap_end--;
+        index->starts[index->gap_end] = index->starts[index->gap_start] - index->delta;
+    }
+    while (index->gap_start < line) {
+        index->starts[index->gap_start] = index->starts[index->gap_start + gap] + index->delta;
+        index->gap_start++;
+        index->gap_end++;
+    }
+}
+
+/* Appends the line starts following breaks in text[from, to) at the gap.
+ * Returns 0 when the gap is full. */
+static int utflite__line_index_scan(struct utflite_line_index *index, const char *text, int length, int from, int to) {
+    for (int offset = utflite__line_break_find(text, from, to); offset < to;
+         offset = utflite__line_break_find(text, offset + 1, to)) {
+        if (utflite__line_start_after(text, length, offset)) {
+            if (index->gap_start == index->gap_end) {
+                return 0;
+            }
+            index->starts[index->gap_start++] = offset + 1;
+            index->line_count++;
+        }
+    }
+    return 1;
+}
+
+int utflite_line_count(const char *text, int length) {
+    int lines = 1;
+    if (!text || length <= 0) {
+        return lines;
+    }
+    for (int offset = utflite__line_break_find(text, 0, length); offset < length;
+         offset = utflite__line_break_find(text, offset + 1, length)) {
+        if (utflite__line_start_after(text, length, offset)) {
+            lines++;
+        }
+    }
+    return lines;
+}
+
+int utflite_line_index_build(struct utflite_line_index *index, int *storage, int capacity, const char *text, int length) {
+    if (!index || !storage || capacity < 1 || length < 0 || (!text && length > 0)) {
+        return 0;
+    }
+    index->starts = storage;
+    index->capacity = capacity;
+    index->delta = 0;
+    index->length = length;
+    storage[0] = 0;
+    index->line_count = 1;
+    index->gap_start = 1;
+    index->gap_end = capacity;
+    return utflite__line_index_scan(index, text, length, 0, length);
+}
+
+int utflite_line_index_update(struct utflite_line_index *index, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!index || (!text && length > 0) || edit_start < 0 ||
+        old_end < edit_start || old_end > index->length || new_end < edit_start ||
+        length != index->length + (new_end - old_end)) {
+        return 0;
+    }
+
+    /* A start s depends on bytes s - 1 and s, so old starts in
+     * [edit_start, old_end] are redone; line 0 always stays. */
+    int first = utflite_line_index_find(index, edit_start - 1) + 1;
+    utflite__line_index_move_gap(index, first);
+    while (index->gap_end < index->capacity &&
+           index->starts[index->gap_end] + index->delta <= old_end) {
+        index->gap_end++;
+        index->line_count--;
+    }
+    index->delta += new_end - old_end;
+    index->length = length;
+
+    int from = edit_start > 0 ? edit_start - 1 : 0;
+    return utflite__line_index_scan(index, text, length, from, new_end);
+}
+
+int utflite_line_index_start(const struct utflite_line_index *index, int line) {
+    if (line <= 0) {
+        return 0;
+    }
+    if (line >= index->line_count) {
+        return index->length;
+    }
+    return utflite__line_index_get(index, line);
+}
+
+int utflite_line_index_find(const struct utflite_line_index *index, int byte_offset) {
+    int low = 0;
+    int high = index->line_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (utflite__line_index_get(index, mid) <= byte_offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+/* ============================================================================
+ * Rope
+ * ============================================================================ */
+
+/*
+ * How the grapheme automaton crosses a span of text, for every state it
+ * could enter the span in: the state it leaves in and how many cluster
+ * boundaries it reports on the way. Two spans combine by feeding the first
+ * one's exit state into the second, which is what lets a node count
+ * clusters across the seam between its children.
+ */
+struct utflite__rope_grapheme_summary {
+    uint8_t exit_state[UTFLITE__GRAPHEME_STATE_COUNT];
+    int boundaries[UTFLITE__GRAPHEME_STATE_COUNT];
+};
+
+/*
+ * A rope node. Leaves hold up to about UTFLITE__ROPE_LEAF_TARGET bytes of text and
+ * always start on a byte that is not a UTF-8 continuation byte (except the
+ * first leaf), so no codepoint is ever split between leaves. Internal
+ * nodes always have two children and cache the totals of their subtree.
+ */
+struct utflite__rope_node {
+    /* Children of an internal node; NULL for leaves. */
+    struct utflite__rope_node *left;
+    struct utflite__rope_node *right;
+
+    /* Longest path down to a leaf; 0 for leaves. */
+    int height;
+
+    /* Bytes, codepoints and display columns in the subtree. */
+    int bytes;
+    int codepoints;
+    int columns;
+
+    /* CR and LF bytes that end a line; a CR at the very end counts even if
+     * the next leaf starts with LF. */
+    int line_breaks;
+
+    /* Whether the subtree's text starts with LF or ends with CR, to merge a
+     * CR LF pair split between leaves. */
+    int starts_with_lf;
+    int ends_with_cr;
+
+    /* How the grapheme automaton crosses the subtree's text. */
+    struct utflite__rope_grapheme_summary graphemes;
+
+    /* Leaf bytes; empty for internal nodes. */
+    char text[];
+};
+
+/* The rope handle: the tree plus a pool of spare internal nodes. */
+struct utflite_rope {
+    /* Root of the tree; NULL for an empty rope. */
+    struct utflite__rope_node *root;
+
+    /* Spare internal nodes, linked through 'left'. */
+    struct utflite__rope_node *spare;
+    int spare_count;
+};
+
+/* Most pieces an edit cuts new leaves from: a neighbour, the kept start of
+ * the first leaf, the new text, the kept end of the last leaf, a neighbour. */
+#define UTFLITE__ROPE_MAX_PIECES 5
+
+/* The text a new run of leaves is cut from, as contiguous pieces. */
+struct utflite__rope_pieces {
+    /* Start and length of each piece, in order. */
+    struct {
+        const char *text;
+        int length;
+    } items[UTFLITE__ROPE_MAX_PIECES];
+
+    /* Pieces in use. */
+    int count;
+};
+
+/* The two trees a split leaves: text before the cut and from it on. */
+struct utflite__rope_pair {
+    struct utflite__rope_node *left;
+    struct utflite__rope_node *right;
+};
+
+/* Returns the height of a possibly empty subtree (-1 when empty). */
+static int utflite__rope_height(const struct utflite__rope_node *node) {
+    return node ? node->height : -1;
+}
+
+/* Nonzero when 'byte' continues a multibyte sequence. */
+static int utflite__rope_is_continuation(unsigned char byte) {
+    return (byte & UTFLITE__UTF8_CONTINUATION_MASK) == UTFLITE__UTF8_CONTINUATION_BITS;
+}
+
+/*
+ * Fills in a leaf's cached totals from its bytes. The grapheme summary runs
+ * the automaton from every state at once until all runs land in the same
+ * state; from then on they agree, so one run finishes the leaf.
+ */
+static void utflite__rope_leaf_summarize(struct utflite__rope_node *leaf) {
+    const char *text = leaf->text;
+    int length = leaf->bytes;
+    uint8_t states[UTFLITE__GRAPHEME_STATE_COUNT];
+    int counts[UTFLITE__GRAPHEME_STATE_COUNT];
+    int converged = 0;
+    int shared_count = 0;
+
+    for (int state = 0; state < UTFLITE__GRAPHEME_STATE_COUNT; state++) {
+        states[state] = (uint8_t)state;
+        counts[state] = 0;
+    }
+    leaf->codepoints = utflite__utf8_lead_byte_count(text, length);
+    leaf->columns = 0;
+    leaf->line_breaks = 0;
+    for (int offset = 0; offset < length; ) {
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            leaf->columns += char_width;
+        }
+        uint8_t class = utflite__grapheme_class(codepoint);
+        if (converged) {
+            uint8_t transition = UTFLITE__GRAPHEME_DFA[states[0]][class];
+            shared_count += (transition & UTFLITE__GRAPHEME_DFA_BREAK) != 0;
+            states[0] = transition & UTFLITE__GRAPHEME_DFA_STATE_MASK;
+
+            /* Printable ASCII after printable ASCII: one column and one
+             * cluster each, and the state stays put */
+            if (codepoint >= UTFLITE__ASCII_PRINTABLE_FIRST && codepoint <= UTFLITE__ASCII_PRINTABLE_LAST) {
+                int run_end = offset;
+                while (run_end < length &&
+                       (unsigned char)text[run_end] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+                       (unsigned char)text[run_end] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+                    run_end++;
+                }
+                leaf->columns += run_end - offset;
+                shared_count += run_end - offset;
+                offset = run_end;
+            }
+            continue;
+        }
+        converged = 1;
+        for (int state = 0; state < UTFLITE__GRAPHEME_STATE_COUNT; state++) {
+            uint8_t transition = UTFLITE__GRAPHEME_DFA[states[state]][class];
+            counts[state] += (transition & UTFLITE__GRAPHEME_DFA_BREAK) != 0;
+            states[state] = transition & UTFLITE__GRAPHEME_DFA_STATE_MASK;
+            if (states[state] != states[0]) {
+                converged = 0;
+            }
+        }
+    }
+    for (int state = 0; state < UTFLITE__GRAPHEME_STATE_COUNT; state++) {
+        leaf->graphemes.exit_state[state] = converged ? states[0] : states[state];
+        leaf->graphemes.boundaries[state] = counts[state] + shared_count;
+    }
+
+    for (int offset = utflite__line_break_find(text, 0, length); offset < length;
+         offset = utflite__line_break_find(text, offset + 1, length)) {
+        if (utflite__line_start_after(text, length, offset)) {
+            leaf->line_breaks++;
+        }
+    }
+    leaf->starts_with_lf = text[0] == UTFLITE__ASCII_LF;
+    leaf->ends_with_cr = text[length - 1] == UTFLITE__ASCII_CR;
+}
+
+/* Recomputes an internal node's height and totals from its children. */
+static void utflite__rope_node_update(struct utflite__rope_node *node) {
+    const struct utflite__rope_node *left = node->left;
+    const struct utflite__rope_node *right = node->right;
+    node->height = 1 + (left->height > right->height ? left->height : right->height);
+    node->bytes = left->bytes + right->bytes;
+    node->codepoints = left->codepoints + right->codepoints;
+    node->columns = left->columns + right->columns;
+    node->line_breaks = left->line_breaks + right->line_breaks -
+                        (left->ends_with_cr && right->starts_with_lf);
+    node->starts_with_lf = left->starts_with_lf;
+    node->ends_with_cr = right->ends_with_cr;
+    for (int state = 0; state < UTFLITE__GRAPHEME_STATE_COUNT; state++) {
+        uint8_t middle = left->graphemes.exit_state[state];
+        node->graphemes.exit_state[state] = right->graphemes.exit_state[middle];
+        node->graphemes.boundaries[state] = left->graphemes.boundaries[state] +
+                                            right->graphemes.boundaries[middle];
+    }
+}
+
+/* Hands out an internal node from the spare pool (refilled before edits). */
+static struct utflite__rope_node *utflite__rope_take_node(struct utflite_rope *rope) {
+    struct utflite__rope_node *node = rope->spare;
+    rope->spare = node->left;
+    rope->spare_count--;
+    return node;
+}
+
+/* Returns an internal node to the spare pool. */
+static void utflite__rope_release_node(struct utflite_rope *rope, struct utflite__rope_node *node) {
+    node->left = rope->spare;
+    rope->spare = node;
+    rope->spare_count++;
+}
+
+/* Makes sure the spare pool holds at least 'count' internal nodes. */
+static int utflite__rope_reserve_nodes(struct utflite_rope *rope, int count) {
+    while (rope->spare_count < count) {
+        struct utflite__rope_node *node = malloc(sizeof(struct utflite__rope_node));
+        if (!node) {
+            return 0;
+        }
+        utflite__rope_release_node(rope, node);
+    }
+    return 1;
+}
+
+/* Frees a whole subtree. */
+static void utflite__rope_free_tree(struct utflite__rope_node *node) {
+    if (!node) {
+        return;
+    }
+    utflite__rope_free_tree(node->left);
+    utflite__rope_free_tree(node->right);
+    free(node);
+}
+
+static struct utflite__rope_node *utflite__rope_rotate_left(struct utflite__rope_node *node) {
+    struct utflite__rope_node *pivot = node->right;
+    node->right = pivot->left;
+    utflite__rope_node_update(node);
+    pivot->left = node;
+    utflite__rope_node_update(pivot);
+    return pivot;
+}
+
+static struct utflite__rope_node *utflite__rope_rotate_right(struct utflite__rope_node *node) {
+    struct utflite__rope_node *pivot = node->left;
+    node->left = pivot->right;
+    utflite__rope_node_update(node);
+    pivot->right = node;
+    utflite__rope_node_update(pivot);
+    return pivot;
+}
+
+/* Restores the AVL height invariant at 'node' after one child changed. */
+static struct utflite__rope_node *utflite__rope_rebalance(struct utflite__rope_node *node) {
+    utflite__rope_node_update(node);
+    int balance = node->left->height - node->right->height;
+    if (balance > 1) {
+        if (utflite__rope_height(node->left->left) < utflite__rope_height(node->left->right)) {
+            node->left = utflite__rope_rotate_left(node->left);
+        }
+        return utflite__rope_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (utflite__rope_height(node->right->right) < utflite__rope_height(node->right->left)) {
+            node->right = utflite__rope_rotate_right(node->right);
+        }
+        return utflite__rope_rotate_left(node);
+    }
+    return node;
+}
+
+/*
+ * Concatenates two trees. The taller one is descended along its inner
+ * spine to a subtree of similar height, joined there, and rebalanced on the
+ * way back up, so the cost is proportional to the height difference.
+ */
+static struct utflite__rope_node *utflite__rope_join(struct utflite_rope *rope, struct utflite__rope_node *left, struct utflite__rope_node *right) {
+    if (!left) {
+        return right;
+    }
+    if (!right) {
+        return left;
+    }
+    if (left->height > right->height + 1) {
+        left->right = utflite__rope_join(rope, left->right, right);
+        return utflite__rope_rebalance(left);
+    }
+    if (right->height > left->height + 1) {
+        right->left = utflite__rope_join(rope, left, right->left);
+        return utflite__rope_rebalance(right);
+    }
+    struct utflite__rope_node *node = utflite__rope_take_node(rope);
+    node->left = left;
+    node->right = right;
+    utflite__rope_node_update(node);
+    return node;
+}
+
+/*
+ * Splits a tree before the leaf containing byte 'offset' (which must lie
+ * inside the tree). Internal nodes on the path go back to the spare pool.
+ */
+static struct utflite__rope_pair utflite__rope_split(struct utflite_rope *rope, struct utflite__rope_node *node, int offset) {
+    struct utflite__rope_pair pair = { NULL, node };
+    if (!node->left) {
+        return pair;
+    }
+    struct utflite__rope_node *left_child = node->left;
+    struct utflite__rope_node *right_child = node->right;
+    utflite__rope_release_node(rope, node);
+    if (offset < left_child->bytes) {
+        pair = utflite__rope_split(rope, left_child, offset);
+        pair.right = utflite__rope_join(rope, pair.right, right_child);
+    } else {
+        pair = utflite__rope_split(rope, right_child, offset - left_child->bytes);
+        pair.left = utflite__rope_join(rope, left_child, pair.left);
+    }
+    return pair;
+}
+
+/* Returns the leaf holding byte 'offset' and stores where it starts. */
+static struct utflite__rope_node *utflite__rope_find_leaf(struct utflite__rope_node *node, int offset, int *leaf_start) {
+    *leaf_start = 0;
+    while (node->left) {
+        if (offset < node->left->bytes) {
+            node = node->left;
+        } else {
+            *leaf_start += node->left->bytes;
+            offset -= node->left->bytes;
+            node = node->right;
+        }
+    }
+    return node;
+}
+
+/* Returns byte 'offset' of the text described by 'pieces'. */
+static unsigned char utflite__rope_piece_byte(const struct utflite__rope_pieces *pieces, int offset) {
+    for (int i = 0; i < pieces->count; i++) {
+        if (offset < pieces->items[i].length) {
+            return (unsigned char)pieces->items[i].text[offset];
+        }
+        offset -= pieces->items[i].length;
+    }
+    return 0;
+}
+
+/* Copies bytes [start, start + count) of the pieces into 'out'. */
+static void utflite__rope_piece_copy(const struct utflite__rope_pieces *pieces, int start, int count, char *out) {
+    for (int i = 0; i < pieces->count && count > 0; i++) {
+        if (start >= pieces->items[i].length) {
+            start -= pieces->items[i].length;
+            continue;
+        }
+        int take = pieces->items[i].length - start;
+        if (take > count) {
+            take = count;
+        }
+        memcpy(out, pieces->items[i].text + start, (size_t)take);
+        out += take;
+        count -= take;
+        start = 0;
+    }
+}
+
+/*
+ * Cuts the concatenated pieces into evenly sized leaves of about
+ * UTFLITE__ROPE_LEAF_TARGET bytes, moving each cut forward to the next byte that
+ * starts a codepoint. The leaves are stored as a list linked through
+ * 'right'. Returns how many there are, or -1 (allocating nothing) when
+ * memory runs out.
+ */
+static int utflite__rope_build_leaves(const struct utflite__rope_pieces *pieces, struct utflite__rope_node **leaves) {
+    int total = 0;
+    for (int i = 0; i < pieces->count; i++) {
+        total += pieces->items[i].length;
+    }
+    *leaves = NULL;
+    if (total == 0) {
+        return 0;
+    }
+
+    int wanted = (total + UTFLITE__ROPE_LEAF_TARGET - 1) / UTFLITE__ROPE_LEAF_TARGET;
+    struct utflite__rope_node **tail = leaves;
+    int leaf_count = 0;
+    int start = 0;
+    for (int leaf_number = 1; leaf_number <= wanted; leaf_number++) {
+        int end = (int)((long long)total * leaf_number / wanted);
+        while (end < total && utflite__rope_is_continuation(utflite__rope_piece_byte(pieces, end))) {
+            end++;
+        }
+        if (end <= start) {
+            continue;
+        }
+        struct utflite__rope_node *leaf = malloc(sizeof(struct utflite__rope_node) + (size_t)(end - start));
+        if (!leaf) {
+            utflite__rope_free_tree(*leaves);
+            *leaves = NULL;
+            return -1;
+        }
+        leaf->left = NULL;
+        leaf->right = NULL;
+        leaf->height = 0;
+        leaf->bytes = end - start;
+        utflite__rope_piece_copy(pieces, start, end - start, leaf->text);
+        utflite__rope_leaf_summarize(leaf);
+        *tail = leaf;
+        tail = &leaf->right;
+        leaf_count++;
+        start = end;
+    }
+    return leaf_count;
+}
+
+struct utflite_rope *utflite_rope_create(const char *text, int length) {
+    if (length < 0 || (!text && length > 0)) {
+        return NULL;
+    }
+    struct utflite_rope *rope = malloc(sizeof(struct utflite_rope));
+    if (!rope) {
+        return NULL;
+    }
+    rope->root = NULL;
+    rope->spare = NULL;
+    rope->spare_count = 0;
+    if (!utflite_rope_replace(rope, 0, 0, text, length)) {
+        utflite_rope_destroy(rope);
+        return NULL;
+    }
+    return rope;
+}
+
+void utflite_rope_destroy(struct utflite_rope *rope) {
+    if (!rope) {
+        return;
+    }
+    utflite__rope_free_tree(rope->root);
+    while (rope->spare) {
+        free(utflite__rope_take_node(rope));
+    }
+    free(rope);
+}
+
+int utflite_rope_replace(struct utflite_rope *rope, int start, int end, const char *text, int length) {
+    int total = utflite_rope_length(rope);
+    if (!rope || start < 0 || end < start || end > total || length < 0 ||
+        (!text && length > 0)) {
+        return 0;
+    }
+    if (start == end && length == 0) {
+        return 1;
+    }
+
+    /*
+     * Rebuild the leaves the edit touches: the one holding the byte before
+     * 'start' and the one holding the last replaced byte. Their kept bytes
+     * plus the new text become a fresh run of leaves. Both ends of that run
+     * sit where old leaves began or ended, so leaves still start on
+     * codepoint boundaries.
+     */
+    struct utflite__rope_pieces pieces;
+    pieces.count = 0;
+    int range_start = 0;
+    int range_end = 0;
+    int merged = length;
+    struct utflite__rope_node *first = NULL;
+    struct utflite__rope_node *last = NULL;
+    int first_start = 0;
+    int last_start = 0;
+    if (total > 0) {
+        first = utflite__rope_find_leaf(rope->root, start > 0 ? start - 1 : 0, &first_start);
+        last = utflite__rope_find_leaf(rope->root, end > start ? end - 1 : (start > 0 ? start - 1 : 0),
+                              &last_start);
+        range_start = first_start;
+        range_end = last_start + last->bytes;
+        merged = (start - first_start) + length + (range_end - end);
+    }
+
+    /* Pull in a neighbouring leaf rather than leave a tiny one behind */
+    struct utflite__rope_node *previous = NULL;
+    struct utflite__rope_node *next = NULL;
+    if (total > 0 && merged < UTFLITE__ROPE_LEAF_MINIMUM) {
+        int neighbour_start;
+        if (range_end < total) {
+            next = utflite__rope_find_leaf(rope->root, range_end, &neighbour_start);
+            range_end += next->bytes;
+        } else if (range_start > 0) {
+            previous = utflite__rope_find_leaf(rope->root, range_start - 1, &neighbour_start);
+            range_start = neighbour_start;
+        }
+    }
+    if (previous) {
+        pieces.items[pieces.count].text = previous->text;
+        pieces.items[pieces.count++].length = previous->bytes;
+    }
+    if (first) {
+        pieces.items[pieces.count].text = first->text;
+        pieces.items[pieces.count++].length = start - first_start;
+    }
+    pieces.items[pieces.count].text = text;
+    pieces.items[pieces.count++].length = length;
+    if (last) {
+        pieces.items[pieces.count].text = last->text + (end - last_start);
+        pieces.items[pieces.count++].length = range_end - end - (next ? next->bytes : 0);
+    }
+    if (next) {
+        pieces.items[pieces.count].text = next->text;
+        pieces.items[pieces.count++].length = next->bytes;
+    }
+
+    /* Allocate everything up front so a failure leaves the rope untouched */
+    struct utflite__rope_node *leaves;
+    int leaf_count = utflite__rope_build_leaves(&pieces, &leaves);
+    if (leaf_count < 0) {
+        return 0;
+    }
+    if (!utflite__rope_reserve_nodes(rope, leaf_count + 2 * (utflite__rope_height(rope->root) + 2))) {
+        utflite__rope_free_tree(leaves);
+        return 0;
+    }
+
+    /* Cut out the old leaves and splice in the new ones */
+    struct utflite__rope_node *before = NULL;
+    struct utflite__rope_node *middle = rope->root;
+    struct utflite__rope_node *after = NULL;
+    if (middle && range_start > 0) {
+        struct utflite__rope_pair pair = utflite__rope_split(rope, middle, range_start);
+        before = pair.left;
+        middle = pair.right;
+    }
+    if (middle && range_end < total) {
+        struct utflite__rope_pair pair = utflite__rope_split(rope, middle, range_end - range_start);
+        middle = pair.left;
+        after = pair.right;
+    }
+    utflite__rope_free_tree(middle);
+
+    struct utflite__rope_node *inserted = NULL;
+    while (leaves) {
+        struct utflite__rope_node *leaf = leaves;
+        leaves = leaf->right;
+        leaf->right = NULL;
+        inserted = utflite__rope_join(rope, inserted, leaf);
+    }
+    rope->root = utflite__rope_join(rope, utflite__rope_join(rope, before, inserted), after);
+
+    /* Keep a modest pool for the next edit */
+    while (rope->spare_count > UTFLITE__ROPE_SPARE_NODES) {
+        free(utflite__rope_take_node(rope));
+    }
+    return 1;
+}
+
+int utflite_rope_length(const struct utflite_rope *rope) {
+    return (rope && rope->root) ? rope->root->bytes : 0;
+}
+
+void utflite_rope_get_metrics(const struct utflite_rope *rope, struct utflite_rope_metrics *metrics) {
+    const struct utflite__rope_node *root = rope ? rope->root : NULL;
+    metrics->bytes = root ? root->bytes : 0;
+    metrics->codepoints = root ? root->codepoints : 0;
+    metrics->graphemes = root ? root->graphemes.boundaries[UTFLITE__GRAPHEME_STATE_START] : 0;
+    metrics->columns = root ? root->columns : 0;
+    metrics->lines = root ? root->line_breaks + 1 : 1;
+}
+
+int utflite_rope_copy(const struct utflite_rope *rope, int start, int end, char *buffer) {
+    int total = utflite_rope_length(rope);
+    if (start < 0) {
+        start = 0;
+    }
+    if (end > total) {
+        end = total;
+    }
+    int copied = 0;
+    while (start + copied < end) {
+        int chunk_length;
+        const char *chunk = utflite_rope_chunk(rope, start + copied, &chunk_length);
+        if (chunk_length > end - start - copied) {
+            chunk_length = end - start - copied;
+        }
+        memcpy(buffer + copied, chunk, (size_t)chunk_length);
+        copied += chunk_length;
+    }
+    return copied;
+}
+
+const char *utflite_rope_chunk(const struct utflite_rope *rope, int offset, int *chunk_length) {
+    if (offset < 0 || offset >= utflite_rope_length(rope)) {
+        *chunk_length = 0;
+        return NULL;
+    }
+    int leaf_start;
+    const struct utflite__rope_node *leaf = utflite__rope_find_leaf(rope->root, offset, &leaf_start);
+    *chunk_length = leaf->bytes - (offset - leaf_start);
+    return leaf->text + (offset - leaf_start);
+}
+
+/* A walk down the tree: the metric it counts, and where it ended. */
+struct utflite__rope_position {
+    /* Metric counted in 'units'; set before utflite__rope_descend(). */
+    enum utflite_rope_metric metric;
+
+    /* The leaf the walk ended at and the byte offset it starts at. */
+    const struct utflite__rope_node *leaf;
+    int leaf_start;
+
+    /* Metric units before the leaf. */
+    int units;
+
+    /* Grapheme automaton state on entering the leaf. */
+    uint8_t state;
+
+    /* Whether the byte after the leaf is an LF. */
+    int follows_lf;
+};
+
+/* Returns a subtree's size in the position's metric when entered in the
+ * position's grapheme state. */
+static int utflite__rope_node_units(const struct utflite__rope_node *node, const struct utflite__rope_node *next, const struct utflite__rope_position *position) {
+    switch (position->metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        return node->codepoints;
+    case UTFLITE_ROPE_GRAPHEMES:
+        return node->graphemes.boundaries[position->state];
+    case UTFLITE_ROPE_COLUMNS:
+        return node->columns;
+    case UTFLITE_ROPE_LINES:
+        return node->line_breaks - (node->ends_with_cr && next && next->starts_with_lf);
+    }
+    return 0;
+}
+
+/*
+ * Descends to the leaf holding byte 'offset' (when by_offset) or to the
+ * leaf where the metric total passes 'target' (otherwise). For lines the
+ * target is a line number, so the leaf holding its starting break is
+ * chosen; for the other metrics, the leaf holding unit number 'target'.
+ */
+static void utflite__rope_descend(const struct utflite__rope_node *node, int by_offset, int target, struct utflite__rope_position *position) {
+    position->leaf_start = 0;
+    position->units = 0;
+    position->state = UTFLITE__GRAPHEME_STATE_START;
+    position->follows_lf = 0;
+    while (node->left) {
+        const struct utflite__rope_node *left = node->left;
+        int left_units = utflite__rope_node_units(left, node->right, position);
+        int go_left;
+        if (by_offset) {
+            go_left = target < position->leaf_start + left->bytes;
+        } else if (position->metric == UTFLITE_ROPE_LINES) {
+            go_left = target <= position->units + left_units;
+        } else {
+            go_left = target < position->units + left_units;
+        }
+        if (go_left) {
+            position->follows_lf = node->right->starts_with_lf;
+            node = left;
+        } else {
+            position->leaf_start += left->bytes;
+            position->units += left_units;
+            position->state = left->graphemes.exit_state[position->state];
+            node = node->right;
+        }
+    }
+    position->leaf = node;
+}
+
+/* Nonzero when the CR or LF at 'offset' of a leaf ends a line. */
+static int utflite__rope_ends_line(const struct utflite__rope_position *position, int offset) {
+    const struct utflite__rope_node *leaf = position->leaf;
+    if (leaf->text[offset] == UTFLITE__ASCII_LF) {
+        return 1;
+    }
+    if (offset + 1 < leaf->bytes) {
+        return leaf->text[offset + 1] != UTFLITE__ASCII_LF;
+    }
+    return !position->follows_lf;
+}
+
+int utflite_rope_from_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int byte_offset) {
+    struct utflite_rope_metrics totals;
+    utflite_rope_get_metrics(rope, &totals);
+    if (byte_offset >= totals.bytes) {
+        switch (metric) {
+        case UTFLITE_ROPE_CODEPOINTS:
+            return totals.codepoints;
+        case UTFLITE_ROPE_GRAPHEMES:
+            return totals.graphemes;
+        case UTFLITE_ROPE_COLUMNS:
+            return totals.columns;
+        case UTFLITE_ROPE_LINES:
+            return totals.lines - 1;
+        }
+    }
+    if (byte_offset <= 0) {
+        return 0;
+    }
+
+    struct utflite__rope_position position;
+    position.metric = metric;
+    utflite__rope_descend(rope->root, 1, byte_offset, &position);
+    const struct utflite__rope_node *leaf = position.leaf;
+    int offset = byte_offset - position.leaf_start;
+    int units = position.units;
+    switch (metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        units += utflite__utf8_lead_byte_count(leaf->text, offset + 1) - 1;
+        return units > 0 ? units : 0;
+    case UTFLITE_ROPE_LINES:
+        for (int at = utflite__line_break_find(leaf->text, 0, offset); at < offset;
+             at = utflite__line_break_find(leaf->text, at + 1, offset)) {
+            units += utflite__rope_ends_line(&position, at);
+        }
+        return units;
+    default:
+        break;
+    }
+
+    /* Graphemes count boundaries up to and including 'offset'; columns add
+     * the widths of codepoints that end by 'offset' */
+    uint8_t state = position.state;
+    for (int at = 0; at < leaf->bytes; ) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(leaf->text + at, leaf->bytes - at, &codepoint);
+        if (metric == UTFLITE_ROPE_GRAPHEMES) {
+            if (at > offset) {
+                break;
+            }
+            units += utflite__grapheme_step(&state, codepoint) != 0;
+        } else {
+            if (at + bytes > offset) {
+                break;
+            }
+            int char_width = utflite_codepoint_width(codepoint);
+            units += char_width > 0 ? char_width : 0;
+        }
+        at += bytes;
+    }
+    return metric == UTFLITE_ROPE_GRAPHEMES ? units - 1 : units;
+}
+
+int utflite_rope_to_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int value) {
+    struct utflite_rope_metrics totals;
+    utflite_rope_get_metrics(rope, &totals);
+    int limit = 0;
+    switch (metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        limit = totals.codepoints;
+        break;
+    case UTFLITE_ROPE_GRAPHEMES:
+        limit = totals.graphemes;
+        break;
+    case UTFLITE_ROPE_COLUMNS:
+        limit = totals.columns;
+        break;
+    case UTFLITE_ROPE_LINES:
+        limit = totals.lines;
+        break;
+    }
+    if (value >= limit) {
+        return totals.bytes;
+    }
+    if (value < 0 || (value == 0 && metric != UTFLITE_ROPE_COLUMNS)) {
+        return 0;
+    }
+
+    struct utflite__rope_position position;
+    position.metric = metric;
+    utflite__rope_descend(rope->root, 0, value, &position);
+    const struct utflite__rope_node *leaf = position.leaf;
+    int remaining = value - position.units;
+    switch (metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        for (int at = 0; ; at++) {
+            if (!utflite__rope_is_continuation((unsigned char)leaf->text[at]) && remaining-- == 0) {
+                return position.leaf_start + at;
+            }
+        }
+    case UTFLITE_ROPE_LINES:
+        for (int at = utflite__line_break_find(leaf->text, 0, leaf->bytes); at < leaf->bytes;
+             at = utflite__line_break_find(leaf->text, at + 1, leaf->bytes)) {
+            if (utflite__rope_ends_line(&position, at) && --remaining == 0) {
+                return position.leaf_start + at + 1;
+            }
+        }
+        return position.leaf_start + leaf->bytes;
+    default:
+        break;
+    }
+
+    /* Graphemes stop at the wanted boundary. Columns keep the last boundary
+     * that still fits, like utflite_column_index_to_offset() */
+    uint8_t state = position.state;
+    int best = -1;
+    int width = 0;
+    for (int at = 0; at < leaf->bytes; ) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(leaf->text + at, leaf->bytes - at, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint)) {
+            if (metric == UTFLITE_ROPE_GRAPHEMES) {
+                if (remaining-- == 0) {
+                    return position.leaf_start + at;
+                }
+            } else if (width > remaining) {
+                break;
+            } else {
+                best = at;
+            }
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        width += char_width > 0 ? char_width : 0;
+        at += bytes;
+    }
+    if (best >= 0) {
+        return position.leaf_start + best;
+    }
+
+    /* The cluster holding the overflowing character began in an earlier leaf */
+    int cluster = utflite_rope_from_offset(rope, UTFLITE_ROPE_GRAPHEMES, position.leaf_start);
+    return utflite_rope_to_offset(rope, UTFLITE_ROPE_GRAPHEMES, cluster);
+}
+
+/* ============================================================================
+ * Gap Buffer
+ * ============================================================================ */
+
+/* Returns byte 'offset' of the text, skipping over the gap. */
+static unsigned char utflite__gap_buffer_byte(const struct utflite_gap_buffer *buffer, int offset) {
+    if (offset >= buffer->gap_start) {
+        offset += buffer->gap_end - buffer->gap_start;
+    }
+    return (unsigned char)buffer->text[offset];
+}
+
+/* Returns the cache entry of a line. */
+static struct utflite_gap_line *utflite__gap_buffer_entry(const struct utflite_gap_buffer *buffer, int line) {
+    if (line < buffer->line_gap_start) {
+        return &buffer->lines[line];
+    }
+    return &buffer->lines[line + buffer->line_gap_end - buffer->line_gap_start];
+}
+
+/* Returns where a line starts; the line must exist. */
+static int utflite__gap_buffer_line_start(const struct utflite_gap_buffer *buffer, int line) {
+    if (line < buffer->line_gap_start) {
+        return buffer->lines[line].start;
+    }
+    return utflite_gap_buffer_length(buffer) - utflite__gap_buffer_entry(buffer, line)->start;
+}
+
+/* Clamps an offset to the text and moves it back to the start of the
+ * codepoint it falls in, as utflite_decode() splits the text. */
+static int utflite__gap_buffer_round(const struct utflite_gap_buffer *buffer, int offset) {
+    int length = utflite_gap_buffer_length(buffer);
+    if (offset <= 0) {
+        return 0;
+    }
+    if (offset >= length) {
+        return length;
+    }
+    int lead = offset;
+    while (lead > 0 && offset - lead < UTFLITE_MAX_BYTES - 1 &&
+           (utflite__gap_buffer_byte(buffer, lead) & UTFLITE__UTF8_CONTINUATION_MASK) ==
+           UTFLITE__UTF8_CONTINUATION_BITS) {
+        lead--;
+    }
+    if (lead == offset) {
+        return offset;
+    }
+
+    /* Decode the candidate sequence; a stray continuation byte stands alone */
+    char bytes[UTFLITE_MAX_BYTES];
+    int count = 0;
+    for (int at = lead; at < length && count < UTFLITE_MAX_BYTES; at++) {
+        bytes[count++] = (char)utflite__gap_buffer_byte(buffer, at);
+    }
+    uint32_t codepoint;
+    return lead + utflite_decode(bytes, count, &codepoint) > offset ? lead : offset;
+}
+
+/* Feeds text[from, to), which lies before the gap, through the grapheme
+ * automaton, remembering where the last cluster began. */
+static void utflite__gap_buffer_step(struct utflite_gap_buffer *buffer, int from, int to) {
+    int offset = from;
+    while (offset < to) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(buffer->text + offset, to - offset, &codepoint);
+        if (utflite__grapheme_step(&buffer->grapheme_state, codepoint)) {
+            buffer->grapheme_start = offset;
+        }
+        offset += bytes;
+    }
+}
 
 /*
- * InCB (Indic_Conjunct_Break) property tables for GB9c rule.
- * Linkers are virama characters that join consonants in Indic scripts.
+ * Recomputes the grapheme state at the gap if an earlier move made it
+ * stale. Clusters always break before a line break, so the scan only
+ * needs to start at the break that ends the previous line (a lone CR may
+ * still pair with an LF inserted after it).
  */
-static const uint32_t UTFLITE__INCB_LINKERS[] = {
-    0x094D, 0x09CD, 0x0ACD, 0x0B4D, 0x0C4D, 0x0D4D, 0x1039, 0x103A,
-    0x1714, 0x1715, 0x17D2, 0x1A60, 0x1B44, 0x1BAA, 0x1BAB, 0xA806,
-    0xA8C4, 0xA9C0, 0xAAF6, 0x10A3F, 0x11046, 0x110B9, 0x11133, 0x11134,
-    0x111C0, 0x11235, 0x1134D, 0x11442, 0x114C2, 0x115BF, 0x1163F, 0x116B6,
-    0x1172B, 0x11839, 0x119E0, 0x11A34, 0x11A47, 0x11A99, 0x11C3F, 0x11D45,
-    0x11D97, 0x11F41, 0x11F42,
-};
-#define UTFLITE__INCB_LINKER_COUNT (sizeof(UTFLITE__INCB_LINKERS) / sizeof(UTFLITE__INCB_LINKERS[0]))
+static void utflite__gap_buffer_sync(struct utflite_gap_buffer *buffer) {
+    if (buffer->grapheme_start >= 0) {
+        return;
+    }
+    int from = buffer->lines[buffer->line_gap_start - 1].start;
+    if (from > 1 && buffer->text[from - 1] == UTFLITE__ASCII_LF &&
+        buffer->text[from - 2] == UTFLITE__ASCII_CR) {
+        from -= 2;
+    } else if (from > 0) {
+        from--;
+    }
+    buffer->grapheme_state = UTFLITE__GRAPHEME_STATE_START;
+    buffer->grapheme_start = from;
+    utflite__gap_buffer_step(buffer, from, buffer->gap_start);
+}
 
-/* InCB Consonant ranges */
-static const struct utflite__unicode_range UTFLITE__INCB_CONSONANTS[] = {
-    {0x0915, 0x0939}, {0x0958, 0x095F}, {0x0978, 0x097F}, {0x0995, 0x09A8},
-    {0x09AA, 0x09B0}, {0x09B2, 0x09B2}, {0x09B6, 0x09B9}, {0x09DC, 0x09DD},
-    {0x09DF, 0x09E1}, {0x09F0, 0x09F1}, {0x0A15, 0x0A28}, {0x0A2A, 0x0A30},
-    {0x0A32, 0x0A33}, {0x0A35, 0x0A36}, {0x0A38, 0x0A39}, {0x0A59, 0x0A5C},
-    {0x0A5E, 0x0A5E}, {0x0A72, 0x0A74}, {0x0A95, 0x0AA8}, {0x0AAA, 0x0AB0},
-    {0x0AB2, 0x0AB3}, {0x0AB5, 0x0AB9}, {0x0AE0, 0x0AE1}, {0x0B15, 0x0B28},
-    {0x0B2A, 0x0B30}, {0x0B32, 0x0B33}, {0x0B35, 0x0B39}, {0x0B5C, 0x0B5D},
-    {0x0B5F, 0x0B61}, {0x0B71, 0x0B71}, {0x0B95, 0x0B95}, {0x0B99, 0x0B9A},
-    {0x0B9C, 0x0B9C}, {0x0B9E, 0x0B9F}, {0x0BA3, 0x0BA4}, {0x0BA8, 0x0BAA},
-    {0x0BAE, 0x0BB9}, {0x0C15, 0x0C28}, {0x0C2A, 0x0C39}, {0x0C58, 0x0C5A},
-    {0x0C5D, 0x0C5D}, {0x0C60, 0x0C61}, {0x0C95, 0x0CA8}, {0x0CAA, 0x0CB3},
-    {0x0CB5, 0x0CB9}, {0x0CDD, 0x0CDE}, {0x0CE0, 0x0CE1}, {0x0D15, 0x0D3A},
-    {0x0D54, 0x0D56}, {0x0D5F, 0x0D61}, {0x0D7A, 0x0D7F}, {0x1000, 0x1025},
-    {0x1027, 0x1027}, {0x1029, 0x102A}, {0x1050, 0x1055}, {0x105A, 0x105D},
-    {0x1061, 0x1061}, {0x1065, 0x1066}, {0x106E, 0x1070}, {0x1075, 0x1081},
-    {0x108E, 0x108E}, {0x1703, 0x170C}, {0x170E, 0x1711}, {0x1780, 0x17A2},
-    {0x17A5, 0x17A7}, {0x17A9, 0x17B3}, {0x1901, 0x1922}, {0x1930, 0x1931},
-    {0x1950, 0x196D}, {0x1980, 0x19A9}, {0x19C1, 0x19C7}, {0x1A00, 0x1A16},
-    {0x1A20, 0x1A4C}, {0x1B05, 0x1B33}, {0x1B83, 0x1BA0}, {0xA807, 0xA80A},
-    {0xA80C, 0xA822}, {0xA882, 0xA8B3}, {0xA90A, 0xA925}, {0xA930, 0xA946},
-    {0xA989, 0xA98B}, {0xA98D, 0xA9B2}, {0xAA00, 0xAA28}, {0xAA60, 0xAA6F},
-    {0xAA71, 0xAA76}, {0xAAE0, 0xAAEA}, {0x10A00, 0x10A00}, {0x10A10, 0x10A13},
-    {0x10A15, 0x10A17}, {0x10A19, 0x10A35}, {0x11005, 0x11037}, {0x11071, 0x11072},
-    {0x11075, 0x11075}, {0x11083, 0x110AF}, {0x11107, 0x1112B}, {0x11150, 0x11172},
-    {0x11183, 0x111B2}, {0x111C1, 0x111C4}, {0x11200, 0x11211}, {0x11213, 0x1122B},
-    {0x1123F, 0x11240}, {0x11284, 0x11286}, {0x11288, 0x11288}, {0x1128A, 0x1128D},
-    {0x1128F, 0x1129D}, {0x1129F, 0x112A8}, {0x11305, 0x1130C}, {0x1130F, 0x11310},
-    {0x11313, 0x11328}, {0x1132A, 0x11330}, {0x11332, 0x11333}, {0x11335, 0x11339},
-    {0x1135D, 0x11361}, {0x11400, 0x11434}, {0x11447, 0x1144A}, {0x11481, 0x114AF},
-    {0x114C4, 0x114C5}, {0x114C7, 0x114C7}, {0x11580, 0x115AE}, {0x115D8, 0x115DB},
-    {0x11600, 0x1162F}, {0x11644, 0x11644}, {0x11680, 0x116AA}, {0x116B8, 0x116B8},
-    {0x11700, 0x1171A}, {0x11800, 0x1182B}, {0x11912, 0x11935}, {0x11937, 0x11938},
-    {0x119A0, 0x119A7}, {0x119AA, 0x119D0}, {0x11A0B, 0x11A32}, {0x11A5C, 0x11A89},
-    {0x11C00, 0x11C08}, {0x11C0A, 0x11C2E}, {0x11C72, 0x11C8F}, {0x11D00, 0x11D06},
-    {0x11D08, 0x11D09}, {0x11D0B, 0x11D30}, {0x11D60, 0x11D65}, {0x11D67, 0x11D68},
-    {0x11D6A, 0x11D89}, {0x11EE0, 0x11EF2}, {0x11F02, 0x11F02}, {0x11F04, 0x11F10},
-    {0x11F12, 0x11F33},
-};
-#define UTFLITE__INCB_CONSONANT_COUNT (sizeof(UTFLITE__INCB_CONSONANTS) / sizeof(UTFLITE__INCB_CONSONANTS[0]))
+/*
+ * Moves the gap to 'offset', which must be a codepoint boundary. Line
+ * entries that cross the gap switch between absolute offsets and
+ * distances from the end. Moving forward within a line keeps the grapheme
+ * state current; any other move leaves it for utflite__gap_buffer_sync().
+ */
+static void utflite__gap_buffer_move_gap(struct utflite_gap_buffer *buffer, int offset) {
+    int length = utflite_gap_buffer_length(buffer);
+    struct utflite_gap_line *lines = buffer->lines;
+    if (offset < buffer->gap_start) {
+        int count = buffer->gap_start - offset;
+        memmove(buffer->text + buffer->gap_end - count, buffer->text + offset, (size_t)count);
+        buffer->gap_start -= count;
+        buffer->gap_end -= count;
+        while (lines[buffer->line_gap_start - 1].start > offset) {
+            buffer->line_gap_start--;
+            buffer->line_gap_end--;
+            lines[buffer->line_gap_end] = lines[buffer->line_gap_start];
+            lines[buffer->line_gap_end].start = length - lines[buffer->line_gap_start].start;
+        }
+        buffer->grapheme_start = -1;
+    } else if (offset > buffer->gap_start) {
+        int count = offset - buffer->gap_start;
+        int crossed_line = 0;
+        memmove(buffer->text + buffer->gap_start, buffer->text + buffer->gap_end, (size_t)count);
+        while (buffer->line_gap_end < buffer->line_capacity &&
+               length - lines[buffer->line_gap_end].start <= offset) {
+            lines[buffer->line_gap_start] = lines[buffer->line_gap_end];
+            lines[buffer->line_gap_start].start = length - lines[buffer->line_gap_end].start;
+            buffer->line_gap_start++;
+            buffer->line_gap_end++;
+            crossed_line = 1;
+        }
+        if (crossed_line) {
+            buffer->grapheme_start = -1;
+        } else if (buffer->grapheme_start >= 0) {
+            utflite__gap_buffer_step(buffer, buffer->gap_start, offset);
+        }
+        buffer->gap_start += count;
+        buffer->gap_end += count;
+    }
+}
+
+/*
+ * Finds the lines that start inside (from, to]. With 'store', their
+ * entries are written after the lines before the gap. Returns how many
+ * were found.
+ */
+static int utflite__gap_buffer_scan(struct utflite_gap_buffer *buffer, int from, int to, int store) {
+    int length = utflite_gap_buffer_length(buffer);
+    int gap = buffer->gap_end - buffer->gap_start;
+    int found = 0;
+    for (int piece = 0; piece < 2; piece++) {
+        int piece_from = piece == 0 ? from : buffer->gap_start;
+        int piece_to = piece == 0 ? buffer->gap_start : to;
+        int shift = piece == 0 ? 0 : gap;
+        if (piece_from < from) {
+            piece_from = from;
+        }
+        if (piece_to > to) {
+            piece_to = to;
+        }
+        for (int offset = utflite__line_break_find(buffer->text + shift, piece_from, piece_to);
+             offset < piece_to;
+             offset = utflite__line_break_find(buffer->text + shift, offset + 1, piece_to)) {
+            if (buffer->text[offset + shift] == UTFLITE__ASCII_CR && offset + 1 < length &&
+                utflite__gap_buffer_byte(buffer, offset + 1) == UTFLITE__ASCII_LF) {
+                continue;
+            }
+            if (store) {
+                struct utflite_gap_line *entry = &buffer->lines[buffer->line_gap_start + found];
+                entry->start = offset + 1;
+                entry->codepoints = -1;
+                entry->columns = 0;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+int utflite_gap_buffer_init(struct utflite_gap_buffer *buffer, char *storage, int capacity, struct utflite_gap_line *lines, int line_capacity) {
+    if (!buffer || !storage || capacity < 0 || !lines || line_capacity < 1) {
+        return 0;
+    }
+    buffer->text = storage;
+    buffer->capacity = capacity;
+    buffer->gap_start = 0;
+    buffer->gap_end = capacity;
+    buffer->lines = lines;
+    buffer->line_capacity = line_capacity;
+    buffer->line_gap_start = 1;
+    buffer->line_gap_end = line_capacity;
+    buffer->grapheme_state = UTFLITE__GRAPHEME_STATE_START;
+    buffer->grapheme_start = 0;
+    lines[0].start = 0;
+    lines[0].codepoints = -1;
+    lines[0].columns = 0;
+    return 1;
+}
+
+int utflite_gap_buffer_length(const struct utflite_gap_buffer *buffer) {
+    return buffer->capacity - (buffer->gap_end - buffer->gap_start);
+}
+
+int utflite_gap_buffer_line_count(const struct utflite_gap_buffer *buffer) {
+    return buffer->line_gap_start + buffer->line_capacity - buffer->line_gap_end;
+}
+
+int utflite_gap_buffer_replace(struct utflite_gap_buffer *buffer, int start, int end, const char *text, int length) {
+    if (!buffer) {
+        return 0;
+    }
+    int total = utflite_gap_buffer_length(buffer);
+    if (start < 0 || end < start || end > total || length < 0 || (!text && length > 0)) {
+        return 0;
+    }
+    start = utflite__gap_buffer_round(buffer, start);
+    end = utflite__gap_buffer_round(buffer, end);
+    if (buffer->gap_end - buffer->gap_start + (end - start) < length) {
+        return 0;
+    }
+    utflite__gap_buffer_move_gap(buffer, start);
+
+    /*
+     * Drop the entries of the lines the edit can change: from the line
+     * holding the byte before 'start' (a CR there may pair with a new LF)
+     * through the line holding 'end'. Their text is rescanned below.
+     */
+    int saved_line_gap_start = buffer->line_gap_start;
+    int saved_line_gap_end = buffer->line_gap_end;
+    struct utflite_gap_line *lines = buffer->lines;
+    buffer->line_gap_start--;
+    if (start > 0 && lines[buffer->line_gap_start].start == start) {
+        buffer->line_gap_start--;
+    }
+    int region_start = lines[buffer->line_gap_start].start;
+    while (buffer->line_gap_end < buffer->line_capacity &&
+           total - lines[buffer->line_gap_end].start <= end) {
+        buffer->line_gap_end++;
+    }
+    int more_lines = buffer->line_gap_end < buffer->line_capacity;
+
+    buffer->gap_end += end - start;
+    if (length > 0) {
+        memcpy(buffer->text + buffer->gap_start, text, (size_t)length);
+    }
+    buffer->gap_start += length;
+    int new_total = utflite_gap_buffer_length(buffer);
+    int region_end = more_lines ? new_total - lines[buffer->line_gap_end].start : new_total;
+
+    /* A kept line starts at region_end, so its break is not rescanned */
+    int scan_end = more_lines ? region_end - 1 : region_end;
+    int found = utflite__gap_buffer_scan(buffer, region_start, scan_end, 0);
+    if (found + 1 > buffer->line_gap_end - buffer->line_gap_start) {
+        buffer->gap_start -= length;
+        buffer->gap_end -= end - start;
+        buffer->line_gap_start = saved_line_gap_start;
+        buffer->line_gap_end = saved_line_gap_end;
+        return 0;
+    }
+    lines[buffer->line_gap_start].start = region_start;
+    lines[buffer->line_gap_start].codepoints = -1;
+    lines[buffer->line_gap_start].columns = 0;
+    buffer->line_gap_start++;
+    utflite__gap_buffer_scan(buffer, region_start, scan_end, 1);
+    buffer->line_gap_start += found;
+
+    /* Lines that start after the new gap belong on the far side of it */
+    while (lines[buffer->line_gap_start - 1].start > buffer->gap_start) {
+        buffer->line_gap_start--;
+        buffer->line_gap_end--;
+        lines[buffer->line_gap_end] = lines[buffer->line_gap_start];
+        lines[buffer->line_gap_end].start = new_total - lines[buffer->line_gap_start].start;
+    }
+
+    /* Invalid text can join with its neighbours into one sequence: resync
+     * the grapheme state, and keep the gap out of the joined sequence */
+    if (length > 0 &&
+        ((unsigned char)text[0] & UTFLITE__UTF8_CONTINUATION_MASK) == UTFLITE__UTF8_CONTINUATION_BITS) {
+        buffer->grapheme_start = -1;
+    } else if (buffer->grapheme_start >= 0) {
+        utflite__gap_buffer_step(buffer, start, start + length);
+    }
+    utflite__gap_buffer_move_gap(buffer, utflite__gap_buffer_round(buffer, buffer->gap_start));
+    return 1;
+}
+
+int utflite_gap_buffer_move_gap(struct utflite_gap_buffer *buffer, int offset) {
+    offset = utflite__gap_buffer_round(buffer, offset);
+    utflite__gap_buffer_move_gap(buffer, offset);
+    return offset;
+}
+
+int utflite_gap_buffer_prev_grapheme(struct utflite_gap_buffer *buffer) {
+    utflite__gap_buffer_sync(buffer);
+    return buffer->grapheme_start;
+}
+
+int utflite_gap_buffer_next_grapheme(struct utflite_gap_buffer *buffer) {
+    int length = utflite_gap_buffer_length(buffer);
+    int gap = buffer->gap_end - buffer->gap_start;
+    int offset = buffer->gap_start;
+    if (offset >= length) {
+        return length;
+    }
+    utflite__gap_buffer_sync(buffer);
+    uint8_t state = buffer->grapheme_state;
+    for (int first = 1; offset < length; first = 0) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(buffer->text + offset + gap, length - offset, &codepoint);
+        if (utflite__grapheme_step(&state, codepoint) && !first) {
+            break;
+        }
+        offset += bytes;
+    }
+    return offset;
+}
+
+int utflite_gap_buffer_find_line(const struct utflite_gap_buffer *buffer, int byte_offset) {
+    int low = 0;
+    int high = utflite_gap_buffer_line_count(buffer) - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (utflite__gap_buffer_line_start(buffer, mid) <= byte_offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+int utflite_gap_buffer_line(struct utflite_gap_buffer *buffer, int line, struct utflite_gap_line_metrics *metrics) {
+    int line_count = utflite_gap_buffer_line_count(buffer);
+    if (line < 0 || line >= line_count) {
+        return 0;
+    }
+    int start = utflite__gap_buffer_line_start(buffer, line);
+    int end = line + 1 < line_count ? utflite__gap_buffer_line_start(buffer, line + 1)
+                                    : utflite_gap_buffer_length(buffer);
+    struct utflite_gap_line *entry = utflite__gap_buffer_entry(buffer, line);
+    if (entry->codepoints < 0) {
+        /* Measure the line without its break, in the pieces on either
+         * side of the gap */
+        int content_end = end;
+        if (content_end > start && utflite__gap_buffer_byte(buffer, content_end - 1) == UTFLITE__ASCII_LF) {
+            content_end--;
+        }
+        if (content_end > start && utflite__gap_buffer_byte(buffer, content_end - 1) == UTFLITE__ASCII_CR) {
+            content_end--;
+        }
+        int gap = buffer->gap_end - buffer->gap_start;
+        int before_end = content_end < buffer->gap_start ? content_end : buffer->gap_start;
+        int after_start = start > buffer->gap_start ? start : buffer->gap_start;
+        entry->codepoints = 0;
+        entry->columns = 0;
+        if (start < before_end) {
+            entry->codepoints += utflite_codepoint_count(buffer->text + start, before_end - start);
+            entry->columns += utflite_string_width(buffer->text + start, before_end - start);
+        }
+        if (after_start < content_end) {
+            const char *after = buffer->text + after_start + gap;
+            entry->codepoints += utflite_codepoint_count(after, content_end - after_start);
+            entry->columns += utflite_string_width(after, content_end - after_start);
+        }
+    }
+    metrics->start = start;
+    metrics->bytes = end - start;
+    metrics->codepoints = entry->codepoints;
+    metrics->columns = entry->columns;
+    return 1;
+}
+
+int utflite_gap_buffer_copy(const struct utflite_gap_buffer *buffer, int start, int end, char *out) {
+    int length = utflite_gap_buffer_length(buffer);
+    int gap = buffer->gap_end - buffer->gap_start;
+    if (start < 0) {
+        start = 0;
+    }
+    if (end > length) {
+        end = length;
+    }
+    if (end <= start) {
+        return 0;
+    }
+    int before_end = end < buffer->gap_start ? end : buffer->gap_start;
+    int copied = 0;
+    if (start < before_end) {
+        memcpy(out, buffer->text + start, (size_t)(before_end - start));
+        copied = before_end - start;
+    }
+    if (start + copied < end) {
+        memcpy(out + copied, buffer->text + start + copied + gap, (size_t)(end - start - copied));
+    }
+    return end - start;
+}
+
+/* ============================================================================
+ * Cursor
+ * ============================================================================ */
+
+/* Measures the grapheme cluster starting at 'offset' as
+ * utflite_grapheme_width() does, also counting its codepoints. Stores where
+ * it ends and returns its width, never below 0. */
+static int utflite__cursor_cluster(const char *text, int length, int offset, int *next_offset, int *codepoints) {
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int width = 0;
+    int count = 0;
+    while (offset < length) {
+        uint32_t codepoint;
+        int cp_width;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (utflite__grapheme_step_class(&state, utflite__grapheme_class_width(codepoint, &cp_width)) &&
+            count > 0) {
+            break;
+        }
+        width = count == 0 ? cp_width : utflite__grapheme_width_extend(width, codepoint, cp_width);
+        count++;
+        offset += bytes;
+    }
+    *next_offset = offset;
+    *codepoints = count;
+    return width > 0 ? width : 0;
+}
+
+/* Moves a cursor that is not at the start back over the cluster before
+ * it. Only text[0, offset) is read. */
+static void utflite__cursor_back(struct utflite_cursor *cursor, const char *text) {
+    int end = cursor->offset;
+    int start = utflite_prev_grapheme(text, end);
+    int next;
+    int codepoints;
+    int width = utflite__cursor_cluster(text, end, start, &next, &codepoints);
+    while (next < end) {
+        /* Stepping back can group stray continuation bytes differently
+         * from decoding, so take the last cluster decoded from there */
+        start = next;
+        width = utflite__cursor_cluster(text, end, start, &next, &codepoints);
+    }
+    cursor->offset = start;
+    cursor->codepoint -= codepoints;
+    cursor->grapheme--;
+    cursor->column -= width;
+}
+
+int utflite_cursor_next(struct utflite_cursor *cursor, const char *text, int length) {
+    if (!cursor || !text || cursor->offset >= length) {
+        return 0;
+    }
+    int next;
+    int codepoints;
+    int width = utflite__cursor_cluster(text, length, cursor->offset, &next, &codepoints);
+    cursor->offset = next;
+    cursor->codepoint += codepoints;
+    cursor->grapheme++;
+    cursor->column += width;
+    return 1;
+}
+
+int utflite_cursor_prev(struct utflite_cursor *cursor, const char *text) {
+    if (!cursor || !text || cursor->offset <= 0) {
+        return 0;
+    }
+    utflite__cursor_back(cursor, text);
+    return 1;
+}
+
+int utflite_cursor_update(struct utflite_cursor *cursor, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!cursor || !text || edit_start < 0 || old_end < edit_start ||
+        new_end < edit_start || new_end > length) {
+        return 0;
+    }
+    int offset = cursor->offset;
+    if (edit_start - offset >= UTFLITE_MAX_BYTES) {
+        /* Neither the text before the cursor nor the codepoint after it,
+         * which decides whether a cluster ends there, can have changed */
+        return 1;
+    }
+    int target = offset;
+    if (offset >= old_end) {
+        target = offset - old_end + new_end;
+    } else if (offset > edit_start) {
+        target = new_end;
+    }
+    if (target > length) {
+        /* The cursor or the edit does not match the text */
+        return 0;
+    }
+    if (edit_start < offset) {
+        cursor->offset = 0;
+        cursor->codepoint = 0;
+        cursor->grapheme = 0;
+        cursor->column = 0;
+    } else {
+        /* Text before edit_start is unchanged, but a codepoint up to three
+         * bytes before it may have read into the edit. Back off to a
+         * cluster that starts further away and measure again from there. */
+        while (cursor->offset > 0 && edit_start - cursor->offset < UTFLITE_MAX_BYTES) {
+            utflite__cursor_back(cursor, text);
+        }
+    }
+    while (cursor->offset < target) {
+        utflite_cursor_next(cursor, text, length);
+    }
+    return 1;
+}
+
+int utflite_validate(const char *text, int length, int *error_offset) {
+    int offset = 0;
+    while (offset < length) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (codepoint == UTFLITE_REPLACEMENT_CHAR) {
+            unsigned char first = (unsigned char)text[offset];
+            if (first != 0xEF || length - offset < 3 ||
+                (unsigned char)text[offset + 1] != 0xBF ||
+                (unsigned char)text[offset + 2] != 0xBD) {
+                if (error_offset) {
+                    *error_offset = offset;
+                }
+                return 0;
+            }
+        }
+        offset += bytes;
+    }
+    return 1;
+}
 
-static inline int utflite__unicode_range_contains(uint32_t codepoint,
-                                                   const struct utflite__unicode_range *ranges,
-                                                   int count) {
-    int low = 0;
-    int high = count - 1;
-    while (low <= high) {
-        int mid = (low + high) / 2;
-        if (codepoint < ranges[mid].start) {
-            high = mid - 1;
-        } else if (codepoint > ranges[mid].end) {
-            low = mid + 1;
+int utflite_codepoint_count(const char *text, int length) {
+    int count = 0;
+    int offset = 0;
+    while (offset < length) {
+        offset = utflite_next_char(text, length, offset);
+        count++;
+    }
+    return count;
+}
+
+int utflite_string_width(const char *text, int length) {
+    int width = 0;
+    int offset = 0;
+    while (offset < length) {
+        int char_width = utflite_char_width(text, length, offset);
+        if (char_width > 0) {
+            width += char_width;
+        }
+        offset = utflite_next_char(text, length, offset);
+    }
+    return width;
+}
+
+int utflite_string_width_mode(const char *text, int length, enum utflite_width_mode mode) {
+    if (mode != UTFLITE_WIDTH_GRAPHEMES) {
+        return utflite_string_width(text, length);
+    }
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int total = 0;
+    int cluster = 0;
+    int offset = 0;
+    while (offset < length) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte >= UTFLITE__ASCII_PRINTABLE_FIRST && byte <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            /* Each printable ASCII byte after the first in a run closes the
+             * cluster before it and starts a new one of width 1 */
+            if (utflite__grapheme_step(&state, byte)) {
+                total += cluster > 0 ? cluster : 0;
+                cluster = 1;
+            } else if (cluster < 1) {
+                /* Joined to a Prepend (GB9b), it still takes its column */
+                cluster = 1;
+            }
+            int run_end = offset + 1;
+            while (run_end < length &&
+                   (unsigned char)text[run_end] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            if (run_end > offset + 1) {
+                total += (cluster > 0 ? cluster : 0) + run_end - offset - 2;
+                cluster = 1;
+            }
+            offset = run_end;
+            continue;
+        }
+        uint32_t codepoint;
+        int cp_width;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        if (utflite__grapheme_step_class(&state, utflite__grapheme_class_width(codepoint, &cp_width))) {
+            total += cluster > 0 ? cluster : 0;
+            cluster = cp_width;
         } else {
-            return 1;
+            cluster = utflite__grapheme_width_extend(cluster, codepoint, cp_width);
         }
     }
-    return 0;
+    return total + (cluster > 0 ? cluster : 0);
 }
 
-/* Get grapheme cluster break property for a codepoint */
-static enum utflite__gcb_property utflite__get_gcb(uint32_t cp) {
-	/* Hangul syllables: LV and LVT are computed algorithmically */
-	if (cp >= UTFLITE__HANGUL_SBASE && cp <= UTFLITE__HANGUL_SEND) {
-		return ((cp - UTFLITE__HANGUL_SBASE) % UTFLITE__HANGUL_TCOUNT == 0)
-		       ? UTFLITE__GCB_LV : UTFLITE__GCB_LVT;
-	}
+int utflite_is_zero_width(uint32_t codepoint) {
+    return utflite__unicode_range_contains(codepoint, UTFLITE__ZERO_WIDTH_RANGES, UTFLITE__ZERO_WIDTH_COUNT);
+}
 
-    /* Binary search in property table */
-    int low = 0;
-    int high = UTFLITE__GCB_RANGE_COUNT - 1;
-    while (low <= high) {
-        int mid = (low + high) / 2;
-        if (cp < UTFLITE__GCB_RANGES[mid].start) {
-            high = mid - 1;
-        } else if (cp > UTFLITE__GCB_RANGES[mid].end) {
-            low = mid + 1;
-        } else {
-            return (enum utflite__gcb_property)UTFLITE__GCB_RANGES[mid].property;
+int utflite_is_wide(uint32_t codepoint) {
+    return utflite__unicode_range_contains(codepoint, UTFLITE__DOUBLE_WIDTH_RANGES, UTFLITE__DOUBLE_WIDTH_COUNT);
+}
+
+int utflite_truncate(const char *text, int length, int max_cols) {
+    int width = 0;
+    int offset = 0;
+
+    while (offset < length) {
+        int char_width = utflite_char_width(text, length, offset);
+        if (char_width > 0) {
+            if (width + char_width > max_cols) {
+                return offset;
+            }
+            width += char_width;
         }
+        offset = utflite_next_char(text, length, offset);
     }
-    return UTFLITE__GCB_OTHER;
+    return length;
 }
 
-/* Extended_Pictographic check for GB11 (emoji ZWJ sequences) */
-static int utflite__is_extended_pictographic(uint32_t cp) {
-	/* Use double-width ranges which include Extended_Pictographic */
-	return utflite__unicode_range_contains(cp, UTFLITE__DOUBLE_WIDTH_RANGES,
-	                                       UTFLITE__DOUBLE_WIDTH_COUNT);
+/* Tab stops for utflite__grapheme_fit(): every 'size' columns, counting from
+ * 'start_col'. */
+struct utflite__tab_stops {
+    /* Columns between tab stops; 0 treats TAB like any control. */
+    int size;
+
+    /* Column the text starts at. */
+    int start_col;
+};
+
+/* Columns taken by a cluster of measured width 'cluster' whose first byte
+ * is 'first_byte', when it begins 'column' columns into the text: a TAB
+ * advances to the next tab stop, anything else is as wide as measured. */
+static int utflite__grapheme_fit_columns(const struct utflite__tab_stops *tabs, char first_byte, int cluster, int column) {
+    if (tabs && tabs->size > 0 && first_byte == UTFLITE__ASCII_TAB) {
+        return tabs->size - (tabs->start_col + column) % tabs->size;
+    }
+    return cluster > 0 ? cluster : 0;
 }
 
-/* InCB Linker check for GB9c (binary search in sorted array) */
-static int utflite__is_incb_linker(uint32_t cp) {
-    int low = 0;
-    int high = UTFLITE__INCB_LINKER_COUNT - 1;
-    while (low <= high) {
-        int mid = (low + high) / 2;
-        if (cp < UTFLITE__INCB_LINKERS[mid]) {
-            high = mid - 1;
-        } else if (cp > UTFLITE__INCB_LINKERS[mid]) {
-            low = mid + 1;
+/*
+ * Walks text[0, end) by grapheme clusters, each as wide as
+ * utflite_grapheme_width() reports, and stops before the first cluster
+ * that would take the width past max_cols. With 'tabs' a TAB advances to
+ * the next tab stop; without, it is a zero-width control. Bytes from 'end'
+ * to 'length' are only read to tell whether 'end' is a cluster boundary.
+ * Returns the boundary where the walk stopped and stores the width of the
+ * text before it.
+ */
+static int utflite__grapheme_fit(const char *text, int length, int end, int max_cols, const struct utflite__tab_stops *tabs, int *width) {
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int total = 0;
+    int cluster = 0;
+    int cluster_start = 0;
+    int offset = 0;
+    while (offset < end) {
+        unsigned char byte = (unsigned char)text[offset];
+        uint32_t codepoint = byte;
+        int cp_width = 1;
+        int bytes = 1;
+        int is_break;
+        if (byte >= UTFLITE__ASCII_PRINTABLE_FIRST && byte <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            is_break = utflite__grapheme_step(&state, byte);
         } else {
-            return 1;
+            bytes = utflite_decode(text + offset, length - offset, &codepoint);
+            is_break = utflite__grapheme_step_class(&state, utflite__grapheme_class_width(codepoint, &cp_width));
+        }
+        if (is_break && offset > 0) {
+            /* The open cluster is complete: keep it only if it fits */
+            int closed = utflite__grapheme_fit_columns(tabs, text[cluster_start], cluster, total);
+            if (total + closed > max_cols) {
+                break;
+            }
+            total += closed;
+            cluster_start = offset;
+            cluster = cp_width;
+        } else {
+            cluster = utflite__grapheme_width_extend(cluster, codepoint, cp_width);
+        }
+        offset += bytes;
+        if (byte >= UTFLITE__ASCII_PRINTABLE_FIRST && byte <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            /* The rest of a printable ASCII run: each byte closes the open
+             * cluster and opens a new one of width 1 */
+            int run_end = offset;
+            while (run_end < end &&
+                   (unsigned char)text[run_end] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            if (run_end > offset) {
+                int closed = utflite__grapheme_fit_columns(tabs, text[cluster_start], cluster, total);
+                if (total + closed > max_cols) {
+                    break;
+                }
+                total += closed;
+                int room = max_cols - total;
+                if (run_end - 1 - offset > room) {
+                    total += room;
+                    cluster_start = offset + room;
+                    break;
+                }
+                total += run_end - 1 - offset;
+                cluster_start = run_end - 1;
+                cluster = 1;
+                offset = run_end;
+                utflite__grapheme_step(&state, (unsigned char)text[run_end - 1]);
+            }
         }
     }
-    return 0;
+    if (offset == end && end > 0) {
+        /* The last cluster counts only if it ends at 'end' */
+        int at_boundary = 1;
+        if (end < length) {
+            uint32_t codepoint;
+            utflite_decode(text + end, length - end, &codepoint);
+            at_boundary = utflite__grapheme_step(&state, codepoint);
+        }
+        int closed = utflite__grapheme_fit_columns(tabs, text[cluster_start], cluster, total);
+        if (at_boundary && total + closed <= max_cols) {
+            total += closed;
+            cluster_start = end;
+        }
+    }
+    if (width) {
+        *width = total;
+    }
+    return cluster_start;
 }
 
-/* InCB Consonant check for GB9c */
-static int utflite__is_incb_consonant(uint32_t cp) {
-    return utflite__unicode_range_contains(cp, UTFLITE__INCB_CONSONANTS,
-                                           UTFLITE__INCB_CONSONANT_COUNT);
+int utflite_truncate_graphemes(const char *text, int length, int max_cols, int *width) {
+    return utflite__grapheme_fit(text, length, length, max_cols, NULL, width);
 }
 
 /*
- * Determine if there's a grapheme cluster break between two codepoints.
- * Implements UAX #29 extended grapheme cluster rules (GB3-GB13, GB999).
- *
- * incb_state: 0 = not in sequence, 1 = seen Consonant, 2 = seen Consonant+Linker
+ * Backs up from the end of text by at least 'codepoints' codepoints, then
+ * on to one the grapheme automaton restarts at (or UTFLITE__GRAPHEME_MAX_BACKTRACK
+ * more, as utflite_prev_grapheme() does), never crossing 'start'. Every
+ * boundary after the returned offset is one a scan from 'start' finds.
  */
-static int utflite__is_grapheme_break(
-    enum utflite__gcb_property prev_prop,
-    enum utflite__gcb_property curr_prop,
-    int ri_count,
-    int in_ext_pict,
-    uint32_t curr_cp,
-    int incb_state
-) {
-    /* GB3: CR × LF */
-    if (prev_prop == UTFLITE__GCB_CR && curr_prop == UTFLITE__GCB_LF) {
-        return 0;
+static int utflite__suffix_restart(const char *text, int start, int length, int codepoints) {
+    int offset = length;
+    int remaining = UTFLITE__GRAPHEME_MAX_BACKTRACK;
+    while (offset > start) {
+        uint32_t codepoint;
+        offset = utflite__codepoint_before(text, length, offset, &codepoint);
+        if (--codepoints > 0) {
+            continue;
+        }
+        if ((UTFLITE__GRAPHEME_RESTART_CLASSES & (1u << utflite__grapheme_class(codepoint))) || --remaining <= 0) {
+            break;
+        }
     }
+    return offset;
+}
 
-    /* GB4: (Control | CR | LF) ÷ */
-    if (prev_prop == UTFLITE__GCB_CONTROL ||
-        prev_prop == UTFLITE__GCB_CR ||
-        prev_prop == UTFLITE__GCB_LF) {
-        return 1;
-    }
+/* Width of the cluster at 'offset', never negative; stores where it ends. */
+static int utflite__suffix_cluster(const char *text, int length, int offset, int *next) {
+    int cluster = utflite_grapheme_width(text, length, offset, next);
+    return cluster > 0 ? cluster : 0;
+}
 
-    /* GB5: ÷ (Control | CR | LF) */
-    if (curr_prop == UTFLITE__GCB_CONTROL ||
-        curr_prop == UTFLITE__GCB_CR ||
-        curr_prop == UTFLITE__GCB_LF) {
-        return 1;
+/*
+ * Finds the last clusters of text that fit in max_cols, never crossing
+ * 'start'. Backs up once to where segmentation can restart, measures the
+ * clusters from there forward, then drops leading ones until the rest
+ * fits. If the clusters measured do not fill max_cols, it backs up twice
+ * as far and measures again. Returns where the kept suffix begins and
+ * stores its width.
+ */
+static int utflite__truncate_suffix(const char *text, int start, int length, int max_cols, int *width) {
+    /* A cluster is at least one codepoint, and most take a column */
+    int span = length - start;
+    int codepoints = max_cols < span ? max_cols + 1 : span;
+    for (;;) {
+        int restart = utflite__suffix_restart(text, start, length, codepoints);
+        int next;
+        int first = restart;
+        if (restart > start) {
+            /* The cluster at the restart point may begin before it */
+            utflite__suffix_cluster(text, length, restart, &first);
+        }
+        int total = 0;
+        for (int offset = first; offset < length; offset = next) {
+            total += utflite__suffix_cluster(text, length, offset, &next);
+        }
+        if (total > max_cols || restart <= start) {
+            int offset = first;
+            while (total > max_cols && offset < length) {
+                total -= utflite__suffix_cluster(text, length, offset, &next);
+                offset = next;
+            }
+            *width = total;
+            return offset;
+        }
+        codepoints = codepoints < span / 2 ? codepoints * 2 : span;
     }
+}
 
-    /* GB6: L × (L | V | LV | LVT) */
-    if (prev_prop == UTFLITE__GCB_L &&
-        (curr_prop == UTFLITE__GCB_L || curr_prop == UTFLITE__GCB_V ||
-         curr_prop == UTFLITE__GCB_LV || curr_prop == UTFLITE__GCB_LVT)) {
+int utflite_truncate_ellipsis(const char *text, int length, int max_cols, enum utflite_ellipsis_mode mode, char *buffer, int *width) {
+    if (length <= 0) {
+        if (width) {
+            *width = 0;
+        }
         return 0;
     }
-
-    /* GB7: (LV | V) × (V | T) */
-    if ((prev_prop == UTFLITE__GCB_LV || prev_prop == UTFLITE__GCB_V) &&
-        (curr_prop == UTFLITE__GCB_V || curr_prop == UTFLITE__GCB_T)) {
-        return 0;
+    int room = max_cols - UTFLITE__ELLIPSIS_WIDTH;
+    int head_cols = room;
+    if (mode == UTFLITE_ELLIPSIS_START) {
+        head_cols = 0;
+    } else if (mode == UTFLITE_ELLIPSIS_MIDDLE) {
+        head_cols = room - room / 2;
     }
-
-    /* GB8: (LVT | T) × T */
-    if ((prev_prop == UTFLITE__GCB_LVT || prev_prop == UTFLITE__GCB_T) &&
-        curr_prop == UTFLITE__GCB_T) {
-        return 0;
+    if (head_cols > max_cols) {
+        head_cols = max_cols;
     }
 
-    /* GB9: × (Extend | ZWJ) */
-    if (curr_prop == UTFLITE__GCB_EXTEND || curr_prop == UTFLITE__GCB_ZWJ) {
-        return 0;
+    /* The head the result would keep, then whether the rest fits beside it
+     * without an ellipsis. Both scans stop after about max_cols columns. */
+    int head_width;
+    int head = utflite_truncate_graphemes(text, length, head_cols, &head_width);
+    int rest_width;
+    int rest = utflite_truncate_graphemes(text + head, length - head,
+                                          max_cols - head_width, &rest_width);
+    if (head + rest == length) {
+        memcpy(buffer, text, (size_t)length);
+        if (width) {
+            *width = head_width + rest_width;
+        }
+        return length;
     }
-
-    /* GB9a: × SpacingMark */
-    if (curr_prop == UTFLITE__GCB_SPACING_MARK) {
+    if (room < 0) {
+        if (width) {
+            *width = 0;
+        }
         return 0;
     }
 
-    /* GB9b: Prepend × */
-    if (prev_prop == UTFLITE__GCB_PREPEND) {
-        return 0;
+    if (mode == UTFLITE_ELLIPSIS_START) {
+        head = 0;
+        head_width = 0;
     }
-
-    /* GB9c: Indic conjunct sequences - don't break before Consonant
-     * if we've seen Consonant + [Extend|Linker]* + Linker */
-    if (incb_state == 2 && utflite__is_incb_consonant(curr_cp)) {
-        return 0;
+    int tail = length;
+    int tail_width = 0;
+    if (mode != UTFLITE_ELLIPSIS_END) {
+        tail = utflite__truncate_suffix(text, head, length, room - head_width, &tail_width);
     }
 
-    /* GB11: ExtPict Extend* ZWJ × ExtPict */
-    if (in_ext_pict && prev_prop == UTFLITE__GCB_ZWJ &&
-        utflite__is_extended_pictographic(curr_cp)) {
-        return 0;
+    memcpy(buffer, text, (size_t)head);
+    memcpy(buffer + head, UTFLITE__ELLIPSIS_UTF8, UTFLITE__ELLIPSIS_BYTES);
+    memcpy(buffer + head + UTFLITE__ELLIPSIS_BYTES, text + tail, (size_t)(length - tail));
+    if (width) {
+        *width = head_width + UTFLITE__ELLIPSIS_WIDTH + tail_width;
     }
+    return head + UTFLITE__ELLIPSIS_BYTES + length - tail;
+}
 
-    /* GB12/GB13: RI × RI (only for pairs) */
-    if (prev_prop == UTFLITE__GCB_REGIONAL_INDICATOR &&
-        curr_prop == UTFLITE__GCB_REGIONAL_INDICATOR) {
-        /* Break if we've already seen an even number of RIs */
-        return (ri_count % 2) == 0;
+int utflite_pad(const char *text, int length, int cols, enum utflite_align align, char *buffer) {
+    int width;
+    int kept = utflite_truncate_graphemes(text, length, cols, &width);
+    int padding = cols > width ? cols - width : 0;
+    int before = 0;
+    if (align == UTFLITE_ALIGN_RIGHT) {
+        before = padding;
+    } else if (align == UTFLITE_ALIGN_CENTER) {
+        before = padding / 2;
+    }
+    memset(buffer, UTFLITE__PADDING_BYTE, (size_t)before);
+    if (kept > 0) {
+        memcpy(buffer + before, text, (size_t)kept);
     }
+    memset(buffer + before + kept, UTFLITE__PADDING_BYTE, (size_t)(padding - before));
+    return kept + padding;
+}
 
-    /* GB999: Any ÷ Any */
-    return 1;
+int utflite_pad_row(const struct utflite_span *cells, const int *cols, const enum utflite_align *aligns, int count, const char *separator, char *buffer) {
+    int separator_length = separator ? (int)strlen(separator) : 0;
+    int written = 0;
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && separator_length > 0) {
+            memcpy(buffer + written, separator, (size_t)separator_length);
+            written += separator_length;
+        }
+        enum utflite_align align = aligns ? aligns[i] : UTFLITE_ALIGN_LEFT;
+        written += utflite_pad(cells[i].text, cells[i].length, cols[i], align, buffer + written);
+    }
+    return written;
 }
 
 /*
- * Error handling strategy: consume minimal bytes for structural errors,
- * consume full sequence for semantic errors.
+ * Nonzero when every byte of 'word' is printable ASCII: no top bit set, no
+ * byte below the space (the borrow test is exact once top bits are clear)
+ * and no DEL.
  */
-int utflite_decode(const char *bytes, int length, uint32_t *codepoint) {
-    if (length <= 0 || !bytes) {
-        *codepoint = UTFLITE_REPLACEMENT_CHAR;
-        return 1;
+static int utflite__swar_all_printable(uint64_t word) {
+    uint64_t below = (word - UTFLITE__SWAR_LOW_BITS * UTFLITE__ASCII_PRINTABLE_FIRST) & ~word &
+                     UTFLITE__SWAR_HIGH_BITS;
+    return (word & UTFLITE__SWAR_HIGH_BITS) == 0 && below == 0 &&
+           !utflite__swar_has_byte(word, UTFLITE__ASCII_PRINTABLE_LAST + 1);
+}
+
+/* Width of one table cell: its printable ASCII prefix is one column per
+ * byte. In cluster mode measuring resumes at the last byte of that prefix,
+ * which always starts a cluster. */
+static int utflite__cell_width(const char *text, int length, enum utflite_width_mode mode) {
+    int offset = 0;
+    while (offset + UTFLITE__SWAR_WORD_BYTES <= length) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        if (!utflite__swar_all_printable(word)) {
+            break;
+        }
+        offset += UTFLITE__SWAR_WORD_BYTES;
     }
-    unsigned char first = (unsigned char)bytes[0];
-    if (first < 0x80) {
-        *codepoint = first;
-        return 1;
+    while (offset < length &&
+           (unsigned char)text[offset] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+           (unsigned char)text[offset] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+        offset++;
     }
-    int sequence_length;
-    uint32_t cp;
-    if ((first & 0xE0) == 0xC0) {
-        sequence_length = 2;
-        cp = first & 0x1F;
-    } else if ((first & 0xF0) == 0xE0) {
-        sequence_length = 3;
-        cp = first & 0x0F;
-    } else if ((first & 0xF8) == 0xF0) {
-        sequence_length = 4;
-        cp = first & 0x07;
-    } else {
-        *codepoint = UTFLITE_REPLACEMENT_CHAR;
-        return 1;
+    if (offset == length) {
+        return length;
     }
-    if (length < sequence_length) {
-        *codepoint = UTFLITE_REPLACEMENT_CHAR;
-        return 1;
+    if (mode == UTFLITE_WIDTH_GRAPHEMES) {
+        if (offset > 0) {
+            offset--;
+        }
+        return offset + utflite_string_width_mode(text + offset, length - offset, mode);
     }
-    for (int i = 1; i < sequence_length; i++) {
-        unsigned char byte = (unsigned char)bytes[i];
-        if ((byte & 0xC0) != 0x80) {
-            *codepoint = UTFLITE_REPLACEMENT_CHAR;
-            return 1;
+    /* Per codepoint: decode each one once, where utflite_string_width()
+     * decodes it again to step over it */
+    int width = offset;
+    while (offset < length) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte >= UTFLITE__ASCII_PRINTABLE_FIRST && byte <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            width++;
+            offset++;
+            continue;
+        }
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            width += char_width;
         }
-        cp = (cp << 6) | (byte & 0x3F);
     }
-    if ((sequence_length == 2 && cp < 0x80) ||
-        (sequence_length == 3 && cp < 0x800) ||
-        (sequence_length == 4 && cp < 0x10000)) {
-        *codepoint = UTFLITE_REPLACEMENT_CHAR;
-        return sequence_length;
+    return width;
+}
+
+int utflite_column_widths(const struct utflite_span *cells, int rows, int columns, enum utflite_width_mode mode, int *cell_widths, int *column_widths) {
+    for (int column = 0; column < columns; column++) {
+        column_widths[column] = 0;
     }
-    if (cp >= 0xD800 && cp <= 0xDFFF) {
-        *codepoint = UTFLITE_REPLACEMENT_CHAR;
-        return sequence_length;
+    for (int row = 0; row < rows; row++) {
+        const struct utflite_span *row_cells = cells + (size_t)row * (size_t)columns;
+        for (int column = 0; column < columns; column++) {
+            int width = utflite__cell_width(row_cells[column].text, row_cells[column].length, mode);
+            if (cell_widths) {
+                cell_widths[(size_t)row * (size_t)columns + (size_t)column] = width;
+            }
+            if (width > column_widths[column]) {
+                column_widths[column] = width;
+            }
+        }
     }
-    if (cp > 0x10FFFF) {
-        *codepoint = UTFLITE_REPLACEMENT_CHAR;
-        return sequence_length;
+    int total = 0;
+    for (int column = 0; column < columns; column++) {
+        total += column_widths[column];
     }
-    *codepoint = cp;
-    return sequence_length;
+    return total;
 }
 
-int utflite_encode(uint32_t codepoint, char *buffer) {
-    if (codepoint < 0x80) {
-        buffer[0] = (char)codepoint;
-        return 1;
-    } else if (codepoint < 0x800) {
-        buffer[0] = (char)(0xC0 | (codepoint >> 6));
-        buffer[1] = (char)(0x80 | (codepoint & 0x3F));
-        return 2;
-    } else if (codepoint < 0x10000) {
-        if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
-            return 0;
-        }
-        buffer[0] = (char)(0xE0 | (codepoint >> 12));
-        buffer[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-        buffer[2] = (char)(0x80 | (codepoint & 0x3F));
-        return 3;
-    } else if (codepoint <= 0x10FFFF) {
-        buffer[0] = (char)(0xF0 | (codepoint >> 18));
-        buffer[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
-        buffer[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-        buffer[3] = (char)(0x80 | (codepoint & 0x3F));
-        return 4;
-    }
-    return 0;
+int utflite_string_width_tabs(const char *text, int length, int tab_size, int start_col) {
+    struct utflite__tab_stops tabs = { tab_size, start_col };
+    int width;
+    utflite__grapheme_fit(text, length, length, UTFLITE__UNLIMITED_COLUMNS, &tabs, &width);
+    return width;
 }
 
-int utflite_codepoint_width(uint32_t codepoint) {
-    if (codepoint < 0x20) {
-        if (codepoint == 0x00) return 0;
-        return -1;
-    }
-    if (codepoint < 0x7F) {
-        return 1;
+int utflite_truncate_tabs(const char *text, int length, int max_cols, int tab_size, int start_col, int *width) {
+    struct utflite__tab_stops tabs = { tab_size, start_col };
+    return utflite__grapheme_fit(text, length, length, max_cols, &tabs, width);
+}
+
+int utflite_offset_to_column_tabs(const char *text, int length, int byte_offset, int tab_size, int start_col) {
+    if (byte_offset < 0) {
+        byte_offset = 0;
+    } else if (byte_offset > length) {
+        byte_offset = length;
     }
-    if (codepoint == 0x7F) {
-        return -1;
+    struct utflite__tab_stops tabs = { tab_size, start_col };
+    int width;
+    utflite__grapheme_fit(text, length, byte_offset, UTFLITE__UNLIMITED_COLUMNS, &tabs, &width);
+    return start_col + width;
+}
+
+/* Places a grapheme cluster that starts at 'column' into the cells of the
+ * viewport [first_col, end_col) and returns the column after it. */
+static int utflite__cell_grid_place(struct utflite_cell *cells, const char *text, int start, int end, int width, int tab_size, int column, int first_col, int end_col) {
+    int is_tab = tab_size > 0 && text[start] == UTFLITE__ASCII_TAB;
+    if (is_tab) {
+        width = tab_size - column % tab_size;
     }
-    if (codepoint < 0xA0) {
-        return -1;
+    if (width <= 0) {
+        return column;
     }
-    if (codepoint == 0x00AD) {
-        return 1;
+    /* A cluster is drawn only when all of its columns are visible */
+    int drawn = !is_tab && column >= first_col && column + width <= end_col;
+    for (int at = column; at < column + width && at < end_col; at++) {
+        if (at < first_col) {
+            continue;
+        }
+        struct utflite_cell *cell = &cells[at - first_col];
+        cell->offset = start;
+        if (!drawn) {
+            cell->length = 0;
+            cell->width = 1;
+        } else if (at == column) {
+            cell->length = end - start;
+            cell->width = width;
+        } else {
+            cell->length = 0;
+            cell->width = 0;
+        }
     }
-    if (utflite__unicode_range_contains(codepoint, UTFLITE__ZERO_WIDTH_RANGES, UTFLITE__ZERO_WIDTH_COUNT)) {
+    return column + width;
+}
+
+int utflite_fill_cells(const char *text, int length, int first_col, int col_count, int tab_size, struct utflite_cell *cells) {
+    if (!text || first_col < 0 || col_count <= 0) {
         return 0;
     }
-    if (utflite__unicode_range_contains(codepoint, UTFLITE__DOUBLE_WIDTH_RANGES, UTFLITE__DOUBLE_WIDTH_COUNT)) {
-        return 2;
+    int end_col = first_col + col_count;
+    uint8_t state = UTFLITE__GRAPHEME_STATE_START;
+    int column = 0;
+    int cluster = 0;
+    int cluster_start = 0;
+    int offset = 0;
+    while (offset < length && column < end_col) {
+        unsigned char byte = (unsigned char)text[offset];
+        uint32_t codepoint = byte;
+        int cp_width = 1;
+        int bytes = 1;
+        int is_break;
+        if (byte >= UTFLITE__ASCII_PRINTABLE_FIRST && byte <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            is_break = utflite__grapheme_step(&state, byte);
+        } else {
+            bytes = utflite_decode(text + offset, length - offset, &codepoint);
+            is_break = utflite__grapheme_step_class(&state, utflite__grapheme_class_width(codepoint, &cp_width));
+        }
+        if (is_break && offset > 0) {
+            column = utflite__cell_grid_place(cells, text, cluster_start, offset, cluster, tab_size,
+                                     column, first_col, end_col);
+            cluster_start = offset;
+            cluster = cp_width;
+        } else {
+            cluster = utflite__grapheme_width_extend(cluster, codepoint, cp_width);
+        }
+        offset += bytes;
+        if (byte >= UTFLITE__ASCII_PRINTABLE_FIRST && byte <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            /* In a printable ASCII run every byte but the last is a cluster
+             * of its own, one column wide. The run is only scanned as far
+             * as the viewport reaches. */
+            int run_end = offset;
+            while (run_end < length && run_end - offset <= end_col - column &&
+                   (unsigned char)text[run_end] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            if (run_end > offset) {
+                column = utflite__cell_grid_place(cells, text, cluster_start, offset, cluster, tab_size,
+                                         column, first_col, end_col);
+                for (; offset < run_end - 1 && column < end_col; offset++, column++) {
+                    if (column >= first_col) {
+                        struct utflite_cell *cell = &cells[column - first_col];
+                        cell->offset = offset;
+                        cell->length = 1;
+                        cell->width = 1;
+                    }
+                }
+                cluster_start = offset;
+                cluster = 1;
+                utflite__grapheme_step(&state, (unsigned char)text[offset]);
+                offset++;
+            }
+        }
     }
-    return 1;
-}
-
-int utflite_char_width(const char *text, int length, int offset) {
-    if (offset >= length) {
+    if (offset >= length && length > 0 && column < end_col) {
+        column = utflite__cell_grid_place(cells, text, cluster_start, length, cluster, tab_size,
+                                 column, first_col, end_col);
+    }
+    if (column <= first_col) {
         return 0;
     }
-    uint32_t codepoint;
-    utflite_decode(text + offset, length - offset, &codepoint);
-    return utflite_codepoint_width(codepoint);
+    return (column < end_col ? column : end_col) - first_col;
 }
 
-int utflite_next_char(const char *text, int length, int offset) {
-    if (offset >= length) {
-        return length;
+/* Returns how many leading bytes a and b share, within 'count'. */
+static int utflite__common_prefix_length(const char *a, const char *b, int count) {
+    int offset = 0;
+    while (offset + UTFLITE__SWAR_WORD_BYTES <= count) {
+        uint64_t a_word;
+        uint64_t b_word;
+        memcpy(&a_word, a + offset, sizeof(a_word));
+        memcpy(&b_word, b + offset, sizeof(b_word));
+        if (a_word != b_word) {
+            break;
+        }
+        offset += UTFLITE__SWAR_WORD_BYTES;
     }
-    uint32_t codepoint;
-    int char_bytes = utflite_decode(text + offset, length - offset, &codepoint);
-    int next_offset = offset + char_bytes;
-    return (next_offset > length) ? length : next_offset;
+    while (offset < count && a[offset] == b[offset]) {
+        offset++;
+    }
+    return offset;
 }
 
-int utflite_prev_char(const char *text, int offset) {
-    if (offset <= 0) {
-        return 0;
+/* Returns how many trailing bytes a and b share, within 'count'. */
+static int utflite__common_suffix_length(const char *a, int a_length, const char *b, int b_length, int count) {
+    int matched = 0;
+    while (matched + UTFLITE__SWAR_WORD_BYTES <= count) {
+        uint64_t a_word;
+        uint64_t b_word;
+        memcpy(&a_word, a + a_length - matched - UTFLITE__SWAR_WORD_BYTES, sizeof(a_word));
+        memcpy(&b_word, b + b_length - matched - UTFLITE__SWAR_WORD_BYTES, sizeof(b_word));
+        if (a_word != b_word) {
+            break;
+        }
+        matched += UTFLITE__SWAR_WORD_BYTES;
     }
-    int pos = offset - 1;
-    int limit = (offset > 4) ? offset - 4 : 0;
-    while (pos > limit && ((unsigned char)text[pos] & 0xC0) == 0x80) {
-        pos--;
+    while (matched < count && a[a_length - matched - 1] == b[b_length - matched - 1]) {
+        matched++;
     }
-    return pos;
+    return matched;
 }
 
-/*
- * Returns byte offset of next grapheme cluster boundary.
- * Implements UAX #29 extended grapheme cluster segmentation.
- */
-int utflite_next_grapheme(const char *text, int length, int offset) {
-    if (!text || offset >= length || offset < 0) {
-        return length;
+/* Steps over the cluster at *offset and adds its width to *column. */
+static void utflite__line_damage_step(const char *text, int length, int *offset, int *column) {
+    int width = utflite_grapheme_width(text, length, *offset, offset);
+    if (width > 0) {
+        *column += width;
     }
+}
 
-    /* Decode first codepoint */
-    uint32_t prev_cp;
-    int bytes = utflite_decode(text + offset, length - offset, &prev_cp);
-    int next_offset = offset + bytes;
+int utflite_line_damage(const char *old_text, int old_length, const char *new_text, int new_length, int *first_col, int *end_col) {
+    int shorter = old_length < new_length ? old_length : new_length;
+    int prefix = utflite__common_prefix_length(old_text, new_text, shorter);
+    if (prefix == old_length && prefix == new_length) {
+        *first_col = 0;
+        *end_col = 0;
+        return 0;
+    }
 
-    if (next_offset >= length) {
-        return length;
+    /* Boundaries up to a codepoint before the first difference are the
+     * same in both lines, so one walk finds them. Closer to it, a boundary
+     * counts only if both lines have it. */
+    int column;
+    int start = 0;
+    if (prefix > UTFLITE_MAX_BYTES) {
+        start = utflite__grapheme_fit(old_text, old_length, prefix - UTFLITE_MAX_BYTES, UTFLITE__UNLIMITED_COLUMNS, NULL, &column);
+    } else {
+        column = 0;
+    }
+    while (start < prefix) {
+        int old_next;
+        int new_next;
+        int width = utflite_grapheme_width(old_text, old_length, start, &old_next);
+        utflite_grapheme_width(new_text, new_length, start, &new_next);
+        if (old_next != new_next || old_next > prefix) {
+            break;
+        }
+        column += width > 0 ? width : 0;
+        start = old_next;
     }
+    *first_col = column;
 
-    enum utflite__gcb_property prev_prop = utflite__get_gcb(prev_cp);
-    int ri_count = (prev_prop == UTFLITE__GCB_REGIONAL_INDICATOR) ? 1 : 0;
-    int in_ext_pict = utflite__is_extended_pictographic(prev_cp);
+    /* Walk both lines through the change until they reach the same
+     * boundary in the common suffix; from there they segment alike. */
+    int suffix = utflite__common_suffix_length(old_text, old_length, new_text, new_length,
+                                      shorter - start);
+    int old_suffix = old_length - suffix;
+    int new_suffix = new_length - suffix;
+    int old_offset = start;
+    int new_offset = start;
+    int old_column = column;
+    int new_column = column;
+    while (old_offset - old_suffix != new_offset - new_suffix || old_offset < old_suffix) {
+        if (old_offset - old_suffix <= new_offset - new_suffix) {
+            utflite__line_damage_step(old_text, old_length, &old_offset, &old_column);
+        } else {
+            utflite__line_damage_step(new_text, new_length, &new_offset, &new_column);
+        }
+    }
+    if (old_column == new_column) {
+        *end_col = old_column;
+    } else {
+        /* The suffix moved: everything after the change is redrawn */
+        int rest = utflite_string_width_mode(old_text + old_offset, old_length - old_offset,
+                                             UTFLITE_WIDTH_GRAPHEMES);
+        *end_col = (old_column > new_column ? old_column : new_column) + rest;
+    }
+    return 1;
+}
 
-    /* InCB state for GB9c: 0=none, 1=seen Consonant, 2=seen Consonant+Linker */
-    int incb_state = utflite__is_incb_consonant(prev_cp) ? 1 : 0;
+int utflite_slice_columns(const char *text, int length, int first_col, int end_col, struct utflite_column_slice *slice) {
+    slice->start = 0;
+    slice->end = 0;
+    slice->left_padding = 0;
+    slice->right_padding = 0;
+    if (first_col < 0) {
+        first_col = 0;
+    }
+    if (!text || length <= 0 || end_col <= first_col) {
+        return 0;
+    }
+    int before;
+    int start = utflite__grapheme_fit(text, length, length, first_col, NULL, &before);
+    if (before < first_col && start < length) {
+        /* A wide cluster straddles the left edge: skip it, keep its columns */
+        int next;
+        int cluster = utflite_grapheme_width(text, length, start, &next);
+        slice->left_padding = before + cluster - first_col;
+        start = next;
+    }
+    int room = end_col - first_col - slice->left_padding;
+    int width;
+    int end = start + utflite__grapheme_fit(text + start, length - start, length - start, room, NULL, &width);
+    if (end < length && width < room) {
+        /* The walk stopped short of the edge, before a cluster too wide for it */
+        slice->right_padding = room - width;
+    }
+    slice->start = start;
+    slice->end = end;
+    return width;
+}
 
-    /* Loop through following characters */
-    while (next_offset < length) {
-        uint32_t curr_cp;
-        bytes = utflite_decode(text + next_offset, length - next_offset, &curr_cp);
-        enum utflite__gcb_property curr_prop = utflite__get_gcb(curr_cp);
+int utflite_column_seek(const char *text, int length, int column, int *cluster_column, int *inside) {
+    if (column < 0) {
+        column = 0;
+    }
+    if (!text || length < 0) {
+        length = 0;
+    }
+    int offset;
+    int start_col = column;
+    int is_inside = 0;
 
-        /* Check for break */
-        if (utflite__is_grapheme_break(prev_prop, curr_prop, ri_count,
-                                       in_ext_pict, curr_cp, incb_state)) {
-            return next_offset;
+    /* Through printable ASCII every byte is a column; when the byte at the
+     * target column is printable too, the cluster starting there is it */
+    int ascii_end = column + 1 < length ? column + 1 : length;
+    int ascii = 0;
+    while (ascii + UTFLITE__SWAR_WORD_BYTES <= ascii_end) {
+        uint64_t word;
+        memcpy(&word, text + ascii, sizeof(word));
+        if (!utflite__swar_all_printable(word)) {
+            break;
         }
+        ascii += UTFLITE__SWAR_WORD_BYTES;
+    }
+    while (ascii < ascii_end && (unsigned char)text[ascii] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+           (unsigned char)text[ascii] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+        ascii++;
+    }
+    if (ascii == column + 1) {
+        offset = column;
+    } else {
+        offset = utflite__grapheme_fit(text, length, length, column, NULL, &start_col);
+        is_inside = start_col < column && offset < length;
+    }
+    if (cluster_column) {
+        *cluster_column = start_col;
+    }
+    if (inside) {
+        *inside = is_inside;
+    }
+    return offset;
+}
 
-        /* Update state for next iteration */
-        if (curr_prop == UTFLITE__GCB_REGIONAL_INDICATOR) {
-            ri_count++;
-        } else if (curr_prop != UTFLITE__GCB_EXTEND && curr_prop != UTFLITE__GCB_ZWJ) {
-            ri_count = 0;
+int utflite_convert_offsets(const char *text, int length, const int *byte_offsets, int count, int *codepoints, int *utf16, int *columns) {
+    if (!text || length < 0) {
+        length = 0;
+    }
+    int offset = 0;
+    int codepoint_count = 0;
+    int units = 0;
+    int column = 0;
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && byte_offsets[i] < byte_offsets[i - 1]) {
+            return i;
         }
-
-        /* Track ExtPict sequence for GB11 */
-        if (utflite__is_extended_pictographic(curr_cp)) {
-            in_ext_pict = 1;
-        } else if (curr_prop != UTFLITE__GCB_EXTEND && curr_prop != UTFLITE__GCB_ZWJ) {
-            in_ext_pict = 0;
+        int target = byte_offsets[i] < length ? byte_offsets[i] : length;
+        while (offset < target) {
+            /* Printable ASCII is one codepoint, unit and column per byte */
+            int run = offset;
+            while (run + UTFLITE__SWAR_WORD_BYTES <= target) {
+                uint64_t word;
+                memcpy(&word, text + run, sizeof(word));
+                if (!utflite__swar_all_printable(word)) {
+                    break;
+                }
+                run += UTFLITE__SWAR_WORD_BYTES;
+            }
+            while (run < target && (unsigned char)text[run] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+                run++;
+            }
+            codepoint_count += run - offset;
+            units += run - offset;
+            column += run - offset;
+            offset = run;
+            if (offset == target) {
+                break;
+            }
+            uint32_t codepoint;
+            int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+            if (offset + bytes > target) {
+                /* The target is inside this codepoint */
+                break;
+            }
+            int width = utflite__codepoint_width(codepoint, UTFLITE__WIDTH_NOT_LOOKED_UP);
+            codepoint_count++;
+            units += codepoint >= UTFLITE__UTF16_PAIR_FIRST ? 2 : 1;
+            column += width > 0 ? width : 0;
+            offset += bytes;
         }
-
-        /* Track InCB state for GB9c */
-        if (utflite__is_incb_consonant(curr_cp)) {
-            incb_state = 1;
-        } else if (utflite__is_incb_linker(curr_cp) && incb_state >= 1) {
-            incb_state = 2;
-        } else if (curr_prop != UTFLITE__GCB_EXTEND && curr_prop != UTFLITE__GCB_ZWJ) {
-            incb_state = 0;
+        if (codepoints) {
+            codepoints[i] = codepoint_count;
+        }
+        if (utf16) {
+            utf16[i] = units;
         }
-        /* else: Extend/ZWJ keeps the current incb_state */
+        if (columns) {
+            columns[i] = column;
+        }
+    }
+    return count;
+}
 
-        prev_cp = curr_cp;
-        prev_prop = curr_prop;
-        next_offset += bytes;
+/* ============================================================================
+ * ANSI Escape Sequences
+ * ============================================================================ */
+
+/* Returns the offset of the first ESC in text[from, to), or 'to'. memchr
+ * scans a vector at a time, so plain text costs next to nothing. */
+static int utflite__ansi_escape_find(const char *text, int from, int to) {
+    if (from >= to) {
+        return to;
     }
+    const char *escape = memchr(text + from, UTFLITE__ASCII_ESC, (size_t)(to - from));
+    return escape ? (int)(escape - text) : to;
+}
 
-    return length;
+/* Nonzero for the byte after ESC that opens a string ended by BEL or ST. */
+static int utflite__ansi_is_string_introducer(unsigned char byte) {
+    return byte == UTFLITE__ANSI_OSC || byte == UTFLITE__ANSI_DCS || byte == UTFLITE__ANSI_SOS ||
+           byte == UTFLITE__ANSI_PM || byte == UTFLITE__ANSI_APC;
 }
 
-/*
- * Returns byte offset of previous grapheme cluster boundary.
- * Scans backward and applies UAX #29 rules.
- */
-int utflite_prev_grapheme(const char *text, int offset) {
-    if (!text || offset <= 0) {
+int utflite_ansi_sequence_length(const char *text, int length, int offset) {
+    if (!text || offset < 0 || offset >= length || (unsigned char)text[offset] != UTFLITE__ASCII_ESC) {
         return 0;
     }
-
-    /* Find the start of the previous codepoint */
-    int prev_start = utflite_prev_char(text, offset);
-    if (prev_start == 0 && offset > 0) {
-        /* We're at the start after moving back one char */
-        return 0;
+    int at = offset + 1;
+    if (at >= length) {
+        return 1;
     }
-
-	/*
-	 * Strategy: scan forward from a safe point to find grapheme boundaries,
-	 * then return the last one before 'offset'.
-	 */
-	int scan_start = prev_start;
-	int remaining = UTFLITE__GRAPHEME_MAX_BACKTRACK;
-	while (remaining > 0 && scan_start > 0) {
-		int prev = utflite_prev_char(text, scan_start);
-		if (prev == scan_start) break;
-		scan_start = prev;
-		remaining--;
-	}
-
-    /* Scan forward from scan_start, tracking grapheme boundaries */
-    int curr = scan_start;
-    int grapheme_start = scan_start;
-
-    while (curr < offset) {
-        /* We need to pass a length to next_grapheme - use offset as the limit */
-        int next = utflite_next_grapheme(text, offset, curr);
-        if (next >= offset) {
-            break;
+    unsigned char introducer = (unsigned char)text[at];
+    if (introducer == UTFLITE__ANSI_CSI) {
+        for (at++; at < length; at++) {
+            unsigned char byte = (unsigned char)text[at];
+            if (byte >= UTFLITE__ANSI_CSI_FINAL_FIRST && byte <= UTFLITE__ANSI_CSI_FINAL_LAST) {
+                return at + 1 - offset;
+            }
+            if (byte < UTFLITE__ANSI_CSI_BODY_FIRST || byte > UTFLITE__ANSI_CSI_BODY_LAST) {
+                /* Malformed: the sequence ends before the stray byte */
+                break;
+            }
         }
-        grapheme_start = next;
-        curr = next;
+        return at - offset;
     }
-
-    return grapheme_start;
+    if (utflite__ansi_is_string_introducer(introducer)) {
+        for (at++; at < length; at++) {
+            unsigned char byte = (unsigned char)text[at];
+            if (byte == UTFLITE__ASCII_BEL) {
+                return at + 1 - offset;
+            }
+            if (byte == UTFLITE__ASCII_ESC) {
+                if (at + 1 >= length) {
+                    return length - offset;
+                }
+                /* ST ends the string; any other escape cancels it */
+                return (text[at + 1] == UTFLITE__ANSI_STRING_TERMINATOR ? at + 2 : at) - offset;
+            }
+        }
+        return at - offset;
+    }
+    while (at < length && (unsigned char)text[at] >= UTFLITE__ANSI_INTERMEDIATE_FIRST &&
+           (unsigned char)text[at] <= UTFLITE__ANSI_INTERMEDIATE_LAST) {
+        at++;
+    }
+    if (at < length && (unsigned char)text[at] >= UTFLITE__ANSI_FINAL_FIRST &&
+        (unsigned char)text[at] <= UTFLITE__ANSI_FINAL_LAST) {
+        at++;
+    }
+    return at - offset;
 }
 
-int utflite_validate(const char *text, int length, int *error_offset) {
+int utflite_string_width_ansi(const char *text, int length) {
+    int width = 0;
     int offset = 0;
     while (offset < length) {
-        uint32_t codepoint;
-        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
-        if (codepoint == UTFLITE_REPLACEMENT_CHAR) {
-            unsigned char first = (unsigned char)text[offset];
-            if (first != 0xEF || length - offset < 3 ||
-                (unsigned char)text[offset + 1] != 0xBF ||
-                (unsigned char)text[offset + 2] != 0xBD) {
-                if (error_offset) {
-                    *error_offset = offset;
-                }
-                return 0;
-            }
+        int escape = utflite__ansi_escape_find(text, offset, length);
+        width += utflite_string_width_mode(text + offset, escape - offset, UTFLITE_WIDTH_GRAPHEMES);
+        if (escape == length) {
+            break;
         }
-        offset += bytes;
+        offset = escape + utflite_ansi_sequence_length(text, length, escape);
     }
-    return 1;
+    return width;
 }
 
-int utflite_codepoint_count(const char *text, int length) {
-    int count = 0;
+int utflite_truncate_ansi(const char *text, int length, int max_cols, char *buffer, int *width) {
+    int written = 0;
+    int total = 0;
+    int cut = 0;
     int offset = 0;
     while (offset < length) {
-        offset = utflite_next_char(text, length, offset);
-        count++;
+        int escape = utflite__ansi_escape_find(text, offset, length);
+        if (!cut) {
+            /* Escapes end clusters, so each visible run is measured alone */
+            int run = escape - offset;
+            int run_width;
+            int kept = utflite__grapheme_fit(text + offset, run, run, max_cols - total, NULL, &run_width);
+            memcpy(buffer + written, text + offset, (size_t)kept);
+            written += kept;
+            total += run_width;
+            cut = kept < run;
+        }
+        if (escape == length) {
+            break;
+        }
+        int sequence = utflite_ansi_sequence_length(text, length, escape);
+        memcpy(buffer + written, text + escape, (size_t)sequence);
+        written += sequence;
+        offset = escape + sequence;
     }
-    return count;
+    if (width) {
+        *width = total;
+    }
+    return written;
 }
 
-int utflite_string_width(const char *text, int length) {
-    int width = 0;
+int utflite_strip_ansi(const char *text, int length, char *buffer) {
+    int written = 0;
     int offset = 0;
     while (offset < length) {
-        int char_width = utflite_char_width(text, length, offset);
-        if (char_width > 0) {
-            width += char_width;
+        int escape = utflite__ansi_escape_find(text, offset, length);
+        memmove(buffer + written, text + offset, (size_t)(escape - offset));
+        written += escape - offset;
+        if (escape == length) {
+            break;
         }
-        offset = utflite_next_char(text, length, offset);
+        offset = escape + utflite_ansi_sequence_length(text, length, escape);
     }
-    return width;
+    return written;
 }
 
-int utflite_is_zero_width(uint32_t codepoint) {
-    return utflite__unicode_range_contains(codepoint, UTFLITE__ZERO_WIDTH_RANGES, UTFLITE__ZERO_WIDTH_COUNT);
+/* ============================================================================
+ * Terminal Output
+ * ============================================================================ */
+
+/* Bytes in the UTF-8 sequence 'byte' leads, as utflite_decode() reads it;
+ * 1 for ASCII and for bytes that cannot lead a sequence. */
+static int utflite__utf8_sequence_length(unsigned char byte) {
+    if ((byte & 0xE0) == 0xC0) {
+        return 2;
+    }
+    if ((byte & 0xF0) == 0xE0) {
+        return 3;
+    }
+    if ((byte & 0xF8) == 0xF0) {
+        return 4;
+    }
+    return 1;
 }
 
-int utflite_is_wide(uint32_t codepoint) {
-    return utflite__unicode_range_contains(codepoint, UTFLITE__DOUBLE_WIDTH_RANGES, UTFLITE__DOUBLE_WIDTH_COUNT);
+/* Returns how many bytes at the end of text[0, length) start a UTF-8
+ * sequence that the text cuts short, or 0 if it ends on a whole one. */
+static int utflite__utf8_cut_length(const char *text, int length) {
+    for (int back = 1; back < UTFLITE_MAX_BYTES && back <= length; back++) {
+        unsigned char byte = (unsigned char)text[length - back];
+        if ((byte & UTFLITE__UTF8_CONTINUATION_MASK) != UTFLITE__UTF8_CONTINUATION_BITS) {
+            return utflite__utf8_sequence_length(byte) > back ? back : 0;
+        }
+    }
+    return 0;
 }
 
-int utflite_truncate(const char *text, int length, int max_cols) {
-    int width = 0;
+/*
+ * Feeds one codepoint of a print run, whose bytes end at 'end' in the
+ * input, to the grapheme automaton. A boundary opens a cell; anything else
+ * extends the open cell, or the previous call's last cluster when no cell
+ * is open yet. Returns 0, with the state untouched, when a cell is needed
+ * but all are taken.
+ */
+static int utflite__print_run_add(struct utflite_print_state *state, struct utflite_print_cell *cells, int capacity, int *count, uint32_t codepoint, int end) {
+    int cp_width;
+    uint8_t next = state->grapheme_state;
+    int is_break = utflite__grapheme_step_class(&next, utflite__grapheme_class_width(codepoint, &cp_width));
+    if (cp_width < 0) {
+        cp_width = 0;
+    }
+    if (!is_break && *count > 0) {
+        struct utflite_print_cell *cell = &cells[*count - 1];
+        cell->extra_length = end - cell->extra_offset;
+        cell->width = utflite__grapheme_width_extend(cell->width, codepoint, cp_width);
+    } else {
+        if (*count >= capacity) {
+            return 0;
+        }
+        struct utflite_print_cell *cell = &cells[(*count)++];
+        cell->codepoint = codepoint;
+        cell->extra_offset = end > 0 ? end : 0;
+        cell->extra_length = 0;
+        cell->width = is_break ? cp_width :
+                      utflite__grapheme_width_extend(state->cluster_width, codepoint, cp_width);
+        cell->joins_previous = !is_break;
+    }
+    state->grapheme_state = next;
+    return 1;
+}
+
+int utflite_print_run(struct utflite_print_state *state, const char *data, int length, struct utflite_print_cell *cells, int cell_capacity, int *cell_count) {
+    if (!state || !cells || !cell_count) {
+        return 0;
+    }
+    *cell_count = 0;
+    if (cell_capacity <= 0 || length <= 0 || !data) {
+        return 0;
+    }
+    int count = 0;
     int offset = 0;
+    if (state->pending_length > 0) {
+        /* Finish the sequence the previous read cut off. Its bytes are
+         * decoded as if the two reads were one. */
+        char joined[2 * UTFLITE_MAX_BYTES];
+        int held = state->pending_length;
+        int taken = length < UTFLITE_MAX_BYTES ? length : UTFLITE_MAX_BYTES;
+        memcpy(joined, state->pending, (size_t)held);
+        memcpy(joined + held, data, (size_t)taken);
+        if (utflite__utf8_cut_length(joined, held + taken) == held + taken) {
+            memcpy(state->pending, joined, (size_t)(held + taken));
+            state->pending_length = held + taken;
+            return length;
+        }
+        int at = 0;
+        while (at < held) {
+            uint32_t codepoint;
+            int bytes = utflite_decode(joined + at, held + taken - at, &codepoint);
+            if (!utflite__print_run_add(state, cells, cell_capacity, &count, codepoint,
+                               at + bytes - held)) {
+                memmove(state->pending, state->pending + at, (size_t)(held - at));
+                state->pending_length = held - at;
+                *cell_count = count;
+                return 0;
+            }
+            at += bytes;
+        }
+        state->pending_length = 0;
+        offset = at - held;
+    }
 
-    while (offset < length) {
-        int char_width = utflite_char_width(text, length, offset);
-        if (char_width > 0) {
-            if (width + char_width > max_cols) {
-                return offset;
+    int limit = length - utflite__utf8_cut_length(data, length);
+    while (offset < limit) {
+        unsigned char byte = (unsigned char)data[offset];
+        if (byte < UTFLITE__ASCII_PRINTABLE_FIRST || byte == UTFLITE__ASCII_DEL) {
+            break;
+        }
+        if (byte > UTFLITE__ASCII_PRINTABLE_LAST) {
+            uint32_t codepoint;
+            int bytes = utflite_decode(data + offset, length - offset, &codepoint);
+            if (!utflite__print_run_add(state, cells, cell_capacity, &count, codepoint, offset + bytes)) {
+                break;
             }
-            width += char_width;
+            offset += bytes;
+            continue;
+        }
+        if (!utflite__print_run_add(state, cells, cell_capacity, &count, byte, offset + 1)) {
+            break;
+        }
+        offset++;
+
+        /* The rest of a printable ASCII run: one-column clusters of a byte
+         * each, found a word at a time */
+        int run_end = offset;
+        int run_limit = offset + (cell_capacity - count);
+        if (run_limit > limit) {
+            run_limit = limit;
+        }
+        while (run_end + UTFLITE__SWAR_WORD_BYTES <= run_limit) {
+            uint64_t word;
+            memcpy(&word, data + run_end, sizeof(word));
+            if (!utflite__swar_all_printable(word)) {
+                break;
+            }
+            run_end += UTFLITE__SWAR_WORD_BYTES;
+        }
+        while (run_end < run_limit &&
+               (unsigned char)data[run_end] >= UTFLITE__ASCII_PRINTABLE_FIRST &&
+               (unsigned char)data[run_end] <= UTFLITE__ASCII_PRINTABLE_LAST) {
+            run_end++;
+        }
+        if (run_end > offset) {
+            for (; offset < run_end; offset++) {
+                struct utflite_print_cell *cell = &cells[count++];
+                cell->codepoint = (unsigned char)data[offset];
+                cell->extra_offset = offset + 1;
+                cell->extra_length = 0;
+                cell->width = 1;
+                cell->joins_previous = 0;
+            }
+            utflite__grapheme_step(&state->grapheme_state, (unsigned char)data[offset - 1]);
         }
-        offset = utflite_next_char(text, length, offset);
     }
-    return length;
+    if (offset == limit && limit < length) {
+        state->pending_length = length - limit;
+        memcpy(state->pending, data + limit, (size_t)state->pending_length);
+        offset = length;
+    } else if (offset < length && ((unsigned char)data[offset] < UTFLITE__ASCII_PRINTABLE_FIRST ||
+                                   (unsigned char)data[offset] == UTFLITE__ASCII_DEL)) {
+        /* Clusters always break around a control */
+        state->grapheme_state = UTFLITE__GRAPHEME_STATE_START;
+    }
+    if (count > 0) {
+        state->cluster_width = cells[count - 1].width;
+    }
+    *cell_count = count;
+    return offset;
 }
 
 #endif /* UTFLITE_IMPLEMENTATION */
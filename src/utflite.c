@@ -5,6 +5,8 @@
  */
 
 #include <utflite/utflite.h>
+#include <stdlib.h>
+#include <string.h>
 
 /* ============================================================================
  * Unicode Width Tables
@@ -618,11 +620,121 @@ enum gcb_property {
 	GCB_LVT
 };
 
+/* Number of Grapheme Cluster Break property values (rows/columns of the pair table). */
+#define GCB_PROPERTY_COUNT 14
+
+/*
+ * Feature index layout for the grapheme automaton: the GCB property plus the
+ * extra bits GB11 (Extended_Pictographic) and GB9c (InCB) need, combined as
+ * gcb + GCB_PROPERTY_COUNT * (extpict + 2 * incb). The generated tables map
+ * each feature to the class (column) it uses in the automaton.
+ */
+#define GRAPHEME_FEATURE_EXTENDED_PICTOGRAPHIC GCB_PROPERTY_COUNT
+#define GRAPHEME_FEATURE_INCB_CONSONANT (2 * GCB_PROPERTY_COUNT)
+#define GRAPHEME_FEATURE_INCB_LINKER (4 * GCB_PROPERTY_COUNT)
+#define GRAPHEME_FEATURE_COUNT (6 * GCB_PROPERTY_COUNT)
+
+/* Codepoints below this are ASCII and have a precomputed grapheme class. */
+#define ASCII_LIMIT 0x80
+
+/* Printable ASCII (space through tilde): always GCB Other, never ExtPict. */
+#define ASCII_PRINTABLE_FIRST 0x20
+#define ASCII_PRINTABLE_LAST 0x7E
+
+/* DEL, the one control byte above the printable ASCII range. */
+#define ASCII_DEL 0x7F
+
+/* Line break bytes. */
+#define ASCII_LF 0x0A
+#define ASCII_CR 0x0D
+
+/* Horizontal tab, which the *_tabs functions expand to the next tab stop. */
+#define ASCII_TAB 0x09
+
+/* Escape sequences (ECMA-48): ESC starts one, BEL or ESC '\' ends strings. */
+#define ASCII_ESC 0x1B
+#define ASCII_BEL 0x07
+#define ANSI_CSI '['
+#define ANSI_OSC ']'
+#define ANSI_DCS 'P'
+#define ANSI_SOS 'X'
+#define ANSI_PM '^'
+#define ANSI_APC '_'
+#define ANSI_STRING_TERMINATOR '\\'
+
+/* CSI parameter and intermediate bytes, then the byte that ends it. */
+#define ANSI_CSI_BODY_FIRST 0x20
+#define ANSI_CSI_BODY_LAST 0x3F
+#define ANSI_CSI_FINAL_FIRST 0x40
+#define ANSI_CSI_FINAL_LAST 0x7E
+
+/* Other escapes: intermediate bytes, then the byte that ends it. */
+#define ANSI_INTERMEDIATE_FIRST 0x20
+#define ANSI_INTERMEDIATE_LAST 0x2F
+#define ANSI_FINAL_FIRST 0x30
+#define ANSI_FINAL_LAST 0x7E
+
+/* Automaton state at the start of text (before any codepoint). */
+#define GRAPHEME_STATE_START 0
+
+/* Transition byte layout: next state in the low bits, boundary flag on top. */
+#define GRAPHEME_DFA_BREAK 0x80
+#define GRAPHEME_DFA_STATE_MASK 0x7F
+
 /* Hangul syllable constants for LV/LVT computation (Unicode 3.0) */
 #define HANGUL_SBASE  0xAC00  /* First Hangul syllable */
 #define HANGUL_SEND   0xD7A3  /* Last Hangul syllable */
 #define HANGUL_TCOUNT 28      /* Number of trailing jamo per syllable */
 
+/* Word-at-a-time (SWAR) byte scanning: eight bytes per 64-bit word. */
+#define SWAR_WORD_BYTES 8
+#define SWAR_LOW_BITS 0x0101010101010101ULL
+#define SWAR_HIGH_BITS 0x8080808080808080ULL
+#define SWAR_TOP_BYTE_SHIFT 56
+
+/* A UTF-8 continuation byte is 10xxxxxx; every other byte starts a codepoint. */
+#define UTF8_CONTINUATION_MASK 0xC0
+#define UTF8_CONTINUATION_BITS 0x80
+
+/* Lead bytes 11110xxx start four-byte sequences, which need a surrogate pair. */
+#define UTF8_FOUR_BYTE_LEAD 0xF0
+
+/* Codepoints from here on take a surrogate pair in UTF-16. */
+#define UTF16_PAIR_FIRST 0x10000
+
+/* An edit may grow a column index segment to this many intervals before
+ * the index is rebuilt to split it again. */
+#define COLUMN_INDEX_MAX_SEGMENT_INTERVALS 4
+
+/* Variation selectors that request text or emoji presentation, and the
+ * cluster widths they imply. */
+#define VARIATION_SELECTOR_TEXT 0xFE0E
+#define VARIATION_SELECTOR_EMOJI 0xFE0F
+#define TEXT_PRESENTATION_WIDTH 1
+#define EMOJI_PRESENTATION_WIDTH 2
+
+/* Tells codepoint_width() to search the double-width table itself. */
+#define WIDTH_NOT_LOOKED_UP -1
+
+/* A column budget no real text reaches, for walks that must not stop early. */
+#define UNLIMITED_COLUMNS 0x7FFFFFFF
+
+/* U+2026 HORIZONTAL ELLIPSIS, written where truncation dropped text. */
+#define ELLIPSIS_UTF8 "\xE2\x80\xA6"
+#define ELLIPSIS_BYTES 3
+#define ELLIPSIS_WIDTH 1
+
+/* Byte written by utflite_pad() to fill a cell. */
+#define PADDING_BYTE ' '
+
+/* Rope chunks are cut to about this many bytes, and an edit that would
+ * leave a chunk shorter than the minimum merges it with a neighbour. */
+#define ROPE_LEAF_TARGET 1024
+#define ROPE_LEAF_MINIMUM 256
+
+/* Spare internal rope nodes kept between edits. */
+#define ROPE_SPARE_NODES 64
+
 /* Maximum codepoints to scan backward for grapheme boundary */
 #define GRAPHEME_MAX_BACKTRACK 128
 
@@ -1212,6 +1324,128 @@ static const struct utflite_unicode_range INCB_CONSONANTS[] = {
 };
 #define INCB_CONSONANT_COUNT (sizeof(INCB_CONSONANTS) / sizeof(INCB_CONSONANTS[0]))
 
+/* BEGIN GENERATED: tools/gen_grapheme_tables.py */
+/* Span covered by the InCB tables; codepoints outside it skip both searches. */
+#define GRAPHEME_INCB_FIRST 0x0915
+#define GRAPHEME_INCB_LAST 0x11F42
+
+/* Bit per GCB property that any InCB Consonant or Linker carries. */
+#define GRAPHEME_INCB_PROPERTY_MASK 0x0191
+
+/* Number of distinct grapheme classes (columns of the automaton). */
+#define GRAPHEME_CLASS_COUNT 22
+
+/* Number of automaton states (rows of the automaton). */
+#define GRAPHEME_STATE_COUNT 20
+
+/*
+ * Grapheme class for every feature index. Classes:
+ *    0  OTHER
+ *    1  CR
+ *    2  LF
+ *    3  CONTROL
+ *    4  EXTEND
+ *    5  ZWJ
+ *    6  REGIONAL_INDICATOR
+ *    7  PREPEND
+ *    8  SPACING_MARK
+ *    9  V
+ *   10  T
+ *   11  OTHER ExtPict
+ *   12  EXTEND ExtPict
+ *   13  L ExtPict
+ *   14  LV ExtPict
+ *   15  LVT ExtPict
+ *   16  OTHER InCB=Consonant
+ *   17  EXTEND InCB=Consonant
+ *   18  PREPEND InCB=Consonant
+ *   19  SPACING_MARK InCB=Consonant
+ *   20  OTHER InCB=Linker
+ *   21  EXTEND InCB=Linker
+ */
+static const uint8_t GRAPHEME_FEATURE_CLASSES[GRAPHEME_FEATURE_COUNT] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 9, 10, 0, 0,
+    11, 0, 0, 0, 12, 0, 0, 0, 0, 13, 0, 0, 14, 15,
+    16, 0, 0, 0, 17, 0, 0, 18, 19, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    20, 0, 0, 0, 21, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* Grapheme class of each ASCII codepoint, so ASCII skips every lookup. */
+static const uint8_t GRAPHEME_ASCII_CLASSES[ASCII_LIMIT] = {
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2, 3, 3, 1, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3,
+};
+
+/* Bit per class after which the automaton reaches the same state whatever
+ * came before, so segmentation may restart at such a codepoint. */
+#define GRAPHEME_RESTART_CLASSES 0x0DEF8F
+
+/* Per class of a codepoint: bit per class of the next codepoint whose
+ * boundary the pair alone decides, whatever preceded the pair. */
+static const uint32_t GRAPHEME_PAIR_DECIDED[GRAPHEME_CLASS_COUNT] = {
+    0x3FFFFF, 0x3FFFFF, 0x3FFFFF, 0x3FFFFF, 0x3AFFFF, 0x3A17FF,
+    0x3FFFBF, 0x3FFFFF, 0x3FFFFF, 0x3FFFFF, 0x3FFFFF, 0x3FFFFF,
+    0x3AFFFF, 0x3FFFFF, 0x3FFFFF, 0x3FFFFF, 0x3FFFFF, 0x3FFFFF,
+    0x3FFFFF, 0x3FFFFF, 0x3AFFFF, 0x3AFFFF,
+};
+
+/*
+ * Transition table: GRAPHEME_DFA[state][class] holds the next state in the
+ * low bits and GRAPHEME_DFA_BREAK when a cluster boundary precedes the
+ * codepoint. Each row notes one rule state that the row stands for.
+ */
+static const uint8_t GRAPHEME_DFA[GRAPHEME_STATE_COUNT][GRAPHEME_CLASS_COUNT] = {
+    /*  0: start of text */
+    {0x81, 0x82, 0x83, 0x83, 0x81, 0x81, 0x84, 0x85, 0x81, 0x86, 0x87, 0x88, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8C, 0x8D, 0x8C, 0x81, 0x81},
+    /*  1: after OTHER */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x81, 0x01},
+    /*  2: after CR */
+    {0x81, 0x82, 0x03, 0x83, 0x81, 0x81, 0x84, 0x85, 0x81, 0x86, 0x87, 0x88, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8C, 0x8D, 0x8C, 0x81, 0x81},
+    /*  3: after LF */
+    {0x81, 0x82, 0x83, 0x83, 0x81, 0x81, 0x84, 0x85, 0x81, 0x86, 0x87, 0x88, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8C, 0x8D, 0x8C, 0x81, 0x81},
+    /*  4: after REGIONAL_INDICATOR, odd RI run */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x01, 0x85, 0x01, 0x86, 0x87, 0x88, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x81, 0x01},
+    /*  5: after PREPEND */
+    {0x01, 0x82, 0x83, 0x83, 0x01, 0x01, 0x04, 0x05, 0x01, 0x06, 0x07, 0x08, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0C, 0x0D, 0x0C, 0x01, 0x01},
+    /*  6: after V */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x84, 0x85, 0x01, 0x06, 0x07, 0x88, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x81, 0x01},
+    /*  7: after T */
+    {0x81, 0x82, 0x83, 0x83, 0x01, 0x01, 0x84, 0x85, 0x01, 0x86, 0x07, 0x88, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x81, 0x01},
+    /*  8: after OTHER, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x81, 0x08},
+    /*  9: after L, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x06, 0x87, 0x88, 0x08, 0x09, 0x0A, 0x0B, 0x8C, 0x0F, 0x8D, 0x0C, 0x81, 0x08},
+    /* 10: after LV, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x06, 0x07, 0x88, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x81, 0x08},
+    /* 11: after LVT, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x86, 0x07, 0x88, 0x08, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x81, 0x08},
+    /* 12: after OTHER, InCB consonant */
+    {0x81, 0x82, 0x83, 0x83, 0x0C, 0x0C, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x0F, 0x89, 0x8A, 0x8B, 0x8C, 0x0C, 0x8D, 0x0C, 0x81, 0x10},
+    /* 13: after PREPEND, InCB consonant */
+    {0x01, 0x82, 0x83, 0x83, 0x0C, 0x0C, 0x04, 0x05, 0x01, 0x06, 0x07, 0x08, 0x0F, 0x09, 0x0A, 0x0B, 0x0C, 0x0C, 0x0D, 0x0C, 0x10, 0x10},
+    /* 14: after ZWJ, in ExtPict Extend* */
+    {0x81, 0x82, 0x83, 0x83, 0x08, 0x0E, 0x84, 0x85, 0x01, 0x86, 0x87, 0x08, 0x08, 0x09, 0x0A, 0x0B, 0x8C, 0x0F, 0x8D, 0x0C, 0x81, 0x08},
+    /* 15: after EXTEND, in ExtPict Extend*, InCB consonant */
+    {0x81, 0x82, 0x83, 0x83, 0x0F, 0x11, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x0F, 0x89, 0x8A, 0x8B, 0x8C, 0x0F, 0x8D, 0x0C, 0x81, 0x12},
+    /* 16: after EXTEND, InCB consonant+linker */
+    {0x81, 0x82, 0x83, 0x83, 0x10, 0x10, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x12, 0x89, 0x8A, 0x8B, 0x0C, 0x0C, 0x0D, 0x0C, 0x81, 0x10},
+    /* 17: after ZWJ, in ExtPict Extend*, InCB consonant */
+    {0x81, 0x82, 0x83, 0x83, 0x0F, 0x11, 0x84, 0x85, 0x01, 0x86, 0x87, 0x08, 0x0F, 0x09, 0x0A, 0x0B, 0x8C, 0x0F, 0x8D, 0x0C, 0x81, 0x12},
+    /* 18: after EXTEND, in ExtPict Extend*, InCB consonant+linker */
+    {0x81, 0x82, 0x83, 0x83, 0x12, 0x13, 0x84, 0x85, 0x01, 0x86, 0x87, 0x88, 0x12, 0x89, 0x8A, 0x8B, 0x0C, 0x0F, 0x0D, 0x0C, 0x81, 0x12},
+    /* 19: after ZWJ, in ExtPict Extend*, InCB consonant+linker */
+    {0x81, 0x82, 0x83, 0x83, 0x12, 0x13, 0x84, 0x85, 0x01, 0x86, 0x87, 0x08, 0x12, 0x09, 0x0A, 0x0B, 0x0C, 0x0F, 0x0D, 0x0C, 0x81, 0x12},
+};
+/* END GENERATED: tools/gen_grapheme_tables.py */
+
 /* ============================================================================
  * Internal Helpers
  * ============================================================================ */
@@ -1219,9 +1453,7 @@ static const struct utflite_unicode_range INCB_CONSONANTS[] = {
 /*
  * Binary search helper to check if a codepoint falls within any range.
  */
-static int unicode_range_contains(uint32_t codepoint,
-                                   const struct utflite_unicode_range *ranges,
-                                   int count) {
+static int unicode_range_contains(uint32_t codepoint, const struct utflite_unicode_range *ranges, int count) {
     int low = 0;
     int high = count - 1;
     while (low <= high) {
@@ -1289,86 +1521,57 @@ static int is_incb_consonant(uint32_t cp) {
 }
 
 /*
- * Determine if there's a grapheme cluster break between two codepoints.
- * Implements UAX #29 extended grapheme cluster rules (GB3-GB13, GB999).
- *
- * incb_state: 0 = not in sequence, 1 = seen Consonant, 2 = seen Consonant+Linker
+ * Maps a non-ASCII codepoint to its column in the grapheme automaton,
+ * combining its GCB property with the Extended_Pictographic and InCB bits
+ * that GB11 and GB9c look at. The caller passes Extended_Pictographic in,
+ * as it may already have searched the double-width table for the width.
+ * The InCB searches only run for properties and codepoints their tables
+ * can cover.
  */
-static int is_grapheme_break(
-    enum gcb_property prev_prop,
-    enum gcb_property curr_prop,
-    int ri_count,
-    int in_ext_pict,
-    uint32_t curr_cp,
-    int incb_state
-) {
-    /* GB3: CR × LF */
-    if (prev_prop == GCB_CR && curr_prop == GCB_LF) {
-        return 0;
-    }
-
-    /* GB4: (Control | CR | LF) ÷ */
-    if (prev_prop == GCB_CONTROL || prev_prop == GCB_CR || prev_prop == GCB_LF) {
-        return 1;
-    }
-
-    /* GB5: ÷ (Control | CR | LF) */
-    if (curr_prop == GCB_CONTROL || curr_prop == GCB_CR || curr_prop == GCB_LF) {
-        return 1;
-    }
-
-    /* GB6: L × (L | V | LV | LVT) */
-    if (prev_prop == GCB_L &&
-        (curr_prop == GCB_L || curr_prop == GCB_V ||
-         curr_prop == GCB_LV || curr_prop == GCB_LVT)) {
-        return 0;
-    }
-
-    /* GB7: (LV | V) × (V | T) */
-    if ((prev_prop == GCB_LV || prev_prop == GCB_V) &&
-        (curr_prop == GCB_V || curr_prop == GCB_T)) {
-        return 0;
-    }
-
-    /* GB8: (LVT | T) × T */
-    if ((prev_prop == GCB_LVT || prev_prop == GCB_T) && curr_prop == GCB_T) {
-        return 0;
-    }
-
-    /* GB9: × (Extend | ZWJ) */
-    if (curr_prop == GCB_EXTEND || curr_prop == GCB_ZWJ) {
-        return 0;
-    }
-
-    /* GB9a: × SpacingMark */
-    if (curr_prop == GCB_SPACING_MARK) {
-        return 0;
-    }
-
-    /* GB9b: Prepend × */
-    if (prev_prop == GCB_PREPEND) {
-        return 0;
+static uint8_t grapheme_class_lookup(uint32_t cp, int extended_pictographic) {
+    enum gcb_property property = get_gcb(cp);
+    int feature = (int)property;
+    if (extended_pictographic) {
+        feature += GRAPHEME_FEATURE_EXTENDED_PICTOGRAPHIC;
     }
-
-    /* GB9c: Indic conjunct sequences - don't break before Consonant
-     * if we've seen Consonant + [Extend|Linker]* + Linker */
-    if (incb_state == 2 && is_incb_consonant(curr_cp)) {
-        return 0;
+    if (cp >= GRAPHEME_INCB_FIRST && cp <= GRAPHEME_INCB_LAST &&
+        (GRAPHEME_INCB_PROPERTY_MASK & (1u << property))) {
+        if (is_incb_consonant(cp)) {
+            feature += GRAPHEME_FEATURE_INCB_CONSONANT;
+        } else if (is_incb_linker(cp)) {
+            feature += GRAPHEME_FEATURE_INCB_LINKER;
+        }
     }
+    return GRAPHEME_FEATURE_CLASSES[feature];
+}
 
-    /* GB11: ExtPict Extend* ZWJ × ExtPict */
-    if (in_ext_pict && prev_prop == GCB_ZWJ && is_extended_pictographic(curr_cp)) {
-        return 0;
+/* Maps a codepoint to its column in the grapheme automaton; ASCII comes
+ * straight from a table. */
+static uint8_t grapheme_class(uint32_t cp) {
+    if (cp < ASCII_LIMIT) {
+        return GRAPHEME_ASCII_CLASSES[cp];
     }
+    return grapheme_class_lookup(cp, is_extended_pictographic(cp));
+}
 
-    /* GB12/GB13: RI × RI (only for pairs) */
-    if (prev_prop == GCB_REGIONAL_INDICATOR && curr_prop == GCB_REGIONAL_INDICATOR) {
-        /* Break if we've already seen an even number of RIs */
-        return (ri_count % 2) == 0;
-    }
+/*
+ * Feeds one codepoint, given as its grapheme_class() column, to the grapheme
+ * automaton (UAX #29, GB3-GB13, GB999).
+ * The state byte replaces the separate RI count, ExtPict and InCB trackers:
+ * a single table load yields both the next state and the break decision.
+ *
+ * Returns nonzero when a cluster boundary falls before this codepoint. The
+ * first codepoint after GRAPHEME_STATE_START always reports a boundary (GB1).
+ */
+static int grapheme_step_class(uint8_t *state, uint8_t class) {
+    uint8_t transition = GRAPHEME_DFA[*state][class];
+    *state = transition & GRAPHEME_DFA_STATE_MASK;
+    return transition & GRAPHEME_DFA_BREAK;
+}
 
-    /* GB999: Any ÷ Any */
-    return 1;
+/* Feeds one codepoint to the grapheme automaton; see grapheme_step_class(). */
+static int grapheme_step(uint8_t *state, uint32_t cp) {
+    return grapheme_step_class(state, grapheme_class(cp));
 }
 
 /* ============================================================================
@@ -1478,7 +1681,11 @@ int utflite_encode(uint32_t codepoint, char *buffer) {
  * Character Width
  * ============================================================================ */
 
-int utflite_codepoint_width(uint32_t codepoint) {
+/*
+ * Display width of a codepoint. 'wide' is the double-width table result
+ * when the caller already has it, or WIDTH_NOT_LOOKED_UP to search here.
+ */
+static int codepoint_width(uint32_t codepoint, int wide) {
     /* Handle ASCII range with fast path */
     if (codepoint < 0x20) {
         /* C0 control characters: treat as non-printable */
@@ -1506,13 +1713,20 @@ int utflite_codepoint_width(uint32_t codepoint) {
         return 0;
     }
     /* Check double-width ranges (CJK, fullwidth, emoji) */
-    if (unicode_range_contains(codepoint, DOUBLE_WIDTH_RANGES, DOUBLE_WIDTH_COUNT)) {
+    if (wide == WIDTH_NOT_LOOKED_UP) {
+        wide = unicode_range_contains(codepoint, DOUBLE_WIDTH_RANGES, DOUBLE_WIDTH_COUNT);
+    }
+    if (wide) {
         return 2;
     }
     /* Default: normal width */
     return 1;
 }
 
+int utflite_codepoint_width(uint32_t codepoint) {
+    return codepoint_width(codepoint, WIDTH_NOT_LOOKED_UP);
+}
+
 int utflite_char_width(const char *text, int length, int offset) {
     if (offset >= length) {
         return 0;
@@ -1522,6 +1736,60 @@ int utflite_char_width(const char *text, int length, int offset) {
     return utflite_codepoint_width(codepoint);
 }
 
+/*
+ * Looks up a codepoint's grapheme automaton column and display width
+ * together. The double-width table doubles as the Extended_Pictographic
+ * test, so one search serves both.
+ */
+static uint8_t grapheme_class_width(uint32_t cp, int *width) {
+    if (cp < ASCII_LIMIT) {
+        *width = codepoint_width(cp, 0);
+        return GRAPHEME_ASCII_CLASSES[cp];
+    }
+    int wide = unicode_range_contains(cp, DOUBLE_WIDTH_RANGES, DOUBLE_WIDTH_COUNT);
+    *width = codepoint_width(cp, wide);
+    return grapheme_class_lookup(cp, wide);
+}
+
+/* Folds a codepoint that continues a cluster into the cluster's width:
+ * the widest codepoint wins, and variation selectors pick a presentation. */
+static int grapheme_width_extend(int width, uint32_t cp, int cp_width) {
+    if (width > 0 && cp == VARIATION_SELECTOR_EMOJI) {
+        return EMOJI_PRESENTATION_WIDTH;
+    }
+    if (width > 0 && cp == VARIATION_SELECTOR_TEXT) {
+        return TEXT_PRESENTATION_WIDTH;
+    }
+    return cp_width > width ? cp_width : width;
+}
+
+int utflite_grapheme_width(const char *text, int length, int offset, int *next_offset) {
+    if (!text || offset < 0 || offset >= length) {
+        if (next_offset) {
+            *next_offset = length > 0 ? length : 0;
+        }
+        return 0;
+    }
+    uint8_t state = GRAPHEME_STATE_START;
+    uint32_t codepoint;
+    int width;
+    offset += utflite_decode(text + offset, length - offset, &codepoint);
+    grapheme_step_class(&state, grapheme_class_width(codepoint, &width));
+    while (offset < length) {
+        int cp_width;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (grapheme_step_class(&state, grapheme_class_width(codepoint, &cp_width))) {
+            break;
+        }
+        width = grapheme_width_extend(width, codepoint, cp_width);
+        offset += bytes;
+    }
+    if (next_offset) {
+        *next_offset = offset;
+    }
+    return width;
+}
+
 /* ============================================================================
  * String Navigation
  * ============================================================================ */
@@ -1557,66 +1825,42 @@ int utflite_next_grapheme(const char *text, int length, int offset) {
         return length;
     }
 
-    /* Decode first codepoint */
-    uint32_t prev_cp;
-    int bytes = utflite_decode(text + offset, length - offset, &prev_cp);
-    int next_offset = offset + bytes;
-
-    if (next_offset >= length) {
-        return length;
-    }
-
-    enum gcb_property prev_prop = get_gcb(prev_cp);
-    int ri_count = (prev_prop == GCB_REGIONAL_INDICATOR) ? 1 : 0;
-    int in_ext_pict = is_extended_pictographic(prev_cp);
-
-    /* InCB state for GB9c: 0=none, 1=seen Consonant, 2=seen Consonant+Linker */
-    int incb_state = is_incb_consonant(prev_cp) ? 1 : 0;
+    /* The first codepoint always starts the cluster */
+    uint8_t state = GRAPHEME_STATE_START;
+    uint32_t codepoint;
+    int next_offset = offset + utflite_decode(text + offset, length - offset, &codepoint);
+    grapheme_step(&state, codepoint);
 
-    /* Loop through following characters */
+    /* Consume codepoints until the automaton reports a boundary */
     while (next_offset < length) {
-        uint32_t curr_cp;
-        bytes = utflite_decode(text + next_offset, length - next_offset, &curr_cp);
-        enum gcb_property curr_prop = get_gcb(curr_cp);
-
-        /* Check for break */
-        if (is_grapheme_break(prev_prop, curr_prop, ri_count, in_ext_pict,
-                              curr_cp, incb_state)) {
+        int bytes = utflite_decode(text + next_offset, length - next_offset, &codepoint);
+        if (grapheme_step(&state, codepoint)) {
             return next_offset;
         }
-
-        /* Update state for next iteration */
-        if (curr_prop == GCB_REGIONAL_INDICATOR) {
-            ri_count++;
-        } else if (curr_prop != GCB_EXTEND && curr_prop != GCB_ZWJ) {
-            ri_count = 0;
-        }
-
-        /* Track ExtPict sequence for GB11 */
-        if (is_extended_pictographic(curr_cp)) {
-            in_ext_pict = 1;
-        } else if (curr_prop != GCB_EXTEND && curr_prop != GCB_ZWJ) {
-            in_ext_pict = 0;
-        }
-
-        /* Track InCB state for GB9c */
-        if (is_incb_consonant(curr_cp)) {
-            incb_state = 1;
-        } else if (is_incb_linker(curr_cp) && incb_state >= 1) {
-            incb_state = 2;
-        } else if (curr_prop != GCB_EXTEND && curr_prop != GCB_ZWJ) {
-            incb_state = 0;
-        }
-        /* else: Extend/ZWJ keeps the current incb_state */
-
-        prev_cp = curr_cp;
-        prev_prop = curr_prop;
         next_offset += bytes;
     }
 
     return length;
 }
 
+/*
+ * Finds the codepoint that forward decoding ends exactly at 'offset',
+ * storing it in *codepoint. Returns its start, or -1 when 'offset' falls
+ * inside a multibyte sequence. Stray continuation bytes decode alone.
+ */
+static int codepoint_before(const char *text, int length, int offset, uint32_t *codepoint) {
+    int start = utflite_prev_char(text, offset);
+    int end = start + utflite_decode(text + start, length - start, codepoint);
+    if (end > offset) {
+        return -1;
+    }
+    if (end < offset) {
+        start = offset - 1;
+        utflite_decode(text + start, length - start, codepoint);
+    }
+    return start;
+}
+
 int utflite_prev_grapheme(const char *text, int offset) {
     if (!text || offset <= 0) {
         return 0;
@@ -1642,93 +1886,3428 @@ int utflite_prev_grapheme(const char *text, int offset) {
 		remaining--;
 	}
 
-    /* Scan forward from scan_start, tracking grapheme boundaries */
-    int curr = scan_start;
+    /* Run the automaton forward once, remembering the last boundary before
+     * 'offset'. Restarting at each boundary would give the same answer,
+     * since the state after a break depends only on the new codepoint. */
+    uint8_t state = GRAPHEME_STATE_START;
     int grapheme_start = scan_start;
+    int curr = scan_start;
 
     while (curr < offset) {
-        int next = utflite_next_grapheme(text, offset, curr);
-        if (next >= offset) {
-            break;
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + curr, offset - curr, &codepoint);
+        if (grapheme_step(&state, codepoint)) {
+            grapheme_start = curr;
         }
-        grapheme_start = next;
-        curr = next;
+        curr += bytes;
     }
 
     return grapheme_start;
 }
 
+int utflite_is_grapheme_boundary(const char *text, int length, int offset) {
+    if (!text || offset <= 0 || offset >= length) {
+        return 1;
+    }
+    uint32_t codepoint;
+    int start = codepoint_before(text, length, offset, &codepoint);
+    if (start < 0) {
+        return 0;
+    }
+    uint8_t before = grapheme_class(codepoint);
+    utflite_decode(text + offset, length - offset, &codepoint);
+    uint8_t after = grapheme_class(codepoint);
+
+    /* Common case: the pair decides the boundary whatever came before it */
+    uint8_t state = GRAPHEME_STATE_START;
+    if (GRAPHEME_PAIR_DECIDED[before] & (1u << after)) {
+        grapheme_step_class(&state, before);
+        return grapheme_step_class(&state, after) != 0;
+    }
+
+    /* RI parity, ExtPict Extend* ZWJ or a conjunct in progress: back up to a
+     * codepoint the automaton restarts at and run forward from there */
+    uint8_t class = before;
+    int remaining = GRAPHEME_MAX_BACKTRACK;
+    while (!(GRAPHEME_RESTART_CLASSES & (1u << class)) && start > 0 && remaining > 0) {
+        start = codepoint_before(text, length, start, &codepoint);
+        class = grapheme_class(codepoint);
+        remaining--;
+    }
+    while (start < offset) {
+        start += utflite_decode(text + start, length - start, &codepoint);
+        grapheme_step(&state, codepoint);
+    }
+    return grapheme_step_class(&state, after) != 0;
+}
+
+/*
+ * Counts grapheme clusters in text, returning early once the count passes
+ * 'limit'. A run of printable ASCII only needs the automaton for its first
+ * byte, which may still attach to a preceding Prepend (GB9b). Every later
+ * byte in the run is Other after Other, which always breaks (GB999) and
+ * leaves the state unchanged, so the rest of the run is counted directly.
+ */
+static int grapheme_count_limited(const char *text, int length, int limit) {
+    uint8_t state = GRAPHEME_STATE_START;
+    int count = 0;
+    int offset = 0;
+
+    while (offset < length) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte >= ASCII_PRINTABLE_FIRST && byte <= ASCII_PRINTABLE_LAST) {
+            if (grapheme_step(&state, byte)) {
+                count++;
+            }
+            /* Scan no further than the byte that takes the count past the limit */
+            int run_end = offset + 1;
+            int run_limit = length;
+            if (limit - count < length - run_end) {
+                run_limit = run_end + (limit - count) + 1;
+            }
+            while (run_end < run_limit &&
+                   (unsigned char)text[run_end] >= ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            count += run_end - offset - 1;
+            offset = run_end;
+        } else {
+            uint32_t codepoint;
+            offset += utflite_decode(text + offset, length - offset, &codepoint);
+            if (grapheme_step(&state, codepoint)) {
+                count++;
+            }
+        }
+        if (count > limit) {
+            return limit + 1;
+        }
+    }
+
+    return count;
+}
+
+int utflite_grapheme_count(const char *text, int length) {
+    if (!text || length <= 0) {
+        return 0;
+    }
+    /* The count can never exceed the byte length */
+    return grapheme_count_limited(text, length, length);
+}
+
+int utflite_grapheme_count_bounded(const char *text, int length, int max_graphemes) {
+    if (!text || length <= 0) {
+        return 0;
+    }
+    if (max_graphemes < 0) {
+        max_graphemes = 0;
+    }
+    return grapheme_count_limited(text, length, max_graphemes);
+}
+
 /* ============================================================================
- * Utility Functions
+ * Grapheme Index
  * ============================================================================ */
 
-int utflite_validate(const char *text, int length, int *error_offset) {
-    int offset = 0;
+/*
+ * Scans forward from the last checkpoint of 'index', appending a checkpoint
+ * every index->interval clusters. 'tail' holds the old checkpoints after an
+ * edit, still in old-text coordinates; 'delta' converts them to new ones.
+ * A boundary that lands on a shifted old checkpoint ends the scan early:
+ * the automaton state after a boundary depends only on the text from there
+ * on, so every later boundary matches the old ones too.
+ *
+ * Returns 1 on success, 0 when the checkpoint storage is full.
+ */
+static int grapheme_index_rescan(struct utflite_grapheme_index *index, const char *text, int length, int tail_start, int tail_count, int delta) {
+    struct utflite_grapheme_checkpoint *checkpoints = index->checkpoints;
+    struct utflite_grapheme_checkpoint last = checkpoints[index->count - 1];
+    int old_grapheme_count = index->grapheme_count;
+    uint8_t state = GRAPHEME_STATE_START;
+    int graphemes = last.grapheme_index;
+    int since_checkpoint = 0;
+    int tail_next = 0;
+    int offset = last.byte_offset;
+
+    index->length = length;
+    if (offset < length) {
+        /* The checkpoint itself starts a cluster */
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        grapheme_step(&state, codepoint);
+        graphemes++;
+    }
     while (offset < length) {
         uint32_t codepoint;
         int bytes = utflite_decode(text + offset, length - offset, &codepoint);
-        if (codepoint == UTFLITE_REPLACEMENT_CHAR) {
-            /* Check if it's actually the replacement char or an error */
-            unsigned char first = (unsigned char)text[offset];
-            if (first != 0xEF || length - offset < 3 ||
-                (unsigned char)text[offset + 1] != 0xBF ||
-                (unsigned char)text[offset + 2] != 0xBD) {
-                /* It's an error, not the actual replacement char */
-                if (error_offset) {
-                    *error_offset = offset;
+        if (grapheme_step(&state, codepoint)) {
+            /* Cluster number 'graphemes' starts here */
+            while (tail_next < tail_count &&
+                   checkpoints[tail_start + tail_next].byte_offset + delta < offset) {
+                tail_next++;
+            }
+            if (tail_next < tail_count &&
+                checkpoints[tail_start + tail_next].byte_offset + delta == offset) {
+                int shift = graphemes - checkpoints[tail_start + tail_next].grapheme_index;
+                for (int i = tail_next; i < tail_count; i++) {
+                    struct utflite_grapheme_checkpoint moved = checkpoints[tail_start + i];
+                    moved.byte_offset += delta;
+                    moved.grapheme_index += shift;
+                    checkpoints[index->count++] = moved;
                 }
-                return 0;
+                index->grapheme_count = old_grapheme_count + shift;
+                return 1;
             }
+            if (++since_checkpoint == index->interval) {
+                if (index->count == tail_start + tail_next) {
+                    /* Out of free slots: park the unread tail at the end */
+                    int remaining = tail_count - tail_next;
+                    int new_start = index->capacity - remaining;
+                    if (new_start <= index->count) {
+                        return 0;
+                    }
+                    for (int i = remaining - 1; i >= 0; i--) {
+                        checkpoints[new_start + i] = checkpoints[tail_start + tail_next + i];
+                    }
+                    tail_start = new_start;
+                    tail_count = remaining;
+                    tail_next = 0;
+                }
+                checkpoints[index->count].byte_offset = offset;
+                checkpoints[index->count].grapheme_index = graphemes;
+                index->count++;
+                since_checkpoint = 0;
+            }
+            graphemes++;
         }
         offset += bytes;
     }
+
+    index->grapheme_count = graphemes;
     return 1;
 }
 
-int utflite_codepoint_count(const char *text, int length) {
-    int count = 0;
-    int offset = 0;
-    while (offset < length) {
-        offset = utflite_next_char(text, length, offset);
-        count++;
+/*
+ * Returns the position of the last checkpoint whose byte offset (or
+ * grapheme index, if by_grapheme is set) is at most 'key'.
+ */
+static int grapheme_index_find(const struct utflite_grapheme_index *index, int key, int by_grapheme) {
+    int low = 0;
+    int high = index->count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        const struct utflite_grapheme_checkpoint *checkpoint = &index->checkpoints[mid];
+        int value = by_grapheme ? checkpoint->grapheme_index : checkpoint->byte_offset;
+        if (value <= key) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
     }
-    return count;
+    return low;
 }
 
-int utflite_string_width(const char *text, int length) {
-    int width = 0;
-    int offset = 0;
-    while (offset < length) {
-        int char_width = utflite_char_width(text, length, offset);
-        if (char_width > 0) {
-            width += char_width;
-        }
-        offset = utflite_next_char(text, length, offset);
+int utflite_grapheme_index_capacity(int length, int interval) {
+    if (length < 0 || interval < 1) {
+        return 1;
     }
-    return width;
+    /* Every cluster takes at least one byte */
+    return length / interval + 1;
 }
 
-int utflite_is_zero_width(uint32_t codepoint) {
-    return unicode_range_contains(codepoint, ZERO_WIDTH_RANGES, ZERO_WIDTH_COUNT);
+int utflite_grapheme_index_build(struct utflite_grapheme_index *index, struct utflite_grapheme_checkpoint *storage, int capacity, int interval, const char *text, int length) {
+    if (!index || !storage || capacity < 1 || interval < 1 || length < 0 ||
+        (!text && length > 0)) {
+        return 0;
+    }
+    index->checkpoints = storage;
+    index->capacity = capacity;
+    index->interval = interval;
+    index->count = 1;
+    index->length = 0;
+    index->grapheme_count = 0;
+    storage[0].byte_offset = 0;
+    storage[0].grapheme_index = 0;
+    return grapheme_index_rescan(index, text, length, capacity, 0, 0);
 }
 
-int utflite_is_wide(uint32_t codepoint) {
-    return unicode_range_contains(codepoint, DOUBLE_WIDTH_RANGES, DOUBLE_WIDTH_COUNT);
+int utflite_grapheme_index_update(struct utflite_grapheme_index *index, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!index || (!text && length > 0) || edit_start < 0 ||
+        old_end < edit_start || old_end > index->length || new_end < edit_start ||
+        length != index->length + (new_end - old_end)) {
+        return 0;
+    }
+
+    /* Keep checkpoints whose first codepoint ends before the edit; the
+     * boundary there depends only on text before it. Offset 0 always stays. */
+    int keep = grapheme_index_find(index, edit_start - UTFLITE_MAX_BYTES, 0) + 1;
+
+    /* Old checkpoints past the edit are candidates for resynchronizing */
+    int tail_start = grapheme_index_find(index, old_end - 1, 0) + 1;
+    if (tail_start < keep) {
+        tail_start = keep;
+    }
+
+    int tail_count = index->count - tail_start;
+    index->count = keep;
+    return grapheme_index_rescan(index, text, length, tail_start, tail_count,
+                                 new_end - old_end);
 }
 
-int utflite_truncate(const char *text, int length, int max_cols) {
-    int width = 0;
-    int offset = 0;
+int utflite_grapheme_index_offset(const struct utflite_grapheme_index *index, const char *text, int grapheme_index) {
+    if (grapheme_index <= 0) {
+        return 0;
+    }
+    if (grapheme_index >= index->grapheme_count) {
+        return index->length;
+    }
+    const struct utflite_grapheme_checkpoint *checkpoint =
+        &index->checkpoints[grapheme_index_find(index, grapheme_index, 1)];
+    int offset = checkpoint->byte_offset;
+    for (int i = checkpoint->grapheme_index; i < grapheme_index; i++) {
+        offset = utflite_next_grapheme(text, index->length, offset);
+    }
+    return offset;
+}
 
-    while (offset < length) {
-        int char_width = utflite_char_width(text, length, offset);
-        if (char_width > 0) {
-            if (width + char_width > max_cols) {
-                return offset;
-            }
-            width += char_width;
+int utflite_grapheme_index_lookup(const struct utflite_grapheme_index *index, const char *text, int byte_offset) {
+    if (byte_offset <= 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->grapheme_count;
+    }
+    const struct utflite_grapheme_checkpoint *checkpoint =
+        &index->checkpoints[grapheme_index_find(index, byte_offset, 0)];
+    int grapheme_index = checkpoint->grapheme_index;
+    int offset = checkpoint->byte_offset;
+    for (;;) {
+        offset = utflite_next_grapheme(text, index->length, offset);
+        if (offset > byte_offset) {
+            return grapheme_index;
         }
-        offset = utflite_next_char(text, length, offset);
+        grapheme_index++;
     }
-    return length;
+}
+
+/* ============================================================================
+ * Codepoint Index
+ * ============================================================================ */
+
+/*
+ * Counts the lead bytes in one 8-byte word. A continuation byte has bit 7
+ * set and bit 6 clear; shifting left by one lines each bit 6 up under its
+ * bit 7, and the multiply sums the per-byte flags into the top byte.
+ */
+static int utf8_lead_bytes_in_word(uint64_t word) {
+    uint64_t continuation = word & ~(word << 1) & SWAR_HIGH_BITS;
+    int continuation_count = (int)(((continuation >> 7) * SWAR_LOW_BITS) >> SWAR_TOP_BYTE_SHIFT);
+    return SWAR_WORD_BYTES - continuation_count;
+}
+
+/* Counts the bytes in text[0, count) that start a codepoint. */
+static int utf8_lead_byte_count(const char *text, int count) {
+    int leads = 0;
+    int i = 0;
+    for (; i + SWAR_WORD_BYTES <= count; i += SWAR_WORD_BYTES) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        leads += utf8_lead_bytes_in_word(word);
+    }
+    for (; i < count; i++) {
+        if (((unsigned char)text[i] & UTF8_CONTINUATION_MASK) != UTF8_CONTINUATION_BITS) {
+            leads++;
+        }
+    }
+    return leads;
+}
+
+/* Returns the last block in [low, high] whose rank is at most 'rank'. */
+static int codepoint_index_block_at(const struct utflite_codepoint_index *index, int low, int high, int rank) {
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (index->block_ranks[mid] <= rank) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+int utflite_codepoint_index_capacity(int length) {
+    if (length < 0) {
+        length = 0;
+    }
+    /* One rank per block plus at most one select sample per block */
+    return 2 * (length / UTFLITE_CODEPOINT_INDEX_BLOCK + 1);
+}
+
+int utflite_codepoint_index_build(struct utflite_codepoint_index *index, int *storage, int capacity, const char *text, int length) {
+    if (!index || !storage || length < 0 || (!text && length > 0) ||
+        capacity < utflite_codepoint_index_capacity(length)) {
+        return 0;
+    }
+    index->block_count = length / UTFLITE_CODEPOINT_INDEX_BLOCK + 1;
+    index->block_ranks = storage;
+    index->select_blocks = storage + index->block_count;
+    index->sample_count = 0;
+    index->length = length;
+
+    int rank = 0;
+    for (int block = 0; block < index->block_count; block++) {
+        int start = block * UTFLITE_CODEPOINT_INDEX_BLOCK;
+        int end = start + UTFLITE_CODEPOINT_INDEX_BLOCK;
+        if (end > length) {
+            end = length;
+        }
+        index->block_ranks[block] = rank;
+        rank += utf8_lead_byte_count(text + start, end - start);
+        /* Record this block for every sampled codepoint that starts in it */
+        while (index->sample_count * UTFLITE_CODEPOINT_INDEX_SAMPLE < rank) {
+            index->select_blocks[index->sample_count++] = block;
+        }
+    }
+    index->codepoint_count = rank;
+    return 1;
+}
+
+int utflite_codepoint_index_offset(const struct utflite_codepoint_index *index, const char *text, int codepoint_index) {
+    if (codepoint_index < 0) {
+        codepoint_index = 0;
+    }
+    if (codepoint_index >= index->codepoint_count) {
+        return index->length;
+    }
+
+    /* Select: the samples around the target bound the blocks to search */
+    int sample = codepoint_index / UTFLITE_CODEPOINT_INDEX_SAMPLE;
+    int low = index->select_blocks[sample];
+    int high = (sample + 1 < index->sample_count) ? index->select_blocks[sample + 1]
+                                                  : index->block_count - 1;
+    int block = codepoint_index_block_at(index, low, high, codepoint_index);
+
+    /* Skip whole words, then find the lead byte within the last one */
+    int rank = index->block_ranks[block];
+    int offset = block * UTFLITE_CODEPOINT_INDEX_BLOCK;
+    while (offset + SWAR_WORD_BYTES <= index->length) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        int leads = utf8_lead_bytes_in_word(word);
+        if (rank + leads > codepoint_index) {
+            break;
+        }
+        rank += leads;
+        offset += SWAR_WORD_BYTES;
+    }
+    for (;; offset++) {
+        if (((unsigned char)text[offset] & UTF8_CONTINUATION_MASK) != UTF8_CONTINUATION_BITS) {
+            if (rank == codepoint_index) {
+                return offset;
+            }
+            rank++;
+        }
+    }
+}
+
+int utflite_codepoint_index_lookup(const struct utflite_codepoint_index *index, const char *text, int byte_offset) {
+    if (byte_offset < 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->codepoint_count;
+    }
+    /* Rank: codepoints starting in [0, byte_offset], minus one */
+    int block = byte_offset / UTFLITE_CODEPOINT_INDEX_BLOCK;
+    int start = block * UTFLITE_CODEPOINT_INDEX_BLOCK;
+    int rank = index->block_ranks[block] +
+               utf8_lead_byte_count(text + start, byte_offset + 1 - start);
+    return rank > 0 ? rank - 1 : 0;
+}
+
+/* ============================================================================
+ * UTF-16 Offset Index
+ * ============================================================================ */
+
+/*
+ * Counts the UTF-16 code units that the codepoints starting in one 8-byte
+ * word need: one per lead byte plus one per byte whose top four bits are
+ * set (a four-byte lead).
+ */
+static int utf8_utf16_units_in_word(uint64_t word) {
+    uint64_t four_byte = word & (word << 1) & (word << 2) & (word << 3) & SWAR_HIGH_BITS;
+    int four_byte_count = (int)(((four_byte >> 7) * SWAR_LOW_BITS) >> SWAR_TOP_BYTE_SHIFT);
+    return utf8_lead_bytes_in_word(word) + four_byte_count;
+}
+
+/* Returns the UTF-16 code units needed by a codepoint starting with 'byte'. */
+static int utf8_byte_utf16_units(unsigned char byte) {
+    if ((byte & UTF8_CONTINUATION_MASK) == UTF8_CONTINUATION_BITS) {
+        return 0;
+    }
+    return byte >= UTF8_FOUR_BYTE_LEAD ? 2 : 1;
+}
+
+/* Counts the UTF-16 code units for the codepoints starting in text[0, count). */
+static int utf8_utf16_unit_count(const char *text, int count) {
+    int units = 0;
+    int i = 0;
+    for (; i + SWAR_WORD_BYTES <= count; i += SWAR_WORD_BYTES) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        units += utf8_utf16_units_in_word(word);
+    }
+    for (; i < count; i++) {
+        units += utf8_byte_utf16_units((unsigned char)text[i]);
+    }
+    return units;
+}
+
+int utflite_utf16_index_capacity(int length) {
+    if (length < 0) {
+        length = 0;
+    }
+    return length / UTFLITE_UTF16_INDEX_BLOCK + 1;
+}
+
+int utflite_utf16_index_build(struct utflite_utf16_index *index, int *storage, int capacity, const char *text, int length) {
+    if (!index || !storage || length < 0 || (!text && length > 0) ||
+        capacity < utflite_utf16_index_capacity(length)) {
+        return 0;
+    }
+    index->block_units = storage;
+    index->block_count = length / UTFLITE_UTF16_INDEX_BLOCK + 1;
+    index->length = length;
+
+    int units = 0;
+    for (int block = 0; block < index->block_count; block++) {
+        int start = block * UTFLITE_UTF16_INDEX_BLOCK;
+        int end = start + UTFLITE_UTF16_INDEX_BLOCK;
+        if (end > length) {
+            end = length;
+        }
+        index->block_units[block] = units;
+        units += utf8_utf16_unit_count(text + start, end - start);
+    }
+    index->utf16_length = units;
+    return 1;
+}
+
+int utflite_utf16_index_to_utf16(const struct utflite_utf16_index *index, const char *text, int byte_offset) {
+    if (byte_offset <= 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->utf16_length;
+    }
+    /* Round down to the start of the codepoint containing byte_offset */
+    byte_offset = utflite_prev_char(text, byte_offset + 1);
+    int block = byte_offset / UTFLITE_UTF16_INDEX_BLOCK;
+    int start = block * UTFLITE_UTF16_INDEX_BLOCK;
+    return index->block_units[block] + utf8_utf16_unit_count(text + start, byte_offset - start);
+}
+
+int utflite_utf16_index_to_utf8(const struct utflite_utf16_index *index, const char *text, int utf16_offset) {
+    if (utf16_offset <= 0) {
+        return 0;
+    }
+    if (utf16_offset >= index->utf16_length) {
+        return index->length;
+    }
+
+    /* Last breadcrumb at or before the target */
+    int low = 0;
+    int high = index->block_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (index->block_units[mid] <= utf16_offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    /* Skip whole words, then walk the lead bytes of the last one */
+    int units = index->block_units[low];
+    int offset = low * UTFLITE_UTF16_INDEX_BLOCK;
+    while (offset + SWAR_WORD_BYTES <= index->length) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        int word_units = utf8_utf16_units_in_word(word);
+        if (units + word_units > utf16_offset) {
+            break;
+        }
+        units += word_units;
+        offset += SWAR_WORD_BYTES;
+    }
+    for (; offset < index->length; offset++) {
+        units += utf8_byte_utf16_units((unsigned char)text[offset]);
+        if (units > utf16_offset) {
+            return offset;
+        }
+    }
+    return index->length;
+}
+
+/* ============================================================================
+ * Column Index
+ * ============================================================================ */
+
+/* A segment found by column_index_find() and where it starts. */
+struct column_index_hit {
+    /* Index of the segment. */
+    int segment;
+
+    /* Bytes and columns before the segment. */
+    struct utflite_column_segment start;
+};
+
+/*
+ * Adds 'delta' to the size of one segment. The tree is a Fenwick tree:
+ * node i (1-based, stored at tree[i - 1]) holds the sum of the i & -i
+ * segments ending at segment i - 1.
+ */
+static void column_index_add(struct utflite_column_index *index, int segment, struct utflite_column_segment delta) {
+    for (int node = segment + 1; node <= index->segment_count; node += node & -node) {
+        index->tree[node - 1].bytes += delta.bytes;
+        index->tree[node - 1].columns += delta.columns;
+    }
+}
+
+/* Returns the total size of segments [0, segment). */
+static struct utflite_column_segment column_index_prefix(const struct utflite_column_index *index, int segment) {
+    struct utflite_column_segment sum = { 0, 0 };
+    for (int node = segment; node > 0; node -= node & -node) {
+        sum.bytes += index->tree[node - 1].bytes;
+        sum.columns += index->tree[node - 1].columns;
+    }
+    return sum;
+}
+
+/*
+ * Returns the last segment whose start (in bytes, or in columns when
+ * by_columns is set) is at most 'key', with where it starts. Descends the
+ * tree from its highest power of two.
+ */
+static struct column_index_hit column_index_find(const struct utflite_column_index *index, int key, int by_columns) {
+    int step = 1;
+    while (step * 2 <= index->segment_count) {
+        step *= 2;
+    }
+    struct column_index_hit hit = { 0, { 0, 0 } };
+    for (; step > 0; step /= 2) {
+        int node = hit.segment + step;
+        if (node >= index->segment_count) {
+            continue;
+        }
+        const struct utflite_column_segment *sum = &index->tree[node - 1];
+        int value = by_columns ? hit.start.columns + sum->columns : hit.start.bytes + sum->bytes;
+        if (value <= key) {
+            hit.segment = node;
+            hit.start.bytes += sum->bytes;
+            hit.start.columns += sum->columns;
+        }
+    }
+    return hit;
+}
+
+int utflite_column_index_capacity(int length, int interval) {
+    if (length < 0 || interval < 1) {
+        return 1;
+    }
+    /* Every segment but the last holds at least 'interval' bytes */
+    return length / interval + 1;
+}
+
+int utflite_column_index_build(struct utflite_column_index *index, struct utflite_column_segment *storage, int capacity, int interval, const char *text, int length) {
+    if (!index || !storage || capacity < 1 || interval < 1 || length < 0 ||
+        (!text && length > 0)) {
+        return 0;
+    }
+    index->tree = storage;
+    index->capacity = capacity;
+    index->interval = interval;
+    index->length = length;
+    index->width = 0;
+
+    /* Cut a segment at the first cluster boundary 'interval' bytes in */
+    uint8_t state = GRAPHEME_STATE_START;
+    int count = 0;
+    int segment_start = 0;
+    int segment_columns = 0;
+    int offset = 0;
+    while (offset < length) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (grapheme_step(&state, codepoint) && offset - segment_start >= interval) {
+            if (count + 1 >= capacity) {
+                return 0;
+            }
+            storage[count].bytes = offset - segment_start;
+            storage[count].columns = segment_columns;
+            count++;
+            segment_start = offset;
+            segment_columns = 0;
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            segment_columns += char_width;
+            index->width += char_width;
+        }
+        offset += bytes;
+    }
+    storage[count].bytes = length - segment_start;
+    storage[count].columns = segment_columns;
+    count++;
+
+    /* Turn the plain sizes into a Fenwick tree in place */
+    index->segment_count = count;
+    for (int node = 1; node <= count; node++) {
+        int parent = node + (node & -node);
+        if (parent <= count) {
+            storage[parent - 1].bytes += storage[node - 1].bytes;
+            storage[parent - 1].columns += storage[node - 1].columns;
+        }
+    }
+    return 1;
+}
+
+int utflite_column_index_update(struct utflite_column_index *index, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!index || (!text && length > 0) || edit_start < 0 ||
+        old_end < edit_start || old_end > index->length || new_end < edit_start ||
+        length != index->length + (new_end - old_end)) {
+        return 0;
+    }
+    int delta = new_end - old_end;
+    int max_segment = index->interval * COLUMN_INDEX_MAX_SEGMENT_INTERVALS;
+
+    /* Restart at a segment whose first codepoint ends before the edit; the
+     * cluster boundary there does not depend on anything after it. */
+    struct column_index_hit hit = column_index_find(index, edit_start - UTFLITE_MAX_BYTES, 0);
+    int first = hit.segment;
+    struct utflite_column_segment start = hit.start;
+    struct utflite_column_segment old_first = column_index_prefix(index, first + 1);
+    old_first.bytes -= start.bytes;
+    old_first.columns -= start.columns;
+
+    /* Old starts of the following segments, in old-text coordinates */
+    int next = first + 1;
+    int next_start = start.bytes + old_first.bytes;
+
+    uint8_t state = GRAPHEME_STATE_START;
+    int columns = 0;
+    int offset = start.bytes;
+    while (offset < length) {
+        /* Samples inside the edit, or no longer on a boundary, are dropped */
+        while (next < index->segment_count &&
+               (next_start < old_end || next_start + delta < offset)) {
+            next_start += column_index_prefix(index, next + 1).bytes -
+                          column_index_prefix(index, next).bytes;
+            next++;
+        }
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (grapheme_step(&state, codepoint) && next < index->segment_count &&
+            offset == next_start + delta) {
+            /* Boundaries from here on match the old text */
+            break;
+        }
+        if (offset - start.bytes > max_segment) {
+            return utflite_column_index_build(index, index->tree, index->capacity,
+                                              index->interval, text, length);
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            columns += char_width;
+        }
+        offset += bytes;
+    }
+    if (offset >= length) {
+        next = index->segment_count;
+    }
+
+    /* The first segment absorbs everything up to the resync point; the
+     * segments it swallowed become empty. */
+    int old_bytes = old_first.bytes;
+    int old_columns = old_first.columns;
+    for (int segment = first + 1; segment < next; segment++) {
+        struct utflite_column_segment size = column_index_prefix(index, segment + 1);
+        struct utflite_column_segment before = column_index_prefix(index, segment);
+        size.bytes -= before.bytes;
+        size.columns -= before.columns;
+        if (size.bytes != 0 || size.columns != 0) {
+            struct utflite_column_segment empty = { -size.bytes, -size.columns };
+            column_index_add(index, segment, empty);
+            old_bytes += size.bytes;
+            old_columns += size.columns;
+        }
+    }
+    struct utflite_column_segment grown = { (offset - start.bytes) - old_first.bytes, columns - old_first.columns };
+    column_index_add(index, first, grown);
+    index->width += columns - old_columns;
+    index->length = length;
+    return 1;
+}
+
+int utflite_column_index_to_column(const struct utflite_column_index *index, const char *text, int byte_offset) {
+    if (byte_offset <= 0) {
+        return 0;
+    }
+    if (byte_offset >= index->length) {
+        return index->width;
+    }
+    struct utflite_column_segment start = column_index_find(index, byte_offset, 0).start;
+    int width = start.columns;
+    for (int offset = start.bytes; offset < byte_offset; ) {
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, index->length - offset, &codepoint);
+        if (offset > byte_offset) {
+            /* byte_offset is inside this codepoint */
+            break;
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            width += char_width;
+        }
+    }
+    return width;
+}
+
+int utflite_column_index_to_offset(const struct utflite_column_index *index, const char *text, int column) {
+    if (column < 0) {
+        return 0;
+    }
+    if (column >= index->width) {
+        return index->length;
+    }
+    struct utflite_column_segment start = column_index_find(index, column, 1).start;
+
+    /* Segments start on cluster boundaries, so the automaton can start fresh */
+    uint8_t state = GRAPHEME_STATE_START;
+    int width = start.columns;
+    int best = start.bytes;
+    int offset = start.bytes;
+    while (offset < index->length) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, index->length - offset, &codepoint);
+        if (grapheme_step(&state, codepoint)) {
+            if (width > column) {
+                break;
+            }
+            best = offset;
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            width += char_width;
+        }
+        offset += bytes;
+    }
+    return best;
+}
+
+/* ============================================================================
+ * Line Index
+ * ============================================================================ */
+
+/*
+ * Nonzero when any byte of 'word' equals 'byte'. Standard SWAR zero-byte
+ * test on word ^ (byte repeated): only a zero byte borrows into its top bit.
+ */
+static int swar_has_byte(uint64_t word, unsigned char byte) {
+    uint64_t x = word ^ (SWAR_LOW_BITS * byte);
+    return ((x - SWAR_LOW_BITS) & ~x & SWAR_HIGH_BITS) != 0;
+}
+
+/* Returns the offset of the first CR or LF in text[from, to), or 'to'. */
+static int line_break_find(const char *text, int from, int to) {
+    int offset = from;
+    while (offset + SWAR_WORD_BYTES <= to) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        if (swar_has_byte(word, ASCII_LF) || swar_has_byte(word, ASCII_CR)) {
+            break;
+        }
+        offset += SWAR_WORD_BYTES;
+    }
+    for (; offset < to; offset++) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte == ASCII_LF || byte == ASCII_CR) {
+            return offset;
+        }
+    }
+    return to;
+}
+
+/* Nonzero when a line starts right after the break byte at text[offset];
+ * a CR directly followed by LF leaves that to the LF. */
+static int line_start_after(const char *text, int length, int offset) {
+    return text[offset] == ASCII_LF || offset + 1 >= length || text[offset + 1] != ASCII_LF;
+}
+
+/* Returns where line 'line' starts; the line must exist. */
+static int line_index_get(const struct utflite_line_index *index, int line) {
+    if (line < index->gap_start) {
+        return index->starts[line];
+    }
+    return index->starts[line + index->gap_end - index->gap_start] + index->delta;
+}
+
+/* Moves the gap so it starts before line 'line', converting the entries it
+ * passes between absolute and delta-relative offsets. */
+static void line_index_move_gap(struct utflite_line_index *index, int line) {
+    int gap = index->gap_end - index->gap_start;
+    while (index->gap_start > line) {
+        index->gap_start--;
+        index->gap_end--;
+        index->starts[index->gap_end] = index->starts[index->gap_start] - index->delta;
+    }
+    while (index->gap_start < line) {
+        index->starts[index->gap_start] = index->starts[index->gap_start + gap] + index->delta;
+        index->gap_start++;
+        index->gap_end++;
+    }
+}
+
+/* Appends the line starts following breaks in text[from, to) at the gap.
+ * Returns 0 when the gap is full. */
+static int line_index_scan(struct utflite_line_index *index, const char *text, int length, int from, int to) {
+    for (int offset = line_break_find(text, from, to); offset < to;
+         offset = line_break_find(text, offset + 1, to)) {
+        if (line_start_after(text, length, offset)) {
+            if (index->gap_start == index->gap_end) {
+                return 0;
+            }
+            index->starts[index->gap_start++] = offset + 1;
+            index->line_count++;
+        }
+    }
+    return 1;
+}
+
+int utflite_line_count(const char *text, int length) {
+    int lines = 1;
+    if (!text || length <= 0) {
+        return lines;
+    }
+    for (int offset = line_break_find(text, 0, length); offset < length;
+         offset = line_break_find(text, offset + 1, length)) {
+        if (line_start_after(text, length, offset)) {
+            lines++;
+        }
+    }
+    return lines;
+}
+
+int utflite_line_index_build(struct utflite_line_index *index, int *storage, int capacity, const char *text, int length) {
+    if (!index || !storage || capacity < 1 || length < 0 || (!text && length > 0)) {
+        return 0;
+    }
+    index->starts = storage;
+    index->capacity = capacity;
+    index->delta = 0;
+    index->length = length;
+    storage[0] = 0;
+    index->line_count = 1;
+    index->gap_start = 1;
+    index->gap_end = capacity;
+    return line_index_scan(index, text, length, 0, length);
+}
+
+int utflite_line_index_update(struct utflite_line_index *index, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!index || (!text && length > 0) || edit_start < 0 ||
+        old_end < edit_start || old_end > index->length || new_end < edit_start ||
+        length != index->length + (new_end - old_end)) {
+        return 0;
+    }
+
+    /* A start s depends on bytes s - 1 and s, so old starts in
+     * [edit_start, old_end] are redone; line 0 always stays. */
+    int first = utflite_line_index_find(index, edit_start - 1) + 1;
+    line_index_move_gap(index, first);
+    while (index->gap_end < index->capacity &&
+           index->starts[index->gap_end] + index->delta <= old_end) {
+        index->gap_end++;
+        index->line_count--;
+    }
+    index->delta += new_end - old_end;
+    index->length = length;
+
+    int from = edit_start > 0 ? edit_start - 1 : 0;
+    return line_index_scan(index, text, length, from, new_end);
+}
+
+int utflite_line_index_start(const struct utflite_line_index *index, int line) {
+    if (line <= 0) {
+        return 0;
+    }
+    if (line >= index->line_count) {
+        return index->length;
+    }
+    return line_index_get(index, line);
+}
+
+int utflite_line_index_find(const struct utflite_line_index *index, int byte_offset) {
+    int low = 0;
+    int high = index->line_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (line_index_get(index, mid) <= byte_offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+
+/* ============================================================================
+ * Rope
+ * ============================================================================ */
+
+/*
+ * How the grapheme automaton crosses a span of text, for every state it
+ * could enter the span in: the state it leaves in and how many cluster
+ * boundaries it reports on the way. Two spans combine by feeding the first
+ * one's exit state into the second, which is what lets a node count
+ * clusters across the seam between its children.
+ */
+struct rope_grapheme_summary {
+    uint8_t exit_state[GRAPHEME_STATE_COUNT];
+    int boundaries[GRAPHEME_STATE_COUNT];
+};
+
+/*
+ * A rope node. Leaves hold up to about ROPE_LEAF_TARGET bytes of text and
+ * always start on a byte that is not a UTF-8 continuation byte (except the
+ * first leaf), so no codepoint is ever split between leaves. Internal
+ * nodes always have two children and cache the totals of their subtree.
+ */
+struct rope_node {
+    /* Children of an internal node; NULL for leaves. */
+    struct rope_node *left;
+    struct rope_node *right;
+
+    /* Longest path down to a leaf; 0 for leaves. */
+    int height;
+
+    /* Bytes, codepoints and display columns in the subtree. */
+    int bytes;
+    int codepoints;
+    int columns;
+
+    /* CR and LF bytes that end a line; a CR at the very end counts even if
+     * the next leaf starts with LF. */
+    int line_breaks;
+
+    /* Whether the subtree's text starts with LF or ends with CR, to merge a
+     * CR LF pair split between leaves. */
+    int starts_with_lf;
+    int ends_with_cr;
+
+    /* How the grapheme automaton crosses the subtree's text. */
+    struct rope_grapheme_summary graphemes;
+
+    /* Leaf bytes; empty for internal nodes. */
+    char text[];
+};
+
+/* The rope handle: the tree plus a pool of spare internal nodes. */
+struct utflite_rope {
+    /* Root of the tree; NULL for an empty rope. */
+    struct rope_node *root;
+
+    /* Spare internal nodes, linked through 'left'. */
+    struct rope_node *spare;
+    int spare_count;
+};
+
+/* Most pieces an edit cuts new leaves from: a neighbour, the kept start of
+ * the first leaf, the new text, the kept end of the last leaf, a neighbour. */
+#define ROPE_MAX_PIECES 5
+
+/* The text a new run of leaves is cut from, as contiguous pieces. */
+struct rope_pieces {
+    /* Start and length of each piece, in order. */
+    struct {
+        const char *text;
+        int length;
+    } items[ROPE_MAX_PIECES];
+
+    /* Pieces in use. */
+    int count;
+};
+
+/* The two trees a split leaves: text before the cut and from it on. */
+struct rope_pair {
+    struct rope_node *left;
+    struct rope_node *right;
+};
+
+/* Returns the height of a possibly empty subtree (-1 when empty). */
+static int rope_height(const struct rope_node *node) {
+    return node ? node->height : -1;
+}
+
+/* Nonzero when 'byte' continues a multibyte sequence. */
+static int rope_is_continuation(unsigned char byte) {
+    return (byte & UTF8_CONTINUATION_MASK) == UTF8_CONTINUATION_BITS;
+}
+
+/*
+ * Fills in a leaf's cached totals from its bytes. The grapheme summary runs
+ * the automaton from every state at once until all runs land in the same
+ * state; from then on they agree, so one run finishes the leaf.
+ */
+static void rope_leaf_summarize(struct rope_node *leaf) {
+    const char *text = leaf->text;
+    int length = leaf->bytes;
+    uint8_t states[GRAPHEME_STATE_COUNT];
+    int counts[GRAPHEME_STATE_COUNT];
+    int converged = 0;
+    int shared_count = 0;
+
+    for (int state = 0; state < GRAPHEME_STATE_COUNT; state++) {
+        states[state] = (uint8_t)state;
+        counts[state] = 0;
+    }
+    leaf->codepoints = utf8_lead_byte_count(text, length);
+    leaf->columns = 0;
+    leaf->line_breaks = 0;
+    for (int offset = 0; offset < length; ) {
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            leaf->columns += char_width;
+        }
+        uint8_t class = grapheme_class(codepoint);
+        if (converged) {
+            uint8_t transition = GRAPHEME_DFA[states[0]][class];
+            shared_count += (transition & GRAPHEME_DFA_BREAK) != 0;
+            states[0] = transition & GRAPHEME_DFA_STATE_MASK;
+
+            /* Printable ASCII after printable ASCII: one column and one
+             * cluster each, and the state stays put */
+            if (codepoint >= ASCII_PRINTABLE_FIRST && codepoint <= ASCII_PRINTABLE_LAST) {
+                int run_end = offset;
+                while (run_end < length &&
+                       (unsigned char)text[run_end] >= ASCII_PRINTABLE_FIRST &&
+                       (unsigned char)text[run_end] <= ASCII_PRINTABLE_LAST) {
+                    run_end++;
+                }
+                leaf->columns += run_end - offset;
+                shared_count += run_end - offset;
+                offset = run_end;
+            }
+            continue;
+        }
+        converged = 1;
+        for (int state = 0; state < GRAPHEME_STATE_COUNT; state++) {
+            uint8_t transition = GRAPHEME_DFA[states[state]][class];
+            counts[state] += (transition & GRAPHEME_DFA_BREAK) != 0;
+            states[state] = transition & GRAPHEME_DFA_STATE_MASK;
+            if (states[state] != states[0]) {
+                converged = 0;
+            }
+        }
+    }
+    for (int state = 0; state < GRAPHEME_STATE_COUNT; state++) {
+        leaf->graphemes.exit_state[state] = converged ? states[0] : states[state];
+        leaf->graphemes.boundaries[state] = counts[state] + shared_count;
+    }
+
+    for (int offset = line_break_find(text, 0, length); offset < length;
+         offset = line_break_find(text, offset + 1, length)) {
+        if (line_start_after(text, length, offset)) {
+            leaf->line_breaks++;
+        }
+    }
+    leaf->starts_with_lf = text[0] == ASCII_LF;
+    leaf->ends_with_cr = text[length - 1] == ASCII_CR;
+}
+
+/* Recomputes an internal node's height and totals from its children. */
+static void rope_node_update(struct rope_node *node) {
+    const struct rope_node *left = node->left;
+    const struct rope_node *right = node->right;
+    node->height = 1 + (left->height > right->height ? left->height : right->height);
+    node->bytes = left->bytes + right->bytes;
+    node->codepoints = left->codepoints + right->codepoints;
+    node->columns = left->columns + right->columns;
+    node->line_breaks = left->line_breaks + right->line_breaks -
+                        (left->ends_with_cr && right->starts_with_lf);
+    node->starts_with_lf = left->starts_with_lf;
+    node->ends_with_cr = right->ends_with_cr;
+    for (int state = 0; state < GRAPHEME_STATE_COUNT; state++) {
+        uint8_t middle = left->graphemes.exit_state[state];
+        node->graphemes.exit_state[state] = right->graphemes.exit_state[middle];
+        node->graphemes.boundaries[state] = left->graphemes.boundaries[state] +
+                                            right->graphemes.boundaries[middle];
+    }
+}
+
+/* Hands out an internal node from the spare pool (refilled before edits). */
+static struct rope_node *rope_take_node(struct utflite_rope *rope) {
+    struct rope_node *node = rope->spare;
+    rope->spare = node->left;
+    rope->spare_count--;
+    return node;
+}
+
+/* Returns an internal node to the spare pool. */
+static void rope_release_node(struct utflite_rope *rope, struct rope_node *node) {
+    node->left = rope->spare;
+    rope->spare = node;
+    rope->spare_count++;
+}
+
+/* Makes sure the spare pool holds at least 'count' internal nodes. */
+static int rope_reserve_nodes(struct utflite_rope *rope, int count) {
+    while (rope->spare_count < count) {
+        struct rope_node *node = malloc(sizeof(struct rope_node));
+        if (!node) {
+            return 0;
+        }
+        rope_release_node(rope, node);
+    }
+    return 1;
+}
+
+/* Frees a whole subtree. */
+static void rope_free_tree(struct rope_node *node) {
+    if (!node) {
+        return;
+    }
+    rope_free_tree(node->left);
+    rope_free_tree(node->right);
+    free(node);
+}
+
+static struct rope_node *rope_rotate_left(struct rope_node *node) {
+    struct rope_node *pivot = node->right;
+    node->right = pivot->left;
+    rope_node_update(node);
+    pivot->left = node;
+    rope_node_update(pivot);
+    return pivot;
+}
+
+static struct rope_node *rope_rotate_right(struct rope_node *node) {
+    struct rope_node *pivot = node->left;
+    node->left = pivot->right;
+    rope_node_update(node);
+    pivot->right = node;
+    rope_node_update(pivot);
+    return pivot;
+}
+
+/* Restores the AVL height invariant at 'node' after one child changed. */
+static struct rope_node *rope_rebalance(struct rope_node *node) {
+    rope_node_update(node);
+    int balance = node->left->height - node->right->height;
+    if (balance > 1) {
+        if (rope_height(node->left->left) < rope_height(node->left->right)) {
+            node->left = rope_rotate_left(node->left);
+        }
+        return rope_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (rope_height(node->right->right) < rope_height(node->right->left)) {
+            node->right = rope_rotate_right(node->right);
+        }
+        return rope_rotate_left(node);
+    }
+    return node;
+}
+
+/*
+ * Concatenates two trees. The taller one is descended along its inner
+ * spine to a subtree of similar height, joined there, and rebalanced on the
+ * way back up, so the cost is proportional to the height difference.
+ */
+static struct rope_node *rope_join(struct utflite_rope *rope, struct rope_node *left, struct rope_node *right) {
+    if (!left) {
+        return right;
+    }
+    if (!right) {
+        return left;
+    }
+    if (left->height > right->height + 1) {
+        left->right = rope_join(rope, left->right, right);
+        return rope_rebalance(left);
+    }
+    if (right->height > left->height + 1) {
+        right->left = rope_join(rope, left, right->left);
+        return rope_rebalance(right);
+    }
+    struct rope_node *node = rope_take_node(rope);
+    node->left = left;
+    node->right = right;
+    rope_node_update(node);
+    return node;
+}
+
+/*
+ * Splits a tree before the leaf containing byte 'offset' (which must lie
+ * inside the tree). Internal nodes on the path go back to the spare pool.
+ */
+static struct rope_pair rope_split(struct utflite_rope *rope, struct rope_node *node, int offset) {
+    struct rope_pair pair = { NULL, node };
+    if (!node->left) {
+        return pair;
+    }
+    struct rope_node *left_child = node->left;
+    struct rope_node *right_child = node->right;
+    rope_release_node(rope, node);
+    if (offset < left_child->bytes) {
+        pair = rope_split(rope, left_child, offset);
+        pair.right = rope_join(rope, pair.right, right_child);
+    } else {
+        pair = rope_split(rope, right_child, offset - left_child->bytes);
+        pair.left = rope_join(rope, left_child, pair.left);
+    }
+    return pair;
+}
+
+/* Returns the leaf holding byte 'offset' and stores where it starts. */
+static struct rope_node *rope_find_leaf(struct rope_node *node, int offset, int *leaf_start) {
+    *leaf_start = 0;
+    while (node->left) {
+        if (offset < node->left->bytes) {
+            node = node->left;
+        } else {
+            *leaf_start += node->left->bytes;
+            offset -= node->left->bytes;
+            node = node->right;
+        }
+    }
+    return node;
+}
+
+/* Returns byte 'offset' of the text described by 'pieces'. */
+static unsigned char rope_piece_byte(const struct rope_pieces *pieces, int offset) {
+    for (int i = 0; i < pieces->count; i++) {
+        if (offset < pieces->items[i].length) {
+            return (unsigned char)pieces->items[i].text[offset];
+        }
+        offset -= pieces->items[i].length;
+    }
+    return 0;
+}
+
+/* Copies bytes [start, start + count) of the pieces into 'out'. */
+static void rope_piece_copy(const struct rope_pieces *pieces, int start, int count, char *out) {
+    for (int i = 0; i < pieces->count && count > 0; i++) {
+        if (start >= pieces->items[i].length) {
+            start -= pieces->items[i].length;
+            continue;
+        }
+        int take = pieces->items[i].length - start;
+        if (take > count) {
+            take = count;
+        }
+        memcpy(out, pieces->items[i].text + start, (size_t)take);
+        out += take;
+        count -= take;
+        start = 0;
+    }
+}
+
+/*
+ * Cuts the concatenated pieces into evenly sized leaves of about
+ * ROPE_LEAF_TARGET bytes, moving each cut forward to the next byte that
+ * starts a codepoint. The leaves are stored as a list linked through
+ * 'right'. Returns how many there are, or -1 (allocating nothing) when
+ * memory runs out.
+ */
+static int rope_build_leaves(const struct rope_pieces *pieces, struct rope_node **leaves) {
+    int total = 0;
+    for (int i = 0; i < pieces->count; i++) {
+        total += pieces->items[i].length;
+    }
+    *leaves = NULL;
+    if (total == 0) {
+        return 0;
+    }
+
+    int wanted = (total + ROPE_LEAF_TARGET - 1) / ROPE_LEAF_TARGET;
+    struct rope_node **tail = leaves;
+    int leaf_count = 0;
+    int start = 0;
+    for (int leaf_number = 1; leaf_number <= wanted; leaf_number++) {
+        int end = (int)((long long)total * leaf_number / wanted);
+        while (end < total && rope_is_continuation(rope_piece_byte(pieces, end))) {
+            end++;
+        }
+        if (end <= start) {
+            continue;
+        }
+        struct rope_node *leaf = malloc(sizeof(struct rope_node) + (size_t)(end - start));
+        if (!leaf) {
+            rope_free_tree(*leaves);
+            *leaves = NULL;
+            return -1;
+        }
+        leaf->left = NULL;
+        leaf->right = NULL;
+        leaf->height = 0;
+        leaf->bytes = end - start;
+        rope_piece_copy(pieces, start, end - start, leaf->text);
+        rope_leaf_summarize(leaf);
+        *tail = leaf;
+        tail = &leaf->right;
+        leaf_count++;
+        start = end;
+    }
+    return leaf_count;
+}
+
+struct utflite_rope *utflite_rope_create(const char *text, int length) {
+    if (length < 0 || (!text && length > 0)) {
+        return NULL;
+    }
+    struct utflite_rope *rope = malloc(sizeof(struct utflite_rope));
+    if (!rope) {
+        return NULL;
+    }
+    rope->root = NULL;
+    rope->spare = NULL;
+    rope->spare_count = 0;
+    if (!utflite_rope_replace(rope, 0, 0, text, length)) {
+        utflite_rope_destroy(rope);
+        return NULL;
+    }
+    return rope;
+}
+
+void utflite_rope_destroy(struct utflite_rope *rope) {
+    if (!rope) {
+        return;
+    }
+    rope_free_tree(rope->root);
+    while (rope->spare) {
+        free(rope_take_node(rope));
+    }
+    free(rope);
+}
+
+int utflite_rope_replace(struct utflite_rope *rope, int start, int end, const char *text, int length) {
+    int total = utflite_rope_length(rope);
+    if (!rope || start < 0 || end < start || end > total || length < 0 ||
+        (!text && length > 0)) {
+        return 0;
+    }
+    if (start == end && length == 0) {
+        return 1;
+    }
+
+    /*
+     * Rebuild the leaves the edit touches: the one holding the byte before
+     * 'start' and the one holding the last replaced byte. Their kept bytes
+     * plus the new text become a fresh run of leaves. Both ends of that run
+     * sit where old leaves began or ended, so leaves still start on
+     * codepoint boundaries.
+     */
+    struct rope_pieces pieces;
+    pieces.count = 0;
+    int range_start = 0;
+    int range_end = 0;
+    int merged = length;
+    struct rope_node *first = NULL;
+    struct rope_node *last = NULL;
+    int first_start = 0;
+    int last_start = 0;
+    if (total > 0) {
+        first = rope_find_leaf(rope->root, start > 0 ? start - 1 : 0, &first_start);
+        last = rope_find_leaf(rope->root, end > start ? end - 1 : (start > 0 ? start - 1 : 0),
+                              &last_start);
+        range_start = first_start;
+        range_end = last_start + last->bytes;
+        merged = (start - first_start) + length + (range_end - end);
+    }
+
+    /* Pull in a neighbouring leaf rather than leave a tiny one behind */
+    struct rope_node *previous = NULL;
+    struct rope_node *next = NULL;
+    if (total > 0 && merged < ROPE_LEAF_MINIMUM) {
+        int neighbour_start;
+        if (range_end < total) {
+            next = rope_find_leaf(rope->root, range_end, &neighbour_start);
+            range_end += next->bytes;
+        } else if (range_start > 0) {
+            previous = rope_find_leaf(rope->root, range_start - 1, &neighbour_start);
+            range_start = neighbour_start;
+        }
+    }
+    if (previous) {
+        pieces.items[pieces.count].text = previous->text;
+        pieces.items[pieces.count++].length = previous->bytes;
+    }
+    if (first) {
+        pieces.items[pieces.count].text = first->text;
+        pieces.items[pieces.count++].length = start - first_start;
+    }
+    pieces.items[pieces.count].text = text;
+    pieces.items[pieces.count++].length = length;
+    if (last) {
+        pieces.items[pieces.count].text = last->text + (end - last_start);
+        pieces.items[pieces.count++].length = range_end - end - (next ? next->bytes : 0);
+    }
+    if (next) {
+        pieces.items[pieces.count].text = next->text;
+        pieces.items[pieces.count++].length = next->bytes;
+    }
+
+    /* Allocate everything up front so a failure leaves the rope untouched */
+    struct rope_node *leaves;
+    int leaf_count = rope_build_leaves(&pieces, &leaves);
+    if (leaf_count < 0) {
+        return 0;
+    }
+    if (!rope_reserve_nodes(rope, leaf_count + 2 * (rope_height(rope->root) + 2))) {
+        rope_free_tree(leaves);
+        return 0;
+    }
+
+    /* Cut out the old leaves and splice in the new ones */
+    struct rope_node *before = NULL;
+    struct rope_node *middle = rope->root;
+    struct rope_node *after = NULL;
+    if (middle && range_start > 0) {
+        struct rope_pair pair = rope_split(rope, middle, range_start);
+        before = pair.left;
+        middle = pair.right;
+    }
+    if (middle && range_end < total) {
+        struct rope_pair pair = rope_split(rope, middle, range_end - range_start);
+        middle = pair.left;
+        after = pair.right;
+    }
+    rope_free_tree(middle);
+
+    struct rope_node *inserted = NULL;
+    while (leaves) {
+        struct rope_node *leaf = leaves;
+        leaves = leaf->right;
+        leaf->right = NULL;
+        inserted = rope_join(rope, inserted, leaf);
+    }
+    rope->root = rope_join(rope, rope_join(rope, before, inserted), after);
+
+    /* Keep a modest pool for the next edit */
+    while (rope->spare_count > ROPE_SPARE_NODES) {
+        free(rope_take_node(rope));
+    }
+    return 1;
+}
+
+int utflite_rope_length(const struct utflite_rope *rope) {
+    return (rope && rope->root) ? rope->root->bytes : 0;
+}
+
+void utflite_rope_get_metrics(const struct utflite_rope *rope, struct utflite_rope_metrics *metrics) {
+    const struct rope_node *root = rope ? rope->root : NULL;
+    metrics->bytes = root ? root->bytes : 0;
+    metrics->codepoints = root ? root->codepoints : 0;
+    metrics->graphemes = root ? root->graphemes.boundaries[GRAPHEME_STATE_START] : 0;
+    metrics->columns = root ? root->columns : 0;
+    metrics->lines = root ? root->line_breaks + 1 : 1;
+}
+
+int utflite_rope_copy(const struct utflite_rope *rope, int start, int end, char *buffer) {
+    int total = utflite_rope_length(rope);
+    if (start < 0) {
+        start = 0;
+    }
+    if (end > total) {
+        end = total;
+    }
+    int copied = 0;
+    while (start + copied < end) {
+        int chunk_length;
+        const char *chunk = utflite_rope_chunk(rope, start + copied, &chunk_length);
+        if (chunk_length > end - start - copied) {
+            chunk_length = end - start - copied;
+        }
+        memcpy(buffer + copied, chunk, (size_t)chunk_length);
+        copied += chunk_length;
+    }
+    return copied;
+}
+
+const char *utflite_rope_chunk(const struct utflite_rope *rope, int offset, int *chunk_length) {
+    if (offset < 0 || offset >= utflite_rope_length(rope)) {
+        *chunk_length = 0;
+        return NULL;
+    }
+    int leaf_start;
+    const struct rope_node *leaf = rope_find_leaf(rope->root, offset, &leaf_start);
+    *chunk_length = leaf->bytes - (offset - leaf_start);
+    return leaf->text + (offset - leaf_start);
+}
+
+/* A walk down the tree: the metric it counts, and where it ended. */
+struct rope_position {
+    /* Metric counted in 'units'; set before rope_descend(). */
+    enum utflite_rope_metric metric;
+
+    /* The leaf the walk ended at and the byte offset it starts at. */
+    const struct rope_node *leaf;
+    int leaf_start;
+
+    /* Metric units before the leaf. */
+    int units;
+
+    /* Grapheme automaton state on entering the leaf. */
+    uint8_t state;
+
+    /* Whether the byte after the leaf is an LF. */
+    int follows_lf;
+};
+
+/* Returns a subtree's size in the position's metric when entered in the
+ * position's grapheme state. */
+static int rope_node_units(const struct rope_node *node, const struct rope_node *next, const struct rope_position *position) {
+    switch (position->metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        return node->codepoints;
+    case UTFLITE_ROPE_GRAPHEMES:
+        return node->graphemes.boundaries[position->state];
+    case UTFLITE_ROPE_COLUMNS:
+        return node->columns;
+    case UTFLITE_ROPE_LINES:
+        return node->line_breaks - (node->ends_with_cr && next && next->starts_with_lf);
+    }
+    return 0;
+}
+
+/*
+ * Descends to the leaf holding byte 'offset' (when by_offset) or to the
+ * leaf where the metric total passes 'target' (otherwise). For lines the
+ * target is a line number, so the leaf holding its starting break is
+ * chosen; for the other metrics, the leaf holding unit number 'target'.
+ */
+static void rope_descend(const struct rope_node *node, int by_offset, int target, struct rope_position *position) {
+    position->leaf_start = 0;
+    position->units = 0;
+    position->state = GRAPHEME_STATE_START;
+    position->follows_lf = 0;
+    while (node->left) {
+        const struct rope_node *left = node->left;
+        int left_units = rope_node_units(left, node->right, position);
+        int go_left;
+        if (by_offset) {
+            go_left = target < position->leaf_start + left->bytes;
+        } else if (position->metric == UTFLITE_ROPE_LINES) {
+            go_left = target <= position->units + left_units;
+        } else {
+            go_left = target < position->units + left_units;
+        }
+        if (go_left) {
+            position->follows_lf = node->right->starts_with_lf;
+            node = left;
+        } else {
+            position->leaf_start += left->bytes;
+            position->units += left_units;
+            position->state = left->graphemes.exit_state[position->state];
+            node = node->right;
+        }
+    }
+    position->leaf = node;
+}
+
+/* Nonzero when the CR or LF at 'offset' of a leaf ends a line. */
+static int rope_ends_line(const struct rope_position *position, int offset) {
+    const struct rope_node *leaf = position->leaf;
+    if (leaf->text[offset] == ASCII_LF) {
+        return 1;
+    }
+    if (offset + 1 < leaf->bytes) {
+        return leaf->text[offset + 1] != ASCII_LF;
+    }
+    return !position->follows_lf;
+}
+
+int utflite_rope_from_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int byte_offset) {
+    struct utflite_rope_metrics totals;
+    utflite_rope_get_metrics(rope, &totals);
+    if (byte_offset >= totals.bytes) {
+        switch (metric) {
+        case UTFLITE_ROPE_CODEPOINTS:
+            return totals.codepoints;
+        case UTFLITE_ROPE_GRAPHEMES:
+            return totals.graphemes;
+        case UTFLITE_ROPE_COLUMNS:
+            return totals.columns;
+        case UTFLITE_ROPE_LINES:
+            return totals.lines - 1;
+        }
+    }
+    if (byte_offset <= 0) {
+        return 0;
+    }
+
+    struct rope_position position;
+    position.metric = metric;
+    rope_descend(rope->root, 1, byte_offset, &position);
+    const struct rope_node *leaf = position.leaf;
+    int offset = byte_offset - position.leaf_start;
+    int units = position.units;
+    switch (metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        units += utf8_lead_byte_count(leaf->text, offset + 1) - 1;
+        return units > 0 ? units : 0;
+    case UTFLITE_ROPE_LINES:
+        for (int at = line_break_find(leaf->text, 0, offset); at < offset;
+             at = line_break_find(leaf->text, at + 1, offset)) {
+            units += rope_ends_line(&position, at);
+        }
+        return units;
+    default:
+        break;
+    }
+
+    /* Graphemes count boundaries up to and including 'offset'; columns add
+     * the widths of codepoints that end by 'offset' */
+    uint8_t state = position.state;
+    for (int at = 0; at < leaf->bytes; ) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(leaf->text + at, leaf->bytes - at, &codepoint);
+        if (metric == UTFLITE_ROPE_GRAPHEMES) {
+            if (at > offset) {
+                break;
+            }
+            units += grapheme_step(&state, codepoint) != 0;
+        } else {
+            if (at + bytes > offset) {
+                break;
+            }
+            int char_width = utflite_codepoint_width(codepoint);
+            units += char_width > 0 ? char_width : 0;
+        }
+        at += bytes;
+    }
+    return metric == UTFLITE_ROPE_GRAPHEMES ? units - 1 : units;
+}
+
+int utflite_rope_to_offset(const struct utflite_rope *rope, enum utflite_rope_metric metric, int value) {
+    struct utflite_rope_metrics totals;
+    utflite_rope_get_metrics(rope, &totals);
+    int limit = 0;
+    switch (metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        limit = totals.codepoints;
+        break;
+    case UTFLITE_ROPE_GRAPHEMES:
+        limit = totals.graphemes;
+        break;
+    case UTFLITE_ROPE_COLUMNS:
+        limit = totals.columns;
+        break;
+    case UTFLITE_ROPE_LINES:
+        limit = totals.lines;
+        break;
+    }
+    if (value >= limit) {
+        return totals.bytes;
+    }
+    if (value < 0 || (value == 0 && metric != UTFLITE_ROPE_COLUMNS)) {
+        return 0;
+    }
+
+    struct rope_position position;
+    position.metric = metric;
+    rope_descend(rope->root, 0, value, &position);
+    const struct rope_node *leaf = position.leaf;
+    int remaining = value - position.units;
+    switch (metric) {
+    case UTFLITE_ROPE_CODEPOINTS:
+        for (int at = 0; ; at++) {
+            if (!rope_is_continuation((unsigned char)leaf->text[at]) && remaining-- == 0) {
+                return position.leaf_start + at;
+            }
+        }
+    case UTFLITE_ROPE_LINES:
+        for (int at = line_break_find(leaf->text, 0, leaf->bytes); at < leaf->bytes;
+             at = line_break_find(leaf->text, at + 1, leaf->bytes)) {
+            if (rope_ends_line(&position, at) && --remaining == 0) {
+                return position.leaf_start + at + 1;
+            }
+        }
+        return position.leaf_start + leaf->bytes;
+    default:
+        break;
+    }
+
+    /* Graphemes stop at the wanted boundary. Columns keep the last boundary
+     * that still fits, like utflite_column_index_to_offset() */
+    uint8_t state = position.state;
+    int best = -1;
+    int width = 0;
+    for (int at = 0; at < leaf->bytes; ) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(leaf->text + at, leaf->bytes - at, &codepoint);
+        if (grapheme_step(&state, codepoint)) {
+            if (metric == UTFLITE_ROPE_GRAPHEMES) {
+                if (remaining-- == 0) {
+                    return position.leaf_start + at;
+                }
+            } else if (width > remaining) {
+                break;
+            } else {
+                best = at;
+            }
+        }
+        int char_width = utflite_codepoint_width(codepoint);
+        width += char_width > 0 ? char_width : 0;
+        at += bytes;
+    }
+    if (best >= 0) {
+        return position.leaf_start + best;
+    }
+
+    /* The cluster holding the overflowing character began in an earlier leaf */
+    int cluster = utflite_rope_from_offset(rope, UTFLITE_ROPE_GRAPHEMES, position.leaf_start);
+    return utflite_rope_to_offset(rope, UTFLITE_ROPE_GRAPHEMES, cluster);
+}
+
+
+/* ============================================================================
+ * Gap Buffer
+ * ============================================================================ */
+
+/* Returns byte 'offset' of the text, skipping over the gap. */
+static unsigned char gap_buffer_byte(const struct utflite_gap_buffer *buffer, int offset) {
+    if (offset >= buffer->gap_start) {
+        offset += buffer->gap_end - buffer->gap_start;
+    }
+    return (unsigned char)buffer->text[offset];
+}
+
+/* Returns the cache entry of a line. */
+static struct utflite_gap_line *gap_buffer_entry(const struct utflite_gap_buffer *buffer, int line) {
+    if (line < buffer->line_gap_start) {
+        return &buffer->lines[line];
+    }
+    return &buffer->lines[line + buffer->line_gap_end - buffer->line_gap_start];
+}
+
+/* Returns where a line starts; the line must exist. */
+static int gap_buffer_line_start(const struct utflite_gap_buffer *buffer, int line) {
+    if (line < buffer->line_gap_start) {
+        return buffer->lines[line].start;
+    }
+    return utflite_gap_buffer_length(buffer) - gap_buffer_entry(buffer, line)->start;
+}
+
+/* Clamps an offset to the text and moves it back to the start of the
+ * codepoint it falls in, as utflite_decode() splits the text. */
+static int gap_buffer_round(const struct utflite_gap_buffer *buffer, int offset) {
+    int length = utflite_gap_buffer_length(buffer);
+    if (offset <= 0) {
+        return 0;
+    }
+    if (offset >= length) {
+        return length;
+    }
+    int lead = offset;
+    while (lead > 0 && offset - lead < UTFLITE_MAX_BYTES - 1 &&
+           (gap_buffer_byte(buffer, lead) & UTF8_CONTINUATION_MASK) ==
+           UTF8_CONTINUATION_BITS) {
+        lead--;
+    }
+    if (lead == offset) {
+        return offset;
+    }
+
+    /* Decode the candidate sequence; a stray continuation byte stands alone */
+    char bytes[UTFLITE_MAX_BYTES];
+    int count = 0;
+    for (int at = lead; at < length && count < UTFLITE_MAX_BYTES; at++) {
+        bytes[count++] = (char)gap_buffer_byte(buffer, at);
+    }
+    uint32_t codepoint;
+    return lead + utflite_decode(bytes, count, &codepoint) > offset ? lead : offset;
+}
+
+/* Feeds text[from, to), which lies before the gap, through the grapheme
+ * automaton, remembering where the last cluster began. */
+static void gap_buffer_step(struct utflite_gap_buffer *buffer, int from, int to) {
+    int offset = from;
+    while (offset < to) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(buffer->text + offset, to - offset, &codepoint);
+        if (grapheme_step(&buffer->grapheme_state, codepoint)) {
+            buffer->grapheme_start = offset;
+        }
+        offset += bytes;
+    }
+}
+
+/*
+ * Recomputes the grapheme state at the gap if an earlier move made it
+ * stale. Clusters always break before a line break, so the scan only
+ * needs to start at the break that ends the previous line (a lone CR may
+ * still pair with an LF inserted after it).
+ */
+static void gap_buffer_sync(struct utflite_gap_buffer *buffer) {
+    if (buffer->grapheme_start >= 0) {
+        return;
+    }
+    int from = buffer->lines[buffer->line_gap_start - 1].start;
+    if (from > 1 && buffer->text[from - 1] == ASCII_LF &&
+        buffer->text[from - 2] == ASCII_CR) {
+        from -= 2;
+    } else if (from > 0) {
+        from--;
+    }
+    buffer->grapheme_state = GRAPHEME_STATE_START;
+    buffer->grapheme_start = from;
+    gap_buffer_step(buffer, from, buffer->gap_start);
+}
+
+/*
+ * Moves the gap to 'offset', which must be a codepoint boundary. Line
+ * entries that cross the gap switch between absolute offsets and
+ * distances from the end. Moving forward within a line keeps the grapheme
+ * state current; any other move leaves it for gap_buffer_sync().
+ */
+static void gap_buffer_move_gap(struct utflite_gap_buffer *buffer, int offset) {
+    int length = utflite_gap_buffer_length(buffer);
+    struct utflite_gap_line *lines = buffer->lines;
+    if (offset < buffer->gap_start) {
+        int count = buffer->gap_start - offset;
+        memmove(buffer->text + buffer->gap_end - count, buffer->text + offset, (size_t)count);
+        buffer->gap_start -= count;
+        buffer->gap_end -= count;
+        while (lines[buffer->line_gap_start - 1].start > offset) {
+            buffer->line_gap_start--;
+            buffer->line_gap_end--;
+            lines[buffer->line_gap_end] = lines[buffer->line_gap_start];
+            lines[buffer->line_gap_end].start = length - lines[buffer->line_gap_start].start;
+        }
+        buffer->grapheme_start = -1;
+    } else if (offset > buffer->gap_start) {
+        int count = offset - buffer->gap_start;
+        int crossed_line = 0;
+        memmove(buffer->text + buffer->gap_start, buffer->text + buffer->gap_end, (size_t)count);
+        while (buffer->line_gap_end < buffer->line_capacity &&
+               length - lines[buffer->line_gap_end].start <= offset) {
+            lines[buffer->line_gap_start] = lines[buffer->line_gap_end];
+            lines[buffer->line_gap_start].start = length - lines[buffer->line_gap_end].start;
+            buffer->line_gap_start++;
+            buffer->line_gap_end++;
+            crossed_line = 1;
+        }
+        if (crossed_line) {
+            buffer->grapheme_start = -1;
+        } else if (buffer->grapheme_start >= 0) {
+            gap_buffer_step(buffer, buffer->gap_start, offset);
+        }
+        buffer->gap_start += count;
+        buffer->gap_end += count;
+    }
+}
+
+/*
+ * Finds the lines that start inside (from, to]. With 'store', their
+ * entries are written after the lines before the gap. Returns how many
+ * were found.
+ */
+static int gap_buffer_scan(struct utflite_gap_buffer *buffer, int from, int to, int store) {
+    int length = utflite_gap_buffer_length(buffer);
+    int gap = buffer->gap_end - buffer->gap_start;
+    int found = 0;
+    for (int piece = 0; piece < 2; piece++) {
+        int piece_from = piece == 0 ? from : buffer->gap_start;
+        int piece_to = piece == 0 ? buffer->gap_start : to;
+        int shift = piece == 0 ? 0 : gap;
+        if (piece_from < from) {
+            piece_from = from;
+        }
+        if (piece_to > to) {
+            piece_to = to;
+        }
+        for (int offset = line_break_find(buffer->text + shift, piece_from, piece_to);
+             offset < piece_to;
+             offset = line_break_find(buffer->text + shift, offset + 1, piece_to)) {
+            if (buffer->text[offset + shift] == ASCII_CR && offset + 1 < length &&
+                gap_buffer_byte(buffer, offset + 1) == ASCII_LF) {
+                continue;
+            }
+            if (store) {
+                struct utflite_gap_line *entry = &buffer->lines[buffer->line_gap_start + found];
+                entry->start = offset + 1;
+                entry->codepoints = -1;
+                entry->columns = 0;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+int utflite_gap_buffer_init(struct utflite_gap_buffer *buffer, char *storage, int capacity, struct utflite_gap_line *lines, int line_capacity) {
+    if (!buffer || !storage || capacity < 0 || !lines || line_capacity < 1) {
+        return 0;
+    }
+    buffer->text = storage;
+    buffer->capacity = capacity;
+    buffer->gap_start = 0;
+    buffer->gap_end = capacity;
+    buffer->lines = lines;
+    buffer->line_capacity = line_capacity;
+    buffer->line_gap_start = 1;
+    buffer->line_gap_end = line_capacity;
+    buffer->grapheme_state = GRAPHEME_STATE_START;
+    buffer->grapheme_start = 0;
+    lines[0].start = 0;
+    lines[0].codepoints = -1;
+    lines[0].columns = 0;
+    return 1;
+}
+
+int utflite_gap_buffer_length(const struct utflite_gap_buffer *buffer) {
+    return buffer->capacity - (buffer->gap_end - buffer->gap_start);
+}
+
+int utflite_gap_buffer_line_count(const struct utflite_gap_buffer *buffer) {
+    return buffer->line_gap_start + buffer->line_capacity - buffer->line_gap_end;
+}
+
+int utflite_gap_buffer_replace(struct utflite_gap_buffer *buffer, int start, int end, const char *text, int length) {
+    if (!buffer) {
+        return 0;
+    }
+    int total = utflite_gap_buffer_length(buffer);
+    if (start < 0 || end < start || end > total || length < 0 || (!text && length > 0)) {
+        return 0;
+    }
+    start = gap_buffer_round(buffer, start);
+    end = gap_buffer_round(buffer, end);
+    if (buffer->gap_end - buffer->gap_start + (end - start) < length) {
+        return 0;
+    }
+    gap_buffer_move_gap(buffer, start);
+
+    /*
+     * Drop the entries of the lines the edit can change: from the line
+     * holding the byte before 'start' (a CR there may pair with a new LF)
+     * through the line holding 'end'. Their text is rescanned below.
+     */
+    int saved_line_gap_start = buffer->line_gap_start;
+    int saved_line_gap_end = buffer->line_gap_end;
+    struct utflite_gap_line *lines = buffer->lines;
+    buffer->line_gap_start--;
+    if (start > 0 && lines[buffer->line_gap_start].start == start) {
+        buffer->line_gap_start--;
+    }
+    int region_start = lines[buffer->line_gap_start].start;
+    while (buffer->line_gap_end < buffer->line_capacity &&
+           total - lines[buffer->line_gap_end].start <= end) {
+        buffer->line_gap_end++;
+    }
+    int more_lines = buffer->line_gap_end < buffer->line_capacity;
+
+    buffer->gap_end += end - start;
+    if (length > 0) {
+        memcpy(buffer->text + buffer->gap_start, text, (size_t)length);
+    }
+    buffer->gap_start += length;
+    int new_total = utflite_gap_buffer_length(buffer);
+    int region_end = more_lines ? new_total - lines[buffer->line_gap_end].start : new_total;
+
+    /* A kept line starts at region_end, so its break is not rescanned */
+    int scan_end = more_lines ? region_end - 1 : region_end;
+    int found = gap_buffer_scan(buffer, region_start, scan_end, 0);
+    if (found + 1 > buffer->line_gap_end - buffer->line_gap_start) {
+        buffer->gap_start -= length;
+        buffer->gap_end -= end - start;
+        buffer->line_gap_start = saved_line_gap_start;
+        buffer->line_gap_end = saved_line_gap_end;
+        return 0;
+    }
+    lines[buffer->line_gap_start].start = region_start;
+    lines[buffer->line_gap_start].codepoints = -1;
+    lines[buffer->line_gap_start].columns = 0;
+    buffer->line_gap_start++;
+    gap_buffer_scan(buffer, region_start, scan_end, 1);
+    buffer->line_gap_start += found;
+
+    /* Lines that start after the new gap belong on the far side of it */
+    while (lines[buffer->line_gap_start - 1].start > buffer->gap_start) {
+        buffer->line_gap_start--;
+        buffer->line_gap_end--;
+        lines[buffer->line_gap_end] = lines[buffer->line_gap_start];
+        lines[buffer->line_gap_end].start = new_total - lines[buffer->line_gap_start].start;
+    }
+
+    /* Invalid text can join with its neighbours into one sequence: resync
+     * the grapheme state, and keep the gap out of the joined sequence */
+    if (length > 0 &&
+        ((unsigned char)text[0] & UTF8_CONTINUATION_MASK) == UTF8_CONTINUATION_BITS) {
+        buffer->grapheme_start = -1;
+    } else if (buffer->grapheme_start >= 0) {
+        gap_buffer_step(buffer, start, start + length);
+    }
+    gap_buffer_move_gap(buffer, gap_buffer_round(buffer, buffer->gap_start));
+    return 1;
+}
+
+int utflite_gap_buffer_move_gap(struct utflite_gap_buffer *buffer, int offset) {
+    offset = gap_buffer_round(buffer, offset);
+    gap_buffer_move_gap(buffer, offset);
+    return offset;
+}
+
+int utflite_gap_buffer_prev_grapheme(struct utflite_gap_buffer *buffer) {
+    gap_buffer_sync(buffer);
+    return buffer->grapheme_start;
+}
+
+int utflite_gap_buffer_next_grapheme(struct utflite_gap_buffer *buffer) {
+    int length = utflite_gap_buffer_length(buffer);
+    int gap = buffer->gap_end - buffer->gap_start;
+    int offset = buffer->gap_start;
+    if (offset >= length) {
+        return length;
+    }
+    gap_buffer_sync(buffer);
+    uint8_t state = buffer->grapheme_state;
+    for (int first = 1; offset < length; first = 0) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(buffer->text + offset + gap, length - offset, &codepoint);
+        if (grapheme_step(&state, codepoint) && !first) {
+            break;
+        }
+        offset += bytes;
+    }
+    return offset;
+}
+
+int utflite_gap_buffer_find_line(const struct utflite_gap_buffer *buffer, int byte_offset) {
+    int low = 0;
+    int high = utflite_gap_buffer_line_count(buffer) - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (gap_buffer_line_start(buffer, mid) <= byte_offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+int utflite_gap_buffer_line(struct utflite_gap_buffer *buffer, int line, struct utflite_gap_line_metrics *metrics) {
+    int line_count = utflite_gap_buffer_line_count(buffer);
+    if (line < 0 || line >= line_count) {
+        return 0;
+    }
+    int start = gap_buffer_line_start(buffer, line);
+    int end = line + 1 < line_count ? gap_buffer_line_start(buffer, line + 1)
+                                    : utflite_gap_buffer_length(buffer);
+    struct utflite_gap_line *entry = gap_buffer_entry(buffer, line);
+    if (entry->codepoints < 0) {
+        /* Measure the line without its break, in the pieces on either
+         * side of the gap */
+        int content_end = end;
+        if (content_end > start && gap_buffer_byte(buffer, content_end - 1) == ASCII_LF) {
+            content_end--;
+        }
+        if (content_end > start && gap_buffer_byte(buffer, content_end - 1) == ASCII_CR) {
+            content_end--;
+        }
+        int gap = buffer->gap_end - buffer->gap_start;
+        int before_end = content_end < buffer->gap_start ? content_end : buffer->gap_start;
+        int after_start = start > buffer->gap_start ? start : buffer->gap_start;
+        entry->codepoints = 0;
+        entry->columns = 0;
+        if (start < before_end) {
+            entry->codepoints += utflite_codepoint_count(buffer->text + start, before_end - start);
+            entry->columns += utflite_string_width(buffer->text + start, before_end - start);
+        }
+        if (after_start < content_end) {
+            const char *after = buffer->text + after_start + gap;
+            entry->codepoints += utflite_codepoint_count(after, content_end - after_start);
+            entry->columns += utflite_string_width(after, content_end - after_start);
+        }
+    }
+    metrics->start = start;
+    metrics->bytes = end - start;
+    metrics->codepoints = entry->codepoints;
+    metrics->columns = entry->columns;
+    return 1;
+}
+
+int utflite_gap_buffer_copy(const struct utflite_gap_buffer *buffer, int start, int end, char *out) {
+    int length = utflite_gap_buffer_length(buffer);
+    int gap = buffer->gap_end - buffer->gap_start;
+    if (start < 0) {
+        start = 0;
+    }
+    if (end > length) {
+        end = length;
+    }
+    if (end <= start) {
+        return 0;
+    }
+    int before_end = end < buffer->gap_start ? end : buffer->gap_start;
+    int copied = 0;
+    if (start < before_end) {
+        memcpy(out, buffer->text + start, (size_t)(before_end - start));
+        copied = before_end - start;
+    }
+    if (start + copied < end) {
+        memcpy(out + copied, buffer->text + start + copied + gap, (size_t)(end - start - copied));
+    }
+    return end - start;
+}
+
+/* ============================================================================
+ * Cursor
+ * ============================================================================ */
+
+/* Measures the grapheme cluster starting at 'offset' as
+ * utflite_grapheme_width() does, also counting its codepoints. Stores where
+ * it ends and returns its width, never below 0. */
+static int cursor_cluster(const char *text, int length, int offset, int *next_offset, int *codepoints) {
+    uint8_t state = GRAPHEME_STATE_START;
+    int width = 0;
+    int count = 0;
+    while (offset < length) {
+        uint32_t codepoint;
+        int cp_width;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (grapheme_step_class(&state, grapheme_class_width(codepoint, &cp_width)) &&
+            count > 0) {
+            break;
+        }
+        width = count == 0 ? cp_width : grapheme_width_extend(width, codepoint, cp_width);
+        count++;
+        offset += bytes;
+    }
+    *next_offset = offset;
+    *codepoints = count;
+    return width > 0 ? width : 0;
+}
+
+/* Moves a cursor that is not at the start back over the cluster before
+ * it. Only text[0, offset) is read. */
+static void cursor_back(struct utflite_cursor *cursor, const char *text) {
+    int end = cursor->offset;
+    int start = utflite_prev_grapheme(text, end);
+    int next;
+    int codepoints;
+    int width = cursor_cluster(text, end, start, &next, &codepoints);
+    while (next < end) {
+        /* Stepping back can group stray continuation bytes differently
+         * from decoding, so take the last cluster decoded from there */
+        start = next;
+        width = cursor_cluster(text, end, start, &next, &codepoints);
+    }
+    cursor->offset = start;
+    cursor->codepoint -= codepoints;
+    cursor->grapheme--;
+    cursor->column -= width;
+}
+
+int utflite_cursor_next(struct utflite_cursor *cursor, const char *text, int length) {
+    if (!cursor || !text || cursor->offset >= length) {
+        return 0;
+    }
+    int next;
+    int codepoints;
+    int width = cursor_cluster(text, length, cursor->offset, &next, &codepoints);
+    cursor->offset = next;
+    cursor->codepoint += codepoints;
+    cursor->grapheme++;
+    cursor->column += width;
+    return 1;
+}
+
+int utflite_cursor_prev(struct utflite_cursor *cursor, const char *text) {
+    if (!cursor || !text || cursor->offset <= 0) {
+        return 0;
+    }
+    cursor_back(cursor, text);
+    return 1;
+}
+
+int utflite_cursor_update(struct utflite_cursor *cursor, const char *text, int length, int edit_start, int old_end, int new_end) {
+    if (!cursor || !text || edit_start < 0 || old_end < edit_start ||
+        new_end < edit_start || new_end > length) {
+        return 0;
+    }
+    int offset = cursor->offset;
+    if (edit_start - offset >= UTFLITE_MAX_BYTES) {
+        /* Neither the text before the cursor nor the codepoint after it,
+         * which decides whether a cluster ends there, can have changed */
+        return 1;
+    }
+    int target = offset;
+    if (offset >= old_end) {
+        target = offset - old_end + new_end;
+    } else if (offset > edit_start) {
+        target = new_end;
+    }
+    if (target > length) {
+        /* The cursor or the edit does not match the text */
+        return 0;
+    }
+    if (edit_start < offset) {
+        cursor->offset = 0;
+        cursor->codepoint = 0;
+        cursor->grapheme = 0;
+        cursor->column = 0;
+    } else {
+        /* Text before edit_start is unchanged, but a codepoint up to three
+         * bytes before it may have read into the edit. Back off to a
+         * cluster that starts further away and measure again from there. */
+        while (cursor->offset > 0 && edit_start - cursor->offset < UTFLITE_MAX_BYTES) {
+            cursor_back(cursor, text);
+        }
+    }
+    while (cursor->offset < target) {
+        utflite_cursor_next(cursor, text, length);
+    }
+    return 1;
+}
+
+/* ============================================================================
+ * Utility Functions
+ * ============================================================================ */
+
+int utflite_validate(const char *text, int length, int *error_offset) {
+    int offset = 0;
+    while (offset < length) {
+        uint32_t codepoint;
+        int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+        if (codepoint == UTFLITE_REPLACEMENT_CHAR) {
+            /* Check if it's actually the replacement char or an error */
+            unsigned char first = (unsigned char)text[offset];
+            if (first != 0xEF || length - offset < 3 ||
+                (unsigned char)text[offset + 1] != 0xBF ||
+                (unsigned char)text[offset + 2] != 0xBD) {
+                /* It's an error, not the actual replacement char */
+                if (error_offset) {
+                    *error_offset = offset;
+                }
+                return 0;
+            }
+        }
+        offset += bytes;
+    }
+    return 1;
+}
+
+int utflite_codepoint_count(const char *text, int length) {
+    int count = 0;
+    int offset = 0;
+    while (offset < length) {
+        offset = utflite_next_char(text, length, offset);
+        count++;
+    }
+    return count;
+}
+
+int utflite_string_width(const char *text, int length) {
+    int width = 0;
+    int offset = 0;
+    while (offset < length) {
+        int char_width = utflite_char_width(text, length, offset);
+        if (char_width > 0) {
+            width += char_width;
+        }
+        offset = utflite_next_char(text, length, offset);
+    }
+    return width;
+}
+
+int utflite_string_width_mode(const char *text, int length, enum utflite_width_mode mode) {
+    if (mode != UTFLITE_WIDTH_GRAPHEMES) {
+        return utflite_string_width(text, length);
+    }
+    uint8_t state = GRAPHEME_STATE_START;
+    int total = 0;
+    int cluster = 0;
+    int offset = 0;
+    while (offset < length) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte >= ASCII_PRINTABLE_FIRST && byte <= ASCII_PRINTABLE_LAST) {
+            /* Each printable ASCII byte after the first in a run closes the
+             * cluster before it and starts a new one of width 1 */
+            if (grapheme_step(&state, byte)) {
+                total += cluster > 0 ? cluster : 0;
+                cluster = 1;
+            } else if (cluster < 1) {
+                /* Joined to a Prepend (GB9b), it still takes its column */
+                cluster = 1;
+            }
+            int run_end = offset + 1;
+            while (run_end < length &&
+                   (unsigned char)text[run_end] >= ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            if (run_end > offset + 1) {
+                total += (cluster > 0 ? cluster : 0) + run_end - offset - 2;
+                cluster = 1;
+            }
+            offset = run_end;
+            continue;
+        }
+        uint32_t codepoint;
+        int cp_width;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        if (grapheme_step_class(&state, grapheme_class_width(codepoint, &cp_width))) {
+            total += cluster > 0 ? cluster : 0;
+            cluster = cp_width;
+        } else {
+            cluster = grapheme_width_extend(cluster, codepoint, cp_width);
+        }
+    }
+    return total + (cluster > 0 ? cluster : 0);
+}
+
+int utflite_is_zero_width(uint32_t codepoint) {
+    return unicode_range_contains(codepoint, ZERO_WIDTH_RANGES, ZERO_WIDTH_COUNT);
+}
+
+int utflite_is_wide(uint32_t codepoint) {
+    return unicode_range_contains(codepoint, DOUBLE_WIDTH_RANGES, DOUBLE_WIDTH_COUNT);
+}
+
+int utflite_truncate(const char *text, int length, int max_cols) {
+    int width = 0;
+    int offset = 0;
+
+    while (offset < length) {
+        int char_width = utflite_char_width(text, length, offset);
+        if (char_width > 0) {
+            if (width + char_width > max_cols) {
+                return offset;
+            }
+            width += char_width;
+        }
+        offset = utflite_next_char(text, length, offset);
+    }
+    return length;
+}
+
+/* Tab stops for grapheme_fit(): every 'size' columns, counting from
+ * 'start_col'. */
+struct tab_stops {
+    /* Columns between tab stops; 0 treats TAB like any control. */
+    int size;
+
+    /* Column the text starts at. */
+    int start_col;
+};
+
+/* Columns taken by a cluster of measured width 'cluster' whose first byte
+ * is 'first_byte', when it begins 'column' columns into the text: a TAB
+ * advances to the next tab stop, anything else is as wide as measured. */
+static int grapheme_fit_columns(const struct tab_stops *tabs, char first_byte, int cluster, int column) {
+    if (tabs && tabs->size > 0 && first_byte == ASCII_TAB) {
+        return tabs->size - (tabs->start_col + column) % tabs->size;
+    }
+    return cluster > 0 ? cluster : 0;
+}
+
+/*
+ * Walks text[0, end) by grapheme clusters, each as wide as
+ * utflite_grapheme_width() reports, and stops before the first cluster
+ * that would take the width past max_cols. With 'tabs' a TAB advances to
+ * the next tab stop; without, it is a zero-width control. Bytes from 'end'
+ * to 'length' are only read to tell whether 'end' is a cluster boundary.
+ * Returns the boundary where the walk stopped and stores the width of the
+ * text before it.
+ */
+static int grapheme_fit(const char *text, int length, int end, int max_cols, const struct tab_stops *tabs, int *width) {
+    uint8_t state = GRAPHEME_STATE_START;
+    int total = 0;
+    int cluster = 0;
+    int cluster_start = 0;
+    int offset = 0;
+    while (offset < end) {
+        unsigned char byte = (unsigned char)text[offset];
+        uint32_t codepoint = byte;
+        int cp_width = 1;
+        int bytes = 1;
+        int is_break;
+        if (byte >= ASCII_PRINTABLE_FIRST && byte <= ASCII_PRINTABLE_LAST) {
+            is_break = grapheme_step(&state, byte);
+        } else {
+            bytes = utflite_decode(text + offset, length - offset, &codepoint);
+            is_break = grapheme_step_class(&state, grapheme_class_width(codepoint, &cp_width));
+        }
+        if (is_break && offset > 0) {
+            /* The open cluster is complete: keep it only if it fits */
+            int closed = grapheme_fit_columns(tabs, text[cluster_start], cluster, total);
+            if (total + closed > max_cols) {
+                break;
+            }
+            total += closed;
+            cluster_start = offset;
+            cluster = cp_width;
+        } else {
+            cluster = grapheme_width_extend(cluster, codepoint, cp_width);
+        }
+        offset += bytes;
+        if (byte >= ASCII_PRINTABLE_FIRST && byte <= ASCII_PRINTABLE_LAST) {
+            /* The rest of a printable ASCII run: each byte closes the open
+             * cluster and opens a new one of width 1 */
+            int run_end = offset;
+            while (run_end < end &&
+                   (unsigned char)text[run_end] >= ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            if (run_end > offset) {
+                int closed = grapheme_fit_columns(tabs, text[cluster_start], cluster, total);
+                if (total + closed > max_cols) {
+                    break;
+                }
+                total += closed;
+                int room = max_cols - total;
+                if (run_end - 1 - offset > room) {
+                    total += room;
+                    cluster_start = offset + room;
+                    break;
+                }
+                total += run_end - 1 - offset;
+                cluster_start = run_end - 1;
+                cluster = 1;
+                offset = run_end;
+                grapheme_step(&state, (unsigned char)text[run_end - 1]);
+            }
+        }
+    }
+    if (offset == end && end > 0) {
+        /* The last cluster counts only if it ends at 'end' */
+        int at_boundary = 1;
+        if (end < length) {
+            uint32_t codepoint;
+            utflite_decode(text + end, length - end, &codepoint);
+            at_boundary = grapheme_step(&state, codepoint);
+        }
+        int closed = grapheme_fit_columns(tabs, text[cluster_start], cluster, total);
+        if (at_boundary && total + closed <= max_cols) {
+            total += closed;
+            cluster_start = end;
+        }
+    }
+    if (width) {
+        *width = total;
+    }
+    return cluster_start;
+}
+
+int utflite_truncate_graphemes(const char *text, int length, int max_cols, int *width) {
+    return grapheme_fit(text, length, length, max_cols, NULL, width);
+}
+
+/*
+ * Backs up from the end of text by at least 'codepoints' codepoints, then
+ * on to one the grapheme automaton restarts at (or GRAPHEME_MAX_BACKTRACK
+ * more, as utflite_prev_grapheme() does), never crossing 'start'. Every
+ * boundary after the returned offset is one a scan from 'start' finds.
+ */
+static int suffix_restart(const char *text, int start, int length, int codepoints) {
+    int offset = length;
+    int remaining = GRAPHEME_MAX_BACKTRACK;
+    while (offset > start) {
+        uint32_t codepoint;
+        offset = codepoint_before(text, length, offset, &codepoint);
+        if (--codepoints > 0) {
+            continue;
+        }
+        if ((GRAPHEME_RESTART_CLASSES & (1u << grapheme_class(codepoint))) || --remaining <= 0) {
+            break;
+        }
+    }
+    return offset;
+}
+
+/* Width of the cluster at 'offset', never negative; stores where it ends. */
+static int suffix_cluster(const char *text, int length, int offset, int *next) {
+    int cluster = utflite_grapheme_width(text, length, offset, next);
+    return cluster > 0 ? cluster : 0;
+}
+
+/*
+ * Finds the last clusters of text that fit in max_cols, never crossing
+ * 'start'. Backs up once to where segmentation can restart, measures the
+ * clusters from there forward, then drops leading ones until the rest
+ * fits. If the clusters measured do not fill max_cols, it backs up twice
+ * as far and measures again. Returns where the kept suffix begins and
+ * stores its width.
+ */
+static int truncate_suffix(const char *text, int start, int length, int max_cols, int *width) {
+    /* A cluster is at least one codepoint, and most take a column */
+    int span = length - start;
+    int codepoints = max_cols < span ? max_cols + 1 : span;
+    for (;;) {
+        int restart = suffix_restart(text, start, length, codepoints);
+        int next;
+        int first = restart;
+        if (restart > start) {
+            /* The cluster at the restart point may begin before it */
+            suffix_cluster(text, length, restart, &first);
+        }
+        int total = 0;
+        for (int offset = first; offset < length; offset = next) {
+            total += suffix_cluster(text, length, offset, &next);
+        }
+        if (total > max_cols || restart <= start) {
+            int offset = first;
+            while (total > max_cols && offset < length) {
+                total -= suffix_cluster(text, length, offset, &next);
+                offset = next;
+            }
+            *width = total;
+            return offset;
+        }
+        codepoints = codepoints < span / 2 ? codepoints * 2 : span;
+    }
+}
+
+int utflite_truncate_ellipsis(const char *text, int length, int max_cols, enum utflite_ellipsis_mode mode, char *buffer, int *width) {
+    if (length <= 0) {
+        if (width) {
+            *width = 0;
+        }
+        return 0;
+    }
+    int room = max_cols - ELLIPSIS_WIDTH;
+    int head_cols = room;
+    if (mode == UTFLITE_ELLIPSIS_START) {
+        head_cols = 0;
+    } else if (mode == UTFLITE_ELLIPSIS_MIDDLE) {
+        head_cols = room - room / 2;
+    }
+    if (head_cols > max_cols) {
+        head_cols = max_cols;
+    }
+
+    /* The head the result would keep, then whether the rest fits beside it
+     * without an ellipsis. Both scans stop after about max_cols columns. */
+    int head_width;
+    int head = utflite_truncate_graphemes(text, length, head_cols, &head_width);
+    int rest_width;
+    int rest = utflite_truncate_graphemes(text + head, length - head,
+                                          max_cols - head_width, &rest_width);
+    if (head + rest == length) {
+        memcpy(buffer, text, (size_t)length);
+        if (width) {
+            *width = head_width + rest_width;
+        }
+        return length;
+    }
+    if (room < 0) {
+        if (width) {
+            *width = 0;
+        }
+        return 0;
+    }
+
+    if (mode == UTFLITE_ELLIPSIS_START) {
+        head = 0;
+        head_width = 0;
+    }
+    int tail = length;
+    int tail_width = 0;
+    if (mode != UTFLITE_ELLIPSIS_END) {
+        tail = truncate_suffix(text, head, length, room - head_width, &tail_width);
+    }
+
+    memcpy(buffer, text, (size_t)head);
+    memcpy(buffer + head, ELLIPSIS_UTF8, ELLIPSIS_BYTES);
+    memcpy(buffer + head + ELLIPSIS_BYTES, text + tail, (size_t)(length - tail));
+    if (width) {
+        *width = head_width + ELLIPSIS_WIDTH + tail_width;
+    }
+    return head + ELLIPSIS_BYTES + length - tail;
+}
+
+int utflite_pad(const char *text, int length, int cols, enum utflite_align align, char *buffer) {
+    int width;
+    int kept = utflite_truncate_graphemes(text, length, cols, &width);
+    int padding = cols > width ? cols - width : 0;
+    int before = 0;
+    if (align == UTFLITE_ALIGN_RIGHT) {
+        before = padding;
+    } else if (align == UTFLITE_ALIGN_CENTER) {
+        before = padding / 2;
+    }
+    memset(buffer, PADDING_BYTE, (size_t)before);
+    if (kept > 0) {
+        memcpy(buffer + before, text, (size_t)kept);
+    }
+    memset(buffer + before + kept, PADDING_BYTE, (size_t)(padding - before));
+    return kept + padding;
+}
+
+int utflite_pad_row(const struct utflite_span *cells, const int *cols, const enum utflite_align *aligns, int count, const char *separator, char *buffer) {
+    int separator_length = separator ? (int)strlen(separator) : 0;
+    int written = 0;
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && separator_length > 0) {
+            memcpy(buffer + written, separator, (size_t)separator_length);
+            written += separator_length;
+        }
+        enum utflite_align align = aligns ? aligns[i] : UTFLITE_ALIGN_LEFT;
+        written += utflite_pad(cells[i].text, cells[i].length, cols[i], align, buffer + written);
+    }
+    return written;
+}
+
+/*
+ * Nonzero when every byte of 'word' is printable ASCII: no top bit set, no
+ * byte below the space (the borrow test is exact once top bits are clear)
+ * and no DEL.
+ */
+static int swar_all_printable(uint64_t word) {
+    uint64_t below = (word - SWAR_LOW_BITS * ASCII_PRINTABLE_FIRST) & ~word & SWAR_HIGH_BITS;
+    return (word & SWAR_HIGH_BITS) == 0 && below == 0 &&
+           !swar_has_byte(word, ASCII_PRINTABLE_LAST + 1);
+}
+
+/* Width of one table cell: its printable ASCII prefix is one column per
+ * byte. In cluster mode measuring resumes at the last byte of that prefix,
+ * which always starts a cluster. */
+static int cell_width(const char *text, int length, enum utflite_width_mode mode) {
+    int offset = 0;
+    while (offset + SWAR_WORD_BYTES <= length) {
+        uint64_t word;
+        memcpy(&word, text + offset, sizeof(word));
+        if (!swar_all_printable(word)) {
+            break;
+        }
+        offset += SWAR_WORD_BYTES;
+    }
+    while (offset < length &&
+           (unsigned char)text[offset] >= ASCII_PRINTABLE_FIRST &&
+           (unsigned char)text[offset] <= ASCII_PRINTABLE_LAST) {
+        offset++;
+    }
+    if (offset == length) {
+        return length;
+    }
+    if (mode == UTFLITE_WIDTH_GRAPHEMES) {
+        if (offset > 0) {
+            offset--;
+        }
+        return offset + utflite_string_width_mode(text + offset, length - offset, mode);
+    }
+    /* Per codepoint: decode each one once, where utflite_string_width()
+     * decodes it again to step over it */
+    int width = offset;
+    while (offset < length) {
+        unsigned char byte = (unsigned char)text[offset];
+        if (byte >= ASCII_PRINTABLE_FIRST && byte <= ASCII_PRINTABLE_LAST) {
+            width++;
+            offset++;
+            continue;
+        }
+        uint32_t codepoint;
+        offset += utflite_decode(text + offset, length - offset, &codepoint);
+        int char_width = utflite_codepoint_width(codepoint);
+        if (char_width > 0) {
+            width += char_width;
+        }
+    }
+    return width;
+}
+
+int utflite_column_widths(const struct utflite_span *cells, int rows, int columns, enum utflite_width_mode mode, int *cell_widths, int *column_widths) {
+    for (int column = 0; column < columns; column++) {
+        column_widths[column] = 0;
+    }
+    for (int row = 0; row < rows; row++) {
+        const struct utflite_span *row_cells = cells + (size_t)row * (size_t)columns;
+        for (int column = 0; column < columns; column++) {
+            int width = cell_width(row_cells[column].text, row_cells[column].length, mode);
+            if (cell_widths) {
+                cell_widths[(size_t)row * (size_t)columns + (size_t)column] = width;
+            }
+            if (width > column_widths[column]) {
+                column_widths[column] = width;
+            }
+        }
+    }
+    int total = 0;
+    for (int column = 0; column < columns; column++) {
+        total += column_widths[column];
+    }
+    return total;
+}
+
+int utflite_string_width_tabs(const char *text, int length, int tab_size, int start_col) {
+    struct tab_stops tabs = { tab_size, start_col };
+    int width;
+    grapheme_fit(text, length, length, UNLIMITED_COLUMNS, &tabs, &width);
+    return width;
+}
+
+int utflite_truncate_tabs(const char *text, int length, int max_cols, int tab_size, int start_col, int *width) {
+    struct tab_stops tabs = { tab_size, start_col };
+    return grapheme_fit(text, length, length, max_cols, &tabs, width);
+}
+
+int utflite_offset_to_column_tabs(const char *text, int length, int byte_offset, int tab_size, int start_col) {
+    if (byte_offset < 0) {
+        byte_offset = 0;
+    } else if (byte_offset > length) {
+        byte_offset = length;
+    }
+    struct tab_stops tabs = { tab_size, start_col };
+    int width;
+    grapheme_fit(text, length, byte_offset, UNLIMITED_COLUMNS, &tabs, &width);
+    return start_col + width;
+}
+
+/* Places a grapheme cluster that starts at 'column' into the cells of the
+ * viewport [first_col, end_col) and returns the column after it. */
+static int cell_grid_place(struct utflite_cell *cells, const char *text, int start, int end, int width, int tab_size, int column, int first_col, int end_col) {
+    int is_tab = tab_size > 0 && text[start] == ASCII_TAB;
+    if (is_tab) {
+        width = tab_size - column % tab_size;
+    }
+    if (width <= 0) {
+        return column;
+    }
+    /* A cluster is drawn only when all of its columns are visible */
+    int drawn = !is_tab && column >= first_col && column + width <= end_col;
+    for (int at = column; at < column + width && at < end_col; at++) {
+        if (at < first_col) {
+            continue;
+        }
+        struct utflite_cell *cell = &cells[at - first_col];
+        cell->offset = start;
+        if (!drawn) {
+            cell->length = 0;
+            cell->width = 1;
+        } else if (at == column) {
+            cell->length = end - start;
+            cell->width = width;
+        } else {
+            cell->length = 0;
+            cell->width = 0;
+        }
+    }
+    return column + width;
+}
+
+int utflite_fill_cells(const char *text, int length, int first_col, int col_count, int tab_size, struct utflite_cell *cells) {
+    if (!text || first_col < 0 || col_count <= 0) {
+        return 0;
+    }
+    int end_col = first_col + col_count;
+    uint8_t state = GRAPHEME_STATE_START;
+    int column = 0;
+    int cluster = 0;
+    int cluster_start = 0;
+    int offset = 0;
+    while (offset < length && column < end_col) {
+        unsigned char byte = (unsigned char)text[offset];
+        uint32_t codepoint = byte;
+        int cp_width = 1;
+        int bytes = 1;
+        int is_break;
+        if (byte >= ASCII_PRINTABLE_FIRST && byte <= ASCII_PRINTABLE_LAST) {
+            is_break = grapheme_step(&state, byte);
+        } else {
+            bytes = utflite_decode(text + offset, length - offset, &codepoint);
+            is_break = grapheme_step_class(&state, grapheme_class_width(codepoint, &cp_width));
+        }
+        if (is_break && offset > 0) {
+            column = cell_grid_place(cells, text, cluster_start, offset, cluster, tab_size,
+                                     column, first_col, end_col);
+            cluster_start = offset;
+            cluster = cp_width;
+        } else {
+            cluster = grapheme_width_extend(cluster, codepoint, cp_width);
+        }
+        offset += bytes;
+        if (byte >= ASCII_PRINTABLE_FIRST && byte <= ASCII_PRINTABLE_LAST) {
+            /* In a printable ASCII run every byte but the last is a cluster
+             * of its own, one column wide. The run is only scanned as far
+             * as the viewport reaches. */
+            int run_end = offset;
+            while (run_end < length && run_end - offset <= end_col - column &&
+                   (unsigned char)text[run_end] >= ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run_end] <= ASCII_PRINTABLE_LAST) {
+                run_end++;
+            }
+            if (run_end > offset) {
+                column = cell_grid_place(cells, text, cluster_start, offset, cluster, tab_size,
+                                         column, first_col, end_col);
+                for (; offset < run_end - 1 && column < end_col; offset++, column++) {
+                    if (column >= first_col) {
+                        struct utflite_cell *cell = &cells[column - first_col];
+                        cell->offset = offset;
+                        cell->length = 1;
+                        cell->width = 1;
+                    }
+                }
+                cluster_start = offset;
+                cluster = 1;
+                grapheme_step(&state, (unsigned char)text[offset]);
+                offset++;
+            }
+        }
+    }
+    if (offset >= length && length > 0 && column < end_col) {
+        column = cell_grid_place(cells, text, cluster_start, length, cluster, tab_size,
+                                 column, first_col, end_col);
+    }
+    if (column <= first_col) {
+        return 0;
+    }
+    return (column < end_col ? column : end_col) - first_col;
+}
+
+/* Returns how many leading bytes a and b share, within 'count'. */
+static int common_prefix_length(const char *a, const char *b, int count) {
+    int offset = 0;
+    while (offset + SWAR_WORD_BYTES <= count) {
+        uint64_t a_word;
+        uint64_t b_word;
+        memcpy(&a_word, a + offset, sizeof(a_word));
+        memcpy(&b_word, b + offset, sizeof(b_word));
+        if (a_word != b_word) {
+            break;
+        }
+        offset += SWAR_WORD_BYTES;
+    }
+    while (offset < count && a[offset] == b[offset]) {
+        offset++;
+    }
+    return offset;
+}
+
+/* Returns how many trailing bytes a and b share, within 'count'. */
+static int common_suffix_length(const char *a, int a_length, const char *b, int b_length, int count) {
+    int matched = 0;
+    while (matched + SWAR_WORD_BYTES <= count) {
+        uint64_t a_word;
+        uint64_t b_word;
+        memcpy(&a_word, a + a_length - matched - SWAR_WORD_BYTES, sizeof(a_word));
+        memcpy(&b_word, b + b_length - matched - SWAR_WORD_BYTES, sizeof(b_word));
+        if (a_word != b_word) {
+            break;
+        }
+        matched += SWAR_WORD_BYTES;
+    }
+    while (matched < count && a[a_length - matched - 1] == b[b_length - matched - 1]) {
+        matched++;
+    }
+    return matched;
+}
+
+/* Steps over the cluster at *offset and adds its width to *column. */
+static void line_damage_step(const char *text, int length, int *offset, int *column) {
+    int width = utflite_grapheme_width(text, length, *offset, offset);
+    if (width > 0) {
+        *column += width;
+    }
+}
+
+int utflite_line_damage(const char *old_text, int old_length, const char *new_text, int new_length, int *first_col, int *end_col) {
+    int shorter = old_length < new_length ? old_length : new_length;
+    int prefix = common_prefix_length(old_text, new_text, shorter);
+    if (prefix == old_length && prefix == new_length) {
+        *first_col = 0;
+        *end_col = 0;
+        return 0;
+    }
+
+    /* Boundaries up to a codepoint before the first difference are the
+     * same in both lines, so one walk finds them. Closer to it, a boundary
+     * counts only if both lines have it. */
+    int column;
+    int start = 0;
+    if (prefix > UTFLITE_MAX_BYTES) {
+        start = grapheme_fit(old_text, old_length, prefix - UTFLITE_MAX_BYTES, UNLIMITED_COLUMNS, NULL, &column);
+    } else {
+        column = 0;
+    }
+    while (start < prefix) {
+        int old_next;
+        int new_next;
+        int width = utflite_grapheme_width(old_text, old_length, start, &old_next);
+        utflite_grapheme_width(new_text, new_length, start, &new_next);
+        if (old_next != new_next || old_next > prefix) {
+            break;
+        }
+        column += width > 0 ? width : 0;
+        start = old_next;
+    }
+    *first_col = column;
+
+    /* Walk both lines through the change until they reach the same
+     * boundary in the common suffix; from there they segment alike. */
+    int suffix = common_suffix_length(old_text, old_length, new_text, new_length,
+                                      shorter - start);
+    int old_suffix = old_length - suffix;
+    int new_suffix = new_length - suffix;
+    int old_offset = start;
+    int new_offset = start;
+    int old_column = column;
+    int new_column = column;
+    while (old_offset - old_suffix != new_offset - new_suffix || old_offset < old_suffix) {
+        if (old_offset - old_suffix <= new_offset - new_suffix) {
+            line_damage_step(old_text, old_length, &old_offset, &old_column);
+        } else {
+            line_damage_step(new_text, new_length, &new_offset, &new_column);
+        }
+    }
+    if (old_column == new_column) {
+        *end_col = old_column;
+    } else {
+        /* The suffix moved: everything after the change is redrawn */
+        int rest = utflite_string_width_mode(old_text + old_offset, old_length - old_offset,
+                                             UTFLITE_WIDTH_GRAPHEMES);
+        *end_col = (old_column > new_column ? old_column : new_column) + rest;
+    }
+    return 1;
+}
+
+int utflite_slice_columns(const char *text, int length, int first_col, int end_col, struct utflite_column_slice *slice) {
+    slice->start = 0;
+    slice->end = 0;
+    slice->left_padding = 0;
+    slice->right_padding = 0;
+    if (first_col < 0) {
+        first_col = 0;
+    }
+    if (!text || length <= 0 || end_col <= first_col) {
+        return 0;
+    }
+    int before;
+    int start = grapheme_fit(text, length, length, first_col, NULL, &before);
+    if (before < first_col && start < length) {
+        /* A wide cluster straddles the left edge: skip it, keep its columns */
+        int next;
+        int cluster = utflite_grapheme_width(text, length, start, &next);
+        slice->left_padding = before + cluster - first_col;
+        start = next;
+    }
+    int room = end_col - first_col - slice->left_padding;
+    int width;
+    int end = start + grapheme_fit(text + start, length - start, length - start, room, NULL, &width);
+    if (end < length && width < room) {
+        /* The walk stopped short of the edge, before a cluster too wide for it */
+        slice->right_padding = room - width;
+    }
+    slice->start = start;
+    slice->end = end;
+    return width;
+}
+
+int utflite_column_seek(const char *text, int length, int column, int *cluster_column, int *inside) {
+    if (column < 0) {
+        column = 0;
+    }
+    if (!text || length < 0) {
+        length = 0;
+    }
+    int offset;
+    int start_col = column;
+    int is_inside = 0;
+
+    /* Through printable ASCII every byte is a column; when the byte at the
+     * target column is printable too, the cluster starting there is it */
+    int ascii_end = column + 1 < length ? column + 1 : length;
+    int ascii = 0;
+    while (ascii + SWAR_WORD_BYTES <= ascii_end) {
+        uint64_t word;
+        memcpy(&word, text + ascii, sizeof(word));
+        if (!swar_all_printable(word)) {
+            break;
+        }
+        ascii += SWAR_WORD_BYTES;
+    }
+    while (ascii < ascii_end && (unsigned char)text[ascii] >= ASCII_PRINTABLE_FIRST &&
+           (unsigned char)text[ascii] <= ASCII_PRINTABLE_LAST) {
+        ascii++;
+    }
+    if (ascii == column + 1) {
+        offset = column;
+    } else {
+        offset = grapheme_fit(text, length, length, column, NULL, &start_col);
+        is_inside = start_col < column && offset < length;
+    }
+    if (cluster_column) {
+        *cluster_column = start_col;
+    }
+    if (inside) {
+        *inside = is_inside;
+    }
+    return offset;
+}
+
+int utflite_convert_offsets(const char *text, int length, const int *byte_offsets, int count, int *codepoints, int *utf16, int *columns) {
+    if (!text || length < 0) {
+        length = 0;
+    }
+    int offset = 0;
+    int codepoint_count = 0;
+    int units = 0;
+    int column = 0;
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && byte_offsets[i] < byte_offsets[i - 1]) {
+            return i;
+        }
+        int target = byte_offsets[i] < length ? byte_offsets[i] : length;
+        while (offset < target) {
+            /* Printable ASCII is one codepoint, unit and column per byte */
+            int run = offset;
+            while (run + SWAR_WORD_BYTES <= target) {
+                uint64_t word;
+                memcpy(&word, text + run, sizeof(word));
+                if (!swar_all_printable(word)) {
+                    break;
+                }
+                run += SWAR_WORD_BYTES;
+            }
+            while (run < target && (unsigned char)text[run] >= ASCII_PRINTABLE_FIRST &&
+                   (unsigned char)text[run] <= ASCII_PRINTABLE_LAST) {
+                run++;
+            }
+            codepoint_count += run - offset;
+            units += run - offset;
+            column += run - offset;
+            offset = run;
+            if (offset == target) {
+                break;
+            }
+            uint32_t codepoint;
+            int bytes = utflite_decode(text + offset, length - offset, &codepoint);
+            if (offset + bytes > target) {
+                /* The target is inside this codepoint */
+                break;
+            }
+            int width = codepoint_width(codepoint, WIDTH_NOT_LOOKED_UP);
+            codepoint_count++;
+            units += codepoint >= UTF16_PAIR_FIRST ? 2 : 1;
+            column += width > 0 ? width : 0;
+            offset += bytes;
+        }
+        if (codepoints) {
+            codepoints[i] = codepoint_count;
+        }
+        if (utf16) {
+            utf16[i] = units;
+        }
+        if (columns) {
+            columns[i] = column;
+        }
+    }
+    return count;
+}
+
+/* ============================================================================
+ * ANSI Escape Sequences
+ * ============================================================================ */
+
+/* Returns the offset of the first ESC in text[from, to), or 'to'. memchr
+ * scans a vector at a time, so plain text costs next to nothing. */
+static int ansi_escape_find(const char *text, int from, int to) {
+    if (from >= to) {
+        return to;
+    }
+    const char *escape = memchr(text + from, ASCII_ESC, (size_t)(to - from));
+    return escape ? (int)(escape - text) : to;
+}
+
+/* Nonzero for the byte after ESC that opens a string ended by BEL or ST. */
+static int ansi_is_string_introducer(unsigned char byte) {
+    return byte == ANSI_OSC || byte == ANSI_DCS || byte == ANSI_SOS ||
+           byte == ANSI_PM || byte == ANSI_APC;
+}
+
+int utflite_ansi_sequence_length(const char *text, int length, int offset) {
+    if (!text || offset < 0 || offset >= length || (unsigned char)text[offset] != ASCII_ESC) {
+        return 0;
+    }
+    int at = offset + 1;
+    if (at >= length) {
+        return 1;
+    }
+    unsigned char introducer = (unsigned char)text[at];
+    if (introducer == ANSI_CSI) {
+        for (at++; at < length; at++) {
+            unsigned char byte = (unsigned char)text[at];
+            if (byte >= ANSI_CSI_FINAL_FIRST && byte <= ANSI_CSI_FINAL_LAST) {
+                return at + 1 - offset;
+            }
+            if (byte < ANSI_CSI_BODY_FIRST || byte > ANSI_CSI_BODY_LAST) {
+                /* Malformed: the sequence ends before the stray byte */
+                break;
+            }
+        }
+        return at - offset;
+    }
+    if (ansi_is_string_introducer(introducer)) {
+        for (at++; at < length; at++) {
+            unsigned char byte = (unsigned char)text[at];
+            if (byte == ASCII_BEL) {
+                return at + 1 - offset;
+            }
+            if (byte == ASCII_ESC) {
+                if (at + 1 >= length) {
+                    return length - offset;
+                }
+                /* ST ends the string; any other escape cancels it */
+                return (text[at + 1] == ANSI_STRING_TERMINATOR ? at + 2 : at) - offset;
+            }
+        }
+        return at - offset;
+    }
+    while (at < length && (unsigned char)text[at] >= ANSI_INTERMEDIATE_FIRST &&
+           (unsigned char)text[at] <= ANSI_INTERMEDIATE_LAST) {
+        at++;
+    }
+    if (at < length && (unsigned char)text[at] >= ANSI_FINAL_FIRST &&
+        (unsigned char)text[at] <= ANSI_FINAL_LAST) {
+        at++;
+    }
+    return at - offset;
+}
+
+int utflite_string_width_ansi(const char *text, int length) {
+    int width = 0;
+    int offset = 0;
+    while (offset < length) {
+        int escape = ansi_escape_find(text, offset, length);
+        width += utflite_string_width_mode(text + offset, escape - offset, UTFLITE_WIDTH_GRAPHEMES);
+        if (escape == length) {
+            break;
+        }
+        offset = escape + utflite_ansi_sequence_length(text, length, escape);
+    }
+    return width;
+}
+
+int utflite_truncate_ansi(const char *text, int length, int max_cols, char *buffer, int *width) {
+    int written = 0;
+    int total = 0;
+    int cut = 0;
+    int offset = 0;
+    while (offset < length) {
+        int escape = ansi_escape_find(text, offset, length);
+        if (!cut) {
+            /* Escapes end clusters, so each visible run is measured alone */
+            int run = escape - offset;
+            int run_width;
+            int kept = grapheme_fit(text + offset, run, run, max_cols - total, NULL, &run_width);
+            memcpy(buffer + written, text + offset, (size_t)kept);
+            written += kept;
+            total += run_width;
+            cut = kept < run;
+        }
+        if (escape == length) {
+            break;
+        }
+        int sequence = utflite_ansi_sequence_length(text, length, escape);
+        memcpy(buffer + written, text + escape, (size_t)sequence);
+        written += sequence;
+        offset = escape + sequence;
+    }
+    if (width) {
+        *width = total;
+    }
+    return written;
+}
+
+int utflite_strip_ansi(const char *text, int length, char *buffer) {
+    int written = 0;
+    int offset = 0;
+    while (offset < length) {
+        int escape = ansi_escape_find(text, offset, length);
+        memmove(buffer + written, text + offset, (size_t)(escape - offset));
+        written += escape - offset;
+        if (escape == length) {
+            break;
+        }
+        offset = escape + utflite_ansi_sequence_length(text, length, escape);
+    }
+    return written;
+}
+
+/* ============================================================================
+ * Terminal Output
+ * ============================================================================ */
+
+/* Bytes in the UTF-8 sequence 'byte' leads, as utflite_decode() reads it;
+ * 1 for ASCII and for bytes that cannot lead a sequence. */
+static int utf8_sequence_length(unsigned char byte) {
+    if ((byte & 0xE0) == 0xC0) {
+        return 2;
+    }
+    if ((byte & 0xF0) == 0xE0) {
+        return 3;
+    }
+    if ((byte & 0xF8) == 0xF0) {
+        return 4;
+    }
+    return 1;
+}
+
+/* Returns how many bytes at the end of text[0, length) start a UTF-8
+ * sequence that the text cuts short, or 0 if it ends on a whole one. */
+static int utf8_cut_length(const char *text, int length) {
+    for (int back = 1; back < UTFLITE_MAX_BYTES && back <= length; back++) {
+        unsigned char byte = (unsigned char)text[length - back];
+        if ((byte & UTF8_CONTINUATION_MASK) != UTF8_CONTINUATION_BITS) {
+            return utf8_sequence_length(byte) > back ? back : 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Feeds one codepoint of a print run, whose bytes end at 'end' in the
+ * input, to the grapheme automaton. A boundary opens a cell; anything else
+ * extends the open cell, or the previous call's last cluster when no cell
+ * is open yet. Returns 0, with the state untouched, when a cell is needed
+ * but all are taken.
+ */
+static int print_run_add(struct utflite_print_state *state, struct utflite_print_cell *cells, int capacity, int *count, uint32_t codepoint, int end) {
+    int cp_width;
+    uint8_t next = state->grapheme_state;
+    int is_break = grapheme_step_class(&next, grapheme_class_width(codepoint, &cp_width));
+    if (cp_width < 0) {
+        cp_width = 0;
+    }
+    if (!is_break && *count > 0) {
+        struct utflite_print_cell *cell = &cells[*count - 1];
+        cell->extra_length = end - cell->extra_offset;
+        cell->width = grapheme_width_extend(cell->width, codepoint, cp_width);
+    } else {
+        if (*count >= capacity) {
+            return 0;
+        }
+        struct utflite_print_cell *cell = &cells[(*count)++];
+        cell->codepoint = codepoint;
+        cell->extra_offset = end > 0 ? end : 0;
+        cell->extra_length = 0;
+        cell->width = is_break ? cp_width :
+                      grapheme_width_extend(state->cluster_width, codepoint, cp_width);
+        cell->joins_previous = !is_break;
+    }
+    state->grapheme_state = next;
+    return 1;
+}
+
+int utflite_print_run(struct utflite_print_state *state, const char *data, int length, struct utflite_print_cell *cells, int cell_capacity, int *cell_count) {
+    if (!state || !cells || !cell_count) {
+        return 0;
+    }
+    *cell_count = 0;
+    if (cell_capacity <= 0 || length <= 0 || !data) {
+        return 0;
+    }
+    int count = 0;
+    int offset = 0;
+    if (state->pending_length > 0) {
+        /* Finish the sequence the previous read cut off. Its bytes are
+         * decoded as if the two reads were one. */
+        char joined[2 * UTFLITE_MAX_BYTES];
+        int held = state->pending_length;
+        int taken = length < UTFLITE_MAX_BYTES ? length : UTFLITE_MAX_BYTES;
+        memcpy(joined, state->pending, (size_t)held);
+        memcpy(joined + held, data, (size_t)taken);
+        if (utf8_cut_length(joined, held + taken) == held + taken) {
+            memcpy(state->pending, joined, (size_t)(held + taken));
+            state->pending_length = held + taken;
+            return length;
+        }
+        int at = 0;
+        while (at < held) {
+            uint32_t codepoint;
+            int bytes = utflite_decode(joined + at, held + taken - at, &codepoint);
+            if (!print_run_add(state, cells, cell_capacity, &count, codepoint,
+                               at + bytes - held)) {
+                memmove(state->pending, state->pending + at, (size_t)(held - at));
+                state->pending_length = held - at;
+                *cell_count = count;
+                return 0;
+            }
+            at += bytes;
+        }
+        state->pending_length = 0;
+        offset = at - held;
+    }
+
+    int limit = length - utf8_cut_length(data, length);
+    while (offset < limit) {
+        unsigned char byte = (unsigned char)data[offset];
+        if (byte < ASCII_PRINTABLE_FIRST || byte == ASCII_DEL) {
+            break;
+        }
+        if (byte > ASCII_PRINTABLE_LAST) {
+            uint32_t codepoint;
+            int bytes = utflite_decode(data + offset, length - offset, &codepoint);
+            if (!print_run_add(state, cells, cell_capacity, &count, codepoint, offset + bytes)) {
+                break;
+            }
+            offset += bytes;
+            continue;
+        }
+        if (!print_run_add(state, cells, cell_capacity, &count, byte, offset + 1)) {
+            break;
+        }
+        offset++;
+
+        /* The rest of a printable ASCII run: one-column clusters of a byte
+         * each, found a word at a time */
+        int run_end = offset;
+        int run_limit = offset + (cell_capacity - count);
+        if (run_limit > limit) {
+            run_limit = limit;
+        }
+        while (run_end + SWAR_WORD_BYTES <= run_limit) {
+            uint64_t word;
+            memcpy(&word, data + run_end, sizeof(word));
+            if (!swar_all_printable(word)) {
+                break;
+            }
+            run_end += SWAR_WORD_BYTES;
+        }
+        while (run_end < run_limit &&
+               (unsigned char)data[run_end] >= ASCII_PRINTABLE_FIRST &&
+               (unsigned char)data[run_end] <= ASCII_PRINTABLE_LAST) {
+            run_end++;
+        }
+        if (run_end > offset) {
+            for (; offset < run_end; offset++) {
+                struct utflite_print_cell *cell = &cells[count++];
+                cell->codepoint = (unsigned char)data[offset];
+                cell->extra_offset = offset + 1;
+                cell->extra_length = 0;
+                cell->width = 1;
+                cell->joins_previous = 0;
+            }
+            grapheme_step(&state->grapheme_state, (unsigned char)data[offset - 1]);
+        }
+    }
+    if (offset == limit && limit < length) {
+        state->pending_length = length - limit;
+        memcpy(state->pending, data + limit, (size_t)state->pending_length);
+        offset = length;
+    } else if (offset < length && ((unsigned char)data[offset] < ASCII_PRINTABLE_FIRST ||
+                                   (unsigned char)data[offset] == ASCII_DEL)) {
+        /* Clusters always break around a control */
+        state->grapheme_state = GRAPHEME_STATE_START;
+    }
+    if (count > 0) {
+        state->cluster_width = cells[count - 1].width;
+    }
+    *cell_count = count;
+    return offset;
 }
@@ -0,0 +1,133 @@
+/*
+ * test_grapheme_break.c - Runs Unicode's GraphemeBreakTest.txt against utflite
+ *
+ * The data file is not shipped with the library. Download it from
+ * https://www.unicode.org/Public/17.0.0/ucd/auxiliary/GraphemeBreakTest.txt
+ * and run:
+ *
+ *   make test-grapheme-break GRAPHEME_BREAK_TEST=path/to/GraphemeBreakTest.txt
+ *
+ * Each test line lists codepoints separated by "÷" (boundary) or "×" (no
+ * boundary). The line is encoded as UTF-8, segmented with
+ * utflite_next_grapheme(), and the boundaries are compared with the expected
+ * ones. prev_grapheme is checked against the same boundaries walking back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef UTFLITE_SINGLE_HEADER
+#define UTFLITE_IMPLEMENTATION
+#include "utflite.h"
+#else
+#include <utflite/utflite.h>
+#endif
+
+/* Longest line we expect in the test file. */
+#define LINE_BUFFER_SIZE 4096
+
+/* Upper bound on codepoints in one test case. */
+#define MAX_TEST_CODEPOINTS 64
+
+/* Marker bytes for "÷" (U+00F7) in UTF-8; "×" is anything else. */
+#define BREAK_MARKER "\xC3\xB7"
+
+/* Base for parsing the hexadecimal codepoint fields. */
+#define HEXADECIMAL_BASE 16
+
+/* One parsed line: UTF-8 text plus the expected boundary byte offsets. */
+struct break_test_case {
+    char text[MAX_TEST_CODEPOINTS * UTFLITE_MAX_BYTES];
+    int text_length;
+    int boundaries[MAX_TEST_CODEPOINTS + 1];
+    int boundary_count;
+};
+
+/* Parses one GraphemeBreakTest line into a test case. Returns 0 for blank
+ * and comment-only lines, 1 when a case was parsed. */
+static int break_test_parse_line(char *line, struct break_test_case *test_case) {
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+    test_case->text_length = 0;
+    test_case->boundary_count = 0;
+
+    char *token = strtok(line, " \t\r\n");
+    int codepoint_count = 0;
+    while (token) {
+        if (strcmp(token, BREAK_MARKER) == 0) {
+            test_case->boundaries[test_case->boundary_count++] = test_case->text_length;
+        } else if ((unsigned char)token[0] < 0x80) {
+            uint32_t codepoint = (uint32_t)strtoul(token, NULL, HEXADECIMAL_BASE);
+            if (codepoint_count++ >= MAX_TEST_CODEPOINTS) {
+                return 0;
+            }
+            test_case->text_length += utflite_encode(codepoint,
+                                                     test_case->text + test_case->text_length);
+        }
+        token = strtok(NULL, " \t\r\n");
+    }
+    return codepoint_count > 0;
+}
+
+/* Segments the case forward and backward. Returns 1 when every boundary
+ * matches the expected list. */
+static int break_test_check_case(const struct break_test_case *test_case) {
+    int index = 1;
+    int offset = 0;
+    while (offset < test_case->text_length) {
+        offset = utflite_next_grapheme(test_case->text, test_case->text_length, offset);
+        if (index >= test_case->boundary_count || offset != test_case->boundaries[index]) {
+            return 0;
+        }
+        index++;
+    }
+    if (index != test_case->boundary_count) {
+        return 0;
+    }
+    for (index = test_case->boundary_count - 1; index > 0; index--) {
+        int previous = utflite_prev_grapheme(test_case->text, test_case->boundaries[index]);
+        if (previous != test_case->boundaries[index - 1]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s GraphemeBreakTest.txt\n", argv[0]);
+        return 2;
+    }
+    FILE *file = fopen(argv[1], "r");
+    if (!file) {
+        perror(argv[1]);
+        return 2;
+    }
+
+    char line[LINE_BUFFER_SIZE];
+    struct break_test_case test_case;
+    int line_number = 0;
+    int passed = 0;
+    int failed = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char original[LINE_BUFFER_SIZE];
+        memcpy(original, line, sizeof(line));
+        if (!break_test_parse_line(line, &test_case)) {
+            continue;
+        }
+        if (break_test_check_case(&test_case)) {
+            passed++;
+        } else {
+            failed++;
+            printf("FAIL line %d: %s", line_number, original);
+        }
+    }
+    fclose(file);
+
+    printf("GraphemeBreakTest: %d passed, %d failed\n", passed, failed);
+    return failed > 0 ? 1 : 0;
+}
@@ -338,6 +338,833 @@ TEST(truncate) {
     ASSERT_EQ(utflite_truncate(text, 4, 3), 4);   /* CJK + A fits */
 }
 
+/* ============================================================================
+ * Grapheme Tests
+ * ============================================================================ */
+
+TEST(grapheme_pair_rules) {
+    /* GB3: CR LF stays together, GB4/GB5 break around other controls */
+    ASSERT_EQ(utflite_next_grapheme("\r\nA", 3, 0), 2);
+    ASSERT_EQ(utflite_next_grapheme("\n\r", 2, 0), 1);
+    ASSERT_EQ(utflite_next_grapheme("A\t", 2, 0), 1);
+
+    /* GB6-GB8: conjoining Hangul jamo L + V + T form one syllable */
+    const char *jamo = "\xE1\x84\x92\xE1\x85\xA1\xE1\x86\xAB" "A";
+    ASSERT_EQ(utflite_next_grapheme(jamo, 10, 0), 9);
+
+    /* GB9: e + combining acute accent */
+    ASSERT_EQ(utflite_next_grapheme("e\xCC\x81x", 4, 0), 3);
+
+    /* GB999: plain Latin letters break everywhere */
+    ASSERT_EQ(utflite_next_grapheme("ab", 2, 0), 1);
+}
+
+TEST(grapheme_stateful_rules) {
+    /* GB11: man ZWJ woman is one cluster */
+    const char *couple = "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9";
+    ASSERT_EQ(utflite_next_grapheme(couple, 11, 0), 11);
+
+    /* GB12/GB13: four regional indicators make two flags */
+    const char *flags = "\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6"
+                        "\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6";
+    ASSERT_EQ(utflite_next_grapheme(flags, 16, 0), 8);
+    ASSERT_EQ(utflite_next_grapheme(flags, 16, 8), 16);
+
+    /* GB9c: Devanagari KA + VIRAMA + SSA is a single conjunct */
+    const char *conjunct = "\xE0\xA4\x95\xE0\xA5\x8D\xE0\xA4\xB7";
+    ASSERT_EQ(utflite_next_grapheme(conjunct, 9, 0), 9);
+
+    /* prev_grapheme lands on the same boundaries */
+    ASSERT_EQ(utflite_prev_grapheme(flags, 16), 8);
+    ASSERT_EQ(utflite_prev_grapheme(couple, 11), 0);
+}
+
+TEST(grapheme_boundary) {
+    /* Pairs decide most offsets; inside a sequence is never a boundary */
+    ASSERT_EQ(utflite_is_grapheme_boundary("e\xCC\x81x", 4, 1), 0);
+    ASSERT_EQ(utflite_is_grapheme_boundary("e\xCC\x81x", 4, 2), 0);
+    ASSERT_EQ(utflite_is_grapheme_boundary("e\xCC\x81x", 4, 3), 1);
+    ASSERT_EQ(utflite_is_grapheme_boundary("\r\n", 2, 1), 0);
+    ASSERT_EQ(utflite_is_grapheme_boundary("ab", 2, 0), 1);
+    ASSERT_EQ(utflite_is_grapheme_boundary("ab", 2, 2), 1);
+
+    /* GB12/GB13: only an even number of regional indicators before */
+    const char *flags = "\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6"
+                        "\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6";
+    ASSERT_EQ(utflite_is_grapheme_boundary(flags, 16, 4), 0);
+    ASSERT_EQ(utflite_is_grapheme_boundary(flags, 16, 8), 1);
+    ASSERT_EQ(utflite_is_grapheme_boundary(flags, 16, 12), 0);
+
+    /* GB11: ZWJ joins pictographs, but not after a letter */
+    ASSERT_EQ(utflite_is_grapheme_boundary("\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9",
+                                           11, 7), 0);
+    ASSERT_EQ(utflite_is_grapheme_boundary("a\xE2\x80\x8D\xF0\x9F\x91\xA9", 8, 4), 1);
+
+    /* GB9c: KA VIRAMA SSA is a conjunct, VIRAMA alone after a letter is not */
+    ASSERT_EQ(utflite_is_grapheme_boundary("\xE0\xA4\x95\xE0\xA5\x8D\xE0\xA4\xB7", 9, 6), 0);
+    ASSERT_EQ(utflite_is_grapheme_boundary("a\xE0\xA5\x8D\xE0\xA4\xB7", 7, 4), 1);
+}
+
+TEST(grapheme_count) {
+    ASSERT_EQ(utflite_grapheme_count("", 0), 0);
+    ASSERT_EQ(utflite_grapheme_count("Hello, world!", 13), 13);
+
+    /* CR LF is one cluster; e + combining acute is one cluster */
+    ASSERT_EQ(utflite_grapheme_count("a\r\ne\xCC\x81z", 7), 4);
+
+    /* ZWJ couple, two flags, then ASCII */
+    const char *emoji = "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9"
+                        "\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6"
+                        "\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6" "ok";
+    ASSERT_EQ(utflite_grapheme_count(emoji, 29), 5);
+
+    /* GB9b: ARABIC NUMBER SIGN (Prepend) joins the ASCII digit after it */
+    ASSERT_EQ(utflite_grapheme_count("\xD8\x80" "12", 4), 2);
+
+    /* Agrees with a utflite_next_grapheme() walk */
+    int walked = 0;
+    for (int offset = 0; offset < 29; walked++) {
+        offset = utflite_next_grapheme(emoji, 29, offset);
+    }
+    ASSERT_EQ(utflite_grapheme_count(emoji, 29), walked);
+}
+
+TEST(grapheme_count_bounded) {
+    const char *text = "abc\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD" "de";  /* 6 clusters */
+    ASSERT_EQ(utflite_grapheme_count_bounded(text, 13, 10), 6);
+    ASSERT_EQ(utflite_grapheme_count_bounded(text, 13, 6), 6);
+    ASSERT_EQ(utflite_grapheme_count_bounded(text, 13, 5), 6);
+    ASSERT_EQ(utflite_grapheme_count_bounded(text, 13, 2), 3);
+    ASSERT_EQ(utflite_grapheme_count_bounded(text, 13, -1), 1);
+    ASSERT_EQ(utflite_grapheme_count_bounded("abcdef", 6, 3), 4);
+    ASSERT_EQ(utflite_grapheme_count_bounded("", 0, 0), 0);
+}
+
+TEST(grapheme_width) {
+    /* Man ZWJ woman ZWJ girl: three wide codepoints, one 2-column cluster */
+    const char *family = "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9"
+                         "\xE2\x80\x8D\xF0\x9F\x91\xA7";
+    int next;
+    ASSERT_EQ(utflite_grapheme_width(family, 18, 0, &next), 2);
+    ASSERT_EQ(next, 18);
+    ASSERT_EQ(utflite_string_width(family, 18), 6);
+    ASSERT_EQ(utflite_string_width_mode(family, 18, UTFLITE_WIDTH_GRAPHEMES), 2);
+
+    /* VS16 asks for emoji presentation, VS15 for text */
+    ASSERT_EQ(utflite_grapheme_width("\xE2\x98\xBA\xEF\xB8\x8F", 6, 0, NULL), 2);
+    ASSERT_EQ(utflite_grapheme_width("\xE2\x9D\xA4\xEF\xB8\x8E", 6, 0, NULL), 1);
+
+    /* e + combining acute, then CRLF (a control cluster) */
+    const char *text = "e\xCC\x81\r\nab";
+    ASSERT_EQ(utflite_grapheme_width(text, 7, 0, &next), 1);
+    ASSERT_EQ(next, 3);
+    ASSERT_EQ(utflite_grapheme_width(text, 7, 3, &next), -1);
+    ASSERT_EQ(next, 5);
+    ASSERT_EQ(utflite_string_width_mode(text, 7, UTFLITE_WIDTH_GRAPHEMES), 3);
+    ASSERT_EQ(utflite_string_width_mode(text, 7, UTFLITE_WIDTH_CODEPOINTS), 3);
+    ASSERT_EQ(utflite_grapheme_width(text, 7, 7, &next), 0);
+
+    /* ASCII after a Prepend joins its cluster and still takes a column */
+    ASSERT_EQ(utflite_string_width_mode("\xD8\x80xy", 4, UTFLITE_WIDTH_GRAPHEMES), 2);
+}
+
+TEST(truncate_graphemes) {
+    /* "e" + combining acute, then "x": the accent is never orphaned */
+    const char *accent = "e\xCC\x81x";
+    int width;
+    ASSERT_EQ(utflite_truncate_graphemes(accent, 4, 1, &width), 3);
+    ASSERT_EQ(width, 1);
+    ASSERT_EQ(utflite_truncate_graphemes(accent, 4, 2, &width), 4);
+    ASSERT_EQ(width, 2);
+
+    /* Two flags: utflite_truncate() can stop between the indicators */
+    const char *flags = "\xF0\x9F\x87\xBA\xF0\x9F\x87\xB8"
+                        "\xF0\x9F\x87\xAF\xF0\x9F\x87\xB5";
+    ASSERT_EQ(utflite_truncate(flags, 16, 1), 4);
+    ASSERT_EQ(utflite_truncate_graphemes(flags, 16, 1, &width), 8);
+    ASSERT_EQ(width, 1);
+    ASSERT_EQ(utflite_truncate_graphemes(flags, 16, 0, &width), 0);
+    ASSERT_EQ(width, 0);
+
+    /* A ZWJ family is one 2-column cluster, unlike utflite_truncate() */
+    const char *family = "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9";
+    ASSERT_EQ(utflite_truncate_graphemes(family, 11, 2, &width), 11);
+    ASSERT_EQ(width, 2);
+    ASSERT_EQ(utflite_truncate(family, 11, 2), 7);
+
+    ASSERT_EQ(utflite_truncate_graphemes("ABC", 3, 2, NULL), 2);
+}
+
+TEST(truncate_ellipsis) {
+    const char *path = "src/utflite.c";   /* 13 columns */
+    char out[32];
+    int width;
+    int written = utflite_truncate_ellipsis(path, 13, 8, UTFLITE_ELLIPSIS_END, out, &width);
+    ASSERT_EQ(written, 10);
+    ASSERT(memcmp(out, "src/utf\xE2\x80\xA6", 10) == 0);
+    ASSERT_EQ(width, 8);
+
+    written = utflite_truncate_ellipsis(path, 13, 8, UTFLITE_ELLIPSIS_START, out, &width);
+    ASSERT_EQ(written, 10);
+    ASSERT(memcmp(out, "\xE2\x80\xA6" "flite.c", 10) == 0);
+    ASSERT_EQ(width, 8);
+
+    written = utflite_truncate_ellipsis(path, 13, 8, UTFLITE_ELLIPSIS_MIDDLE, out, &width);
+    ASSERT_EQ(written, 10);
+    ASSERT(memcmp(out, "src/\xE2\x80\xA6" "e.c", 10) == 0);
+
+    /* Text that fits is copied unchanged */
+    ASSERT_EQ(utflite_truncate_ellipsis(path, 13, 13, UTFLITE_ELLIPSIS_MIDDLE, out, &width), 13);
+    ASSERT(memcmp(out, path, 13) == 0);
+    ASSERT_EQ(width, 13);
+
+    /* A wide character that does not fit leaves its column to the tail */
+    const char *cjk = "\xE4\xB8\xAD\xE6\x96\x87" "abc";   /* 7 columns */
+    written = utflite_truncate_ellipsis(cjk, 9, 3, UTFLITE_ELLIPSIS_MIDDLE, out, &width);
+    ASSERT_EQ(written, 5);
+    ASSERT(memcmp(out, "\xE2\x80\xA6" "bc", 5) == 0);
+    ASSERT_EQ(width, 3);
+
+    /* A flag at the end is kept or dropped whole */
+    const char *flag = "ab\xF0\x9F\x87\xBA\xF0\x9F\x87\xB8";
+    written = utflite_truncate_ellipsis(flag, 10, 2, UTFLITE_ELLIPSIS_START, out, &width);
+    ASSERT_EQ(written, 11);
+    ASSERT(memcmp(out + 3, flag + 2, 8) == 0);
+
+    /* No room for the ellipsis */
+    ASSERT_EQ(utflite_truncate_ellipsis(path, 13, 0, UTFLITE_ELLIPSIS_END, out, &width), 0);
+    ASSERT_EQ(width, 0);
+}
+
+TEST(pad) {
+    char out[64];
+    ASSERT_EQ(utflite_pad("ab", 2, 5, UTFLITE_ALIGN_LEFT, out), 5);
+    ASSERT(memcmp(out, "ab   ", 5) == 0);
+    ASSERT_EQ(utflite_pad("ab", 2, 5, UTFLITE_ALIGN_RIGHT, out), 5);
+    ASSERT(memcmp(out, "   ab", 5) == 0);
+    ASSERT_EQ(utflite_pad("ab", 2, 5, UTFLITE_ALIGN_CENTER, out), 5);
+    ASSERT(memcmp(out, " ab  ", 5) == 0);
+
+    /* Padding is counted in columns, not bytes */
+    ASSERT_EQ(utflite_pad("\xE4\xB8\xAD", 3, 4, UTFLITE_ALIGN_RIGHT, out), 5);
+    ASSERT(memcmp(out, "  \xE4\xB8\xAD", 5) == 0);
+
+    /* Too wide: cut at a cluster boundary, then padded to the width */
+    ASSERT_EQ(utflite_pad("\xE4\xB8\xAD\xE6\x96\x87", 6, 3, UTFLITE_ALIGN_LEFT, out), 4);
+    ASSERT(memcmp(out, "\xE4\xB8\xAD ", 4) == 0);
+
+    struct utflite_span cells[] = {{"id", 2}, {"\xE5\x90\x8D\xE5\x89\x8D", 6}, {"42", 2}};
+    int cols[] = {3, 6, 4};
+    enum utflite_align aligns[] = {UTFLITE_ALIGN_LEFT, UTFLITE_ALIGN_CENTER, UTFLITE_ALIGN_RIGHT};
+    int written = utflite_pad_row(cells, cols, aligns, 3, " | ", out);
+    const char *row = "id  |  \xE5\x90\x8D\xE5\x89\x8D  |   42";
+    ASSERT_EQ(written, (int)strlen(row));
+    ASSERT(memcmp(out, row, (size_t)written) == 0);
+
+    ASSERT_EQ(utflite_pad_row(cells, cols, NULL, 3, NULL, out), 15);
+    ASSERT(memcmp(out, "id \xE5\x90\x8D\xE5\x89\x8D  42  ", 15) == 0);
+}
+
+TEST(column_widths) {
+    struct utflite_span cells[] = {
+        {"name", 4}, {"size", 4},
+        {"caf\xC3\xA9 au lait.txt", 17}, {"12", 2},
+        {"\xE4\xB8\xAD\xE6\x96\x87", 6}, {"\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9", 11},
+    };
+    int cell_widths[6];
+    int column_widths[2];
+    ASSERT_EQ(utflite_column_widths(cells, 3, 2, UTFLITE_WIDTH_CODEPOINTS,
+                                    cell_widths, column_widths), 20);
+    ASSERT_EQ(cell_widths[0], 4);
+    ASSERT_EQ(cell_widths[2], 16);
+    ASSERT_EQ(cell_widths[4], 4);
+    ASSERT_EQ(cell_widths[5], 4);
+    ASSERT_EQ(column_widths[0], 16);
+    ASSERT_EQ(column_widths[1], 4);
+
+    /* Per cluster, the ZWJ sequence is one 2-column cell */
+    ASSERT_EQ(utflite_column_widths(cells, 3, 2, UTFLITE_WIDTH_GRAPHEMES,
+                                    NULL, column_widths), 20);
+    ASSERT_EQ(column_widths[1], 4);
+    ASSERT_EQ(utflite_column_widths(cells + 4, 1, 2, UTFLITE_WIDTH_GRAPHEMES,
+                                    cell_widths, column_widths), 6);
+    ASSERT_EQ(cell_widths[1], 2);
+}
+
+TEST(tabs) {
+    /* "a\tb" with 4-column stops: the tab fills columns 1-3 */
+    ASSERT_EQ(utflite_string_width_tabs("a\tb", 3, 4, 0), 5);
+    ASSERT_EQ(utflite_string_width_tabs("a\tb", 3, 4, 2), 3);
+    ASSERT_EQ(utflite_string_width_tabs("a\tb", 3, 8, 0), 9);
+    ASSERT_EQ(utflite_string_width_tabs("a\tb", 3, 0, 0), 2);
+
+    /* A tab after a wide character starts from the column it reached */
+    const char *text = "\xE4\xB8\xAD\t\xCC\x81x";
+    ASSERT_EQ(utflite_string_width_tabs(text, 7, 4, 0), 5);
+
+    int width;
+    ASSERT_EQ(utflite_truncate_tabs("a\tb", 3, 3, 4, 0, &width), 1);
+    ASSERT_EQ(width, 1);
+    ASSERT_EQ(utflite_truncate_tabs("a\tb", 3, 4, 4, 0, &width), 2);
+    ASSERT_EQ(width, 4);
+    ASSERT_EQ(utflite_truncate_tabs("a\tb", 3, 10, 4, 0, &width), 3);
+    ASSERT_EQ(width, 5);
+
+    ASSERT_EQ(utflite_offset_to_column_tabs("a\tb", 3, 2, 4, 0), 4);
+    ASSERT_EQ(utflite_offset_to_column_tabs("a\tb", 3, 2, 4, 6), 8);
+    ASSERT_EQ(utflite_offset_to_column_tabs("a\tb", 3, 99, 4, 0), 5);
+
+    /* An offset inside a cluster maps to the cluster's start */
+    ASSERT_EQ(utflite_offset_to_column_tabs("xe\xCC\x81y", 5, 3, 4, 0), 1);
+    ASSERT_EQ(utflite_offset_to_column_tabs("xe\xCC\x81y", 5, 4, 4, 0), 2);
+}
+
+TEST(ansi) {
+    ASSERT_EQ(utflite_ansi_sequence_length("\x1b[1;31mX", 9, 0), 7);
+    ASSERT_EQ(utflite_ansi_sequence_length("\x1b]8;;http://a\x1b\\", 15, 0), 15);
+    ASSERT_EQ(utflite_ansi_sequence_length("\x1b]0;title\x07", 10, 0), 10);
+    ASSERT_EQ(utflite_ansi_sequence_length("\x1b(B", 3, 0), 3);
+    ASSERT_EQ(utflite_ansi_sequence_length("\x1b[31", 4, 0), 4);   /* Cut off */
+    ASSERT_EQ(utflite_ansi_sequence_length("X\x1b[m", 4, 0), 0);
+
+    /* Red "hi", reset, then a hyperlinked CJK word */
+    const char *text = "\x1b[31mhi\x1b[0m \x1b]8;;http://a\x1b\\\xE4\xB8\xAD\xE6\x96\x87\x1b]8;;\x1b\\";
+    int length = (int)strlen(text);
+    ASSERT_EQ(utflite_string_width_ansi(text, length), 7);
+    ASSERT_EQ(utflite_string_width(text, length) > 7, 1);
+
+    char out[64];
+    int written = utflite_strip_ansi(text, length, out);
+    ASSERT_EQ(written, 9);
+    ASSERT(memcmp(out, "hi \xE4\xB8\xAD\xE6\x96\x87", 9) == 0);
+
+    /* Cutting inside the link keeps the sequences that close it */
+    int width;
+    written = utflite_truncate_ansi(text, length, 5, out, &width);
+    ASSERT_EQ(width, 5);
+    const char *expected = "\x1b[31mhi\x1b[0m \x1b]8;;http://a\x1b\\\xE4\xB8\xAD\x1b]8;;\x1b\\";
+    ASSERT_EQ(written, (int)strlen(expected));
+    ASSERT(memcmp(out, expected, (size_t)written) == 0);
+
+    written = utflite_truncate_ansi(text, length, 1, out, &width);
+    ASSERT_EQ(width, 1);
+    ASSERT_EQ(utflite_strip_ansi(out, written, out), 1);
+    ASSERT_EQ(out[0], 'h');
+
+    /* Stripping in place */
+    char line[] = "a\x1b[1mb\x1b[0mc";
+    ASSERT_EQ(utflite_strip_ansi(line, (int)strlen(line), line), 3);
+    ASSERT(memcmp(line, "abc", 3) == 0);
+}
+
+TEST(fill_cells) {
+    /* "a", CJK (2 columns), "e" + acute, tab, "z" */
+    const char *line = "a\xE4\xB8\xAD" "e\xCC\x81\tz";
+    int length = (int)strlen(line);
+    struct utflite_cell cells[16];
+    ASSERT_EQ(utflite_fill_cells(line, length, 0, 16, 8, cells), 9);
+    ASSERT_EQ(cells[0].offset, 0);
+    ASSERT_EQ(cells[0].length, 1);
+    ASSERT_EQ(cells[1].offset, 1);
+    ASSERT_EQ(cells[1].length, 3);
+    ASSERT_EQ(cells[1].width, 2);
+    ASSERT_EQ(cells[2].offset, 1);   /* Spacer */
+    ASSERT_EQ(cells[2].width, 0);
+    ASSERT_EQ(cells[3].offset, 4);
+    ASSERT_EQ(cells[3].length, 3);
+    ASSERT_EQ(cells[4].offset, 7);   /* Tab to column 8, drawn blank */
+    ASSERT_EQ(cells[4].length, 0);
+    ASSERT_EQ(cells[4].width, 1);
+    ASSERT_EQ(cells[7].offset, 7);
+    ASSERT_EQ(cells[8].offset, 8);
+    ASSERT_EQ(cells[8].length, 1);
+
+    /* The viewport cuts the wide character in half on both sides */
+    ASSERT_EQ(utflite_fill_cells(line, length, 2, 2, 8, cells), 2);
+    ASSERT_EQ(cells[0].offset, 1);
+    ASSERT_EQ(cells[0].length, 0);
+    ASSERT_EQ(cells[0].width, 1);
+    ASSERT_EQ(cells[1].offset, 4);
+    ASSERT_EQ(utflite_fill_cells(line, length, 0, 2, 8, cells), 2);
+    ASSERT_EQ(cells[1].offset, 1);
+    ASSERT_EQ(cells[1].length, 0);
+    ASSERT_EQ(cells[1].width, 1);
+
+    /* Past the end of the line */
+    ASSERT_EQ(utflite_fill_cells(line, length, 20, 10, 8, cells), 0);
+    ASSERT_EQ(utflite_fill_cells("abcdef", 6, 4, 10, 8, cells), 2);
+    ASSERT_EQ(cells[1].offset, 5);
+}
+
+TEST(line_damage) {
+    int first;
+    int end;
+    ASSERT_EQ(utflite_line_damage("status: ok", 10, "status: ok", 10, &first, &end), 0);
+    ASSERT_EQ(first, 0);
+    ASSERT_EQ(end, 0);
+
+    /* Same width: only the changed columns */
+    ASSERT_EQ(utflite_line_damage("status: ok  [3]", 15, "status: no  [3]", 15, &first, &end), 1);
+    ASSERT_EQ(first, 8);
+    ASSERT_EQ(end, 10);
+
+    /* A changed accent redraws its whole cluster, not just the mark */
+    ASSERT_EQ(utflite_line_damage("xe\xCC\x81y", 5, "xe\xCC\x80y", 5, &first, &end), 1);
+    ASSERT_EQ(first, 1);
+    ASSERT_EQ(end, 2);
+
+    /* CJK to CJK sharing a lead byte: both columns of the wide cell */
+    ASSERT_EQ(utflite_line_damage("a\xE4\xB8\xAD" "b", 5, "a\xE4\xB8\xAE" "b", 5, &first, &end), 1);
+    ASSERT_EQ(first, 1);
+    ASSERT_EQ(end, 3);
+
+    /* Narrow to wide shifts the suffix: redraw to the end of the longer line */
+    ASSERT_EQ(utflite_line_damage("ab-cd", 5, "ab\xE4\xB8\xAD" "cd", 7, &first, &end), 1);
+    ASSERT_EQ(first, 2);
+    ASSERT_EQ(end, 6);
+
+    /* Appending */
+    ASSERT_EQ(utflite_line_damage("ab", 2, "abc", 3, &first, &end), 1);
+    ASSERT_EQ(first, 2);
+    ASSERT_EQ(end, 3);
+}
+
+TEST(print_run) {
+    struct utflite_print_state state = {0};
+    struct utflite_print_cell cells[8];
+    int count;
+
+    /* The cell count is required */
+    ASSERT_EQ(utflite_print_run(&state, "ab", 2, cells, 8, NULL), 0);
+
+    /* Stops at ESC, leaving it to the caller */
+    ASSERT_EQ(utflite_print_run(&state, "ab\x1b[m", 5, cells, 8, &count), 2);
+    ASSERT_EQ(count, 2);
+    ASSERT_EQ(cells[1].codepoint, 'b');
+    ASSERT_EQ(cells[1].width, 1);
+
+    /* Marks stay in the input after the base codepoint */
+    ASSERT_EQ(utflite_print_run(&state, "e\xCC\x81z", 4, cells, 8, &count), 4);
+    ASSERT_EQ(count, 2);
+    ASSERT_EQ(cells[0].codepoint, 'e');
+    ASSERT_EQ(cells[0].extra_offset, 1);
+    ASSERT_EQ(cells[0].extra_length, 2);
+    ASSERT_EQ(cells[1].extra_length, 0);
+
+    /* A sequence cut by the read is held until the next one */
+    ASSERT_EQ(utflite_print_run(&state, "x\xE4\xB8", 3, cells, 8, &count), 3);
+    ASSERT_EQ(count, 1);
+    ASSERT_EQ(utflite_print_run(&state, "\xAD", 1, cells, 8, &count), 1);
+    ASSERT_EQ(count, 1);
+    ASSERT_EQ(cells[0].codepoint, 0x4E2D);
+    ASSERT_EQ(cells[0].width, 2);
+    ASSERT_EQ(cells[0].joins_previous, 0);
+
+    /* A mark in the next read extends the last cluster */
+    ASSERT_EQ(utflite_print_run(&state, "#", 1, cells, 8, &count), 1);
+    ASSERT_EQ(cells[0].width, 1);
+    ASSERT_EQ(utflite_print_run(&state, "\xEF\xB8\x8F", 3, cells, 8, &count), 3);
+    ASSERT_EQ(count, 1);
+    ASSERT_EQ(cells[0].joins_previous, 1);
+    ASSERT_EQ(cells[0].codepoint, 0xFE0F);
+    ASSERT_EQ(cells[0].width, 2);
+
+    /* ...but not across a control */
+    ASSERT_EQ(utflite_print_run(&state, "\r", 1, cells, 8, &count), 0);
+    ASSERT_EQ(utflite_print_run(&state, "\xCC\x81", 2, cells, 8, &count), 2);
+    ASSERT_EQ(cells[0].joins_previous, 0);
+    ASSERT_EQ(cells[0].width, 0);
+
+    /* Stops when the cells run out */
+    ASSERT_EQ(utflite_print_run(&state, "abcdef", 6, cells, 4, &count), 4);
+    ASSERT_EQ(count, 4);
+}
+
+TEST(slice_columns) {
+    /* "ab" + CJK (columns 2-3) + "cd" */
+    const char *line = "ab\xE4\xB8\xAD" "cd";
+    struct utflite_column_slice slice;
+    ASSERT_EQ(utflite_slice_columns(line, 7, 0, 10, &slice), 6);
+    ASSERT_EQ(slice.start, 0);
+    ASSERT_EQ(slice.end, 7);
+    ASSERT_EQ(slice.right_padding, 0);
+
+    /* The wide character is cut by the left edge */
+    ASSERT_EQ(utflite_slice_columns(line, 7, 3, 5, &slice), 1);
+    ASSERT_EQ(slice.start, 5);
+    ASSERT_EQ(slice.end, 6);
+    ASSERT_EQ(slice.left_padding, 1);
+    ASSERT_EQ(slice.right_padding, 0);
+
+    /* ...and by the right edge */
+    ASSERT_EQ(utflite_slice_columns(line, 7, 1, 3, &slice), 1);
+    ASSERT_EQ(slice.start, 1);
+    ASSERT_EQ(slice.end, 2);
+    ASSERT_EQ(slice.left_padding, 0);
+    ASSERT_EQ(slice.right_padding, 1);
+
+    ASSERT_EQ(utflite_slice_columns(line, 7, 2, 4, &slice), 2);
+    ASSERT_EQ(slice.start, 2);
+    ASSERT_EQ(slice.end, 5);
+
+    /* Past the end of the line */
+    ASSERT_EQ(utflite_slice_columns(line, 7, 10, 20, &slice), 0);
+    ASSERT_EQ(slice.start, 7);
+    ASSERT_EQ(slice.end, 7);
+}
+
+TEST(cursor) {
+    /* "a" + e-acute (decomposed) + CJK + "b" */
+    char text[32] = "ae\xCC\x81\xE4\xB8\xAD" "b";
+    int length = 8;
+    struct utflite_cursor cursor = {0};
+    ASSERT_EQ(utflite_cursor_next(&cursor, text, length), 1);
+    ASSERT_EQ(utflite_cursor_next(&cursor, text, length), 1);
+    ASSERT_EQ(cursor.offset, 4);
+    ASSERT_EQ(cursor.codepoint, 3);
+    ASSERT_EQ(cursor.grapheme, 2);
+    ASSERT_EQ(cursor.column, 2);
+    ASSERT_EQ(utflite_cursor_next(&cursor, text, length), 1);
+    ASSERT_EQ(cursor.column, 4);
+    ASSERT_EQ(utflite_cursor_prev(&cursor, text), 1);
+    ASSERT_EQ(cursor.offset, 4);
+    ASSERT_EQ(cursor.column, 2);
+
+    /* Typing at the cursor moves it past the new text */
+    memmove(text + 5, text + 4, 4);
+    text[4] = 'x';
+    length = 9;
+    ASSERT_EQ(utflite_cursor_update(&cursor, text, length, 4, 4, 5), 1);
+    ASSERT_EQ(cursor.offset, 5);
+    ASSERT_EQ(cursor.codepoint, 4);
+    ASSERT_EQ(cursor.grapheme, 3);
+    ASSERT_EQ(cursor.column, 3);
+
+    /* A mark typed after 'x' joins its cluster */
+    memmove(text + 7, text + 5, 4);
+    memcpy(text + 5, "\xCC\x81", 2);
+    length = 11;
+    ASSERT_EQ(utflite_cursor_update(&cursor, text, length, 5, 5, 7), 1);
+    ASSERT_EQ(cursor.offset, 7);
+    ASSERT_EQ(cursor.codepoint, 5);
+    ASSERT_EQ(cursor.grapheme, 3);
+    ASSERT_EQ(cursor.column, 3);
+
+    /* Backspace: step back, then delete the cluster after the cursor */
+    ASSERT_EQ(utflite_cursor_prev(&cursor, text), 1);
+    memmove(text + 4, text + 7, 4);
+    length = 8;
+    ASSERT_EQ(utflite_cursor_update(&cursor, text, length, 4, 7, 4), 1);
+    ASSERT_EQ(cursor.offset, 4);
+    ASSERT_EQ(cursor.grapheme, 2);
+    ASSERT_EQ(cursor.column, 2);
+
+    /* An edit before the cursor shifts it */
+    memmove(text + 1, text, 8);
+    text[0] = '>';
+    length = 9;
+    ASSERT_EQ(utflite_cursor_update(&cursor, text, length, 0, 0, 1), 1);
+    ASSERT_EQ(cursor.offset, 5);
+    ASSERT_EQ(cursor.codepoint, 4);
+    ASSERT_EQ(cursor.grapheme, 3);
+    ASSERT_EQ(cursor.column, 3);
+
+    ASSERT_EQ(utflite_cursor_update(&cursor, text, length, 4, 2, 4), 0);
+
+    /* An edit that would move the cursor past the end is rejected */
+    ASSERT_EQ(utflite_cursor_update(&cursor, text, length, 0, 0, 8), 0);
+    ASSERT_EQ(cursor.offset, 5);
+}
+
+TEST(column_seek) {
+    int column;
+    int inside;
+    ASSERT_EQ(utflite_column_seek("int main(void) {", 16, 4, &column, &inside), 4);
+    ASSERT_EQ(column, 4);
+    ASSERT_EQ(inside, 0);
+
+    /* "a" + CJK (columns 1-2) + "b" */
+    const char *line = "a\xE4\xB8\xAD" "b";
+    ASSERT_EQ(utflite_column_seek(line, 5, 1, &column, &inside), 1);
+    ASSERT_EQ(column, 1);
+    ASSERT_EQ(inside, 0);
+    ASSERT_EQ(utflite_column_seek(line, 5, 2, &column, &inside), 1);
+    ASSERT_EQ(column, 1);
+    ASSERT_EQ(inside, 1);
+    ASSERT_EQ(utflite_column_seek(line, 5, 3, &column, &inside), 4);
+    ASSERT_EQ(column, 3);
+
+    /* A mark after the target column belongs to its cluster */
+    ASSERT_EQ(utflite_column_seek("abe\xCC\x81z", 6, 2, &column, &inside), 2);
+    ASSERT_EQ(utflite_column_seek("abe\xCC\x81z", 6, 3, &column, &inside), 5);
+
+    /* Past the end of the line */
+    ASSERT_EQ(utflite_column_seek(line, 5, 10, &column, &inside), 5);
+    ASSERT_EQ(column, 4);
+    ASSERT_EQ(inside, 0);
+}
+
+TEST(convert_offsets) {
+    /* "a" + e-acute + CJK + emoji + "b" */
+    const char *line = "a\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80" "b";
+    int offsets[] = {0, 1, 3, 4, 6, 10, 11, 20};
+    int codepoints[8];
+    int utf16[8];
+    int columns[8];
+    ASSERT_EQ(utflite_convert_offsets(line, 11, offsets, 8, codepoints, utf16, columns), 8);
+    ASSERT_EQ(codepoints[2], 2);
+    ASSERT_EQ(utf16[2], 2);
+    ASSERT_EQ(columns[2], 2);
+    /* Inside the CJK character: rounded down */
+    ASSERT_EQ(codepoints[3], 2);
+    ASSERT_EQ(columns[3], 2);
+    ASSERT_EQ(codepoints[4], 3);
+    ASSERT_EQ(columns[4], 4);
+    /* After the emoji: a surrogate pair in UTF-16 */
+    ASSERT_EQ(codepoints[5], 4);
+    ASSERT_EQ(utf16[5], 5);
+    ASSERT_EQ(columns[5], 6);
+    /* Past the end: clamped */
+    ASSERT_EQ(codepoints[7], 5);
+    ASSERT_EQ(utf16[7], 6);
+    ASSERT_EQ(columns[7], 7);
+
+    int unsorted[] = {4, 2};
+    ASSERT_EQ(utflite_convert_offsets(line, 11, unsorted, 2, NULL, utf16, NULL), 1);
+    ASSERT_EQ(utf16[0], 2);
+}
+
+TEST(grapheme_index) {
+    /* "ab" + e-acute + flag + "cd": clusters a b é 🇨🇦 c d */
+    char text[64];
+    strcpy(text, "abe\xCC\x81\xF0\x9F\x87\xA8\xF0\x9F\x87\xA6" "cd");
+    int length = (int)strlen(text);
+    struct utflite_grapheme_checkpoint storage[8];
+    struct utflite_grapheme_index index;
+    ASSERT_EQ(utflite_grapheme_index_build(&index, storage, 8, 2, text, length), 1);
+    ASSERT_EQ(index.grapheme_count, 6);
+    ASSERT_EQ(utflite_grapheme_index_offset(&index, text, 2), 2);
+    ASSERT_EQ(utflite_grapheme_index_offset(&index, text, 3), 5);
+    ASSERT_EQ(utflite_grapheme_index_offset(&index, text, 4), 13);
+    ASSERT_EQ(utflite_grapheme_index_offset(&index, text, 6), length);
+    ASSERT_EQ(utflite_grapheme_index_lookup(&index, text, 4), 2);   /* Inside é */
+    ASSERT_EQ(utflite_grapheme_index_lookup(&index, text, 9), 3);   /* Inside flag */
+    ASSERT_EQ(utflite_grapheme_index_lookup(&index, text, length), 6);
+
+    /* Replace "b" with "xyz": two more clusters, everything after shifts */
+    memmove(text + 4, text + 2, (size_t)(length - 2 + 1));
+    memcpy(text + 1, "xyz", 3);
+    length += 2;
+    ASSERT_EQ(utflite_grapheme_index_update(&index, text, length, 1, 2, 4), 1);
+    ASSERT_EQ(index.grapheme_count, 8);
+    ASSERT_EQ(utflite_grapheme_index_offset(&index, text, 6), 15);
+    ASSERT_EQ(utflite_grapheme_index_lookup(&index, text, 16), 7);
+
+    /* Storage too small for the checkpoints */
+    ASSERT_EQ(utflite_grapheme_index_build(&index, storage, 1, 2, text, length), 0);
+}
+
+TEST(codepoint_index) {
+    /* 300 copies of "a" + U+00E9 + U+4E2D + U+1F600: 4 codepoints, 10 bytes */
+    static char text[3000];
+    for (int i = 0; i < 300; i++) {
+        memcpy(text + i * 10, "a\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80", 10);
+    }
+    static int storage[64];
+    struct utflite_codepoint_index index;
+    ASSERT(utflite_codepoint_index_capacity(3000) <= 64);
+    ASSERT_EQ(utflite_codepoint_index_build(&index, storage, 64, text, 3000), 1);
+    ASSERT_EQ(index.codepoint_count, 1200);
+    ASSERT_EQ(utflite_codepoint_index_offset(&index, text, 0), 0);
+    ASSERT_EQ(utflite_codepoint_index_offset(&index, text, 3), 6);
+    ASSERT_EQ(utflite_codepoint_index_offset(&index, text, 1001), 2501);
+    ASSERT_EQ(utflite_codepoint_index_offset(&index, text, 1200), 3000);
+    ASSERT_EQ(utflite_codepoint_index_lookup(&index, text, 2501), 1001);
+    ASSERT_EQ(utflite_codepoint_index_lookup(&index, text, 2508), 1003);  /* Inside emoji */
+    ASSERT_EQ(utflite_codepoint_index_lookup(&index, text, 3000), 1200);
+
+    /* Storage too small */
+    ASSERT_EQ(utflite_codepoint_index_build(&index, storage, 2, text, 3000), 0);
+}
+
+TEST(utf16_index) {
+    /* "x" + U+00E9 + U+1F600 + "y", repeated: 5 UTF-16 units per 8 bytes */
+    static char text[800];
+    for (int i = 0; i < 100; i++) {
+        memcpy(text + i * 8, "x\xC3\xA9\xF0\x9F\x98\x80y", 8);
+    }
+    int storage[8];
+    struct utflite_utf16_index index;
+    ASSERT_EQ(utflite_utf16_index_build(&index, storage, 8, text, 800), 1);
+    ASSERT_EQ(index.utf16_length, 500);
+    ASSERT_EQ(utflite_utf16_index_to_utf16(&index, text, 3), 2);     /* Emoji start */
+    ASSERT_EQ(utflite_utf16_index_to_utf16(&index, text, 5), 2);     /* Inside emoji */
+    ASSERT_EQ(utflite_utf16_index_to_utf16(&index, text, 7), 4);
+    ASSERT_EQ(utflite_utf16_index_to_utf16(&index, text, 403), 252);
+    ASSERT_EQ(utflite_utf16_index_to_utf8(&index, text, 252), 403);
+    ASSERT_EQ(utflite_utf16_index_to_utf8(&index, text, 253), 403);  /* Low surrogate */
+    ASSERT_EQ(utflite_utf16_index_to_utf8(&index, text, 254), 407);
+    ASSERT_EQ(utflite_utf16_index_to_utf8(&index, text, 500), 800);
+}
+
+TEST(column_index) {
+    /* 40 copies of "ab" + U+4E2D (2 columns): 5 bytes, 4 columns each */
+    static char text[256];
+    for (int i = 0; i < 40; i++) {
+        memcpy(text + i * 5, "ab\xE4\xB8\xAD", 5);
+    }
+    int length = 200;
+    struct utflite_column_segment storage[32];
+    struct utflite_column_index index;
+    ASSERT_EQ(utflite_column_index_build(&index, storage, 32, 16, text, length), 1);
+    ASSERT_EQ(index.width, 160);
+    ASSERT_EQ(utflite_column_index_to_column(&index, text, 102), 82);
+    ASSERT_EQ(utflite_column_index_to_column(&index, text, 103), 82);  /* Inside CJK */
+    ASSERT_EQ(utflite_column_index_to_offset(&index, text, 82), 102);
+    ASSERT_EQ(utflite_column_index_to_offset(&index, text, 83), 102);  /* CJK does not fit */
+    ASSERT_EQ(utflite_column_index_to_offset(&index, text, 160), length);
+
+    /* Replace "a" at byte 50 with a second CJK character: one column wider */
+    memmove(text + 53, text + 51, (size_t)(length - 51));
+    memcpy(text + 50, "\xE4\xB8\xAD", 3);
+    length += 2;
+    ASSERT_EQ(utflite_column_index_update(&index, text, length, 50, 51, 53), 1);
+    ASSERT_EQ(index.width, 161);
+    ASSERT_EQ(utflite_column_index_to_column(&index, text, 104), 83);
+    ASSERT_EQ(utflite_column_index_to_offset(&index, text, 83), 104);
+}
+
+TEST(line_index) {
+    ASSERT_EQ(utflite_line_count("", 0), 1);
+    ASSERT_EQ(utflite_line_count("a\r\nb\rc\n", 7), 4);
+
+    char text[64];
+    strcpy(text, "one\ntwo\r\nthree\rfour");
+    int length = (int)strlen(text);
+    int storage[16];
+    struct utflite_line_index index;
+    ASSERT_EQ(utflite_line_index_build(&index, storage, 16, text, length), 1);
+    ASSERT_EQ(index.line_count, 4);
+    ASSERT_EQ(utflite_line_index_start(&index, 1), 4);
+    ASSERT_EQ(utflite_line_index_start(&index, 2), 9);
+    ASSERT_EQ(utflite_line_index_start(&index, 3), 15);
+    ASSERT_EQ(utflite_line_index_find(&index, 10), 2);
+
+    /* Insert LF after the lone CR: "\r\n" is still one break */
+    memmove(text + 16, text + 15, (size_t)(length - 15 + 1));
+    text[15] = '\n';
+    length++;
+    ASSERT_EQ(utflite_line_index_update(&index, text, length, 15, 15, 16), 1);
+    ASSERT_EQ(index.line_count, 4);
+    ASSERT_EQ(utflite_line_index_start(&index, 3), 16);
+
+    /* Replace "two\r\n" with "2\n2\n": one more line, later lines shift */
+    memmove(text + 8, text + 9, (size_t)(length - 9 + 1));
+    memcpy(text + 4, "2\n2\n", 4);
+    length--;
+    ASSERT_EQ(utflite_line_index_update(&index, text, length, 4, 9, 8), 1);
+    ASSERT_EQ(index.line_count, 5);
+    ASSERT_EQ(utflite_line_index_start(&index, 2), 6);
+    ASSERT_EQ(utflite_line_index_start(&index, 3), 8);
+    ASSERT_EQ(utflite_line_index_find(&index, length), 4);
+}
+
+TEST(rope) {
+    /* 2000 CJK characters span several chunks */
+    static char text[6000];
+    for (int i = 0; i < 2000; i++) {
+        memcpy(text + 3 * i, "\xE4\xB8\xAD", 3);
+    }
+    struct utflite_rope *rope = utflite_rope_create(text, 6000);
+    ASSERT(rope != NULL);
+    struct utflite_rope_metrics metrics;
+    utflite_rope_get_metrics(rope, &metrics);
+    ASSERT_EQ(metrics.bytes, 6000);
+    ASSERT_EQ(metrics.codepoints, 2000);
+    ASSERT_EQ(metrics.graphemes, 2000);
+    ASSERT_EQ(metrics.columns, 4000);
+    ASSERT_EQ(metrics.lines, 1);
+    ASSERT_EQ(utflite_rope_to_offset(rope, UTFLITE_ROPE_CODEPOINTS, 1500), 4500);
+    ASSERT_EQ(utflite_rope_from_offset(rope, UTFLITE_ROPE_COLUMNS, 4501), 3000);
+
+    /* Chunks never start inside a codepoint */
+    int chunk_length;
+    for (int offset = 0; offset < 6000; offset += chunk_length) {
+        const char *chunk = utflite_rope_chunk(rope, offset, &chunk_length);
+        ASSERT(chunk != NULL && chunk_length > 0);
+        ASSERT_EQ(offset % 3, 0);
+    }
+
+    /* A CRLF built from two inserts is one line break */
+    ASSERT_EQ(utflite_rope_replace(rope, 3000, 3000, "\n", 1), 1);
+    ASSERT_EQ(utflite_rope_replace(rope, 3000, 3000, "\r", 1), 1);
+    utflite_rope_get_metrics(rope, &metrics);
+    ASSERT_EQ(metrics.lines, 2);
+    ASSERT_EQ(metrics.graphemes, 2001);
+    ASSERT_EQ(utflite_rope_to_offset(rope, UTFLITE_ROPE_LINES, 1), 3002);
+    ASSERT_EQ(utflite_rope_from_offset(rope, UTFLITE_ROPE_LINES, 3001), 0);
+
+    /* A combining mark joins the cluster before it */
+    ASSERT_EQ(utflite_rope_replace(rope, 4502, 4502, "\xCC\x81", 2), 1);
+    utflite_rope_get_metrics(rope, &metrics);
+    ASSERT_EQ(metrics.codepoints, 2003);
+    ASSERT_EQ(metrics.graphemes, 2001);
+    ASSERT_EQ(metrics.columns, 4000);
+    ASSERT_EQ(utflite_rope_from_offset(rope, UTFLITE_ROPE_GRAPHEMES, 4502), 1500);
+    ASSERT_EQ(utflite_rope_to_offset(rope, UTFLITE_ROPE_GRAPHEMES, 1501), 4504);
+
+    char copy[8];
+    ASSERT_EQ(utflite_rope_copy(rope, 4499, 4504, copy), 5);
+    ASSERT(memcmp(copy, "\xE4\xB8\xAD\xCC\x81", 5) == 0);
+
+    ASSERT_EQ(utflite_rope_replace(rope, 0, utflite_rope_length(rope), NULL, 0), 1);
+    utflite_rope_get_metrics(rope, &metrics);
+    ASSERT_EQ(metrics.bytes, 0);
+    ASSERT_EQ(metrics.lines, 1);
+    utflite_rope_destroy(rope);
+}
+
+TEST(gap_buffer) {
+    char storage[64];
+    struct utflite_gap_line lines[8];
+    struct utflite_gap_buffer buffer;
+    ASSERT_EQ(utflite_gap_buffer_init(&buffer, storage, 64, lines, 8), 1);
+    ASSERT_EQ(utflite_gap_buffer_line_count(&buffer), 1);
+    ASSERT_EQ(utflite_gap_buffer_replace(&buffer, 0, 0, "ab\r\n\xE4\xB8\xAD", 7), 1);
+    ASSERT_EQ(utflite_gap_buffer_line_count(&buffer), 2);
+
+    struct utflite_gap_line_metrics metrics;
+    ASSERT_EQ(utflite_gap_buffer_line(&buffer, 0, &metrics), 1);
+    ASSERT_EQ(metrics.bytes, 4);
+    ASSERT_EQ(metrics.codepoints, 2);
+    ASSERT_EQ(utflite_gap_buffer_line(&buffer, 1, &metrics), 1);
+    ASSERT_EQ(metrics.start, 4);
+    ASSERT_EQ(metrics.columns, 2);
+
+    /* The gap never lands inside a codepoint */
+    ASSERT_EQ(utflite_gap_buffer_move_gap(&buffer, 6), 4);
+
+    /* Type "e" and a combining acute, then a line break, at the cursor */
+    ASSERT_EQ(utflite_gap_buffer_replace(&buffer, 4, 4, "e\xCC\x81", 3), 1);
+    ASSERT_EQ(utflite_gap_buffer_prev_grapheme(&buffer), 4);
+    ASSERT_EQ(utflite_gap_buffer_replace(&buffer, 7, 7, "\n", 1), 1);
+    ASSERT_EQ(utflite_gap_buffer_line_count(&buffer), 3);
+    ASSERT_EQ(utflite_gap_buffer_find_line(&buffer, 9), 2);
+    ASSERT_EQ(utflite_gap_buffer_line(&buffer, 1, &metrics), 1);
+    ASSERT_EQ(metrics.bytes, 4);
+    ASSERT_EQ(metrics.codepoints, 2);
+    ASSERT_EQ(metrics.columns, 1);
+    ASSERT_EQ(utflite_gap_buffer_next_grapheme(&buffer), 11);
+
+    /* Deleting "b\r\ne\xCC\x81\n" joins the first and last lines */
+    ASSERT_EQ(utflite_gap_buffer_replace(&buffer, 1, 8, NULL, 0), 1);
+    ASSERT_EQ(utflite_gap_buffer_line_count(&buffer), 1);
+    char text[8];
+    ASSERT_EQ(utflite_gap_buffer_copy(&buffer, 0, 8, text), 4);
+    ASSERT(memcmp(text, "a\xE4\xB8\xAD", 4) == 0);
+    ASSERT_EQ(utflite_gap_buffer_prev_grapheme(&buffer), 0);
+}
+
 /* ============================================================================
  * Main
  * ============================================================================ */
@@ -391,6 +1218,36 @@ int main(void) {
     RUN(is_wide);
     RUN(truncate);
 
+    printf("\nGrapheme tests:\n");
+    RUN(grapheme_pair_rules);
+    RUN(grapheme_stateful_rules);
+    RUN(grapheme_boundary);
+    RUN(grapheme_count);
+    RUN(grapheme_count_bounded);
+    RUN(grapheme_width);
+    RUN(truncate_graphemes);
+    RUN(truncate_ellipsis);
+    RUN(pad);
+    RUN(column_widths);
+    RUN(tabs);
+    RUN(fill_cells);
+    RUN(line_damage);
+    RUN(print_run);
+    RUN(slice_columns);
+    RUN(cursor);
+    RUN(column_seek);
+    RUN(convert_offsets);
+    RUN(ansi);
+    RUN(grapheme_index);
+
+    printf("\nIndex tests:\n");
+    RUN(codepoint_index);
+    RUN(utf16_index);
+    RUN(column_index);
+    RUN(line_index);
+    RUN(rope);
+    RUN(gap_buffer);
+
     printf("\n==================\n");
     printf("Results: %d passed, %d failed\n", tests_passed, tests_failed);
 
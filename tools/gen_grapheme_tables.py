@@ -0,0 +1,606 @@
+#!/usr/bin/env python3
+"""
+gen_grapheme_tables.py - Generates the grapheme segmentation automaton.
+
+Reads the Grapheme_Cluster_Break, InCB and width tables straight out of the
+C sources, compiles the UAX #29 rules into a minimal deterministic automaton,
+and rewrites the block between the GENERATED markers in each file. Both the
+library source and the single-header copy are processed, each from its own
+property tables, so the two distributions can never disagree with their own
+data.
+
+Every codepoint is reduced to a "feature": its GCB property plus the two
+extra bits the context rules need (Extended_Pictographic for GB11, InCB
+Consonant/Linker for GB9c). Features that behave identically share a class.
+The automaton state packs everything the rules remember between codepoints:
+the previous property, regional indicator parity (GB12/GB13), whether we are
+inside "ExtPict Extend* ZWJ" (GB11) and the InCB conjunct progress (GB9c).
+
+Usage:
+    python3 tools/gen_grapheme_tables.py            # rewrite both sources
+    python3 tools/gen_grapheme_tables.py --check    # fail if out of date
+    python3 tools/gen_grapheme_tables.py --verify [GraphemeBreakTest.txt]
+
+--verify compares the automaton against a direct port of the rule-by-rule
+segmenter (the pre-automaton C implementation): exhaustively for every class
+sequence up to VERIFY_DEPTH codepoints, and on every line of
+GraphemeBreakTest.txt when a path is given.
+"""
+
+import itertools
+import os
+import re
+import sys
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Grapheme_Cluster_Break values, in the order of enum gcb_property.
+GCB_NAMES = [
+    "OTHER", "CR", "LF", "CONTROL", "EXTEND", "ZWJ", "REGIONAL_INDICATOR",
+    "PREPEND", "SPACING_MARK", "L", "V", "T", "LV", "LVT",
+]
+GCB = {name: index for index, name in enumerate(GCB_NAMES)}
+GCB_PROPERTY_COUNT = len(GCB_NAMES)
+
+# Hangul syllables get LV/LVT algorithmically rather than from the table.
+HANGUL_SYLLABLE_FIRST = 0xAC00
+HANGUL_SYLLABLE_LAST = 0xD7A3
+HANGUL_TRAILING_COUNT = 28
+
+# InCB values carried in a feature (must match the C feature encoding).
+INCB_NONE = 0
+INCB_CONSONANT = 1
+INCB_LINKER = 2
+
+# Feature index = gcb + GCB_PROPERTY_COUNT * (extpict + 2 * incb).
+FEATURE_COUNT = GCB_PROPERTY_COUNT * 2 * 3
+
+# Transition byte layout: low bits hold the next state, the top bit is set
+# when there is a boundary before the codepoint just consumed.
+DFA_BREAK_BIT = 0x80
+DFA_STATE_MASK = 0x7F
+
+ASCII_LIMIT = 0x80
+MAX_CODEPOINT = 0x10FFFF
+
+# Width of the per-class bit masks emitted for boundary tests.
+CLASS_MASK_BITS = 32
+
+# Exhaustive verification depth (codepoints per sequence).
+VERIFY_DEPTH = 4
+
+BEGIN_MARKER = "/* BEGIN GENERATED: tools/gen_grapheme_tables.py */"
+END_MARKER = "/* END GENERATED: tools/gen_grapheme_tables.py */"
+
+
+class SourceFile:
+    """One C file that owns a set of property tables and a generated block."""
+
+    def __init__(self, path, prefix):
+        self.path = path
+        # Prefix applied to internal identifiers ("" or "UTFLITE__").
+        self.prefix = prefix
+        with open(path, encoding="utf-8") as handle:
+            self.text = handle.read()
+
+    def table_body(self, name):
+        pattern = r"\b%s%s\[\] = \{(.*?)\n\};" % (self.prefix, name)
+        match = re.search(pattern, self.text, re.S)
+        if not match:
+            sys.exit("%s: table %s not found" % (self.path, name))
+        return match.group(1)
+
+    def ranges(self, name):
+        body = self.table_body(name)
+        return [(int(start, 16), int(end, 16)) for start, end in
+                re.findall(r"\{\s*(0x[0-9A-Fa-f]+),\s*(0x[0-9A-Fa-f]+)\s*\}", body)]
+
+    def gcb_ranges(self):
+        body = self.table_body("GCB_RANGES")
+        pattern = r"\{(0x[0-9A-Fa-f]+), (0x[0-9A-Fa-f]+), %sGCB_(\w+)\}" % self.prefix
+        return [(int(start, 16), int(end, 16), GCB[name]) for start, end, name in
+                re.findall(pattern, body)]
+
+    def codepoints(self, name):
+        return [int(value, 16) for value in re.findall(r"0x[0-9A-Fa-f]+", self.table_body(name))]
+
+
+class Properties:
+    """Mirror of the C property lookups, including their binary search order."""
+
+    def __init__(self, source):
+        self.gcb_table = source.gcb_ranges()
+        self.double_width = source.ranges("DOUBLE_WIDTH_RANGES")
+        self.incb_consonants = source.ranges("INCB_CONSONANTS")
+        self.incb_linkers = sorted(source.codepoints("INCB_LINKERS"))
+
+    @staticmethod
+    def search(codepoint, ranges):
+        low, high = 0, len(ranges) - 1
+        while low <= high:
+            mid = (low + high) // 2
+            if codepoint < ranges[mid][0]:
+                high = mid - 1
+            elif codepoint > ranges[mid][1]:
+                low = mid + 1
+            else:
+                return ranges[mid]
+        return None
+
+    def gcb(self, codepoint):
+        if HANGUL_SYLLABLE_FIRST <= codepoint <= HANGUL_SYLLABLE_LAST:
+            if (codepoint - HANGUL_SYLLABLE_FIRST) % HANGUL_TRAILING_COUNT == 0:
+                return GCB["LV"]
+            return GCB["LVT"]
+        found = self.search(codepoint, self.gcb_table)
+        return found[2] if found else GCB["OTHER"]
+
+    def is_extended_pictographic(self, codepoint):
+        return self.search(codepoint, self.double_width) is not None
+
+    def incb(self, codepoint):
+        # Consonant wins, matching the order of the checks in the C code.
+        if self.search(codepoint, self.incb_consonants) is not None:
+            return INCB_CONSONANT
+        if codepoint in self.incb_linkers:
+            return INCB_LINKER
+        return INCB_NONE
+
+    def feature(self, codepoint):
+        return make_feature(self.gcb(codepoint), self.is_extended_pictographic(codepoint),
+                            self.incb(codepoint))
+
+    def breakpoints(self):
+        """Codepoints where any lookup can change its answer.
+
+        Between two consecutive breakpoints every binary search makes the
+        same comparisons, so one probe per segment covers the whole segment.
+        """
+        points = {0, HANGUL_SYLLABLE_FIRST, HANGUL_SYLLABLE_LAST + 1}
+        for start, end, _ in self.gcb_table:
+            points.update((start, end + 1))
+        for start, end in self.double_width + self.incb_consonants:
+            points.update((start, end + 1))
+        for linker in self.incb_linkers:
+            points.update((linker, linker + 1))
+        return sorted(point for point in points if point <= MAX_CODEPOINT)
+
+    def occurring_features(self):
+        features = set()
+        points = self.breakpoints()
+        for index, start in enumerate(points):
+            end = points[index + 1] - 1 if index + 1 < len(points) else MAX_CODEPOINT
+            if start <= HANGUL_SYLLABLE_LAST and end >= HANGUL_SYLLABLE_FIRST:
+                # LV/LVT alternate inside the syllable block.
+                for codepoint in range(max(start, HANGUL_SYLLABLE_FIRST),
+                                       min(end, HANGUL_SYLLABLE_LAST) + 1):
+                    features.add(self.feature(codepoint))
+            else:
+                features.add(self.feature(start))
+        for codepoint in range(ASCII_LIMIT):
+            features.add(self.feature(codepoint))
+        return sorted(features)
+
+
+def make_feature(gcb, extended_pictographic, incb):
+    return gcb + GCB_PROPERTY_COUNT * ((1 if extended_pictographic else 0) + 2 * incb)
+
+
+def split_feature(feature):
+    gcb = feature % GCB_PROPERTY_COUNT
+    rest = feature // GCB_PROPERTY_COUNT
+    return gcb, rest % 2 == 1, rest // 2
+
+
+def describe_feature(feature):
+    gcb, extended_pictographic, incb = split_feature(feature)
+    parts = [GCB_NAMES[gcb]]
+    if extended_pictographic:
+        parts.append("ExtPict")
+    if incb == INCB_CONSONANT:
+        parts.append("InCB=Consonant")
+    elif incb == INCB_LINKER:
+        parts.append("InCB=Linker")
+    return " ".join(parts)
+
+
+# ----------------------------------------------------------------------------
+# Reference rules: a line-by-line port of the rule-based C segmenter.
+# ----------------------------------------------------------------------------
+
+def stateless_decision(prev, curr):
+    """GB3-GB9b: the rules that only look at the two properties.
+
+    Returns True (break) / False (no break), or None when none applies.
+    """
+    controls = (GCB["CONTROL"], GCB["CR"], GCB["LF"])
+    if prev == GCB["CR"] and curr == GCB["LF"]:
+        return False                                            # GB3
+    if prev in controls or curr in controls:
+        return True                                             # GB4, GB5
+    if prev == GCB["L"] and curr in (GCB["L"], GCB["V"], GCB["LV"], GCB["LVT"]):
+        return False                                            # GB6
+    if prev in (GCB["LV"], GCB["V"]) and curr in (GCB["V"], GCB["T"]):
+        return False                                            # GB7
+    if prev in (GCB["LVT"], GCB["T"]) and curr == GCB["T"]:
+        return False                                            # GB8
+    if curr in (GCB["EXTEND"], GCB["ZWJ"], GCB["SPACING_MARK"]):
+        return False                                            # GB9, GB9a
+    if prev == GCB["PREPEND"]:
+        return False                                            # GB9b
+    return None
+
+
+def reference_is_break(prev_gcb, feature, ri_count, in_ext_pict, incb_state):
+    """is_grapheme_break() from the rule-based C implementation."""
+    curr_gcb, curr_ext_pict, curr_incb = split_feature(feature)
+    decision = stateless_decision(prev_gcb, curr_gcb)
+    if decision is not None:
+        return decision
+    if incb_state == 2 and curr_incb == INCB_CONSONANT:
+        return False                                            # GB9c
+    if in_ext_pict and prev_gcb == GCB["ZWJ"] and curr_ext_pict:
+        return False                                            # GB11
+    if prev_gcb == curr_gcb == GCB["REGIONAL_INDICATOR"]:
+        return ri_count % 2 == 0                                # GB12, GB13
+    return True                                                 # GB999
+
+
+def reference_fresh_state(feature):
+    """State after the first codepoint of a cluster."""
+    gcb, ext_pict, incb = split_feature(feature)
+    ri_count = 1 if gcb == GCB["REGIONAL_INDICATOR"] else 0
+    return (gcb, ri_count, ext_pict, 1 if incb == INCB_CONSONANT else 0)
+
+
+def reference_update_state(state, feature):
+    """State update applied when the codepoint joins the current cluster."""
+    _, ri_count, in_ext_pict, incb_state = state
+    gcb, ext_pict, incb = split_feature(feature)
+    extends = gcb in (GCB["EXTEND"], GCB["ZWJ"])
+    if gcb == GCB["REGIONAL_INDICATOR"]:
+        ri_count += 1
+    elif not extends:
+        ri_count = 0
+    if ext_pict:
+        in_ext_pict = True
+    elif not extends:
+        in_ext_pict = False
+    if incb == INCB_CONSONANT:
+        incb_state = 1
+    elif incb == INCB_LINKER and incb_state >= 1:
+        incb_state = 2
+    elif not extends:
+        incb_state = 0
+    return (gcb, ri_count, in_ext_pict, incb_state)
+
+
+def reference_step(state, feature):
+    """Returns (is_break, next_state); state None means start of text."""
+    if state is None:
+        return True, reference_fresh_state(feature)
+    prev_gcb, ri_count, in_ext_pict, incb_state = state
+    if reference_is_break(prev_gcb, feature, ri_count, in_ext_pict, incb_state):
+        return True, reference_fresh_state(feature)
+    return False, reference_update_state(state, feature)
+
+
+# ----------------------------------------------------------------------------
+# Automaton construction
+# ----------------------------------------------------------------------------
+
+class Automaton:
+    def __init__(self, features):
+        self.features = features
+        # Explore reachable rule states. Only RI parity matters to the rules,
+        # so the count is folded to 0/1 before it becomes part of a state.
+        def fold(state):
+            if state is None:
+                return None
+            gcb, ri_count, in_ext_pict, incb_state = state
+            return (gcb, ri_count % 2, bool(in_ext_pict), incb_state)
+
+        states = [None]
+        index_of = {None: 0}
+        transitions = []
+        cursor = 0
+        while cursor < len(states):
+            row = []
+            for feature in features:
+                is_break, target = reference_step(states[cursor], feature)
+                target = fold(target)
+                if target not in index_of:
+                    index_of[target] = len(states)
+                    states.append(target)
+                row.append((is_break, index_of[target]))
+            transitions.append(row)
+            cursor += 1
+        self.minimize(states, transitions)
+        self.merge_classes()
+
+    def minimize(self, states, transitions):
+        """Moore partition refinement; the start state keeps number 0."""
+        block_of = [0] * len(states)
+        block_count = 1
+        while True:
+            signatures = {}
+            new_block_of = []
+            for index in range(len(states)):
+                signature = (index == 0, tuple((is_break, block_of[target])
+                                               for is_break, target in transitions[index]))
+                new_block_of.append(signatures.setdefault(signature, len(signatures)))
+            block_of = new_block_of
+            if len(signatures) == block_count:
+                break
+            block_count = len(signatures)
+        representative = {}
+        for index, block in enumerate(block_of):
+            representative.setdefault(block, index)
+        order = sorted(representative, key=lambda block: representative[block])
+        renumber = {block: position for position, block in enumerate(order)}
+        self.state_descriptions = [states[representative[block]] for block in order]
+        self.table = []
+        for block in order:
+            row = transitions[representative[block]]
+            self.table.append([(is_break, renumber[block_of[target]]) for is_break, target in row])
+        if len(self.table) > DFA_STATE_MASK + 1:
+            sys.exit("automaton has %d states, more than fit in a transition byte" % len(self.table))
+
+    def merge_classes(self):
+        """Features with identical columns share a class (column)."""
+        columns = {}
+        self.class_of_feature = {}
+        self.class_members = []
+        for position, feature in enumerate(self.features):
+            column = tuple(row[position] for row in self.table)
+            if column not in columns:
+                columns[column] = len(columns)
+                self.class_members.append([])
+            self.class_of_feature[feature] = columns[column]
+            self.class_members[columns[column]].append(feature)
+        self.columns = [None] * len(columns)
+        for column, class_index in columns.items():
+            self.columns[class_index] = column
+
+    def restart_classes(self):
+        """Classes that lead to the same state from every state, so that
+        segmentation started fresh at such a codepoint agrees with a scan
+        from the start of text."""
+        return [class_index for class_index, column in enumerate(self.columns)
+                if len(set(target for _, target in column)) == 1]
+
+    def pair_decided(self, prev_class):
+        """Classes whose boundary after prev_class is the same from every
+        state reached by consuming prev_class."""
+        reached = set(target for _, target in self.columns[prev_class])
+        return [class_index for class_index, column in enumerate(self.columns)
+                if len(set(column[state][0] for state in reached)) == 1]
+
+    def step(self, state, feature):
+        is_break, target = self.columns[self.class_of_feature[feature]][state]
+        return is_break, target
+
+
+# ----------------------------------------------------------------------------
+# Verification
+# ----------------------------------------------------------------------------
+
+def reference_boundaries(features):
+    """Boundaries the way utflite_next_grapheme() used to find them."""
+    boundaries = [0]
+    position = 0
+    while position < len(features):
+        state = reference_fresh_state(features[position])
+        position += 1
+        while position < len(features):
+            prev_gcb, ri_count, in_ext_pict, incb_state = state
+            if reference_is_break(prev_gcb, features[position], ri_count, in_ext_pict, incb_state):
+                break
+            state = reference_update_state(state, features[position])
+            position += 1
+        boundaries.append(position)
+    return boundaries
+
+
+def automaton_boundaries(automaton, features):
+    boundaries = []
+    state = 0
+    for position, feature in enumerate(features):
+        is_break, state = automaton.step(state, feature)
+        if is_break:
+            boundaries.append(position)
+    boundaries.append(len(features))
+    return boundaries
+
+
+def verify_exhaustive(automaton, depth):
+    """Compares boundaries for every feature sequence up to 'depth' codepoints."""
+    checked = 0
+    for length in range(1, depth + 1):
+        for sequence in itertools.product(automaton.features, repeat=length):
+            if reference_boundaries(list(sequence)) != automaton_boundaries(automaton, sequence):
+                sys.exit("mismatch on %s" % ", ".join(describe_feature(f) for f in sequence))
+            checked += 1
+    return checked
+
+
+def parse_break_test_line(line):
+    line = line.split("#", 1)[0].strip()
+    if not line:
+        return None
+    tokens = line.split()
+    codepoints, expected = [], []
+    for token in tokens:
+        if token == "÷":
+            expected.append(len(codepoints))
+        elif token != "×":
+            codepoints.append(int(token, 16))
+    return codepoints, expected
+
+
+def verify_break_test(automaton, properties, path):
+    checked = 0
+    with open(path, encoding="utf-8") as handle:
+        for line_number, line in enumerate(handle, 1):
+            parsed = parse_break_test_line(line)
+            if parsed is None:
+                continue
+            features = [properties.feature(codepoint) for codepoint in parsed[0]]
+            if reference_boundaries(features) != automaton_boundaries(automaton, features):
+                sys.exit("%s:%d: automaton disagrees with the rule-based segmenter"
+                         % (path, line_number))
+            checked += 1
+    return checked
+
+
+# ----------------------------------------------------------------------------
+# C emission
+# ----------------------------------------------------------------------------
+
+def describe_state(state):
+    if state is None:
+        return "start of text"
+    gcb, ri_parity, in_ext_pict, incb_state = state
+    parts = ["after " + GCB_NAMES[gcb]]
+    if ri_parity:
+        parts.append("odd RI run")
+    if in_ext_pict:
+        parts.append("in ExtPict Extend*")
+    if incb_state == 1:
+        parts.append("InCB consonant")
+    elif incb_state == 2:
+        parts.append("InCB consonant+linker")
+    return ", ".join(parts)
+
+
+def format_rows(values, per_line, indent):
+    lines = []
+    for start in range(0, len(values), per_line):
+        lines.append(indent + ", ".join(values[start:start + per_line]) + ",")
+    return lines
+
+
+def emit(automaton, properties, prefix):
+    state_count = len(automaton.table)
+    class_count = len(automaton.columns)
+    incb_first = min(properties.incb_consonants[0][0], properties.incb_linkers[0])
+    incb_last = max(max(end for _, end in properties.incb_consonants), properties.incb_linkers[-1])
+    incb_mask = 0
+    for feature in automaton.features:
+        gcb, _, incb = split_feature(feature)
+        if incb != INCB_NONE:
+            incb_mask |= 1 << gcb
+    if class_count > CLASS_MASK_BITS:
+        sys.exit("automaton has %d classes, more than fit in a class mask" % class_count)
+    lines = [
+        "/* Span covered by the InCB tables; codepoints outside it skip both searches. */",
+        "#define %sGRAPHEME_INCB_FIRST 0x%04X" % (prefix, incb_first),
+        "#define %sGRAPHEME_INCB_LAST 0x%04X" % (prefix, incb_last),
+        "",
+        "/* Bit per GCB property that any InCB Consonant or Linker carries. */",
+        "#define %sGRAPHEME_INCB_PROPERTY_MASK 0x%04X" % (prefix, incb_mask),
+        "",
+        "/* Number of distinct grapheme classes (columns of the automaton). */",
+        "#define %sGRAPHEME_CLASS_COUNT %d" % (prefix, class_count),
+        "",
+        "/* Number of automaton states (rows of the automaton). */",
+        "#define %sGRAPHEME_STATE_COUNT %d" % (prefix, state_count),
+        "",
+        "/*",
+        " * Grapheme class for every feature index. Classes:",
+    ]
+    for class_index, members in enumerate(automaton.class_members):
+        names = "; ".join(describe_feature(feature) for feature in members)
+        lines.append(" *   %2d  %s" % (class_index, names))
+    lines.append(" */")
+    lines.append("static const uint8_t %sGRAPHEME_FEATURE_CLASSES[%sGRAPHEME_FEATURE_COUNT] = {"
+                 % (prefix, prefix))
+    values = [str(automaton.class_of_feature.get(feature, 0)) for feature in range(FEATURE_COUNT)]
+    lines += format_rows(values, GCB_PROPERTY_COUNT, "    ")
+    lines.append("};")
+    lines.append("")
+    lines.append("/* Grapheme class of each ASCII codepoint, so ASCII skips every lookup. */")
+    lines.append("static const uint8_t %sGRAPHEME_ASCII_CLASSES[%sASCII_LIMIT] = {"
+                 % (prefix, prefix))
+    values = [str(automaton.class_of_feature[properties.feature(codepoint)])
+              for codepoint in range(ASCII_LIMIT)]
+    lines += format_rows(values, 16, "    ")
+    lines.append("};")
+    lines.append("")
+    restart_mask = sum(1 << class_index for class_index in automaton.restart_classes())
+    lines.append("/* Bit per class after which the automaton reaches the same state whatever")
+    lines.append(" * came before, so segmentation may restart at such a codepoint. */")
+    lines.append("#define %sGRAPHEME_RESTART_CLASSES 0x%06X" % (prefix, restart_mask))
+    lines.append("")
+    lines.append("/* Per class of a codepoint: bit per class of the next codepoint whose")
+    lines.append(" * boundary the pair alone decides, whatever preceded the pair. */")
+    lines.append("static const uint32_t %sGRAPHEME_PAIR_DECIDED[%sGRAPHEME_CLASS_COUNT] = {"
+                 % (prefix, prefix))
+    values = ["0x%06X" % sum(1 << class_index for class_index in automaton.pair_decided(prev_class))
+              for prev_class in range(class_count)]
+    lines += format_rows(values, 6, "    ")
+    lines.append("};")
+    lines.append("")
+    lines.append("/*")
+    lines.append(" * Transition table: GRAPHEME_DFA[state][class] holds the next state in the")
+    lines.append(" * low bits and GRAPHEME_DFA_BREAK when a cluster boundary precedes the")
+    lines.append(" * codepoint. Each row notes one rule state that the row stands for.")
+    lines.append(" */")
+    lines.append("static const uint8_t %sGRAPHEME_DFA[%sGRAPHEME_STATE_COUNT][%sGRAPHEME_CLASS_COUNT] = {"
+                 % (prefix, prefix, prefix))
+    for state in range(state_count):
+        lines.append("    /* %2d: %s */" % (state, describe_state(automaton.state_descriptions[state])))
+        cells = []
+        for class_index in range(class_count):
+            is_break, target = automaton.columns[class_index][state]
+            cells.append("0x%02X" % (target | (DFA_BREAK_BIT if is_break else 0)))
+        lines.append("    {" + ", ".join(cells) + "},")
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def load_targets():
+    return [
+        SourceFile(os.path.join(REPO_ROOT, "src", "utflite.c"), ""),
+        SourceFile(os.path.join(REPO_ROOT, "single_include", "utflite.h"), "UTFLITE__"),
+    ]
+
+
+def main():
+    arguments = sys.argv[1:]
+    check_only = "--check" in arguments
+    verify = "--verify" in arguments
+    test_files = [argument for argument in arguments if not argument.startswith("--")]
+    stale = False
+    for source in load_targets():
+        properties = Properties(source)
+        automaton = Automaton(properties.occurring_features())
+        name = os.path.relpath(source.path, REPO_ROOT)
+        if verify:
+            checked = verify_exhaustive(automaton, VERIFY_DEPTH)
+            print("%s: %d states, %d classes, %d exhaustive sequences match"
+                  % (name, len(automaton.table), len(automaton.columns), checked))
+            for path in test_files:
+                checked = verify_break_test(automaton, properties, path)
+                print("%s: %d lines of %s match" % (name, checked, os.path.basename(path)))
+            continue
+        begin = source.text.find(BEGIN_MARKER)
+        end = source.text.find(END_MARKER)
+        if begin < 0 or end < 0:
+            sys.exit("%s: generated block markers not found" % source.path)
+        block = BEGIN_MARKER + "\n" + emit(automaton, properties, source.prefix) + "\n"
+        updated = source.text[:begin] + block + source.text[end:]
+        if updated == source.text:
+            continue
+        stale = True
+        if check_only:
+            print("%s is out of date" % name)
+        else:
+            with open(source.path, "w", encoding="utf-8") as handle:
+                handle.write(updated)
+            print("updated %s" % name)
+    return 1 if (check_only and stale) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())